@@ -44,6 +44,19 @@
 // Uncomment this to enable long long support
 // #define PUGIXML_HAS_LONG_LONG
 
+// Uncomment this to enable multithreaded parsing (parse_parallel); requires POSIX threads or Win32 threads
+// #define PUGIXML_HAS_THREADS
+
+// Uncomment this to parse files loaded with load_file in place using mmap; requires POSIX
+// The file must not be modified or truncated while the document is alive
+// #define PUGIXML_HAS_MMAP
+
+// Uncomment this to store document tree links as 32-bit offsets, which makes nodes and attributes smaller on 64-bit platforms
+// #define PUGIXML_COMPACT
+
+// Uncomment this to allocate nodes, attributes and strings from separate pages, which makes tree traversal touch less memory
+// #define PUGIXML_SEGREGATED_PAGES
+
 #endif
 
 /**
@@ -20,6 +20,9 @@
 #include <stdio.h>
 #include <string.h>
 #include <assert.h>
+#include <limits.h>
+#include <float.h>
+#include <locale.h>
 
 #ifdef PUGIXML_WCHAR_MODE
 #	include <wchar.h>
@@ -27,7 +30,6 @@
 
 #ifndef PUGIXML_NO_XPATH
 #	include <math.h>
-#	include <float.h>
 #	ifdef PUGIXML_NO_EXCEPTIONS
 #		include <setjmp.h>
 #	endif
@@ -42,6 +44,19 @@
 // For placement new
 #include <new>
 
+#ifdef PUGIXML_HAS_THREADS
+#	ifdef _WIN32
+#		include <windows.h>
+#	else
+#		include <pthread.h>
+#		include <unistd.h>
+#	endif
+#endif
+
+#ifdef PUGIXML_HAS_MMAP
+#	include <sys/mman.h>
+#endif
+
 #ifdef _MSC_VER
 #	pragma warning(push)
 #	pragma warning(disable: 4127) // conditional expression is constant
@@ -91,6 +106,29 @@
 #	define PUGI__UNLIKELY(cond) (cond)
 #endif
 
+// SIMD controls (SSE2 is always available on x64 so no runtime dispatch is necessary)
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#	define PUGI__SIMD_SSE2
+#	include <emmintrin.h>
+#endif
+
+// Vectorized scanning reads whole aligned blocks past the null terminator; this never crosses a page boundary but can trip sanitizers
+#if defined(__SANITIZE_ADDRESS__)
+#	define PUGI__NO_SANITIZE __attribute__((no_sanitize_address))
+#elif defined(__SANITIZE_THREAD__)
+#	define PUGI__NO_SANITIZE __attribute__((no_sanitize_thread))
+#elif defined(__has_feature)
+#	if __has_feature(address_sanitizer)
+#		define PUGI__NO_SANITIZE __attribute__((no_sanitize_address))
+#	elif __has_feature(thread_sanitizer)
+#		define PUGI__NO_SANITIZE __attribute__((no_sanitize_thread))
+#	endif
+#endif
+
+#ifndef PUGI__NO_SANITIZE
+#	define PUGI__NO_SANITIZE
+#endif
+
 // Simple static assertion
 #define PUGI__STATIC_ASSERT(cond) { static const char condition_failed[(cond) ? 1 : -1] = {0}; (void)condition_failed[0]; }
 
@@ -142,6 +180,8 @@ PUGI__NS_BEGIN
 	typedef unsigned __int8 uint8_t;
 	typedef unsigned __int16 uint16_t;
 	typedef unsigned __int32 uint32_t;
+	typedef __int32 int32_t;
+	typedef unsigned __int64 uint64_t;
 PUGI__NS_END
 #endif
 
@@ -170,6 +210,64 @@ PUGI__NS_BEGIN
 	template <typename T> deallocation_function xml_memory_management_function_storage<T>::deallocate = default_deallocate;
 
 	typedef xml_memory_management_function_storage<int> xml_memory;
+
+	// Documents and XPath objects that have a memory resource allocate from it instead of the global functions
+	inline void* resource_allocate(size_t size, xml_memory_resource* resource)
+	{
+		return resource ? resource->allocate(size) : xml_memory::allocate(size);
+	}
+
+	inline void resource_deallocate(void* ptr, xml_memory_resource* resource)
+	{
+		if (resource) resource->deallocate(ptr);
+		else xml_memory::deallocate(ptr);
+	}
+
+	// Resource of the documents that are constructed over a block of memory (see xml_document::xml_document(void*, size_t)); the block is
+	// handed out sequentially and is reused when all allocations are freed, i.e. when the document is reset or loaded again
+	struct xml_fixed_memory_resource: xml_memory_resource
+	{
+		char* data;
+		size_t size;
+		size_t offset;
+		size_t count;
+
+		xml_fixed_memory_resource(void* memory, size_t memory_size): data(0), size(0), offset(0), count(0)
+		{
+			// align the start of the block, so that all allocations are aligned
+			uintptr_t begin = (reinterpret_cast<uintptr_t>(memory) + (alignment - 1)) & ~(alignment - 1);
+			size_t padding = static_cast<size_t>(begin - reinterpret_cast<uintptr_t>(memory));
+
+			if (memory && memory_size > padding)
+			{
+				data = reinterpret_cast<char*>(begin);
+				size = (memory_size - padding) & ~(alignment - 1);
+			}
+		}
+
+		virtual void* allocate(size_t length)
+		{
+			size_t full_length = (length + (alignment - 1)) & ~(alignment - 1);
+			if (full_length < length || full_length > size - offset) return 0;
+
+			void* result = data + offset;
+
+			offset += full_length;
+			count++;
+
+			return result;
+		}
+
+		virtual void deallocate(void* ptr)
+		{
+			assert(ptr >= data && ptr < data + size && count > 0);
+			(void)!ptr;
+
+			if (--count == 0) offset = 0;
+		}
+
+		static const size_t alignment = sizeof(double) > sizeof(void*) ? sizeof(double) : sizeof(void*);
+	};
 PUGI__NS_END
 
 // String utilities
@@ -222,14 +320,15 @@ PUGI__NS_BEGIN
 	#endif
 	}
 
-#ifdef PUGIXML_WCHAR_MODE
-	// Convert string to wide string, assuming all symbols are ASCII
-	PUGI__FN void widen_ascii(wchar_t* dest, const char* source)
+	// Copy ASCII string without the terminating zero, returns string length
+	PUGI__FN size_t copy_ascii(char_t* dest, const char* source)
 	{
-		for (const char* i = source; *i; ++i) *dest++ = *i;
-		*dest = 0;
+		size_t length = 0;
+
+		for (; source[length]; ++length) dest[length] = source[length];
+
+		return length;
 	}
-#endif
 PUGI__NS_END
 
 #if !defined(PUGIXML_NO_STL) || !defined(PUGIXML_NO_XPATH)
@@ -238,15 +337,16 @@ PUGI__NS_BEGIN
 	struct buffer_holder
 	{
 		void* data;
-		void (*deleter)(void*);
+		void (*deleter)(void*, xml_memory_resource*);
+		xml_memory_resource* resource;
 
-		buffer_holder(void* data_, void (*deleter_)(void*)): data(data_), deleter(deleter_)
+		buffer_holder(void* data_, void (*deleter_)(void*, xml_memory_resource*), xml_memory_resource* resource_): data(data_), deleter(deleter_), resource(resource_)
 		{
 		}
 
 		~buffer_holder()
 		{
-			if (data) deleter(data);
+			if (data) deleter(data, resource);
 		}
 
 		void* release()
@@ -268,8 +368,22 @@ PUGI__NS_BEGIN
 	#endif
 		;
 
-	static const uintptr_t xml_memory_page_alignment = 64;
+	// Pages start at the initial size of the document and double up to the maximum size (see xml_document::set_memory_page_size)
+	// String headers store page offsets in 4-byte units, which limits the page size
+	static const size_t xml_memory_page_size_min = 256;
+	static const size_t xml_memory_page_size_max = 256 * 1024;
+	static const size_t xml_memory_string_header_unit = 4;
+
+	inline size_t clamp_page_size(size_t size)
+	{
+		PUGI__STATIC_ASSERT(xml_memory_page_size >= xml_memory_page_size_min && xml_memory_page_size <= xml_memory_page_size_max);
+
+		return size < xml_memory_page_size_min ? xml_memory_page_size_min : size > xml_memory_page_size_max ? xml_memory_page_size_max : size;
+	}
+
+	static const uintptr_t xml_memory_page_alignment = 128;
 	static const uintptr_t xml_memory_page_pointer_mask = ~(xml_memory_page_alignment - 1);
+	static const uintptr_t xml_memory_page_value_lazy_mask = 64;
 	static const uintptr_t xml_memory_page_contents_shared_mask = 32;
 	static const uintptr_t xml_memory_page_name_allocated_mask = 16;
 	static const uintptr_t xml_memory_page_value_allocated_mask = 8;
@@ -279,6 +393,29 @@ PUGI__NS_BEGIN
 
 	#define PUGI__NODETYPE(n) static_cast<xml_node_type>(((n)->header & impl::xml_memory_page_type_mask) + 1)
 
+	// Freed blocks are reused by allocations of the same size; sizes are grouped in lists by multiples of the granularity
+#ifdef PUGIXML_COMPACT
+	static const size_t xml_memory_free_list_granularity = 4;
+#else
+	static const size_t xml_memory_free_list_granularity = sizeof(void*);
+#endif
+	static const size_t xml_memory_free_list_count = 16;
+
+	// Kinds of allocations that get separate pages with PUGIXML_SEGREGATED_PAGES, so that tree traversal only touches pages with node objects
+	enum xml_memory_kind
+	{
+		xml_memory_kind_node = 0,
+	#ifdef PUGIXML_SEGREGATED_PAGES
+		xml_memory_kind_attribute,
+		xml_memory_kind_string,
+		xml_memory_kind_count
+	#else
+		xml_memory_kind_attribute = 0,
+		xml_memory_kind_string = 0,
+		xml_memory_kind_count = 1
+	#endif
+	};
+
 	struct xml_allocator;
 
 	struct xml_memory_page
@@ -294,6 +431,12 @@ PUGI__NS_BEGIN
 			result->next = 0;
 			result->busy_size = 0;
 			result->freed_size = 0;
+			result->free_count = 0;
+
+		#ifdef PUGIXML_COMPACT
+			result->compact_string_base = 0;
+			result->compact_shared_pointer = 0;
+		#endif
 
 			return result;
 		}
@@ -304,19 +447,45 @@ PUGI__NS_BEGIN
 		xml_memory_page* next;
 
 		size_t busy_size;
-		size_t freed_size;
+		size_t freed_size; // includes the blocks in the allocator free lists
+
+		size_t free_count; // number of blocks of this page in the allocator free lists
+
+	#ifdef PUGIXML_COMPACT
+		// strings referenced from the objects on this page are stored as offsets from this pointer (see xml_compact_string)
+		char_t* compact_string_base;
+
+		// the first far pointer stored in the objects on this page, usually the parent of the top-level nodes (see xml_compact_pointer)
+		void* compact_shared_pointer;
+	#endif
 	};
 
 	struct xml_memory_string_header
 	{
-		uint16_t page_offset; // offset from page->data
-		uint16_t full_size; // 0 if string occupies whole page
+		uint16_t page_offset; // offset from page->data, in xml_memory_string_header_unit units
+		uint16_t full_size; // in xml_memory_string_header_unit units, 0 if string occupies whole page
+	};
+
+	// Link of the free list that is stored in the freed block; compact objects are not pointer-aligned, so the link is accessed with memcpy
+	struct xml_memory_free_block
+	{
+		void* next;
+		xml_memory_page* page;
 	};
 
 	struct xml_allocator
 	{
-		xml_allocator(xml_memory_page* root): _root(root), _busy_size(root->busy_size)
+		xml_allocator(xml_memory_page* root, size_t root_size, xml_memory_resource* resource): _page_size(xml_memory_page_size), _page_size_limit(xml_memory_page_size), _resource(resource)
 		{
+			// the other kinds don't have a page until their first allocation
+			for (int kind = 0; kind < xml_memory_kind_count; ++kind)
+			{
+				_root[kind] = kind == xml_memory_kind_node ? root : 0;
+				_root_size[kind] = kind == xml_memory_kind_node ? root_size : 0;
+				_busy_size[kind] = kind == xml_memory_kind_node ? root->busy_size : 0;
+
+				for (size_t i = 0; i < xml_memory_free_list_count; ++i) _free[kind][i] = 0;
+			}
 		}
 
 		xml_memory_page* allocate_page(size_t data_size)
@@ -324,7 +493,7 @@ PUGI__NS_BEGIN
 			size_t size = sizeof(xml_memory_page) + data_size;
 
 			// allocate block with some alignment, leaving memory for worst-case padding
-			void* memory = xml_memory::allocate(size + xml_memory_page_alignment);
+			void* memory = resource_allocate(size + xml_memory_page_alignment, _resource);
 			if (!memory) return 0;
 
 			// align upwards to page boundary (note: this guarantees at least 1 usable byte before the page)
@@ -334,39 +503,85 @@ PUGI__NS_BEGIN
 			xml_memory_page* page = xml_memory_page::construct(page_memory);
 			assert(page);
 
-			page->allocator = _root->allocator;
+			page->allocator = _root[xml_memory_kind_node]->allocator;
 
 			// record the offset for freeing the memory block
-			page_memory[-1] = static_cast<char>(page_memory - static_cast<char*>(memory));
+			PUGI__STATIC_ASSERT(xml_memory_page_alignment <= 255);
+			page_memory[-1] = static_cast<char>(static_cast<unsigned char>(page_memory - static_cast<char*>(memory)));
 
 			return page;
 		}
 
-		static void deallocate_page(xml_memory_page* page)
+		void set_page_size(size_t initial_size, size_t maximum_size)
+		{
+			_page_size = initial_size;
+			_page_size_limit = maximum_size;
+		}
+
+		// Grows the next page to fit the expected amount of data, i.e. the size of the document that is about to be parsed
+		void reserve_page_size(size_t size)
+		{
+			if (size > _page_size) _page_size = size < _page_size_limit ? size : _page_size_limit;
+		}
+
+		void deallocate_page(xml_memory_page* page)
 		{
 			char* page_memory = reinterpret_cast<char*>(page);
 
-			xml_memory::deallocate(page_memory - page_memory[-1]);
+			resource_deallocate(page_memory - static_cast<unsigned char>(page_memory[-1]), _resource);
 		}
 
-		void* allocate_memory_oob(size_t size, xml_memory_page*& out_page);
+		void* allocate_memory_oob(size_t size, xml_memory_page*& out_page, xml_memory_kind kind);
+		void remove_free_blocks(xml_memory_page* page, xml_memory_kind kind);
 
-		void* allocate_memory(size_t size, xml_memory_page*& out_page)
+		static bool is_free_list_size(size_t size)
 		{
-			if (_busy_size + size > xml_memory_page_size) return allocate_memory_oob(size, out_page);
+			return size % xml_memory_free_list_granularity == 0 && size / xml_memory_free_list_granularity < xml_memory_free_list_count && size >= sizeof(xml_memory_free_block);
+		}
+
+		// Frees the memory block if it was the last allocation on the current page, so that the next allocation reuses it
+		bool deallocate_last(void* ptr, size_t size, xml_memory_kind kind)
+		{
+			if (static_cast<char*>(ptr) + size != reinterpret_cast<char*>(_root[kind]) + sizeof(xml_memory_page) + _busy_size[kind]) return false;
+
+			_busy_size[kind] -= size;
+
+			return true;
+		}
+
+		void* allocate_memory(size_t size, xml_memory_page*& out_page, xml_memory_kind kind)
+		{
+			if (is_free_list_size(size) && _free[kind][size / xml_memory_free_list_granularity])
+			{
+				void* buf = _free[kind][size / xml_memory_free_list_granularity];
+
+				xml_memory_free_block block;
+				memcpy(&block, buf, sizeof(block));
+
+				_free[kind][size / xml_memory_free_list_granularity] = block.next;
+
+				block.page->freed_size -= size;
+				block.page->free_count--;
+
+				out_page = block.page;
+
+				return buf;
+			}
+
+			if (_busy_size[kind] + size > _root_size[kind]) return allocate_memory_oob(size, out_page, kind);
 
-			void* buf = reinterpret_cast<char*>(_root) + sizeof(xml_memory_page) + _busy_size;
+			void* buf = reinterpret_cast<char*>(_root[kind]) + sizeof(xml_memory_page) + _busy_size[kind];
 
-			_busy_size += size;
+			_busy_size[kind] += size;
 
-			out_page = _root;
+			out_page = _root[kind];
 
 			return buf;
 		}
 
-		void deallocate_memory(void* ptr, size_t size, xml_memory_page* page)
+		void deallocate_memory(void* ptr, size_t size, xml_memory_page* page, xml_memory_kind kind)
 		{
-			if (page == _root) page->busy_size = _busy_size;
+			if (page == _root[kind]) page->busy_size = _busy_size[kind];
 
 			assert(ptr >= reinterpret_cast<char*>(page) + sizeof(xml_memory_page) && ptr < reinterpret_cast<char*>(page) + sizeof(xml_memory_page) + page->busy_size);
 			(void)!ptr;
@@ -376,27 +591,35 @@ PUGI__NS_BEGIN
 
 			if (page->freed_size == page->busy_size)
 			{
-				if (page->next == 0)
-				{
-					assert(_root == page);
+				if (page->free_count) remove_free_blocks(page, kind);
 
-					// top page freed, just reset sizes
+				if (page == _root[kind])
+				{
+					// current page freed, just reset sizes
 					page->busy_size = page->freed_size = 0;
-					_busy_size = 0;
+					page->free_count = 0;
+					_busy_size[kind] = 0;
 				}
 				else
 				{
-					assert(_root != page);
 					assert(page->prev);
 
 					// remove from the list
 					page->prev->next = page->next;
-					page->next->prev = page->prev;
+					if (page->next) page->next->prev = page->prev;
 
 					// deallocate
 					deallocate_page(page);
 				}
 			}
+			else if (is_free_list_size(size))
+			{
+				xml_memory_free_block block = {_free[kind][size / xml_memory_free_list_granularity], page};
+				memcpy(ptr, &block, sizeof(block));
+
+				_free[kind][size / xml_memory_free_list_granularity] = ptr;
+				page->free_count++;
+			}
 		}
 
 		char_t* allocate_string(size_t length)
@@ -404,23 +627,24 @@ PUGI__NS_BEGIN
 			// allocate memory for string and header block
 			size_t size = sizeof(xml_memory_string_header) + length * sizeof(char_t);
 			
-			// round size up to pointer alignment boundary
-			size_t full_size = (size + (sizeof(void*) - 1)) & ~(sizeof(void*) - 1);
+			// round size up to pointer alignment boundary; small strings take enough space to be reused via free lists
+			size_t full_size = size < sizeof(xml_memory_free_block) ? sizeof(xml_memory_free_block) : (size + (sizeof(void*) - 1)) & ~(sizeof(void*) - 1);
 
 			xml_memory_page* page;
-			xml_memory_string_header* header = static_cast<xml_memory_string_header*>(allocate_memory(full_size, page));
+			xml_memory_string_header* header = static_cast<xml_memory_string_header*>(allocate_memory(full_size, page, xml_memory_kind_string));
 
 			if (!header) return 0;
 
 			// setup header
 			ptrdiff_t page_offset = reinterpret_cast<char*>(header) - reinterpret_cast<char*>(page) - sizeof(xml_memory_page);
 
-			assert(page_offset >= 0 && page_offset < (1 << 16));
-			header->page_offset = static_cast<uint16_t>(page_offset);
+			PUGI__STATIC_ASSERT(sizeof(void*) % xml_memory_string_header_unit == 0);
+			assert(page_offset >= 0 && page_offset / xml_memory_string_header_unit < (1 << 16));
+			header->page_offset = static_cast<uint16_t>(page_offset / xml_memory_string_header_unit);
 
 			// full_size == 0 for large strings that occupy the whole page
-			assert(full_size < (1 << 16) || (page->busy_size == full_size && page_offset == 0));
-			header->full_size = static_cast<uint16_t>(full_size < (1 << 16) ? full_size : 0);
+			assert(full_size / xml_memory_string_header_unit < (1 << 16) || (page->busy_size == full_size && page_offset == 0));
+			header->full_size = static_cast<uint16_t>(full_size / xml_memory_string_header_unit < (1 << 16) ? full_size / xml_memory_string_header_unit : 0);
 
 			// round-trip through void* to avoid 'cast increases required alignment of target type' warning
 			// header is guaranteed a pointer-sized alignment, which should be enough for char_t
@@ -437,50 +661,79 @@ PUGI__NS_BEGIN
 			assert(header);
 
 			// deallocate
-			size_t page_offset = sizeof(xml_memory_page) + header->page_offset;
+			size_t page_offset = sizeof(xml_memory_page) + header->page_offset * xml_memory_string_header_unit;
 			xml_memory_page* page = reinterpret_cast<xml_memory_page*>(static_cast<void*>(reinterpret_cast<char*>(header) - page_offset));
 
 			// if full_size == 0 then this string occupies the whole page
-			size_t full_size = header->full_size == 0 ? page->busy_size : header->full_size;
+			size_t full_size = header->full_size == 0 ? page->busy_size : header->full_size * xml_memory_string_header_unit;
+
+			deallocate_memory(header, full_size, page, xml_memory_kind_string);
+		}
 
-			deallocate_memory(header, full_size, page);
+		// Makes sure that the next few pointer stores into the objects of this allocator don't need memory (see xml_compact_pointer)
+	#ifdef PUGIXML_COMPACT
+		bool reserve();
+	#else
+		bool reserve()
+		{
+			return true;
 		}
+	#endif
+
+		// current page of every kind; all pages are linked in one list that starts with the document page
+		xml_memory_page* _root[xml_memory_kind_count];
+		size_t _root_size[xml_memory_kind_count];
+		size_t _busy_size[xml_memory_kind_count];
+
+		// data size of the next page and the size that the pages stop growing at
+		size_t _page_size;
+		size_t _page_size_limit;
+
+		// source of the pages and the other memory of the document (0 for the global allocation functions)
+		xml_memory_resource* _resource;
 
-		xml_memory_page* _root;
-		size_t _busy_size;
+		void* _free[xml_memory_kind_count][xml_memory_free_list_count];
 	};
 
-	PUGI__FN_NO_INLINE void* xml_allocator::allocate_memory_oob(size_t size, xml_memory_page*& out_page)
+	PUGI__FN_NO_INLINE void* xml_allocator::allocate_memory_oob(size_t size, xml_memory_page*& out_page, xml_memory_kind kind)
 	{
-		const size_t large_allocation_threshold = xml_memory_page_size / 4;
+		const size_t large_allocation_threshold = _page_size / 4;
+
+		size_t page_size = size <= large_allocation_threshold ? _page_size : size;
+		xml_memory_page* page = allocate_page(page_size);
+
+		// the resource may not have enough memory left for a full page (e.g. a fixed block), but a smaller page can still fit
+		while (!page && page_size / 2 >= size && page_size / 2 >= xml_memory_page_size_min)
+		{
+			page_size /= 2;
+			page = allocate_page(page_size);
+		}
 
-		xml_memory_page* page = allocate_page(size <= large_allocation_threshold ? xml_memory_page_size : size);
 		out_page = page;
 
 		if (!page) return 0;
 
-		if (size <= large_allocation_threshold)
-		{
-			_root->busy_size = _busy_size;
+		// insert page after the current page of the same kind
+		xml_memory_page* prev = _root[kind] ? _root[kind] : _root[xml_memory_kind_node];
 
-			// insert page at the end of linked list
-			page->prev = _root;
-			_root->next = page;
-			_root = page;
+		page->prev = prev;
+		page->next = prev->next;
 
-			_busy_size = size;
-		}
-		else
+		if (prev->next) prev->next->prev = page;
+		prev->next = page;
+
+		// large allocations get a page of their own, so that it is deleted as soon as possible
+		// the current page is not deleted even if it's empty (see deallocate_memory)
+		if (size <= large_allocation_threshold)
 		{
-			// insert page before the end of linked list, so that it is deleted as soon as possible
-			// the last page is not deleted even if it's empty (see deallocate_memory)
-			assert(_root->prev);
+			if (_root[kind]) _root[kind]->busy_size = _busy_size[kind];
 
-			page->prev = _root->prev;
-			page->next = _root;
+			_root[kind] = page;
+			_root_size[kind] = page_size;
+			_busy_size[kind] = size;
 
-			_root->prev->next = page;
-			_root->prev = page;
+			// every new page is twice as large as the previous one, so that big documents need few page allocations
+			if (_page_size < _page_size_limit) _page_size = _page_size * 2 < _page_size_limit ? _page_size * 2 : _page_size_limit;
 		}
 
 		// allocate inside page
@@ -488,5631 +741,9682 @@ PUGI__NS_BEGIN
 
 		return reinterpret_cast<char*>(page) + sizeof(xml_memory_page);
 	}
-PUGI__NS_END
 
-namespace pugi
-{
-	/// A 'name=value' XML attribute structure.
-	struct xml_attribute_struct
+	PUGI__FN_NO_INLINE void xml_allocator::remove_free_blocks(xml_memory_page* page, xml_memory_kind kind)
 	{
-		/// Default ctor
-		xml_attribute_struct(impl::xml_memory_page* page): header(reinterpret_cast<uintptr_t>(page)), name(0), value(0), prev_attribute_c(0), next_attribute(0)
+		// the blocks of a page that is about to be reused or freed can't stay in the lists
+		for (size_t i = 0; i < xml_memory_free_list_count && page->free_count; ++i)
 		{
-		}
+			void* prev = 0;
 
-		uintptr_t header;
+			for (void* current = _free[kind][i]; current; )
+			{
+				xml_memory_free_block block;
+				memcpy(&block, current, sizeof(block));
 
-		char_t* name;	///< Pointer to attribute name.
-		char_t*	value;	///< Pointer to attribute value.
+				if (block.page == page)
+				{
+					if (prev) memcpy(prev, &block.next, sizeof(block.next));
+					else _free[kind][i] = block.next;
 
-		xml_attribute_struct* prev_attribute_c;	///< Previous attribute (cyclic list)
-		xml_attribute_struct* next_attribute;	///< Next attribute
-	};
+					page->free_count--;
+				}
+				else
+					prev = current;
 
-	/// An XML document tree node.
-	struct xml_node_struct
-	{
-		/// Default ctor
-		/// \param type - node type
-		xml_node_struct(impl::xml_memory_page* page, xml_node_type type): header(reinterpret_cast<uintptr_t>(page) | (type - 1)), parent(0), name(0), value(0), first_child(0), prev_sibling_c(0), next_sibling(0), first_attribute(0)
-		{
+				current = block.next;
+			}
 		}
+	}
+PUGI__NS_END
 
-		uintptr_t header;
-
-		xml_node_struct*		parent;					///< Pointer to parent
+PUGI__NS_BEGIN
+#ifdef PUGIXML_COMPACT
+	// Object header: offset of the object from its page in the upper 24 bits, flags and type in the lower 8 bits
+	typedef uint32_t xml_header;
 
-		char_t*					name;					///< Pointer to element name.
-		char_t*					value;					///< Pointer to any associated string data.
+	inline xml_header make_header(const void* object, const xml_memory_page* page, uintptr_t flags)
+	{
+		PUGI__STATIC_ASSERT(sizeof(xml_memory_page) + xml_memory_page_size_max < (1 << 24));
 
-		xml_node_struct*		first_child;			///< First child
-		
-		xml_node_struct*		prev_sibling_c;			///< Left brother (cyclic list)
-		xml_node_struct*		next_sibling;			///< Right brother
-		
-		xml_attribute_struct*	first_attribute;		///< First attribute
-	};
-}
+		return static_cast<xml_header>((static_cast<const char*>(object) - reinterpret_cast<const char*>(page)) << 8) | static_cast<xml_header>(flags);
+	}
 
-PUGI__NS_BEGIN
-	struct xml_extra_buffer
+	inline xml_memory_page* get_page(const xml_header& header)
 	{
-		char_t* buffer;
-		xml_extra_buffer* next;
-	};
+		return reinterpret_cast<xml_memory_page*>(const_cast<char*>(reinterpret_cast<const char*>(&header)) - (header >> 8));
+	}
 
-	struct xml_document_struct: public xml_node_struct, public xml_allocator
+	// Pointers and strings that don't fit into 32-bit offsets are stored in the document hash table, keyed by the field address
+	static const int32_t xml_compact_fallback = -2147483647 - 1;
+
+	// Pointer is equal to xml_memory_page::compact_shared_pointer of the page that holds the object
+	static const int32_t xml_compact_shared = -2147483647;
+
+	PUGI__FN void* compact_get_value(const void* key, const xml_header& header);
+	PUGI__FN void compact_set_value(const void* key, void* value, const xml_header& header);
+
+	// Pointer that is stored as a 32-bit offset from the pointer itself; header_offset is the distance from the object header to the pointer
+	template <typename T, int header_offset> class xml_compact_pointer
 	{
-		xml_document_struct(xml_memory_page* page): xml_node_struct(page, node_document), xml_allocator(page), buffer(0), extra_buffers(0)
+	public:
+		// the fields are initialized by the object constructors (see xml_node_link)
+		xml_compact_pointer()
 		{
 		}
 
-		const char_t* buffer;
+		xml_compact_pointer& operator=(const xml_compact_pointer& rhs)
+		{
+			return *this = rhs + 0;
+		}
 
-		xml_extra_buffer* extra_buffers;
-	};
+		xml_compact_pointer& operator=(T* value)
+		{
+			if (value)
+			{
+				ptrdiff_t offset = reinterpret_cast<char*>(value) - reinterpret_cast<char*>(this);
 
-	inline xml_allocator& get_allocator(const xml_node_struct* node)
-	{
-		assert(node);
+				if (offset > xml_compact_shared && offset <= 2147483647)
+					_data = static_cast<int32_t>(offset);
+				else
+				{
+					xml_memory_page* page = get_page(get_header());
 
-		return *reinterpret_cast<xml_memory_page*>(node->header & xml_memory_page_pointer_mask)->allocator;
-	}
+					if (!page->compact_shared_pointer) page->compact_shared_pointer = value;
 
-	template <typename Object> inline xml_document_struct& get_document(const Object* object)
-	{
-		assert(object);
+					if (page->compact_shared_pointer == value)
+						_data = xml_compact_shared;
+					else
+					{
+						compact_set_value(this, value, get_header());
+						_data = xml_compact_fallback;
+					}
+				}
+			}
+			else
+				_data = 0;
 
-		return *static_cast<xml_document_struct*>(reinterpret_cast<xml_memory_page*>(object->header & xml_memory_page_pointer_mask)->allocator);
-	}
-PUGI__NS_END
+			return *this;
+		}
 
-// Low-level DOM operations
-PUGI__NS_BEGIN
-	inline xml_attribute_struct* allocate_attribute(xml_allocator& alloc)
-	{
-		xml_memory_page* page;
-		void* memory = alloc.allocate_memory(sizeof(xml_attribute_struct), page);
+		operator T*() const
+		{
+			if (_data == 0) return 0;
 
-		return new (memory) xml_attribute_struct(page);
-	}
+			if (_data > xml_compact_shared) return reinterpret_cast<T*>(const_cast<char*>(reinterpret_cast<const char*>(this)) + _data);
 
-	inline xml_node_struct* allocate_node(xml_allocator& alloc, xml_node_type type)
-	{
-		xml_memory_page* page;
-		void* memory = alloc.allocate_memory(sizeof(xml_node_struct), page);
+			if (_data == xml_compact_shared) return static_cast<T*>(get_page(get_header())->compact_shared_pointer);
 
-		return new (memory) xml_node_struct(page, type);
-	}
+			return static_cast<T*>(compact_get_value(this, get_header()));
+		}
 
-	inline void destroy_attribute(xml_attribute_struct* a, xml_allocator& alloc)
-	{
-		uintptr_t header = a->header;
+		T* operator->() const
+		{
+			return *this;
+		}
 
-		if (header & impl::xml_memory_page_name_allocated_mask) alloc.deallocate_string(a->name);
-		if (header & impl::xml_memory_page_value_allocated_mask) alloc.deallocate_string(a->value);
+	private:
+		int32_t _data;
 
-		alloc.deallocate_memory(a, sizeof(xml_attribute_struct), reinterpret_cast<xml_memory_page*>(header & xml_memory_page_pointer_mask));
-	}
+		// offsets are relative to the field address, so fields can't be copied verbatim
+		xml_compact_pointer(const xml_compact_pointer&);
 
-	inline void destroy_node(xml_node_struct* n, xml_allocator& alloc)
+		const xml_header& get_header() const
+		{
+			return *reinterpret_cast<const xml_header*>(reinterpret_cast<const char*>(this) - header_offset);
+		}
+	};
+
+	// String that is stored as a 32-bit offset from the string base of the page that holds the object (see xml_memory_page::compact_string_base)
+	template <int header_offset> class xml_compact_string
 	{
-		uintptr_t header = n->header;
+	public:
+		xml_compact_string()
+		{
+		}
 
-		if (header & impl::xml_memory_page_name_allocated_mask) alloc.deallocate_string(n->name);
-		if (header & impl::xml_memory_page_value_allocated_mask) alloc.deallocate_string(n->value);
+		xml_compact_string& operator=(const xml_compact_string& rhs)
+		{
+			return *this = rhs + 0;
+		}
 
-		for (xml_attribute_struct* attr = n->first_attribute; attr; )
+		xml_compact_string& operator=(char_t* value)
 		{
-			xml_attribute_struct* next = attr->next_attribute;
+			if (value)
+			{
+				xml_memory_page* page = get_page(get_header());
 
-			destroy_attribute(attr, alloc);
+				if (!page->compact_string_base) page->compact_string_base = value;
 
-			attr = next;
+				// offsets are stored with a bias of 1 so that 0 can be used for null strings
+				ptrdiff_t offset = value - page->compact_string_base;
+
+				if (offset > xml_compact_fallback && offset < 2147483647 && offset != -1)
+					_data = static_cast<int32_t>(offset + 1);
+				else
+				{
+					compact_set_value(this, value, get_header());
+					_data = xml_compact_fallback;
+				}
+			}
+			else
+				_data = 0;
+
+			return *this;
 		}
 
-		for (xml_node_struct* child = n->first_child; child; )
+		operator char_t*() const
 		{
-			xml_node_struct* next = child->next_sibling;
+			if (_data == 0) return 0;
 
-			destroy_node(child, alloc);
+			if (_data != xml_compact_fallback) return get_page(get_header())->compact_string_base + (_data - 1);
 
-			child = next;
+			return static_cast<char_t*>(compact_get_value(this, get_header()));
 		}
 
-		alloc.deallocate_memory(n, sizeof(xml_node_struct), reinterpret_cast<xml_memory_page*>(header & xml_memory_page_pointer_mask));
-	}
-
-	inline void append_node(xml_node_struct* child, xml_node_struct* node)
-	{
-		child->parent = node;
+	private:
+		int32_t _data;
 
-		xml_node_struct* head = node->first_child;
+		// offsets are relative to the field address, so fields can't be copied verbatim
+		xml_compact_string(const xml_compact_string&);
 
-		if (head)
+		const xml_header& get_header() const
 		{
-			xml_node_struct* tail = head->prev_sibling_c;
-
-			tail->next_sibling = child;
-			child->prev_sibling_c = tail;
-			head->prev_sibling_c = child;
-		}
-		else
-		{
-			node->first_child = child;
-			child->prev_sibling_c = child;
+			return *reinterpret_cast<const xml_header*>(reinterpret_cast<const char*>(this) - header_offset);
 		}
+	};
+#else
+	// Object header: page pointer in the upper bits, flags and type in the lower bits (see xml_memory_page_alignment)
+	typedef uintptr_t xml_header;
+
+	inline xml_header make_header(const void* object, const xml_memory_page* page, uintptr_t flags)
+	{
+		(void)object;
+
+		return reinterpret_cast<uintptr_t>(page) | flags;
 	}
 
-	inline void prepend_node(xml_node_struct* child, xml_node_struct* node)
+	inline xml_memory_page* get_page(const xml_header& header)
 	{
-		child->parent = node;
+		return reinterpret_cast<xml_memory_page*>(header & xml_memory_page_pointer_mask);
+	}
+#endif
 
-		xml_node_struct* head = node->first_child;
+	// Node types that have children and attributes, as bit masks indexed by the type bits of the header
+	static const unsigned int xml_node_types_with_children = (1 << (node_document - 1)) | (1 << (node_element - 1));
+	static const unsigned int xml_node_types_with_attributes = (1 << (node_element - 1)) | (1 << (node_declaration - 1));
 
-		if (head)
+	// Link that is only stored in the nodes of the specified types; other nodes are allocated without it (see get_node_size), so it reads as null and is never written
+	template <typename T, typename Storage, int header_offset, unsigned int types> class xml_node_link
+	{
+	public:
+		xml_node_link()
 		{
-			child->prev_sibling_c = head->prev_sibling_c;
-			head->prev_sibling_c = child;
+			if (present()) _data = 0;
 		}
-		else
-			child->prev_sibling_c = child;
 
-		child->next_sibling = head;
-		node->first_child = child;
-	}
+		xml_node_link& operator=(const xml_node_link& rhs)
+		{
+			return *this = rhs + 0;
+		}
 
-	inline void insert_node_after(xml_node_struct* child, xml_node_struct* node)
+		xml_node_link& operator=(T* value)
+		{
+			assert(present() || !value);
+
+			if (present()) _data = value;
+
+			return *this;
+		}
+
+		operator T*() const
+		{
+			return present() ? static_cast<T*>(_data) : 0;
+		}
+
+		T* operator->() const
+		{
+			return *this;
+		}
+
+	private:
+		Storage _data;
+
+		xml_node_link(const xml_node_link&);
+
+		bool present() const
+		{
+			const xml_header& header = *reinterpret_cast<const xml_header*>(reinterpret_cast<const char*>(this) - header_offset);
+
+			return ((types >> (header & xml_memory_page_type_mask)) & 1) != 0;
+		}
+	};
+PUGI__NS_END
+
+namespace pugi
+{
+	/// A 'name=value' XML attribute structure.
+	struct xml_attribute_struct
 	{
-		xml_node_struct* parent = node->parent;
+		/// Default ctor
+		xml_attribute_struct(impl::xml_memory_page* page): header(impl::make_header(this, page, 0))
+		{
+			name = 0;
+			value = 0;
+			prev_attribute_c = 0;
+			next_attribute = 0;
+		}
 
-		child->parent = parent;
+		impl::xml_header header;
 
-		if (node->next_sibling)
-			node->next_sibling->prev_sibling_c = child;
-		else
-			parent->first_child->prev_sibling_c = child;
+	#ifdef PUGIXML_COMPACT
+		impl::xml_compact_string<4> name;	///< Pointer to attribute name.
+		impl::xml_compact_string<8> value;	///< Pointer to attribute value.
 
-		child->next_sibling = node->next_sibling;
-		child->prev_sibling_c = node;
+		impl::xml_compact_pointer<xml_attribute_struct, 12> prev_attribute_c;	///< Previous attribute (cyclic list)
+		impl::xml_compact_pointer<xml_attribute_struct, 16> next_attribute;	///< Next attribute
+	#else
+		char_t* name;	///< Pointer to attribute name.
+		char_t*	value;	///< Pointer to attribute value.
 
-		node->next_sibling = child;
-	}
+		xml_attribute_struct* prev_attribute_c;	///< Previous attribute (cyclic list)
+		xml_attribute_struct* next_attribute;	///< Next attribute
+	#endif
+	};
 
-	inline void insert_node_before(xml_node_struct* child, xml_node_struct* node)
+	/// An XML document tree node.
+	struct xml_node_struct
 	{
-		xml_node_struct* parent = node->parent;
+		/// Default ctor
+		/// \param type - node type
+		xml_node_struct(impl::xml_memory_page* page, xml_node_type type): header(impl::make_header(this, page, type - 1))
+		{
+			parent = 0;
+			name = 0;
+			value = 0;
+			prev_sibling_c = 0;
+			next_sibling = 0;
+		}
 
-		child->parent = parent;
+		impl::xml_header header;
 
-		if (node->prev_sibling_c->next_sibling)
-			node->prev_sibling_c->next_sibling = child;
-		else
-			parent->first_child = child;
+	#ifdef PUGIXML_COMPACT
+		impl::xml_compact_pointer<xml_node_struct, 4> parent;	///< Pointer to parent
 
-		child->prev_sibling_c = node->prev_sibling_c;
-		child->next_sibling = node;
+		impl::xml_compact_string<8> name;	///< Pointer to element name.
+		impl::xml_compact_string<12> value;	///< Pointer to any associated string data.
 
-		node->prev_sibling_c = child;
-	}
+		impl::xml_compact_pointer<xml_node_struct, 16> prev_sibling_c;	///< Left brother (cyclic list)
+		impl::xml_compact_pointer<xml_node_struct, 20> next_sibling;	///< Right brother
 
-	inline void remove_node(xml_node_struct* node)
+		// the links that only some node types have are stored last, so that the other nodes can be allocated without them (see impl::get_node_size)
+		impl::xml_node_link<xml_attribute_struct, impl::xml_compact_pointer<xml_attribute_struct, 24>, 24, impl::xml_node_types_with_attributes> first_attribute;	///< First attribute
+		impl::xml_node_link<xml_node_struct, impl::xml_compact_pointer<xml_node_struct, 28>, 28, impl::xml_node_types_with_children> first_child;	///< First child
+	#else
+		xml_node_struct*		parent;					///< Pointer to parent
+
+		char_t*					name;					///< Pointer to element name.
+		char_t*					value;					///< Pointer to any associated string data.
+
+		xml_node_struct*		prev_sibling_c;			///< Left brother (cyclic list)
+		xml_node_struct*		next_sibling;			///< Right brother
+
+		// the links that only some node types have are stored last, so that the other nodes can be allocated without them (see impl::get_node_size)
+		impl::xml_node_link<xml_attribute_struct, xml_attribute_struct*, 6 * sizeof(void*), impl::xml_node_types_with_attributes> first_attribute;	///< First attribute
+		impl::xml_node_link<xml_node_struct, xml_node_struct*, 7 * sizeof(void*), impl::xml_node_types_with_children> first_child;	///< First child
+	#endif
+	};
+}
+
+PUGI__NS_BEGIN
+	struct xml_extra_buffer
 	{
-		xml_node_struct* parent = node->parent;
+		char_t* buffer;
+		xml_extra_buffer* next;
+	};
 
-		if (node->next_sibling)
-			node->next_sibling->prev_sibling_c = node->prev_sibling_c;
-		else
-			parent->first_child->prev_sibling_c = node->prev_sibling_c;
+	struct xml_name_table;
+	struct xml_value_cache;
 
-		if (node->prev_sibling_c->next_sibling)
-			node->prev_sibling_c->next_sibling = node->next_sibling;
-		else
-			parent->first_child = node->next_sibling;
+#ifdef PUGIXML_COMPACT
+	struct xml_compact_hash_item
+	{
+		const void* key;
+		void* value;
+	};
 
-		node->prev_sibling_c = 0;
-		node->next_sibling = 0;
+	// Open addressing hash table that maps the addresses of compact fields to the pointers that don't fit into 32 bits
+	struct xml_compact_hash_table
+	{
+		xml_compact_hash_item* items;
+		size_t capacity; // power of 2 or 0
+		size_t count;
+	};
+
+	inline size_t compact_hash(const void* key)
+	{
+		// fields are at least 4-byte aligned
+		return static_cast<size_t>((reinterpret_cast<uintptr_t>(key) >> 2) * 2654435761u);
 	}
 
-	inline void append_attribute(xml_attribute_struct* attr, xml_node_struct* node)
+	PUGI__FN xml_compact_hash_item* compact_hash_find(const xml_compact_hash_table& table, const void* key)
 	{
-		xml_attribute_struct* head = node->first_attribute;
+		assert(table.capacity && (table.capacity & (table.capacity - 1)) == 0);
 
-		if (head)
-		{
-			xml_attribute_struct* tail = head->prev_attribute_c;
+		size_t hashmod = table.capacity - 1;
+		size_t bucket = compact_hash(key) & hashmod;
 
-			tail->next_attribute = attr;
-			attr->prev_attribute_c = tail;
-			head->prev_attribute_c = attr;
-		}
-		else
+		for (size_t probe = 0; probe <= hashmod; ++probe)
 		{
-			node->first_attribute = attr;
-			attr->prev_attribute_c = attr;
+			xml_compact_hash_item& item = table.items[bucket];
+
+			if (item.key == key || item.key == 0) return &item;
+
+			// hash collision, quadratic probing
+			bucket = (bucket + probe + 1) & hashmod;
 		}
+
+		assert(!"Compact hash table is full");
+		return 0;
 	}
 
-	inline void prepend_attribute(xml_attribute_struct* attr, xml_node_struct* node)
+	PUGI__FN bool compact_hash_rehash(xml_compact_hash_table& table, size_t capacity, xml_memory_resource* resource)
 	{
-		xml_attribute_struct* head = node->first_attribute;
+		xml_compact_hash_item* items = static_cast<xml_compact_hash_item*>(resource_allocate(capacity * sizeof(xml_compact_hash_item), resource));
+		if (!items) return false;
 
-		if (head)
-		{
-			attr->prev_attribute_c = head->prev_attribute_c;
-			head->prev_attribute_c = attr;
-		}
-		else
-			attr->prev_attribute_c = attr;
+		memset(items, 0, capacity * sizeof(xml_compact_hash_item));
 
-		attr->next_attribute = head;
-		node->first_attribute = attr;
+		xml_compact_hash_table result = {items, capacity, 0};
+
+		for (size_t i = 0; i < table.capacity; ++i)
+			if (table.items[i].key)
+			{
+				*compact_hash_find(result, table.items[i].key) = table.items[i];
+				result.count++;
+			}
+
+		if (table.items) resource_deallocate(table.items, resource);
+
+		table = result;
+
+		return true;
 	}
 
-	inline void insert_attribute_after(xml_attribute_struct* attr, xml_attribute_struct* place, xml_node_struct* node)
+	// Makes sure that the next 16 insertions fit into the table without exceeding 3/4 load
+	PUGI__FN bool compact_hash_reserve(xml_compact_hash_table& table, xml_memory_resource* resource)
 	{
-		if (place->next_attribute)
-			place->next_attribute->prev_attribute_c = attr;
-		else
-			node->first_attribute->prev_attribute_c = attr;
+		if ((table.count + 16) * 4 <= table.capacity * 3) return true;
 
-		attr->next_attribute = place->next_attribute;
-		attr->prev_attribute_c = place;
-		place->next_attribute = attr;
+		return compact_hash_rehash(table, table.capacity ? table.capacity * 2 : 32, resource);
 	}
 
-	inline void insert_attribute_before(xml_attribute_struct* attr, xml_attribute_struct* place, xml_node_struct* node)
+	PUGI__FN void compact_hash_destroy(xml_compact_hash_table& table, xml_memory_resource* resource)
 	{
-		if (place->prev_attribute_c->next_attribute)
-			place->prev_attribute_c->next_attribute = attr;
-		else
-			node->first_attribute = attr;
+		if (table.items) resource_deallocate(table.items, resource);
 
-		attr->prev_attribute_c = place->prev_attribute_c;
-		attr->next_attribute = place;
-		place->prev_attribute_c = attr;
+		table.items = 0;
+		table.capacity = 0;
+		table.count = 0;
 	}
+#endif
 
-	inline void remove_attribute(xml_attribute_struct* attr, xml_node_struct* node)
+	struct xml_document_struct: public xml_node_struct, public xml_allocator
 	{
-		if (attr->next_attribute)
-			attr->next_attribute->prev_attribute_c = attr->prev_attribute_c;
-		else
-			node->first_attribute->prev_attribute_c = attr->prev_attribute_c;
+		xml_document_struct(xml_memory_page* page, xml_memory_resource* resource): xml_node_struct(page, node_document), xml_allocator(page, 0, resource), buffer(0), extra_buffers(0), lazy_options(0), names(0), filter(0), values(0)
+		#ifdef PUGIXML_HAS_MMAP
+			, mapping(0), mapping_size(0)
+		#endif
+		#ifdef PUGIXML_COMPACT
+			, compact_pointers()
+		#endif
+		{
+		}
 
-		if (attr->prev_attribute_c->next_attribute)
-			attr->prev_attribute_c->next_attribute = attr->next_attribute;
-		else
-			node->first_attribute = attr->next_attribute;
+		const char_t* buffer;
 
-		attr->prev_attribute_c = 0;
-		attr->next_attribute = 0;
+		xml_extra_buffer* extra_buffers;
+
+		// parsing options for the values marked with xml_memory_page_value_lazy_mask
+		unsigned int lazy_options;
+
+		// all node and attribute names if the document was loaded with parse_intern_names
+		xml_name_table* names;
+
+		// filter for parsed elements (see xml_document::set_parse_filter)
+		xml_parse_filter* filter;
+
+		// converted numeric values (see xml_document::set_value_cache)
+		xml_value_cache* values;
+
+	#ifdef PUGIXML_HAS_MMAP
+		// file mapping that is parsed in place by load_file
+		void* mapping;
+		size_t mapping_size;
+	#endif
+
+	#ifdef PUGIXML_COMPACT
+		// pointers that don't fit into compact fields of the document objects
+		xml_compact_hash_table compact_pointers;
+	#endif
+	};
+
+	inline xml_allocator& get_allocator(const xml_node_struct* node)
+	{
+		assert(node);
+
+		return *get_page(node->header)->allocator;
 	}
 
-	PUGI__FN_NO_INLINE xml_node_struct* append_new_node(xml_node_struct* node, xml_allocator& alloc, xml_node_type type = node_element)
+	template <typename Object> inline xml_document_struct& get_document(const Object* object)
 	{
-		xml_node_struct* child = allocate_node(alloc, type);
-		if (!child) return 0;
+		assert(object);
 
-		append_node(child, node);
+		return *static_cast<xml_document_struct*>(get_page(object->header)->allocator);
+	}
 
-		return child;
+	inline xml_extra_buffer* allocate_extra_buffer(xml_allocator& alloc)
+	{
+		xml_memory_page* page;
+
+	#ifdef PUGIXML_COMPACT
+		// compact objects only keep 4-byte alignment of the page memory, so the pointers of the list node need to be aligned manually
+		void* memory = alloc.allocate_memory(sizeof(xml_extra_buffer) + sizeof(void*) - 4, page, xml_memory_kind_string);
+		if (!memory) return 0;
+
+		return reinterpret_cast<xml_extra_buffer*>((reinterpret_cast<uintptr_t>(memory) + (sizeof(void*) - 1)) & ~(sizeof(void*) - 1));
+	#else
+		return static_cast<xml_extra_buffer*>(alloc.allocate_memory(sizeof(xml_extra_buffer), page, xml_memory_kind_string));
+	#endif
 	}
 
-	PUGI__FN_NO_INLINE xml_attribute_struct* append_new_attribute(xml_node_struct* node, xml_allocator& alloc)
+#ifdef PUGIXML_COMPACT
+	PUGI__FN void* compact_get_value(const void* key, const xml_header& header)
 	{
-		xml_attribute_struct* attr = allocate_attribute(alloc);
-		if (!attr) return 0;
+		xml_document_struct* doc = static_cast<xml_document_struct*>(get_page(header)->allocator);
 
-		append_attribute(attr, node);
+		xml_compact_hash_item* item = compact_hash_find(doc->compact_pointers, key);
+		assert(item && item->key == key);
 
-		return attr;
+		return item->value;
 	}
-PUGI__NS_END
 
-// Helper classes for code generation
-PUGI__NS_BEGIN
-	struct opt_false
+	PUGI__FN void compact_set_value(const void* key, void* value, const xml_header& header)
 	{
-		enum { value = 0 };
-	};
+		xml_document_struct* doc = static_cast<xml_document_struct*>(get_page(header)->allocator);
 
-	struct opt_true
+		// the space is normally reserved in advance (see xml_allocator::reserve); this only fails if the table is completely full
+		if ((doc->compact_pointers.count + 1) * 4 > doc->compact_pointers.capacity * 3) compact_hash_rehash(doc->compact_pointers, doc->compact_pointers.capacity ? doc->compact_pointers.capacity * 2 : 32, doc->_resource);
+
+		xml_compact_hash_item* item = compact_hash_find(doc->compact_pointers, key);
+		assert(item);
+
+		if (!item->key)
+		{
+			item->key = key;
+			doc->compact_pointers.count++;
+		}
+
+		item->value = value;
+	}
+
+	PUGI__FN bool xml_allocator::reserve()
 	{
-		enum { value = 1 };
-	};
+		return compact_hash_reserve(static_cast<xml_document_struct*>(_root[xml_memory_kind_node]->allocator)->compact_pointers, _resource);
+	}
+#endif
 PUGI__NS_END
 
-// Unicode utilities
+// Low-level DOM operations
 PUGI__NS_BEGIN
-	inline uint16_t endian_swap(uint16_t value)
+	PUGI__FN_NO_INLINE void parse_lazy_subtree(xml_node_struct* node);
+
+	// Parses the contents of the element if they were skipped with parse_lazy_subtrees
+	inline void load_lazy_subtree(xml_node_struct* node)
 	{
-		return static_cast<uint16_t>(((value & 0xff) << 8) | (value >> 8));
+		if ((node->header & xml_memory_page_value_lazy_mask) && PUGI__NODETYPE(node) == node_element) parse_lazy_subtree(node);
 	}
 
-	inline uint32_t endian_swap(uint32_t value)
+	inline xml_node_struct* get_first_child(xml_node_struct* node)
 	{
-		return ((value & 0xff) << 24) | ((value & 0xff00) << 8) | ((value & 0xff0000) >> 8) | (value >> 24);
+		load_lazy_subtree(node);
+
+		return node->first_child;
 	}
 
-	struct utf8_counter
+	inline xml_attribute_struct* allocate_attribute(xml_allocator& alloc)
 	{
-		typedef size_t value_type;
+		if (!alloc.reserve()) return 0;
 
-		static value_type low(value_type result, uint32_t ch)
-		{
-			// U+0000..U+007F
-			if (ch < 0x80) return result + 1;
-			// U+0080..U+07FF
-			else if (ch < 0x800) return result + 2;
-			// U+0800..U+FFFF
-			else return result + 3;
-		}
+		xml_memory_page* page;
+		void* memory = alloc.allocate_memory(sizeof(xml_attribute_struct), page, xml_memory_kind_attribute);
+		if (!memory) return 0;
 
-		static value_type high(value_type result, uint32_t)
-		{
-			// U+10000..U+10FFFF
-			return result + 4;
-		}
-	};
+		return new (memory) xml_attribute_struct(page);
+	}
 
-	struct utf8_writer
+	// Nodes are allocated without the links that their type can't use (see xml_node_link)
+	inline size_t get_node_size(xml_node_type type)
 	{
-		typedef uint8_t* value_type;
+		const size_t child_size = sizeof(static_cast<xml_node_struct*>(0)->first_child);
+		const size_t attribute_size = sizeof(static_cast<xml_node_struct*>(0)->first_attribute);
 
-		static value_type low(value_type result, uint32_t ch)
+		switch (type)
 		{
-			// U+0000..U+007F
-			if (ch < 0x80)
-			{
-				*result = static_cast<uint8_t>(ch);
-				return result + 1;
-			}
-			// U+0080..U+07FF
-			else if (ch < 0x800)
-			{
-				result[0] = static_cast<uint8_t>(0xC0 | (ch >> 6));
-				result[1] = static_cast<uint8_t>(0x80 | (ch & 0x3F));
-				return result + 2;
-			}
-			// U+0800..U+FFFF
-			else
-			{
-				result[0] = static_cast<uint8_t>(0xE0 | (ch >> 12));
-				result[1] = static_cast<uint8_t>(0x80 | ((ch >> 6) & 0x3F));
-				result[2] = static_cast<uint8_t>(0x80 | (ch & 0x3F));
-				return result + 3;
-			}
-		}
+		case node_document:
+		case node_element:
+			return sizeof(xml_node_struct);
 
-		static value_type high(value_type result, uint32_t ch)
-		{
-			// U+10000..U+10FFFF
-			result[0] = static_cast<uint8_t>(0xF0 | (ch >> 18));
-			result[1] = static_cast<uint8_t>(0x80 | ((ch >> 12) & 0x3F));
-			result[2] = static_cast<uint8_t>(0x80 | ((ch >> 6) & 0x3F));
-			result[3] = static_cast<uint8_t>(0x80 | (ch & 0x3F));
-			return result + 4;
-		}
+		case node_declaration:
+			return sizeof(xml_node_struct) - child_size;
 
-		static value_type any(value_type result, uint32_t ch)
-		{
-			return (ch < 0x10000) ? low(result, ch) : high(result, ch);
+		default:
+			return sizeof(xml_node_struct) - child_size - attribute_size;
 		}
-	};
+	}
 
-	struct utf16_counter
+	inline xml_node_struct* allocate_node(xml_allocator& alloc, xml_node_type type)
 	{
-		typedef size_t value_type;
+		if (!alloc.reserve()) return 0;
 
-		static value_type low(value_type result, uint32_t)
-		{
-			return result + 1;
-		}
+		xml_memory_page* page;
+		void* memory = alloc.allocate_memory(get_node_size(type), page, xml_memory_kind_node);
+		if (!memory) return 0;
 
-		static value_type high(value_type result, uint32_t)
-		{
-			return result + 2;
-		}
-	};
+		return new (memory) xml_node_struct(page, type);
+	}
 
-	struct utf16_writer
+	inline void destroy_attribute(xml_attribute_struct* a, xml_allocator& alloc)
 	{
-		typedef uint16_t* value_type;
+		xml_header header = a->header;
+		xml_memory_page* page = get_page(a->header);
 
-		static value_type low(value_type result, uint32_t ch)
-		{
-			*result = static_cast<uint16_t>(ch);
+		if (header & impl::xml_memory_page_name_allocated_mask) alloc.deallocate_string(a->name);
+		if (header & impl::xml_memory_page_value_allocated_mask) alloc.deallocate_string(a->value);
 
-			return result + 1;
-		}
+		alloc.deallocate_memory(a, sizeof(xml_attribute_struct), page, xml_memory_kind_attribute);
+	}
 
-		static value_type high(value_type result, uint32_t ch)
+	inline void destroy_node(xml_node_struct* n, xml_allocator& alloc)
+	{
+		xml_header header = n->header;
+		xml_memory_page* page = get_page(n->header);
+
+		if (header & impl::xml_memory_page_name_allocated_mask) alloc.deallocate_string(n->name);
+		if (header & impl::xml_memory_page_value_allocated_mask) alloc.deallocate_string(n->value);
+
+		for (xml_attribute_struct* attr = n->first_attribute; attr; )
 		{
-			uint32_t msh = static_cast<uint32_t>(ch - 0x10000) >> 10;
-			uint32_t lsh = static_cast<uint32_t>(ch - 0x10000) & 0x3ff;
+			xml_attribute_struct* next = attr->next_attribute;
 
-			result[0] = static_cast<uint16_t>(0xD800 + msh);
-			result[1] = static_cast<uint16_t>(0xDC00 + lsh);
+			destroy_attribute(attr, alloc);
 
-			return result + 2;
+			attr = next;
 		}
 
-		static value_type any(value_type result, uint32_t ch)
+		for (xml_node_struct* child = n->first_child; child; )
 		{
-			return (ch < 0x10000) ? low(result, ch) : high(result, ch);
+			xml_node_struct* next = child->next_sibling;
+
+			destroy_node(child, alloc);
+
+			child = next;
 		}
-	};
 
-	struct utf32_counter
+		alloc.deallocate_memory(n, get_node_size(PUGI__NODETYPE(n)), page, xml_memory_kind_node);
+	}
+
+	inline void append_node(xml_node_struct* child, xml_node_struct* node)
 	{
-		typedef size_t value_type;
+		child->parent = node;
 
-		static value_type low(value_type result, uint32_t)
+		xml_node_struct* head = node->first_child;
+
+		if (head)
 		{
-			return result + 1;
-		}
+			xml_node_struct* tail = head->prev_sibling_c;
 
-		static value_type high(value_type result, uint32_t)
+			tail->next_sibling = child;
+			child->prev_sibling_c = tail;
+			head->prev_sibling_c = child;
+		}
+		else
 		{
-			return result + 1;
+			node->first_child = child;
+			child->prev_sibling_c = child;
 		}
-	};
+	}
 
-	struct utf32_writer
+	inline void prepend_node(xml_node_struct* child, xml_node_struct* node)
 	{
-		typedef uint32_t* value_type;
+		child->parent = node;
 
-		static value_type low(value_type result, uint32_t ch)
-		{
-			*result = ch;
+		xml_node_struct* head = node->first_child;
 
-			return result + 1;
+		if (head)
+		{
+			child->prev_sibling_c = head->prev_sibling_c;
+			head->prev_sibling_c = child;
 		}
+		else
+			child->prev_sibling_c = child;
 
-		static value_type high(value_type result, uint32_t ch)
-		{
-			*result = ch;
+		child->next_sibling = head;
+		node->first_child = child;
+	}
 
-			return result + 1;
-		}
+	inline void insert_node_after(xml_node_struct* child, xml_node_struct* node)
+	{
+		xml_node_struct* parent = node->parent;
 
-		static value_type any(value_type result, uint32_t ch)
-		{
-			*result = ch;
+		child->parent = parent;
 
-			return result + 1;
-		}
-	};
+		if (node->next_sibling)
+			node->next_sibling->prev_sibling_c = child;
+		else
+			parent->first_child->prev_sibling_c = child;
 
-	struct latin1_writer
-	{
-		typedef uint8_t* value_type;
+		child->next_sibling = node->next_sibling;
+		child->prev_sibling_c = node;
 
-		static value_type low(value_type result, uint32_t ch)
-		{
-			*result = static_cast<uint8_t>(ch > 255 ? '?' : ch);
+		node->next_sibling = child;
+	}
 
-			return result + 1;
-		}
+	inline void insert_node_before(xml_node_struct* child, xml_node_struct* node)
+	{
+		xml_node_struct* parent = node->parent;
 
-		static value_type high(value_type result, uint32_t ch)
-		{
-			(void)ch;
+		child->parent = parent;
 
-			*result = '?';
+		if (node->prev_sibling_c->next_sibling)
+			node->prev_sibling_c->next_sibling = child;
+		else
+			parent->first_child = child;
 
-			return result + 1;
-		}
-	};
+		child->prev_sibling_c = node->prev_sibling_c;
+		child->next_sibling = node;
 
-	template <size_t size> struct wchar_selector;
+		node->prev_sibling_c = child;
+	}
 
-	template <> struct wchar_selector<2>
+	inline void remove_node(xml_node_struct* node)
 	{
-		typedef uint16_t type;
-		typedef utf16_counter counter;
-		typedef utf16_writer writer;
-	};
+		xml_node_struct* parent = node->parent;
 
-	template <> struct wchar_selector<4>
-	{
-		typedef uint32_t type;
-		typedef utf32_counter counter;
-		typedef utf32_writer writer;
-	};
+		if (node->next_sibling)
+			node->next_sibling->prev_sibling_c = node->prev_sibling_c;
+		else
+			parent->first_child->prev_sibling_c = node->prev_sibling_c;
 
-	typedef wchar_selector<sizeof(wchar_t)>::counter wchar_counter;
-	typedef wchar_selector<sizeof(wchar_t)>::writer wchar_writer;
+		if (node->prev_sibling_c->next_sibling)
+			node->prev_sibling_c->next_sibling = node->next_sibling;
+		else
+			parent->first_child = node->next_sibling;
 
-	template <typename Traits, typename opt_swap = opt_false> struct utf_decoder
+		node->prev_sibling_c = 0;
+		node->next_sibling = 0;
+	}
+
+	inline void append_attribute(xml_attribute_struct* attr, xml_node_struct* node)
 	{
-		static inline typename Traits::value_type decode_utf8_block(const uint8_t* data, size_t size, typename Traits::value_type result)
-		{
-			const uint8_t utf8_byte_mask = 0x3f;
+		xml_attribute_struct* head = node->first_attribute;
 
-			while (size)
-			{
-				uint8_t lead = *data;
+		if (head)
+		{
+			xml_attribute_struct* tail = head->prev_attribute_c;
 
-				// 0xxxxxxx -> U+0000..U+007F
-				if (lead < 0x80)
-				{
-					result = Traits::low(result, lead);
-					data += 1;
-					size -= 1;
+			tail->next_attribute = attr;
+			attr->prev_attribute_c = tail;
+			head->prev_attribute_c = attr;
+		}
+		else
+		{
+			node->first_attribute = attr;
+			attr->prev_attribute_c = attr;
+		}
+	}
 
-					// process aligned single-byte (ascii) blocks
-					if ((reinterpret_cast<uintptr_t>(data) & 3) == 0)
-					{
-						// round-trip through void* to silence 'cast increases required alignment of target type' warnings
-						while (size >= 4 && (*static_cast<const uint32_t*>(static_cast<const void*>(data)) & 0x80808080) == 0)
-						{
-							result = Traits::low(result, data[0]);
-							result = Traits::low(result, data[1]);
-							result = Traits::low(result, data[2]);
-							result = Traits::low(result, data[3]);
-							data += 4;
-							size -= 4;
-						}
-					}
-				}
-				// 110xxxxx -> U+0080..U+07FF
-				else if (static_cast<unsigned int>(lead - 0xC0) < 0x20 && size >= 2 && (data[1] & 0xc0) == 0x80)
-				{
-					result = Traits::low(result, ((lead & ~0xC0) << 6) | (data[1] & utf8_byte_mask));
-					data += 2;
-					size -= 2;
-				}
-				// 1110xxxx -> U+0800-U+FFFF
-				else if (static_cast<unsigned int>(lead - 0xE0) < 0x10 && size >= 3 && (data[1] & 0xc0) == 0x80 && (data[2] & 0xc0) == 0x80)
-				{
-					result = Traits::low(result, ((lead & ~0xE0) << 12) | ((data[1] & utf8_byte_mask) << 6) | (data[2] & utf8_byte_mask));
-					data += 3;
-					size -= 3;
-				}
-				// 11110xxx -> U+10000..U+10FFFF
-				else if (static_cast<unsigned int>(lead - 0xF0) < 0x08 && size >= 4 && (data[1] & 0xc0) == 0x80 && (data[2] & 0xc0) == 0x80 && (data[3] & 0xc0) == 0x80)
-				{
-					result = Traits::high(result, ((lead & ~0xF0) << 18) | ((data[1] & utf8_byte_mask) << 12) | ((data[2] & utf8_byte_mask) << 6) | (data[3] & utf8_byte_mask));
-					data += 4;
-					size -= 4;
-				}
-				// 10xxxxxx or 11111xxx -> invalid
-				else
-				{
-					data += 1;
-					size -= 1;
-				}
-			}
+	inline void prepend_attribute(xml_attribute_struct* attr, xml_node_struct* node)
+	{
+		xml_attribute_struct* head = node->first_attribute;
 
-			return result;
+		if (head)
+		{
+			attr->prev_attribute_c = head->prev_attribute_c;
+			head->prev_attribute_c = attr;
 		}
+		else
+			attr->prev_attribute_c = attr;
 
-		static inline typename Traits::value_type decode_utf16_block(const uint16_t* data, size_t size, typename Traits::value_type result)
-		{
-			const uint16_t* end = data + size;
+		attr->next_attribute = head;
+		node->first_attribute = attr;
+	}
 
-			while (data < end)
-			{
-				unsigned int lead = opt_swap::value ? endian_swap(*data) : *data;
+	inline void insert_attribute_after(xml_attribute_struct* attr, xml_attribute_struct* place, xml_node_struct* node)
+	{
+		if (place->next_attribute)
+			place->next_attribute->prev_attribute_c = attr;
+		else
+			node->first_attribute->prev_attribute_c = attr;
 
-				// U+0000..U+D7FF
-				if (lead < 0xD800)
-				{
-					result = Traits::low(result, lead);
-					data += 1;
-				}
-				// U+E000..U+FFFF
-				else if (static_cast<unsigned int>(lead - 0xE000) < 0x2000)
-				{
-					result = Traits::low(result, lead);
-					data += 1;
-				}
-				// surrogate pair lead
-				else if (static_cast<unsigned int>(lead - 0xD800) < 0x400 && data + 1 < end)
-				{
-					uint16_t next = opt_swap::value ? endian_swap(data[1]) : data[1];
+		attr->next_attribute = place->next_attribute;
+		attr->prev_attribute_c = place;
+		place->next_attribute = attr;
+	}
 
-					if (static_cast<unsigned int>(next - 0xDC00) < 0x400)
-					{
-						result = Traits::high(result, 0x10000 + ((lead & 0x3ff) << 10) + (next & 0x3ff));
-						data += 2;
-					}
-					else
-					{
-						data += 1;
-					}
-				}
-				else
-				{
-					data += 1;
-				}
-			}
+	inline void insert_attribute_before(xml_attribute_struct* attr, xml_attribute_struct* place, xml_node_struct* node)
+	{
+		if (place->prev_attribute_c->next_attribute)
+			place->prev_attribute_c->next_attribute = attr;
+		else
+			node->first_attribute = attr;
 
-			return result;
-		}
+		attr->prev_attribute_c = place->prev_attribute_c;
+		attr->next_attribute = place;
+		place->prev_attribute_c = attr;
+	}
 
-		static inline typename Traits::value_type decode_utf32_block(const uint32_t* data, size_t size, typename Traits::value_type result)
-		{
-			const uint32_t* end = data + size;
+	inline void remove_attribute(xml_attribute_struct* attr, xml_node_struct* node)
+	{
+		if (attr->next_attribute)
+			attr->next_attribute->prev_attribute_c = attr->prev_attribute_c;
+		else
+			node->first_attribute->prev_attribute_c = attr->prev_attribute_c;
 
-			while (data < end)
-			{
-				uint32_t lead = opt_swap::value ? endian_swap(*data) : *data;
+		if (attr->prev_attribute_c->next_attribute)
+			attr->prev_attribute_c->next_attribute = attr->next_attribute;
+		else
+			node->first_attribute = attr->next_attribute;
 
-				// U+0000..U+FFFF
-				if (lead < 0x10000)
-				{
-					result = Traits::low(result, lead);
-					data += 1;
-				}
-				// U+10000..U+10FFFF
-				else
-				{
-					result = Traits::high(result, lead);
-					data += 1;
-				}
-			}
+		attr->prev_attribute_c = 0;
+		attr->next_attribute = 0;
+	}
 
-			return result;
+	PUGI__FN_NO_INLINE xml_node_struct* append_new_node(xml_node_struct* node, xml_allocator& alloc, xml_node_type type = node_element)
+	{
+		xml_node_struct* child = allocate_node(alloc, type);
+		if (!child) return 0;
+
+		append_node(child, node);
+
+		return child;
+	}
+
+	PUGI__FN_NO_INLINE xml_attribute_struct* append_new_attribute(xml_node_struct* node, xml_allocator& alloc)
+	{
+		xml_attribute_struct* attr = allocate_attribute(alloc);
+		if (!attr) return 0;
+
+		append_attribute(attr, node);
+
+		return attr;
+	}
+PUGI__NS_END
+
+// Helper classes for code generation
+PUGI__NS_BEGIN
+	struct opt_false
+	{
+		enum { value = 0 };
+	};
+
+	struct opt_true
+	{
+		enum { value = 1 };
+	};
+PUGI__NS_END
+
+#ifdef PUGIXML_HAS_THREADS
+// Thread utilities
+PUGI__NS_BEGIN
+	struct xml_thread
+	{
+		typedef void (*function_t)(void*);
+
+		function_t function;
+		void* data;
+
+	#ifdef _WIN32
+		HANDLE handle;
+
+		static DWORD WINAPI entry(LPVOID self)
+		{
+			static_cast<xml_thread*>(self)->function(static_cast<xml_thread*>(self)->data);
+			return 0;
 		}
 
-		static inline typename Traits::value_type decode_latin1_block(const uint8_t* data, size_t size, typename Traits::value_type result)
+		bool start(function_t function_, void* data_)
 		{
-			for (size_t i = 0; i < size; ++i)
-			{
-				result = Traits::low(result, data[i]);
-			}
+			function = function_;
+			data = data_;
 
-			return result;
+			handle = CreateThread(0, 0, entry, this, 0, 0);
+			return handle != 0;
 		}
 
-		static inline typename Traits::value_type decode_wchar_block_impl(const uint16_t* data, size_t size, typename Traits::value_type result)
+		void join()
 		{
-			return decode_utf16_block(data, size, result);
+			WaitForSingleObject(handle, INFINITE);
+			CloseHandle(handle);
+		}
+	#else
+		pthread_t handle;
+
+		static void* entry(void* self)
+		{
+			static_cast<xml_thread*>(self)->function(static_cast<xml_thread*>(self)->data);
+			return 0;
 		}
 
-		static inline typename Traits::value_type decode_wchar_block_impl(const uint32_t* data, size_t size, typename Traits::value_type result)
+		bool start(function_t function_, void* data_)
 		{
-			return decode_utf32_block(data, size, result);
+			function = function_;
+			data = data_;
+
+			return pthread_create(&handle, 0, entry, this) == 0;
 		}
 
-		static inline typename Traits::value_type decode_wchar_block(const wchar_t* data, size_t size, typename Traits::value_type result)
+		void join()
 		{
-			return decode_wchar_block_impl(reinterpret_cast<const wchar_selector<sizeof(wchar_t)>::type*>(data), size, result);
+			pthread_join(handle, 0);
 		}
+	#endif
 	};
 
-	template <typename T> PUGI__FN void convert_utf_endian_swap(T* result, const T* data, size_t length)
+	// Counting semaphore; after stop() all waits fail
+	struct xml_semaphore
 	{
-		for (size_t i = 0; i < length; ++i) result[i] = endian_swap(data[i]);
-	}
+	#ifdef _WIN32
+		HANDLE handle;
+		volatile LONG stopped;
 
-#ifdef PUGIXML_WCHAR_MODE
-	PUGI__FN void convert_wchar_endian_swap(wchar_t* result, const wchar_t* data, size_t length)
-	{
-		for (size_t i = 0; i < length; ++i) result[i] = static_cast<wchar_t>(endian_swap(static_cast<wchar_selector<sizeof(wchar_t)>::type>(data[i])));
-	}
-#endif
-PUGI__NS_END
+		bool create(unsigned int count)
+		{
+			stopped = 0;
 
-PUGI__NS_BEGIN
-	enum chartype_t
-	{
-		ct_parse_pcdata = 1,	// \0, &, \r, <
-		ct_parse_attr = 2,		// \0, &, \r, ', "
-		ct_parse_attr_ws = 4,	// \0, &, \r, ', ", \n, tab
-		ct_space = 8,			// \r, \n, space, tab
-		ct_parse_cdata = 16,	// \0, ], >, \r
-		ct_parse_comment = 32,	// \0, -, >, \r
-		ct_symbol = 64,			// Any symbol > 127, a-z, A-Z, 0-9, _, :, -, .
-		ct_start_symbol = 128	// Any symbol > 127, a-z, A-Z, _, :
-	};
+			handle = CreateSemaphore(0, static_cast<LONG>(count), 0x7fffffff, 0);
+			return handle != 0;
+		}
 
-	static const unsigned char chartype_table[256] =
-	{
-		55,  0,   0,   0,   0,   0,   0,   0,      0,   12,  12,  0,   0,   63,  0,   0,   // 0-15
-		0,   0,   0,   0,   0,   0,   0,   0,      0,   0,   0,   0,   0,   0,   0,   0,   // 16-31
-		8,   0,   6,   0,   0,   0,   7,   6,      0,   0,   0,   0,   0,   96,  64,  0,   // 32-47
-		64,  64,  64,  64,  64,  64,  64,  64,     64,  64,  192, 0,   1,   0,   48,  0,   // 48-63
-		0,   192, 192, 192, 192, 192, 192, 192,    192, 192, 192, 192, 192, 192, 192, 192, // 64-79
-		192, 192, 192, 192, 192, 192, 192, 192,    192, 192, 192, 0,   0,   16,  0,   192, // 80-95
-		0,   192, 192, 192, 192, 192, 192, 192,    192, 192, 192, 192, 192, 192, 192, 192, // 96-111
-		192, 192, 192, 192, 192, 192, 192, 192,    192, 192, 192, 0, 0, 0, 0, 0,           // 112-127
+		void destroy()
+		{
+			CloseHandle(handle);
+		}
 
-		192, 192, 192, 192, 192, 192, 192, 192,    192, 192, 192, 192, 192, 192, 192, 192, // 128+
-		192, 192, 192, 192, 192, 192, 192, 192,    192, 192, 192, 192, 192, 192, 192, 192,
-		192, 192, 192, 192, 192, 192, 192, 192,    192, 192, 192, 192, 192, 192, 192, 192,
-		192, 192, 192, 192, 192, 192, 192, 192,    192, 192, 192, 192, 192, 192, 192, 192,
-		192, 192, 192, 192, 192, 192, 192, 192,    192, 192, 192, 192, 192, 192, 192, 192,
-		192, 192, 192, 192, 192, 192, 192, 192,    192, 192, 192, 192, 192, 192, 192, 192,
-		192, 192, 192, 192, 192, 192, 192, 192,    192, 192, 192, 192, 192, 192, 192, 192,
-		192, 192, 192, 192, 192, 192, 192, 192,    192, 192, 192, 192, 192, 192, 192, 192
-	};
+		bool wait()
+		{
+			WaitForSingleObject(handle, INFINITE);
+			return InterlockedCompareExchange(&stopped, 0, 0) == 0;
+		}
 
-	enum chartypex_t
-	{
-		ctx_special_pcdata = 1,   // Any symbol >= 0 and < 32 (except \t, \r, \n), &, <, >
-		ctx_special_attr = 2,     // Any symbol >= 0 and < 32 (except \t), &, <, >, "
-		ctx_start_symbol = 4,	  // Any symbol > 127, a-z, A-Z, _
-		ctx_digit = 8,			  // 0-9
-		ctx_symbol = 16			  // Any symbol > 127, a-z, A-Z, 0-9, _, -, .
-	};
-	
-	static const unsigned char chartypex_table[256] =
-	{
-		3,  3,  3,  3,  3,  3,  3,  3,     3,  0,  2,  3,  3,  2,  3,  3,     // 0-15
-		3,  3,  3,  3,  3,  3,  3,  3,     3,  3,  3,  3,  3,  3,  3,  3,     // 16-31
-		0,  0,  2,  0,  0,  0,  3,  0,     0,  0,  0,  0,  0, 16, 16,  0,     // 32-47
-		24, 24, 24, 24, 24, 24, 24, 24,    24, 24, 0,  0,  3,  0,  3,  0,     // 48-63
+		void post()
+		{
+			ReleaseSemaphore(handle, 1, 0);
+		}
 
-		0,  20, 20, 20, 20, 20, 20, 20,    20, 20, 20, 20, 20, 20, 20, 20,    // 64-79
-		20, 20, 20, 20, 20, 20, 20, 20,    20, 20, 20, 0,  0,  0,  0,  20,    // 80-95
-		0,  20, 20, 20, 20, 20, 20, 20,    20, 20, 20, 20, 20, 20, 20, 20,    // 96-111
-		20, 20, 20, 20, 20, 20, 20, 20,    20, 20, 20, 0,  0,  0,  0,  0,     // 112-127
+		void stop()
+		{
+			InterlockedExchange(&stopped, 1);
+			ReleaseSemaphore(handle, 1, 0);
+		}
+	#else
+		pthread_mutex_t mutex;
+		pthread_cond_t cond;
+		unsigned int count;
+		bool stopped;
 
-		20, 20, 20, 20, 20, 20, 20, 20,    20, 20, 20, 20, 20, 20, 20, 20,    // 128+
-		20, 20, 20, 20, 20, 20, 20, 20,    20, 20, 20, 20, 20, 20, 20, 20,
-		20, 20, 20, 20, 20, 20, 20, 20,    20, 20, 20, 20, 20, 20, 20, 20,
-		20, 20, 20, 20, 20, 20, 20, 20,    20, 20, 20, 20, 20, 20, 20, 20,
-		20, 20, 20, 20, 20, 20, 20, 20,    20, 20, 20, 20, 20, 20, 20, 20,
-		20, 20, 20, 20, 20, 20, 20, 20,    20, 20, 20, 20, 20, 20, 20, 20,
-		20, 20, 20, 20, 20, 20, 20, 20,    20, 20, 20, 20, 20, 20, 20, 20,
-		20, 20, 20, 20, 20, 20, 20, 20,    20, 20, 20, 20, 20, 20, 20, 20
-	};
-	
-#ifdef PUGIXML_WCHAR_MODE
-	#define PUGI__IS_CHARTYPE_IMPL(c, ct, table) ((static_cast<unsigned int>(c) < 128 ? table[static_cast<unsigned int>(c)] : table[128]) & (ct))
-#else
-	#define PUGI__IS_CHARTYPE_IMPL(c, ct, table) (table[static_cast<unsigned char>(c)] & (ct))
-#endif
+		bool create(unsigned int count_)
+		{
+			count = count_;
+			stopped = false;
 
-	#define PUGI__IS_CHARTYPE(c, ct) PUGI__IS_CHARTYPE_IMPL(c, ct, chartype_table)
-	#define PUGI__IS_CHARTYPEX(c, ct) PUGI__IS_CHARTYPE_IMPL(c, ct, chartypex_table)
+			if (pthread_mutex_init(&mutex, 0) != 0) return false;
 
-	PUGI__FN bool is_little_endian()
-	{
-		unsigned int ui = 1;
+			if (pthread_cond_init(&cond, 0) != 0)
+			{
+				pthread_mutex_destroy(&mutex);
+				return false;
+			}
 
-		return *reinterpret_cast<unsigned char*>(&ui) == 1;
-	}
+			return true;
+		}
 
-	PUGI__FN xml_encoding get_wchar_encoding()
-	{
-		PUGI__STATIC_ASSERT(sizeof(wchar_t) == 2 || sizeof(wchar_t) == 4);
+		void destroy()
+		{
+			pthread_cond_destroy(&cond);
+			pthread_mutex_destroy(&mutex);
+		}
 
-		if (sizeof(wchar_t) == 2)
-			return is_little_endian() ? encoding_utf16_le : encoding_utf16_be;
-		else 
-			return is_little_endian() ? encoding_utf32_le : encoding_utf32_be;
-	}
+		bool wait()
+		{
+			pthread_mutex_lock(&mutex);
 
-	PUGI__FN xml_encoding guess_buffer_encoding(uint8_t d0, uint8_t d1, uint8_t d2, uint8_t d3)
-	{
-		// look for BOM in first few bytes
-		if (d0 == 0 && d1 == 0 && d2 == 0xfe && d3 == 0xff) return encoding_utf32_be;
-		if (d0 == 0xff && d1 == 0xfe && d2 == 0 && d3 == 0) return encoding_utf32_le;
-		if (d0 == 0xfe && d1 == 0xff) return encoding_utf16_be;
-		if (d0 == 0xff && d1 == 0xfe) return encoding_utf16_le;
-		if (d0 == 0xef && d1 == 0xbb && d2 == 0xbf) return encoding_utf8;
+			while (count == 0 && !stopped) pthread_cond_wait(&cond, &mutex);
 
-		// look for <, <? or <?xm in various encodings
-		if (d0 == 0 && d1 == 0 && d2 == 0 && d3 == 0x3c) return encoding_utf32_be;
-		if (d0 == 0x3c && d1 == 0 && d2 == 0 && d3 == 0) return encoding_utf32_le;
-		if (d0 == 0 && d1 == 0x3c && d2 == 0 && d3 == 0x3f) return encoding_utf16_be;
-		if (d0 == 0x3c && d1 == 0 && d2 == 0x3f && d3 == 0) return encoding_utf16_le;
-		if (d0 == 0x3c && d1 == 0x3f && d2 == 0x78 && d3 == 0x6d) return encoding_utf8;
+			bool result = !stopped;
+			if (result) count--;
 
-		// look for utf16 < followed by node name (this may fail, but is better than utf8 since it's zero terminated so early)
-		if (d0 == 0 && d1 == 0x3c) return encoding_utf16_be;
-		if (d0 == 0x3c && d1 == 0) return encoding_utf16_le;
+			pthread_mutex_unlock(&mutex);
 
-		// no known BOM detected, assume utf8
-		return encoding_utf8;
-	}
+			return result;
+		}
 
-	PUGI__FN xml_encoding get_buffer_encoding(xml_encoding encoding, const void* contents, size_t size)
-	{
-		// replace wchar encoding with utf implementation
-		if (encoding == encoding_wchar) return get_wchar_encoding();
+		void post()
+		{
+			pthread_mutex_lock(&mutex);
+			count++;
+			pthread_cond_signal(&cond);
+			pthread_mutex_unlock(&mutex);
+		}
 
-		// replace utf16 encoding with utf16 with specific endianness
-		if (encoding == encoding_utf16) return is_little_endian() ? encoding_utf16_le : encoding_utf16_be;
+		void stop()
+		{
+			pthread_mutex_lock(&mutex);
+			stopped = true;
+			pthread_cond_broadcast(&cond);
+			pthread_mutex_unlock(&mutex);
+		}
+	#endif
+	};
 
-		// replace utf32 encoding with utf32 with specific endianness
-		if (encoding == encoding_utf32) return is_little_endian() ? encoding_utf32_le : encoding_utf32_be;
+	struct xml_mutex
+	{
+	#ifdef _WIN32
+		CRITICAL_SECTION section;
 
-		// only do autodetection if no explicit encoding is requested
-		if (encoding != encoding_auto) return encoding;
+		bool create()
+		{
+			InitializeCriticalSection(&section);
+			return true;
+		}
 
-		// skip encoding autodetection if input buffer is too small
-		if (size < 4) return encoding_utf8;
+		void destroy()
+		{
+			DeleteCriticalSection(&section);
+		}
 
-		// try to guess encoding (based on XML specification, Appendix F.1)
-		const uint8_t* data = static_cast<const uint8_t*>(contents);
+		void lock()
+		{
+			EnterCriticalSection(&section);
+		}
 
-		PUGI__DMC_VOLATILE uint8_t d0 = data[0], d1 = data[1], d2 = data[2], d3 = data[3];
+		void unlock()
+		{
+			LeaveCriticalSection(&section);
+		}
+	#else
+		pthread_mutex_t mutex;
 
-		return guess_buffer_encoding(d0, d1, d2, d3);
-	}
+		bool create()
+		{
+			return pthread_mutex_init(&mutex, 0) == 0;
+		}
 
-	PUGI__FN bool get_mutable_buffer(char_t*& out_buffer, size_t& out_length, const void* contents, size_t size, bool is_mutable)
-	{
-		size_t length = size / sizeof(char_t);
+		void destroy()
+		{
+			pthread_mutex_destroy(&mutex);
+		}
 
-		if (is_mutable)
+		void lock()
 		{
-			out_buffer = static_cast<char_t*>(const_cast<void*>(contents));
-			out_length = length;
+			pthread_mutex_lock(&mutex);
 		}
-		else
+
+		void unlock()
 		{
-			char_t* buffer = static_cast<char_t*>(xml_memory::allocate((length + 1) * sizeof(char_t)));
-			if (!buffer) return false;
+			pthread_mutex_unlock(&mutex);
+		}
+	#endif
+	};
 
-			memcpy(buffer, contents, length * sizeof(char_t));
-			buffer[length] = 0;
+	PUGI__FN unsigned int get_hardware_concurrency()
+	{
+	#ifdef _WIN32
+		SYSTEM_INFO info;
+		GetSystemInfo(&info);
 
-			out_buffer = buffer;
-			out_length = length + 1;
-		}
+		return info.dwNumberOfProcessors;
+	#elif defined(_SC_NPROCESSORS_ONLN)
+		long result = sysconf(_SC_NPROCESSORS_ONLN);
 
-		return true;
+		return result > 0 ? static_cast<unsigned int>(result) : 1;
+	#else
+		return 1;
+	#endif
 	}
+PUGI__NS_END
+#endif
 
-#ifdef PUGIXML_WCHAR_MODE
-	PUGI__FN bool need_endian_swap_utf(xml_encoding le, xml_encoding re)
+// Unicode utilities
+PUGI__NS_BEGIN
+	inline uint16_t endian_swap(uint16_t value)
 	{
-		return (le == encoding_utf16_be && re == encoding_utf16_le) || (le == encoding_utf16_le && re == encoding_utf16_be) ||
-			   (le == encoding_utf32_be && re == encoding_utf32_le) || (le == encoding_utf32_le && re == encoding_utf32_be);
+		return static_cast<uint16_t>(((value & 0xff) << 8) | (value >> 8));
 	}
 
-	PUGI__FN bool convert_buffer_endian_swap(char_t*& out_buffer, size_t& out_length, const void* contents, size_t size, bool is_mutable)
+	inline uint32_t endian_swap(uint32_t value)
 	{
-		const char_t* data = static_cast<const char_t*>(contents);
-		size_t length = size / sizeof(char_t);
+		return ((value & 0xff) << 24) | ((value & 0xff00) << 8) | ((value & 0xff0000) >> 8) | (value >> 24);
+	}
 
-		if (is_mutable)
+	struct utf8_counter
+	{
+		typedef size_t value_type;
+
+		static value_type low(value_type result, uint32_t ch)
 		{
-			char_t* buffer = const_cast<char_t*>(data);
+			// U+0000..U+007F
+			if (ch < 0x80) return result + 1;
+			// U+0080..U+07FF
+			else if (ch < 0x800) return result + 2;
+			// U+0800..U+FFFF
+			else return result + 3;
+		}
 
-			convert_wchar_endian_swap(buffer, data, length);
+		static value_type high(value_type result, uint32_t)
+		{
+			// U+10000..U+10FFFF
+			return result + 4;
+		}
+	};
 
-			out_buffer = buffer;
-			out_length = length;
+	struct utf8_writer
+	{
+		typedef uint8_t* value_type;
+
+		static value_type low(value_type result, uint32_t ch)
+		{
+			// U+0000..U+007F
+			if (ch < 0x80)
+			{
+				*result = static_cast<uint8_t>(ch);
+				return result + 1;
+			}
+			// U+0080..U+07FF
+			else if (ch < 0x800)
+			{
+				result[0] = static_cast<uint8_t>(0xC0 | (ch >> 6));
+				result[1] = static_cast<uint8_t>(0x80 | (ch & 0x3F));
+				return result + 2;
+			}
+			// U+0800..U+FFFF
+			else
+			{
+				result[0] = static_cast<uint8_t>(0xE0 | (ch >> 12));
+				result[1] = static_cast<uint8_t>(0x80 | ((ch >> 6) & 0x3F));
+				result[2] = static_cast<uint8_t>(0x80 | (ch & 0x3F));
+				return result + 3;
+			}
 		}
-		else
+
+		static value_type high(value_type result, uint32_t ch)
 		{
-			char_t* buffer = static_cast<char_t*>(xml_memory::allocate((length + 1) * sizeof(char_t)));
-			if (!buffer) return false;
+			// U+10000..U+10FFFF
+			result[0] = static_cast<uint8_t>(0xF0 | (ch >> 18));
+			result[1] = static_cast<uint8_t>(0x80 | ((ch >> 12) & 0x3F));
+			result[2] = static_cast<uint8_t>(0x80 | ((ch >> 6) & 0x3F));
+			result[3] = static_cast<uint8_t>(0x80 | (ch & 0x3F));
+			return result + 4;
+		}
 
-			convert_wchar_endian_swap(buffer, data, length);
-			buffer[length] = 0;
+		static value_type any(value_type result, uint32_t ch)
+		{
+			return (ch < 0x10000) ? low(result, ch) : high(result, ch);
+		}
+	};
 
-			out_buffer = buffer;
-			out_length = length + 1;
+	struct utf16_counter
+	{
+		typedef size_t value_type;
+
+		static value_type low(value_type result, uint32_t)
+		{
+			return result + 1;
 		}
 
-		return true;
-	}
+		static value_type high(value_type result, uint32_t)
+		{
+			return result + 2;
+		}
+	};
 
-	PUGI__FN bool convert_buffer_utf8(char_t*& out_buffer, size_t& out_length, const void* contents, size_t size)
+	struct utf16_writer
 	{
-		const uint8_t* data = static_cast<const uint8_t*>(contents);
-		size_t data_length = size;
+		typedef uint16_t* value_type;
 
-		// first pass: get length in wchar_t units
-		size_t length = utf_decoder<wchar_counter>::decode_utf8_block(data, data_length, 0);
+		static value_type low(value_type result, uint32_t ch)
+		{
+			*result = static_cast<uint16_t>(ch);
 
-		// allocate buffer of suitable length
-		char_t* buffer = static_cast<char_t*>(xml_memory::allocate((length + 1) * sizeof(char_t)));
-		if (!buffer) return false;
+			return result + 1;
+		}
 
-		// second pass: convert utf8 input to wchar_t
-		wchar_writer::value_type obegin = reinterpret_cast<wchar_writer::value_type>(buffer);
-		wchar_writer::value_type oend = utf_decoder<wchar_writer>::decode_utf8_block(data, data_length, obegin);
+		static value_type high(value_type result, uint32_t ch)
+		{
+			uint32_t msh = static_cast<uint32_t>(ch - 0x10000) >> 10;
+			uint32_t lsh = static_cast<uint32_t>(ch - 0x10000) & 0x3ff;
 
-		assert(oend == obegin + length);
-		*oend = 0;
+			result[0] = static_cast<uint16_t>(0xD800 + msh);
+			result[1] = static_cast<uint16_t>(0xDC00 + lsh);
 
-		out_buffer = buffer;
-		out_length = length + 1;
+			return result + 2;
+		}
 
-		return true;
-	}
+		static value_type any(value_type result, uint32_t ch)
+		{
+			return (ch < 0x10000) ? low(result, ch) : high(result, ch);
+		}
+	};
 
-	template <typename opt_swap> PUGI__FN bool convert_buffer_utf16(char_t*& out_buffer, size_t& out_length, const void* contents, size_t size, opt_swap)
+	struct utf32_counter
 	{
-		const uint16_t* data = static_cast<const uint16_t*>(contents);
-		size_t data_length = size / sizeof(uint16_t);
-
-		// first pass: get length in wchar_t units
-		size_t length = utf_decoder<wchar_counter, opt_swap>::decode_utf16_block(data, data_length, 0);
-
-		// allocate buffer of suitable length
-		char_t* buffer = static_cast<char_t*>(xml_memory::allocate((length + 1) * sizeof(char_t)));
-		if (!buffer) return false;
-
-		// second pass: convert utf16 input to wchar_t
-		wchar_writer::value_type obegin = reinterpret_cast<wchar_writer::value_type>(buffer);
-		wchar_writer::value_type oend = utf_decoder<wchar_writer, opt_swap>::decode_utf16_block(data, data_length, obegin);
-
-		assert(oend == obegin + length);
-		*oend = 0;
+		typedef size_t value_type;
 
-		out_buffer = buffer;
-		out_length = length + 1;
+		static value_type low(value_type result, uint32_t)
+		{
+			return result + 1;
+		}
 
-		return true;
-	}
+		static value_type high(value_type result, uint32_t)
+		{
+			return result + 1;
+		}
+	};
 
-	template <typename opt_swap> PUGI__FN bool convert_buffer_utf32(char_t*& out_buffer, size_t& out_length, const void* contents, size_t size, opt_swap)
+	struct utf32_writer
 	{
-		const uint32_t* data = static_cast<const uint32_t*>(contents);
-		size_t data_length = size / sizeof(uint32_t);
+		typedef uint32_t* value_type;
 
-		// first pass: get length in wchar_t units
-		size_t length = utf_decoder<wchar_counter, opt_swap>::decode_utf32_block(data, data_length, 0);
+		static value_type low(value_type result, uint32_t ch)
+		{
+			*result = ch;
 
-		// allocate buffer of suitable length
-		char_t* buffer = static_cast<char_t*>(xml_memory::allocate((length + 1) * sizeof(char_t)));
-		if (!buffer) return false;
+			return result + 1;
+		}
 
-		// second pass: convert utf32 input to wchar_t
-		wchar_writer::value_type obegin = reinterpret_cast<wchar_writer::value_type>(buffer);
-		wchar_writer::value_type oend = utf_decoder<wchar_writer, opt_swap>::decode_utf32_block(data, data_length, obegin);
+		static value_type high(value_type result, uint32_t ch)
+		{
+			*result = ch;
 
-		assert(oend == obegin + length);
-		*oend = 0;
+			return result + 1;
+		}
 
-		out_buffer = buffer;
-		out_length = length + 1;
+		static value_type any(value_type result, uint32_t ch)
+		{
+			*result = ch;
 
-		return true;
-	}
+			return result + 1;
+		}
+	};
 
-	PUGI__FN bool convert_buffer_latin1(char_t*& out_buffer, size_t& out_length, const void* contents, size_t size)
+	struct latin1_writer
 	{
-		const uint8_t* data = static_cast<const uint8_t*>(contents);
-		size_t data_length = size;
+		typedef uint8_t* value_type;
 
-		// get length in wchar_t units
-		size_t length = data_length;
+		static value_type low(value_type result, uint32_t ch)
+		{
+			*result = static_cast<uint8_t>(ch > 255 ? '?' : ch);
 
-		// allocate buffer of suitable length
-		char_t* buffer = static_cast<char_t*>(xml_memory::allocate((length + 1) * sizeof(char_t)));
-		if (!buffer) return false;
+			return result + 1;
+		}
 
-		// convert latin1 input to wchar_t
-		wchar_writer::value_type obegin = reinterpret_cast<wchar_writer::value_type>(buffer);
-		wchar_writer::value_type oend = utf_decoder<wchar_writer>::decode_latin1_block(data, data_length, obegin);
+		static value_type high(value_type result, uint32_t ch)
+		{
+			(void)ch;
 
-		assert(oend == obegin + length);
-		*oend = 0;
+			*result = '?';
 
-		out_buffer = buffer;
-		out_length = length + 1;
+			return result + 1;
+		}
+	};
 
-		return true;
-	}
+	template <size_t size> struct wchar_selector;
 
-	PUGI__FN bool convert_buffer(char_t*& out_buffer, size_t& out_length, xml_encoding encoding, const void* contents, size_t size, bool is_mutable)
+	template <> struct wchar_selector<2>
 	{
-		// get native encoding
-		xml_encoding wchar_encoding = get_wchar_encoding();
-
-		// fast path: no conversion required
-		if (encoding == wchar_encoding) return get_mutable_buffer(out_buffer, out_length, contents, size, is_mutable);
-
-		// only endian-swapping is required
-		if (need_endian_swap_utf(encoding, wchar_encoding)) return convert_buffer_endian_swap(out_buffer, out_length, contents, size, is_mutable);
-
-		// source encoding is utf8
-		if (encoding == encoding_utf8) return convert_buffer_utf8(out_buffer, out_length, contents, size);
-
-		// source encoding is utf16
-		if (encoding == encoding_utf16_be || encoding == encoding_utf16_le)
-		{
-			xml_encoding native_encoding = is_little_endian() ? encoding_utf16_le : encoding_utf16_be;
-
-			return (native_encoding == encoding) ?
-				convert_buffer_utf16(out_buffer, out_length, contents, size, opt_false()) :
-				convert_buffer_utf16(out_buffer, out_length, contents, size, opt_true());
-		}
+		typedef uint16_t type;
+		typedef utf16_counter counter;
+		typedef utf16_writer writer;
+	};
 
-		// source encoding is utf32
-		if (encoding == encoding_utf32_be || encoding == encoding_utf32_le)
-		{
-			xml_encoding native_encoding = is_little_endian() ? encoding_utf32_le : encoding_utf32_be;
+	template <> struct wchar_selector<4>
+	{
+		typedef uint32_t type;
+		typedef utf32_counter counter;
+		typedef utf32_writer writer;
+	};
 
-			return (native_encoding == encoding) ?
-				convert_buffer_utf32(out_buffer, out_length, contents, size, opt_false()) :
-				convert_buffer_utf32(out_buffer, out_length, contents, size, opt_true());
-		}
+	typedef wchar_selector<sizeof(wchar_t)>::counter wchar_counter;
+	typedef wchar_selector<sizeof(wchar_t)>::writer wchar_writer;
 
-		// source encoding is latin1
-		if (encoding == encoding_latin1) return convert_buffer_latin1(out_buffer, out_length, contents, size);
+#ifdef PUGI__SIMD_SSE2
+	inline unsigned int simd_count_trailing_zeros(unsigned int mask)
+	{
+		assert(mask);
 
-		assert(!"Invalid encoding");
-		return false;
+	#if defined(__GNUC__)
+		return static_cast<unsigned int>(__builtin_ctz(mask));
+	#else
+		unsigned int result = 0;
+		while ((mask & 1) == 0) mask >>= 1, result++;
+		return result;
+	#endif
 	}
-#else
-	template <typename opt_swap> PUGI__FN bool convert_buffer_utf16(char_t*& out_buffer, size_t& out_length, const void* contents, size_t size, opt_swap)
-	{
-		const uint16_t* data = static_cast<const uint16_t*>(contents);
-		size_t data_length = size / sizeof(uint16_t);
 
-		// first pass: get length in utf8 units
-		size_t length = utf_decoder<utf8_counter, opt_swap>::decode_utf16_block(data, data_length, 0);
+	// Output a block of 16 ascii characters (one per byte); ascii is encoded as a single unit in every output encoding
+	inline size_t simd_ascii_block(size_t result, __m128i)
+	{
+		return result + 16;
+	}
 
-		// allocate buffer of suitable length
-		char_t* buffer = static_cast<char_t*>(xml_memory::allocate((length + 1) * sizeof(char_t)));
-		if (!buffer) return false;
+	inline uint8_t* simd_ascii_block(uint8_t* result, __m128i v)
+	{
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(result), v);
 
-		// second pass: convert utf16 input to utf8
-		uint8_t* obegin = reinterpret_cast<uint8_t*>(buffer);
-		uint8_t* oend = utf_decoder<utf8_writer, opt_swap>::decode_utf16_block(data, data_length, obegin);
+		return result + 16;
+	}
 
-		assert(oend == obegin + length);
-		*oend = 0;
+	inline uint16_t* simd_ascii_block(uint16_t* result, __m128i v)
+	{
+		__m128i zero = _mm_setzero_si128();
 
-		out_buffer = buffer;
-		out_length = length + 1;
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(result), _mm_unpacklo_epi8(v, zero));
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(result + 8), _mm_unpackhi_epi8(v, zero));
 
-		return true;
+		return result + 16;
 	}
 
-	template <typename opt_swap> PUGI__FN bool convert_buffer_utf32(char_t*& out_buffer, size_t& out_length, const void* contents, size_t size, opt_swap)
+	inline uint32_t* simd_ascii_block(uint32_t* result, __m128i v)
 	{
-		const uint32_t* data = static_cast<const uint32_t*>(contents);
-		size_t data_length = size / sizeof(uint32_t);
+		__m128i zero = _mm_setzero_si128();
+		__m128i lo = _mm_unpacklo_epi8(v, zero);
+		__m128i hi = _mm_unpackhi_epi8(v, zero);
 
-		// first pass: get length in utf8 units
-		size_t length = utf_decoder<utf8_counter, opt_swap>::decode_utf32_block(data, data_length, 0);
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(result), _mm_unpacklo_epi16(lo, zero));
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(result + 4), _mm_unpackhi_epi16(lo, zero));
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(result + 8), _mm_unpacklo_epi16(hi, zero));
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(result + 12), _mm_unpackhi_epi16(hi, zero));
 
-		// allocate buffer of suitable length
-		char_t* buffer = static_cast<char_t*>(xml_memory::allocate((length + 1) * sizeof(char_t)));
-		if (!buffer) return false;
+		return result + 16;
+	}
 
-		// second pass: convert utf32 input to utf8
-		uint8_t* obegin = reinterpret_cast<uint8_t*>(buffer);
-		uint8_t* oend = utf_decoder<utf8_writer, opt_swap>::decode_utf32_block(data, data_length, obegin);
+	inline __m128i simd_load_utf16(const uint16_t* data, opt_false)
+	{
+		return _mm_loadu_si128(reinterpret_cast<const __m128i*>(data));
+	}
 
-		assert(oend == obegin + length);
-		*oend = 0;
+	inline __m128i simd_load_utf16(const uint16_t* data, opt_true)
+	{
+		__m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data));
 
-		out_buffer = buffer;
-		out_length = length + 1;
+		return _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+	}
 
-		return true;
+	inline __m128i simd_load_utf32(const uint32_t* data, opt_false)
+	{
+		return _mm_loadu_si128(reinterpret_cast<const __m128i*>(data));
 	}
 
-	PUGI__FN size_t get_latin1_7bit_prefix_length(const uint8_t* data, size_t size)
+	inline __m128i simd_load_utf32(const uint32_t* data, opt_true)
 	{
-		for (size_t i = 0; i < size; ++i)
-			if (data[i] > 127)
-				return i;
+		__m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data));
+		__m128i mid = _mm_set1_epi32(0xff00);
 
-		return size;
+		return _mm_or_si128(_mm_or_si128(_mm_slli_epi32(v, 24), _mm_and_si128(_mm_slli_epi32(v, 8), _mm_slli_epi32(mid, 8))),
+			_mm_or_si128(_mm_and_si128(_mm_srli_epi32(v, 8), mid), _mm_srli_epi32(v, 24)));
 	}
 
-	PUGI__FN bool convert_buffer_latin1(char_t*& out_buffer, size_t& out_length, const void* contents, size_t size, bool is_mutable)
+	// Convert leading blocks of 16 ascii characters; returns the number of processed units
+	template <typename T> PUGI__FN size_t simd_decode_utf8_ascii(const uint8_t* data, size_t size, T& result)
 	{
-		const uint8_t* data = static_cast<const uint8_t*>(contents);
-		size_t data_length = size;
-
-		// get size of prefix that does not need utf8 conversion
-		size_t prefix_length = get_latin1_7bit_prefix_length(data, data_length);
-		assert(prefix_length <= data_length);
+		size_t offset = 0;
 
-		const uint8_t* postfix = data + prefix_length;
-		size_t postfix_length = data_length - prefix_length;
+		for (; offset + 16 <= size; offset += 16)
+		{
+			__m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + offset));
+			if (_mm_movemask_epi8(v)) break;
 
-		// if no conversion is needed, just return the original buffer
-		if (postfix_length == 0) return get_mutable_buffer(out_buffer, out_length, contents, size, is_mutable);
+			result = simd_ascii_block(result, v);
+		}
 
-		// first pass: get length in utf8 units
-		size_t length = prefix_length + utf_decoder<utf8_counter>::decode_latin1_block(postfix, postfix_length, 0);
+		return offset;
+	}
 
-		// allocate buffer of suitable length
-		char_t* buffer = static_cast<char_t*>(xml_memory::allocate((length + 1) * sizeof(char_t)));
-		if (!buffer) return false;
+	template <typename T, typename opt_swap> PUGI__FN size_t simd_decode_utf16_ascii(const uint16_t* data, size_t size, T& result, opt_swap)
+	{
+		const __m128i non_ascii = _mm_set1_epi16(static_cast<short>(0xff80));
 
-		// second pass: convert latin1 input to utf8
-		memcpy(buffer, data, prefix_length);
+		size_t offset = 0;
 
-		uint8_t* obegin = reinterpret_cast<uint8_t*>(buffer);
-		uint8_t* oend = utf_decoder<utf8_writer>::decode_latin1_block(postfix, postfix_length, obegin + prefix_length);
+		for (; offset + 16 <= size; offset += 16)
+		{
+			__m128i v0 = simd_load_utf16(data + offset, opt_swap());
+			__m128i v1 = simd_load_utf16(data + offset + 8, opt_swap());
 
-		assert(oend == obegin + length);
-		*oend = 0;
+			__m128i high = _mm_and_si128(_mm_or_si128(v0, v1), non_ascii);
+			if (_mm_movemask_epi8(_mm_cmpeq_epi8(high, _mm_setzero_si128())) != 0xffff) break;
 
-		out_buffer = buffer;
-		out_length = length + 1;
+			result = simd_ascii_block(result, _mm_packus_epi16(v0, v1));
+		}
 
-		return true;
+		return offset;
 	}
 
-	PUGI__FN bool convert_buffer(char_t*& out_buffer, size_t& out_length, xml_encoding encoding, const void* contents, size_t size, bool is_mutable)
+	template <typename T, typename opt_swap> PUGI__FN size_t simd_decode_utf32_ascii(const uint32_t* data, size_t size, T& result, opt_swap)
 	{
-		// fast path: no conversion required
-		if (encoding == encoding_utf8) return get_mutable_buffer(out_buffer, out_length, contents, size, is_mutable);
-
-		// source encoding is utf16
-		if (encoding == encoding_utf16_be || encoding == encoding_utf16_le)
-		{
-			xml_encoding native_encoding = is_little_endian() ? encoding_utf16_le : encoding_utf16_be;
+		const __m128i non_ascii = _mm_set1_epi32(static_cast<int>(0xffffff80));
 
-			return (native_encoding == encoding) ?
-				convert_buffer_utf16(out_buffer, out_length, contents, size, opt_false()) :
-				convert_buffer_utf16(out_buffer, out_length, contents, size, opt_true());
-		}
+		size_t offset = 0;
 
-		// source encoding is utf32
-		if (encoding == encoding_utf32_be || encoding == encoding_utf32_le)
+		for (; offset + 16 <= size; offset += 16)
 		{
-			xml_encoding native_encoding = is_little_endian() ? encoding_utf32_le : encoding_utf32_be;
+			__m128i v0 = simd_load_utf32(data + offset, opt_swap());
+			__m128i v1 = simd_load_utf32(data + offset + 4, opt_swap());
+			__m128i v2 = simd_load_utf32(data + offset + 8, opt_swap());
+			__m128i v3 = simd_load_utf32(data + offset + 12, opt_swap());
 
-			return (native_encoding == encoding) ?
-				convert_buffer_utf32(out_buffer, out_length, contents, size, opt_false()) :
-				convert_buffer_utf32(out_buffer, out_length, contents, size, opt_true());
-		}
+			__m128i high = _mm_and_si128(_mm_or_si128(_mm_or_si128(v0, v1), _mm_or_si128(v2, v3)), non_ascii);
+			if (_mm_movemask_epi8(_mm_cmpeq_epi8(high, _mm_setzero_si128())) != 0xffff) break;
 
-		// source encoding is latin1
-		if (encoding == encoding_latin1) return convert_buffer_latin1(out_buffer, out_length, contents, size, is_mutable);
+			result = simd_ascii_block(result, _mm_packus_epi16(_mm_packs_epi32(v0, v1), _mm_packs_epi32(v2, v3)));
+		}
 
-		assert(!"Invalid encoding");
-		return false;
+		return offset;
 	}
 #endif
 
-	PUGI__FN size_t as_utf8_begin(const wchar_t* str, size_t length)
-	{
-		// get length in utf8 characters
-		return utf_decoder<utf8_counter>::decode_wchar_block(str, length, 0);
-	}
-
-	PUGI__FN void as_utf8_end(char* buffer, size_t size, const wchar_t* str, size_t length)
-	{
-		// convert to utf8
-		uint8_t* begin = reinterpret_cast<uint8_t*>(buffer);
-		uint8_t* end = utf_decoder<utf8_writer>::decode_wchar_block(str, length, begin);
-	
-		assert(begin + size == end);
-		(void)!end;
-
-		// zero-terminate
-		buffer[size] = 0;
-	}
-	
-#ifndef PUGIXML_NO_STL
-	PUGI__FN std::string as_utf8_impl(const wchar_t* str, size_t length)
+	template <typename Traits, typename opt_swap = opt_false> struct utf_decoder
 	{
-		// first pass: get length in utf8 characters
-		size_t size = as_utf8_begin(str, length);
-
-		// allocate resulting string
-		std::string result;
-		result.resize(size);
-
-		// second pass: convert to utf8
-		if (size > 0) as_utf8_end(&result[0], size, str, length);
-
-		return result;
-	}
+		static inline typename Traits::value_type decode_utf8_block(const uint8_t* data, size_t size, typename Traits::value_type result)
+		{
+			const uint8_t utf8_byte_mask = 0x3f;
 
-	PUGI__FN std::basic_string<wchar_t> as_wide_impl(const char* str, size_t size)
-	{
-		const uint8_t* data = reinterpret_cast<const uint8_t*>(str);
+			while (size)
+			{
+				uint8_t lead = *data;
 
-		// first pass: get length in wchar_t units
-		size_t length = utf_decoder<wchar_counter>::decode_utf8_block(data, size, 0);
+				// 0xxxxxxx -> U+0000..U+007F
+				if (lead < 0x80)
+				{
+					result = Traits::low(result, lead);
+					data += 1;
+					size -= 1;
 
-		// allocate resulting string
-		std::basic_string<wchar_t> result;
-		result.resize(length);
+				#ifdef PUGI__SIMD_SSE2
+					// process unaligned 16-byte ascii blocks
+					size_t ascii = simd_decode_utf8_ascii(data, size, result);
+					data += ascii;
+					size -= ascii;
+				#endif
 
-		// second pass: convert to wchar_t
-		if (length > 0)
-		{
-			wchar_writer::value_type begin = reinterpret_cast<wchar_writer::value_type>(&result[0]);
-			wchar_writer::value_type end = utf_decoder<wchar_writer>::decode_utf8_block(data, size, begin);
+					// process aligned single-byte (ascii) blocks
+					if ((reinterpret_cast<uintptr_t>(data) & 3) == 0)
+					{
+						// round-trip through void* to silence 'cast increases required alignment of target type' warnings
+						while (size >= 4 && (*static_cast<const uint32_t*>(static_cast<const void*>(data)) & 0x80808080) == 0)
+						{
+							result = Traits::low(result, data[0]);
+							result = Traits::low(result, data[1]);
+							result = Traits::low(result, data[2]);
+							result = Traits::low(result, data[3]);
+							data += 4;
+							size -= 4;
+						}
+					}
+				}
+				// 110xxxxx -> U+0080..U+07FF
+				else if (static_cast<unsigned int>(lead - 0xC0) < 0x20 && size >= 2 && (data[1] & 0xc0) == 0x80)
+				{
+					result = Traits::low(result, ((lead & ~0xC0) << 6) | (data[1] & utf8_byte_mask));
+					data += 2;
+					size -= 2;
+				}
+				// 1110xxxx -> U+0800-U+FFFF
+				else if (static_cast<unsigned int>(lead - 0xE0) < 0x10 && size >= 3 && (data[1] & 0xc0) == 0x80 && (data[2] & 0xc0) == 0x80)
+				{
+					result = Traits::low(result, ((lead & ~0xE0) << 12) | ((data[1] & utf8_byte_mask) << 6) | (data[2] & utf8_byte_mask));
+					data += 3;
+					size -= 3;
+				}
+				// 11110xxx -> U+10000..U+10FFFF
+				else if (static_cast<unsigned int>(lead - 0xF0) < 0x08 && size >= 4 && (data[1] & 0xc0) == 0x80 && (data[2] & 0xc0) == 0x80 && (data[3] & 0xc0) == 0x80)
+				{
+					result = Traits::high(result, ((lead & ~0xF0) << 18) | ((data[1] & utf8_byte_mask) << 12) | ((data[2] & utf8_byte_mask) << 6) | (data[3] & utf8_byte_mask));
+					data += 4;
+					size -= 4;
+				}
+				// 10xxxxxx or 11111xxx -> invalid
+				else
+				{
+					data += 1;
+					size -= 1;
+				}
+			}
 
-			assert(begin + length == end);
-			(void)!end;
+			return result;
 		}
 
-		return result;
-	}
-#endif
+		static inline typename Traits::value_type decode_utf16_block(const uint16_t* data, size_t size, typename Traits::value_type result)
+		{
+			const uint16_t* end = data + size;
 
-	inline bool strcpy_insitu_allow(size_t length, uintptr_t header, uintptr_t header_mask, char_t* target)
-	{
-		// never reuse shared memory
-		if (header & xml_memory_page_contents_shared_mask) return false;
+			while (data < end)
+			{
+				unsigned int lead = opt_swap::value ? endian_swap(*data) : *data;
 
-		size_t target_length = strlength(target);
+				// U+0000..U+D7FF
+				if (lead < 0xD800)
+				{
+					result = Traits::low(result, lead);
+					data += 1;
 
-		// always reuse document buffer memory if possible
-		if ((header & header_mask) == 0) return target_length >= length;
+				#ifdef PUGI__SIMD_SSE2
+					// process 16-unit ascii blocks
+					if (lead < 0x80) data += simd_decode_utf16_ascii(data, static_cast<size_t>(end - data), result, opt_swap());
+				#endif
+				}
+				// U+E000..U+FFFF
+				else if (static_cast<unsigned int>(lead - 0xE000) < 0x2000)
+				{
+					result = Traits::low(result, lead);
+					data += 1;
+				}
+				// surrogate pair lead
+				else if (static_cast<unsigned int>(lead - 0xD800) < 0x400 && data + 1 < end)
+				{
+					uint16_t next = opt_swap::value ? endian_swap(data[1]) : data[1];
 
-		// reuse heap memory if waste is not too great
-		const size_t reuse_threshold = 32;
+					if (static_cast<unsigned int>(next - 0xDC00) < 0x400)
+					{
+						result = Traits::high(result, 0x10000 + ((lead & 0x3ff) << 10) + (next & 0x3ff));
+						data += 2;
+					}
+					else
+					{
+						data += 1;
+					}
+				}
+				else
+				{
+					data += 1;
+				}
+			}
 
-		return target_length >= length && (target_length < reuse_threshold || target_length - length < target_length / 2);
-	}
+			return result;
+		}
 
-	PUGI__FN bool strcpy_insitu(char_t*& dest, uintptr_t& header, uintptr_t header_mask, const char_t* source)
-	{
-		assert(header);
+		static inline typename Traits::value_type decode_utf32_block(const uint32_t* data, size_t size, typename Traits::value_type result)
+		{
+			const uint32_t* end = data + size;
 
-		size_t source_length = strlength(source);
+			while (data < end)
+			{
+				uint32_t lead = opt_swap::value ? endian_swap(*data) : *data;
 
-		if (source_length == 0)
-		{
-			// empty string and null pointer are equivalent, so just deallocate old memory
-			xml_allocator* alloc = reinterpret_cast<xml_memory_page*>(header & xml_memory_page_pointer_mask)->allocator;
+				// U+0000..U+FFFF
+				if (lead < 0x10000)
+				{
+					result = Traits::low(result, lead);
+					data += 1;
 
-			if (header & header_mask) alloc->deallocate_string(dest);
-			
-			// mark the string as not allocated
-			dest = 0;
-			header &= ~header_mask;
+				#ifdef PUGI__SIMD_SSE2
+					// process 16-unit ascii blocks
+					if (lead < 0x80) data += simd_decode_utf32_ascii(data, static_cast<size_t>(end - data), result, opt_swap());
+				#endif
+				}
+				// U+10000..U+10FFFF
+				else
+				{
+					result = Traits::high(result, lead);
+					data += 1;
+				}
+			}
 
-			return true;
-		}
-		else if (dest && strcpy_insitu_allow(source_length, header, header_mask, dest))
-		{
-			// we can reuse old buffer, so just copy the new data (including zero terminator)
-			memcpy(dest, source, (source_length + 1) * sizeof(char_t));
-			
-			return true;
+			return result;
 		}
-		else
-		{
-			xml_allocator* alloc = reinterpret_cast<xml_memory_page*>(header & xml_memory_page_pointer_mask)->allocator;
 
-			// allocate new buffer
-			char_t* buf = alloc->allocate_string(source_length + 1);
-			if (!buf) return false;
+		static inline typename Traits::value_type decode_latin1_block(const uint8_t* data, size_t size, typename Traits::value_type result)
+		{
+			for (size_t i = 0; i < size; )
+			{
+				uint8_t ch = data[i++];
 
-			// copy the string (including zero terminator)
-			memcpy(buf, source, (source_length + 1) * sizeof(char_t));
+				result = Traits::low(result, ch);
 
-			// deallocate old buffer (*after* the above to protect against overlapping memory and/or allocation failures)
-			if (header & header_mask) alloc->deallocate_string(dest);
-			
-			// the string is now allocated, so set the flag
-			dest = buf;
-			header |= header_mask;
+			#ifdef PUGI__SIMD_SSE2
+				// process unaligned 16-byte ascii blocks
+				if (ch < 0x80) i += simd_decode_utf8_ascii(data + i, size - i, result);
+			#endif
+			}
 
-			return true;
+			return result;
 		}
-	}
 
-	struct gap
-	{
-		char_t* end;
-		size_t size;
-			
-		gap(): end(0), size(0)
+		static inline typename Traits::value_type decode_wchar_block_impl(const uint16_t* data, size_t size, typename Traits::value_type result)
 		{
+			return decode_utf16_block(data, size, result);
 		}
-			
-		// Push new gap, move s count bytes further (skipping the gap).
-		// Collapse previous gap.
-		void push(char_t*& s, size_t count)
+
+		static inline typename Traits::value_type decode_wchar_block_impl(const uint32_t* data, size_t size, typename Traits::value_type result)
 		{
-			if (end) // there was a gap already; collapse it
-			{
-				// Move [old_gap_end, new_gap_start) to [old_gap_start, ...)
-				assert(s >= end);
-				memmove(end - size, end, reinterpret_cast<char*>(s) - reinterpret_cast<char*>(end));
-			}
-				
-			s += count; // end of current gap
-				
-			// "merge" two gaps
-			end = s;
-			size += count;
+			return decode_utf32_block(data, size, result);
 		}
-			
-		// Collapse all gaps, return past-the-end pointer
-		char_t* flush(char_t* s)
+
+		static inline typename Traits::value_type decode_wchar_block(const wchar_t* data, size_t size, typename Traits::value_type result)
 		{
-			if (end)
-			{
-				// Move [old_gap_end, current_pos) to [old_gap_start, ...)
-				assert(s >= end);
-				memmove(end - size, end, reinterpret_cast<char*>(s) - reinterpret_cast<char*>(end));
+			return decode_wchar_block_impl(reinterpret_cast<const wchar_selector<sizeof(wchar_t)>::type*>(data), size, result);
+		}
+	};
+
+	template <typename T> PUGI__FN void convert_utf_endian_swap(T* result, const T* data, size_t length)
+	{
+		for (size_t i = 0; i < length; ++i) result[i] = endian_swap(data[i]);
+	}
+
+#ifdef PUGIXML_WCHAR_MODE
+	PUGI__FN void convert_wchar_endian_swap(wchar_t* result, const wchar_t* data, size_t length)
+	{
+		for (size_t i = 0; i < length; ++i) result[i] = static_cast<wchar_t>(endian_swap(static_cast<wchar_selector<sizeof(wchar_t)>::type>(data[i])));
+	}
+#endif
+PUGI__NS_END
+
+PUGI__NS_BEGIN
+	enum chartype_t
+	{
+		ct_parse_pcdata = 1,	// \0, &, \r, <
+		ct_parse_attr = 2,		// \0, &, \r, ', "
+		ct_parse_attr_ws = 4,	// \0, &, \r, ', ", \n, tab
+		ct_space = 8,			// \r, \n, space, tab
+		ct_parse_cdata = 16,	// \0, ], >, \r
+		ct_parse_comment = 32,	// \0, -, >, \r
+		ct_symbol = 64,			// Any symbol > 127, a-z, A-Z, 0-9, _, :, -, .
+		ct_start_symbol = 128	// Any symbol > 127, a-z, A-Z, _, :
+	};
+
+	static const unsigned char chartype_table[256] =
+	{
+		55,  0,   0,   0,   0,   0,   0,   0,      0,   12,  12,  0,   0,   63,  0,   0,   // 0-15
+		0,   0,   0,   0,   0,   0,   0,   0,      0,   0,   0,   0,   0,   0,   0,   0,   // 16-31
+		8,   0,   6,   0,   0,   0,   7,   6,      0,   0,   0,   0,   0,   96,  64,  0,   // 32-47
+		64,  64,  64,  64,  64,  64,  64,  64,     64,  64,  192, 0,   1,   0,   48,  0,   // 48-63
+		0,   192, 192, 192, 192, 192, 192, 192,    192, 192, 192, 192, 192, 192, 192, 192, // 64-79
+		192, 192, 192, 192, 192, 192, 192, 192,    192, 192, 192, 0,   0,   16,  0,   192, // 80-95
+		0,   192, 192, 192, 192, 192, 192, 192,    192, 192, 192, 192, 192, 192, 192, 192, // 96-111
+		192, 192, 192, 192, 192, 192, 192, 192,    192, 192, 192, 0, 0, 0, 0, 0,           // 112-127
+
+		192, 192, 192, 192, 192, 192, 192, 192,    192, 192, 192, 192, 192, 192, 192, 192, // 128+
+		192, 192, 192, 192, 192, 192, 192, 192,    192, 192, 192, 192, 192, 192, 192, 192,
+		192, 192, 192, 192, 192, 192, 192, 192,    192, 192, 192, 192, 192, 192, 192, 192,
+		192, 192, 192, 192, 192, 192, 192, 192,    192, 192, 192, 192, 192, 192, 192, 192,
+		192, 192, 192, 192, 192, 192, 192, 192,    192, 192, 192, 192, 192, 192, 192, 192,
+		192, 192, 192, 192, 192, 192, 192, 192,    192, 192, 192, 192, 192, 192, 192, 192,
+		192, 192, 192, 192, 192, 192, 192, 192,    192, 192, 192, 192, 192, 192, 192, 192,
+		192, 192, 192, 192, 192, 192, 192, 192,    192, 192, 192, 192, 192, 192, 192, 192
+	};
+
+	enum chartypex_t
+	{
+		ctx_special_pcdata = 1,   // Any symbol >= 0 and < 32 (except \t, \r, \n), &, <, >
+		ctx_special_attr = 2,     // Any symbol >= 0 and < 32 (except \t), &, <, >, "
+		ctx_start_symbol = 4,	  // Any symbol > 127, a-z, A-Z, _
+		ctx_digit = 8,			  // 0-9
+		ctx_symbol = 16			  // Any symbol > 127, a-z, A-Z, 0-9, _, -, .
+	};
+	
+	static const unsigned char chartypex_table[256] =
+	{
+		3,  3,  3,  3,  3,  3,  3,  3,     3,  0,  2,  3,  3,  2,  3,  3,     // 0-15
+		3,  3,  3,  3,  3,  3,  3,  3,     3,  3,  3,  3,  3,  3,  3,  3,     // 16-31
+		0,  0,  2,  0,  0,  0,  3,  0,     0,  0,  0,  0,  0, 16, 16,  0,     // 32-47
+		24, 24, 24, 24, 24, 24, 24, 24,    24, 24, 0,  0,  3,  0,  3,  0,     // 48-63
+
+		0,  20, 20, 20, 20, 20, 20, 20,    20, 20, 20, 20, 20, 20, 20, 20,    // 64-79
+		20, 20, 20, 20, 20, 20, 20, 20,    20, 20, 20, 0,  0,  0,  0,  20,    // 80-95
+		0,  20, 20, 20, 20, 20, 20, 20,    20, 20, 20, 20, 20, 20, 20, 20,    // 96-111
+		20, 20, 20, 20, 20, 20, 20, 20,    20, 20, 20, 0,  0,  0,  0,  0,     // 112-127
+
+		20, 20, 20, 20, 20, 20, 20, 20,    20, 20, 20, 20, 20, 20, 20, 20,    // 128+
+		20, 20, 20, 20, 20, 20, 20, 20,    20, 20, 20, 20, 20, 20, 20, 20,
+		20, 20, 20, 20, 20, 20, 20, 20,    20, 20, 20, 20, 20, 20, 20, 20,
+		20, 20, 20, 20, 20, 20, 20, 20,    20, 20, 20, 20, 20, 20, 20, 20,
+		20, 20, 20, 20, 20, 20, 20, 20,    20, 20, 20, 20, 20, 20, 20, 20,
+		20, 20, 20, 20, 20, 20, 20, 20,    20, 20, 20, 20, 20, 20, 20, 20,
+		20, 20, 20, 20, 20, 20, 20, 20,    20, 20, 20, 20, 20, 20, 20, 20,
+		20, 20, 20, 20, 20, 20, 20, 20,    20, 20, 20, 20, 20, 20, 20, 20
+	};
+	
+#ifdef PUGIXML_WCHAR_MODE
+	#define PUGI__IS_CHARTYPE_IMPL(c, ct, table) ((static_cast<unsigned int>(c) < 128 ? table[static_cast<unsigned int>(c)] : table[128]) & (ct))
+#else
+	#define PUGI__IS_CHARTYPE_IMPL(c, ct, table) (table[static_cast<unsigned char>(c)] & (ct))
+#endif
+
+	#define PUGI__IS_CHARTYPE(c, ct) PUGI__IS_CHARTYPE_IMPL(c, ct, chartype_table)
+	#define PUGI__IS_CHARTYPEX(c, ct) PUGI__IS_CHARTYPE_IMPL(c, ct, chartypex_table)
+
+#if defined(PUGI__SIMD_SSE2) && !defined(PUGIXML_WCHAR_MODE)
+	// Get a bitmask of characters in the block that belong to the chartype set; only supports the sets used by text conversion functions
+	template <int ct> inline unsigned int simd_chartype_mask(__m128i v)
+	{
+		PUGI__STATIC_ASSERT(ct == ct_parse_pcdata || ct == ct_parse_attr || ct == ct_parse_attr_ws || ct == (ct_parse_attr_ws | ct_space));
+
+		// \0, & and \r are present in all sets
+		__m128i m = _mm_cmpeq_epi8(v, _mm_setzero_si128());
+		m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8('&')));
+		m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8('\r')));
+
+		if (ct == ct_parse_pcdata)
+		{
+			m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8('<')));
+		}
+		else
+		{
+			m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8('"')));
+			m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8('\'')));
+		}
+
+		if (ct & ct_parse_attr_ws)
+		{
+			m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8('\n')));
+			m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8('\t')));
+		}
+
+		if (ct & ct_space)
+		{
+			m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8(' ')));
+		}
+
+		return static_cast<unsigned int>(_mm_movemask_epi8(m));
+	}
+
+	// Find first character that belongs to the chartype set; the string has to be zero-terminated
+	template <int ct> PUGI__FN PUGI__NO_SANITIZE char_t* simd_scan_chartype(char_t* s)
+	{
+		const uintptr_t page_size = 4096;
+
+		// unaligned load is safe if it does not cross a page boundary
+		if ((reinterpret_cast<uintptr_t>(s) & (page_size - 1)) <= page_size - 16)
+		{
+			unsigned int mask = simd_chartype_mask<ct>(_mm_loadu_si128(reinterpret_cast<const __m128i*>(s)));
+			if (mask) return s + simd_count_trailing_zeros(mask);
+
+			// all characters before the next aligned block have been checked
+			s = reinterpret_cast<char_t*>((reinterpret_cast<uintptr_t>(s) + 16) & ~static_cast<uintptr_t>(15));
+		}
+		else
+		{
+			for (; reinterpret_cast<uintptr_t>(s) & 15; ++s)
+				if (PUGI__IS_CHARTYPE(*s, ct)) return s;
+		}
+
+		// aligned loads never cross a page boundary so reading past the terminator is safe
+		for (;;)
+		{
+			unsigned int mask = simd_chartype_mask<ct>(_mm_load_si128(reinterpret_cast<const __m128i*>(s)));
+			if (mask) return s + simd_count_trailing_zeros(mask);
+
+			s += 16;
+		}
+	}
+#endif
+
+	PUGI__FN bool is_little_endian()
+	{
+		unsigned int ui = 1;
+
+		return *reinterpret_cast<unsigned char*>(&ui) == 1;
+	}
+
+	PUGI__FN xml_encoding get_wchar_encoding()
+	{
+		PUGI__STATIC_ASSERT(sizeof(wchar_t) == 2 || sizeof(wchar_t) == 4);
+
+		if (sizeof(wchar_t) == 2)
+			return is_little_endian() ? encoding_utf16_le : encoding_utf16_be;
+		else 
+			return is_little_endian() ? encoding_utf32_le : encoding_utf32_be;
+	}
+
+	PUGI__FN xml_encoding guess_buffer_encoding(uint8_t d0, uint8_t d1, uint8_t d2, uint8_t d3)
+	{
+		// look for BOM in first few bytes
+		if (d0 == 0 && d1 == 0 && d2 == 0xfe && d3 == 0xff) return encoding_utf32_be;
+		if (d0 == 0xff && d1 == 0xfe && d2 == 0 && d3 == 0) return encoding_utf32_le;
+		if (d0 == 0xfe && d1 == 0xff) return encoding_utf16_be;
+		if (d0 == 0xff && d1 == 0xfe) return encoding_utf16_le;
+		if (d0 == 0xef && d1 == 0xbb && d2 == 0xbf) return encoding_utf8;
+
+		// look for <, <? or <?xm in various encodings
+		if (d0 == 0 && d1 == 0 && d2 == 0 && d3 == 0x3c) return encoding_utf32_be;
+		if (d0 == 0x3c && d1 == 0 && d2 == 0 && d3 == 0) return encoding_utf32_le;
+		if (d0 == 0 && d1 == 0x3c && d2 == 0 && d3 == 0x3f) return encoding_utf16_be;
+		if (d0 == 0x3c && d1 == 0 && d2 == 0x3f && d3 == 0) return encoding_utf16_le;
+		if (d0 == 0x3c && d1 == 0x3f && d2 == 0x78 && d3 == 0x6d) return encoding_utf8;
+
+		// look for utf16 < followed by node name (this may fail, but is better than utf8 since it's zero terminated so early)
+		if (d0 == 0 && d1 == 0x3c) return encoding_utf16_be;
+		if (d0 == 0x3c && d1 == 0) return encoding_utf16_le;
+
+		// no known BOM detected, assume utf8
+		return encoding_utf8;
+	}
+
+	PUGI__FN xml_encoding get_buffer_encoding(xml_encoding encoding, const void* contents, size_t size)
+	{
+		// replace wchar encoding with utf implementation
+		if (encoding == encoding_wchar) return get_wchar_encoding();
+
+		// replace utf16 encoding with utf16 with specific endianness
+		if (encoding == encoding_utf16) return is_little_endian() ? encoding_utf16_le : encoding_utf16_be;
+
+		// replace utf32 encoding with utf32 with specific endianness
+		if (encoding == encoding_utf32) return is_little_endian() ? encoding_utf32_le : encoding_utf32_be;
+
+		// only do autodetection if no explicit encoding is requested
+		if (encoding != encoding_auto) return encoding;
+
+		// skip encoding autodetection if input buffer is too small
+		if (size < 4) return encoding_utf8;
+
+		// try to guess encoding (based on XML specification, Appendix F.1)
+		const uint8_t* data = static_cast<const uint8_t*>(contents);
+
+		PUGI__DMC_VOLATILE uint8_t d0 = data[0], d1 = data[1], d2 = data[2], d3 = data[3];
+
+		return guess_buffer_encoding(d0, d1, d2, d3);
+	}
+
+	PUGI__FN bool get_mutable_buffer(char_t*& out_buffer, size_t& out_length, const void* contents, size_t size, xml_memory_resource* resource, bool is_mutable)
+	{
+		size_t length = size / sizeof(char_t);
+
+		if (is_mutable)
+		{
+			out_buffer = static_cast<char_t*>(const_cast<void*>(contents));
+			out_length = length;
+		}
+		else
+		{
+			char_t* buffer = static_cast<char_t*>(resource_allocate((length + 1) * sizeof(char_t), resource));
+			if (!buffer) return false;
+
+			memcpy(buffer, contents, length * sizeof(char_t));
+			buffer[length] = 0;
+
+			out_buffer = buffer;
+			out_length = length + 1;
+		}
+
+		return true;
+	}
+
+#ifdef PUGIXML_WCHAR_MODE
+	PUGI__FN bool need_endian_swap_utf(xml_encoding le, xml_encoding re)
+	{
+		return (le == encoding_utf16_be && re == encoding_utf16_le) || (le == encoding_utf16_le && re == encoding_utf16_be) ||
+			   (le == encoding_utf32_be && re == encoding_utf32_le) || (le == encoding_utf32_le && re == encoding_utf32_be);
+	}
+
+	PUGI__FN bool convert_buffer_endian_swap(char_t*& out_buffer, size_t& out_length, const void* contents, size_t size, xml_memory_resource* resource, bool is_mutable)
+	{
+		const char_t* data = static_cast<const char_t*>(contents);
+		size_t length = size / sizeof(char_t);
+
+		if (is_mutable)
+		{
+			char_t* buffer = const_cast<char_t*>(data);
+
+			convert_wchar_endian_swap(buffer, data, length);
+
+			out_buffer = buffer;
+			out_length = length;
+		}
+		else
+		{
+			char_t* buffer = static_cast<char_t*>(resource_allocate((length + 1) * sizeof(char_t), resource));
+			if (!buffer) return false;
+
+			convert_wchar_endian_swap(buffer, data, length);
+			buffer[length] = 0;
+
+			out_buffer = buffer;
+			out_length = length + 1;
+		}
+
+		return true;
+	}
+
+	PUGI__FN bool convert_buffer_utf8(char_t*& out_buffer, size_t& out_length, const void* contents, size_t size, xml_memory_resource* resource)
+	{
+		const uint8_t* data = static_cast<const uint8_t*>(contents);
+		size_t data_length = size;
+
+		// first pass: get length in wchar_t units
+		size_t length = utf_decoder<wchar_counter>::decode_utf8_block(data, data_length, 0);
+
+		// allocate buffer of suitable length
+		char_t* buffer = static_cast<char_t*>(resource_allocate((length + 1) * sizeof(char_t), resource));
+		if (!buffer) return false;
+
+		// second pass: convert utf8 input to wchar_t
+		wchar_writer::value_type obegin = reinterpret_cast<wchar_writer::value_type>(buffer);
+		wchar_writer::value_type oend = utf_decoder<wchar_writer>::decode_utf8_block(data, data_length, obegin);
+
+		assert(oend == obegin + length);
+		*oend = 0;
+
+		out_buffer = buffer;
+		out_length = length + 1;
+
+		return true;
+	}
+
+	template <typename opt_swap> PUGI__FN bool convert_buffer_utf16(char_t*& out_buffer, size_t& out_length, const void* contents, size_t size, xml_memory_resource* resource, opt_swap)
+	{
+		const uint16_t* data = static_cast<const uint16_t*>(contents);
+		size_t data_length = size / sizeof(uint16_t);
+
+		// first pass: get length in wchar_t units
+		size_t length = utf_decoder<wchar_counter, opt_swap>::decode_utf16_block(data, data_length, 0);
+
+		// allocate buffer of suitable length
+		char_t* buffer = static_cast<char_t*>(resource_allocate((length + 1) * sizeof(char_t), resource));
+		if (!buffer) return false;
+
+		// second pass: convert utf16 input to wchar_t
+		wchar_writer::value_type obegin = reinterpret_cast<wchar_writer::value_type>(buffer);
+		wchar_writer::value_type oend = utf_decoder<wchar_writer, opt_swap>::decode_utf16_block(data, data_length, obegin);
+
+		assert(oend == obegin + length);
+		*oend = 0;
+
+		out_buffer = buffer;
+		out_length = length + 1;
+
+		return true;
+	}
+
+	template <typename opt_swap> PUGI__FN bool convert_buffer_utf32(char_t*& out_buffer, size_t& out_length, const void* contents, size_t size, xml_memory_resource* resource, opt_swap)
+	{
+		const uint32_t* data = static_cast<const uint32_t*>(contents);
+		size_t data_length = size / sizeof(uint32_t);
+
+		// first pass: get length in wchar_t units
+		size_t length = utf_decoder<wchar_counter, opt_swap>::decode_utf32_block(data, data_length, 0);
+
+		// allocate buffer of suitable length
+		char_t* buffer = static_cast<char_t*>(resource_allocate((length + 1) * sizeof(char_t), resource));
+		if (!buffer) return false;
+
+		// second pass: convert utf32 input to wchar_t
+		wchar_writer::value_type obegin = reinterpret_cast<wchar_writer::value_type>(buffer);
+		wchar_writer::value_type oend = utf_decoder<wchar_writer, opt_swap>::decode_utf32_block(data, data_length, obegin);
+
+		assert(oend == obegin + length);
+		*oend = 0;
+
+		out_buffer = buffer;
+		out_length = length + 1;
+
+		return true;
+	}
+
+	PUGI__FN bool convert_buffer_latin1(char_t*& out_buffer, size_t& out_length, const void* contents, size_t size, xml_memory_resource* resource)
+	{
+		const uint8_t* data = static_cast<const uint8_t*>(contents);
+		size_t data_length = size;
+
+		// get length in wchar_t units
+		size_t length = data_length;
+
+		// allocate buffer of suitable length
+		char_t* buffer = static_cast<char_t*>(resource_allocate((length + 1) * sizeof(char_t), resource));
+		if (!buffer) return false;
+
+		// convert latin1 input to wchar_t
+		wchar_writer::value_type obegin = reinterpret_cast<wchar_writer::value_type>(buffer);
+		wchar_writer::value_type oend = utf_decoder<wchar_writer>::decode_latin1_block(data, data_length, obegin);
+
+		assert(oend == obegin + length);
+		*oend = 0;
+
+		out_buffer = buffer;
+		out_length = length + 1;
+
+		return true;
+	}
+
+	PUGI__FN bool convert_buffer(char_t*& out_buffer, size_t& out_length, xml_encoding encoding, const void* contents, size_t size, xml_memory_resource* resource, bool is_mutable)
+	{
+		// get native encoding
+		xml_encoding wchar_encoding = get_wchar_encoding();
+
+		// fast path: no conversion required
+		if (encoding == wchar_encoding) return get_mutable_buffer(out_buffer, out_length, contents, size, resource, is_mutable);
+
+		// only endian-swapping is required
+		if (need_endian_swap_utf(encoding, wchar_encoding)) return convert_buffer_endian_swap(out_buffer, out_length, contents, size, resource, is_mutable);
+
+		// source encoding is utf8
+		if (encoding == encoding_utf8) return convert_buffer_utf8(out_buffer, out_length, contents, size, resource);
+
+		// source encoding is utf16
+		if (encoding == encoding_utf16_be || encoding == encoding_utf16_le)
+		{
+			xml_encoding native_encoding = is_little_endian() ? encoding_utf16_le : encoding_utf16_be;
+
+			return (native_encoding == encoding) ?
+				convert_buffer_utf16(out_buffer, out_length, contents, size, resource, opt_false()) :
+				convert_buffer_utf16(out_buffer, out_length, contents, size, resource, opt_true());
+		}
+
+		// source encoding is utf32
+		if (encoding == encoding_utf32_be || encoding == encoding_utf32_le)
+		{
+			xml_encoding native_encoding = is_little_endian() ? encoding_utf32_le : encoding_utf32_be;
+
+			return (native_encoding == encoding) ?
+				convert_buffer_utf32(out_buffer, out_length, contents, size, resource, opt_false()) :
+				convert_buffer_utf32(out_buffer, out_length, contents, size, resource, opt_true());
+		}
+
+		// source encoding is latin1
+		if (encoding == encoding_latin1) return convert_buffer_latin1(out_buffer, out_length, contents, size, resource);
+
+		assert(!"Invalid encoding");
+		return false;
+	}
+#else
+	template <typename opt_swap> PUGI__FN bool convert_buffer_utf16(char_t*& out_buffer, size_t& out_length, const void* contents, size_t size, xml_memory_resource* resource, opt_swap)
+	{
+		const uint16_t* data = static_cast<const uint16_t*>(contents);
+		size_t data_length = size / sizeof(uint16_t);
+
+		// first pass: get length in utf8 units
+		size_t length = utf_decoder<utf8_counter, opt_swap>::decode_utf16_block(data, data_length, 0);
+
+		// allocate buffer of suitable length
+		char_t* buffer = static_cast<char_t*>(resource_allocate((length + 1) * sizeof(char_t), resource));
+		if (!buffer) return false;
+
+		// second pass: convert utf16 input to utf8
+		uint8_t* obegin = reinterpret_cast<uint8_t*>(buffer);
+		uint8_t* oend = utf_decoder<utf8_writer, opt_swap>::decode_utf16_block(data, data_length, obegin);
+
+		assert(oend == obegin + length);
+		*oend = 0;
+
+		out_buffer = buffer;
+		out_length = length + 1;
+
+		return true;
+	}
+
+	template <typename opt_swap> PUGI__FN bool convert_buffer_utf32(char_t*& out_buffer, size_t& out_length, const void* contents, size_t size, xml_memory_resource* resource, opt_swap)
+	{
+		const uint32_t* data = static_cast<const uint32_t*>(contents);
+		size_t data_length = size / sizeof(uint32_t);
+
+		// first pass: get length in utf8 units
+		size_t length = utf_decoder<utf8_counter, opt_swap>::decode_utf32_block(data, data_length, 0);
+
+		// allocate buffer of suitable length
+		char_t* buffer = static_cast<char_t*>(resource_allocate((length + 1) * sizeof(char_t), resource));
+		if (!buffer) return false;
+
+		// second pass: convert utf32 input to utf8
+		uint8_t* obegin = reinterpret_cast<uint8_t*>(buffer);
+		uint8_t* oend = utf_decoder<utf8_writer, opt_swap>::decode_utf32_block(data, data_length, obegin);
+
+		assert(oend == obegin + length);
+		*oend = 0;
+
+		out_buffer = buffer;
+		out_length = length + 1;
+
+		return true;
+	}
+
+	PUGI__FN size_t get_latin1_7bit_prefix_length(const uint8_t* data, size_t size)
+	{
+		size_t i = 0;
+
+	#ifdef PUGI__SIMD_SSE2
+		for (; i + 16 <= size; i += 16)
+		{
+			unsigned int mask = static_cast<unsigned int>(_mm_movemask_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i))));
+			if (mask) return i + simd_count_trailing_zeros(mask);
+		}
+	#endif
+
+		for (; i < size; ++i)
+			if (data[i] > 127)
+				return i;
+
+		return size;
+	}
+
+	PUGI__FN size_t get_latin1_utf8_length(const uint8_t* data, size_t size)
+	{
+		// every character with the high bit set takes two bytes in utf8
+		size_t result = size;
+		size_t i = 0;
+
+	#ifdef PUGI__SIMD_SSE2
+		for (; i + 16 <= size; i += 16)
+		{
+			unsigned int mask = static_cast<unsigned int>(_mm_movemask_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i))));
+
+			for (; mask; mask &= mask - 1) result++;
+		}
+	#endif
+
+		for (; i < size; ++i) result += data[i] >> 7;
+
+		return result;
+	}
+
+	PUGI__FN bool convert_buffer_latin1(char_t*& out_buffer, size_t& out_length, const void* contents, size_t size, xml_memory_resource* resource, bool is_mutable)
+	{
+		const uint8_t* data = static_cast<const uint8_t*>(contents);
+		size_t data_length = size;
+
+		// get size of prefix that does not need utf8 conversion
+		size_t prefix_length = get_latin1_7bit_prefix_length(data, data_length);
+		assert(prefix_length <= data_length);
+
+		const uint8_t* postfix = data + prefix_length;
+		size_t postfix_length = data_length - prefix_length;
+
+		// if no conversion is needed, just return the original buffer
+		if (postfix_length == 0) return get_mutable_buffer(out_buffer, out_length, contents, size, resource, is_mutable);
+
+		// first pass: get length in utf8 units
+		size_t length = prefix_length + get_latin1_utf8_length(postfix, postfix_length);
+
+		// allocate buffer of suitable length
+		char_t* buffer = static_cast<char_t*>(resource_allocate((length + 1) * sizeof(char_t), resource));
+		if (!buffer) return false;
+
+		// second pass: convert latin1 input to utf8
+		memcpy(buffer, data, prefix_length);
+
+		uint8_t* obegin = reinterpret_cast<uint8_t*>(buffer);
+		uint8_t* oend = utf_decoder<utf8_writer>::decode_latin1_block(postfix, postfix_length, obegin + prefix_length);
+
+		assert(oend == obegin + length);
+		*oend = 0;
+
+		out_buffer = buffer;
+		out_length = length + 1;
+
+		return true;
+	}
+
+	PUGI__FN bool convert_buffer(char_t*& out_buffer, size_t& out_length, xml_encoding encoding, const void* contents, size_t size, xml_memory_resource* resource, bool is_mutable)
+	{
+		// fast path: no conversion required
+		if (encoding == encoding_utf8) return get_mutable_buffer(out_buffer, out_length, contents, size, resource, is_mutable);
+
+		// source encoding is utf16
+		if (encoding == encoding_utf16_be || encoding == encoding_utf16_le)
+		{
+			xml_encoding native_encoding = is_little_endian() ? encoding_utf16_le : encoding_utf16_be;
+
+			return (native_encoding == encoding) ?
+				convert_buffer_utf16(out_buffer, out_length, contents, size, resource, opt_false()) :
+				convert_buffer_utf16(out_buffer, out_length, contents, size, resource, opt_true());
+		}
+
+		// source encoding is utf32
+		if (encoding == encoding_utf32_be || encoding == encoding_utf32_le)
+		{
+			xml_encoding native_encoding = is_little_endian() ? encoding_utf32_le : encoding_utf32_be;
+
+			return (native_encoding == encoding) ?
+				convert_buffer_utf32(out_buffer, out_length, contents, size, resource, opt_false()) :
+				convert_buffer_utf32(out_buffer, out_length, contents, size, resource, opt_true());
+		}
+
+		// source encoding is latin1
+		if (encoding == encoding_latin1) return convert_buffer_latin1(out_buffer, out_length, contents, size, resource, is_mutable);
+
+		assert(!"Invalid encoding");
+		return false;
+	}
+#endif
+
+	PUGI__FN size_t as_utf8_begin(const wchar_t* str, size_t length)
+	{
+		// get length in utf8 characters
+		return utf_decoder<utf8_counter>::decode_wchar_block(str, length, 0);
+	}
+
+	PUGI__FN void as_utf8_end(char* buffer, size_t size, const wchar_t* str, size_t length)
+	{
+		// convert to utf8
+		uint8_t* begin = reinterpret_cast<uint8_t*>(buffer);
+		uint8_t* end = utf_decoder<utf8_writer>::decode_wchar_block(str, length, begin);
+	
+		assert(begin + size == end);
+		(void)!end;
+
+		// zero-terminate
+		buffer[size] = 0;
+	}
+	
+#ifndef PUGIXML_NO_STL
+	PUGI__FN std::string as_utf8_impl(const wchar_t* str, size_t length)
+	{
+		// first pass: get length in utf8 characters
+		size_t size = as_utf8_begin(str, length);
+
+		// allocate resulting string
+		std::string result;
+		result.resize(size);
+
+		// second pass: convert to utf8
+		if (size > 0) as_utf8_end(&result[0], size, str, length);
+
+		return result;
+	}
+
+	PUGI__FN std::basic_string<wchar_t> as_wide_impl(const char* str, size_t size)
+	{
+		const uint8_t* data = reinterpret_cast<const uint8_t*>(str);
+
+		// first pass: get length in wchar_t units
+		size_t length = utf_decoder<wchar_counter>::decode_utf8_block(data, size, 0);
+
+		// allocate resulting string
+		std::basic_string<wchar_t> result;
+		result.resize(length);
+
+		// second pass: convert to wchar_t
+		if (length > 0)
+		{
+			wchar_writer::value_type begin = reinterpret_cast<wchar_writer::value_type>(&result[0]);
+			wchar_writer::value_type end = utf_decoder<wchar_writer>::decode_utf8_block(data, size, begin);
+
+			assert(begin + length == end);
+			(void)!end;
+		}
+
+		return result;
+	}
+#endif
+
+	// Direct-mapped cache of numeric conversion results keyed by the value string; colliding entries replace each other
+	struct xml_value_cache_entry
+	{
+		const char_t* value;
+		int type;
+		bool success;
+
+		union
+		{
+			double number;
+			uint64_t integer;
+		} result;
+	};
+
+	struct xml_value_cache
+	{
+		xml_value_cache_entry* entries;
+		size_t capacity;
+		size_t count;
+
+		xml_memory_resource* resource;
+	};
+
+	PUGI__FN xml_value_cache* create_value_cache(xml_memory_resource* resource)
+	{
+		void* memory = resource_allocate(sizeof(xml_value_cache), resource);
+		if (!memory) return 0;
+
+		xml_value_cache* result = static_cast<xml_value_cache*>(memory);
+
+		result->entries = 0;
+		result->capacity = 0;
+		result->count = 0;
+		result->resource = resource;
+
+		return result;
+	}
+
+	PUGI__FN void destroy_value_cache(xml_value_cache* cache)
+	{
+		if (cache->entries) resource_deallocate(cache->entries, cache->resource);
+
+		resource_deallocate(cache, cache->resource);
+	}
+
+	PUGI__FN void clear_value_cache(xml_value_cache& cache)
+	{
+		if (cache.entries) memset(cache.entries, 0, cache.capacity * sizeof(xml_value_cache_entry));
+
+		cache.count = 0;
+	}
+
+	inline xml_value_cache_entry& get_value_cache_entry(const xml_value_cache& cache, const char_t* value)
+	{
+		assert(cache.capacity);
+
+		// strings are at least pointer-aligned, so low bits carry no information
+		uintptr_t key = reinterpret_cast<uintptr_t>(value) / sizeof(void*);
+
+		return cache.entries[static_cast<size_t>(key * 2654435761u) & (cache.capacity - 1)];
+	}
+
+	PUGI__FN void invalidate_cached_value(const xml_value_cache& cache, const char_t* value)
+	{
+		if (!cache.capacity || !value) return;
+
+		xml_value_cache_entry& entry = get_value_cache_entry(cache, value);
+
+		if (entry.value == value) entry.value = 0;
+	}
+
+	PUGI__FN bool grow_value_cache(xml_value_cache& cache)
+	{
+		size_t capacity = cache.capacity ? cache.capacity * 2 : 256;
+
+		xml_value_cache_entry* entries = static_cast<xml_value_cache_entry*>(resource_allocate(capacity * sizeof(xml_value_cache_entry), cache.resource));
+		if (!entries) return false;
+
+		memset(entries, 0, capacity * sizeof(xml_value_cache_entry));
+
+		xml_value_cache result = {entries, capacity, 0, cache.resource};
+
+		for (size_t i = 0; i < cache.capacity; ++i)
+			if (cache.entries[i].value)
+			{
+				xml_value_cache_entry& entry = get_value_cache_entry(result, cache.entries[i].value);
+
+				result.count += !entry.value;
+				entry = cache.entries[i];
+			}
+
+		if (cache.entries) resource_deallocate(cache.entries, cache.resource);
+
+		cache = result;
+
+		return true;
+	}
+
+	PUGI__FN xml_value_cache_entry* find_cached_value(const xml_value_cache& cache, const char_t* value, int type)
+	{
+		if (!cache.capacity) return 0;
+
+		xml_value_cache_entry& entry = get_value_cache_entry(cache, value);
+
+		return (entry.value == value && entry.type == type) ? &entry : 0;
+	}
+
+	PUGI__FN xml_value_cache_entry* add_cached_value(xml_value_cache& cache, const char_t* value)
+	{
+		// keep load factor under 1/2; if the cache can't grow, the value is just not cached
+		if ((cache.count + 1) * 2 > cache.capacity && !grow_value_cache(cache) && !cache.capacity) return 0;
+
+		xml_value_cache_entry& entry = get_value_cache_entry(cache, value);
+
+		cache.count += !entry.value;
+		entry.value = value;
+
+		return &entry;
+	}
+
+	// Invalidates the cached conversion of the value that is about to change
+	inline void invalidate_cached_value(const xml_header& header, const char_t* value)
+	{
+		xml_value_cache* cache = static_cast<xml_document_struct*>(get_page(header)->allocator)->values;
+
+		if (cache) invalidate_cached_value(*cache, value);
+	}
+
+	inline bool strcpy_insitu_allow(size_t length, const xml_header& header, uintptr_t header_mask, char_t* target)
+	{
+		// never reuse shared memory
+		if (header & xml_memory_page_contents_shared_mask) return false;
+
+		size_t target_length = strlength(target);
+
+		// always reuse document buffer memory if possible
+		if ((header & header_mask) == 0) return target_length >= length;
+
+		// reuse heap memory if waste is not too great
+		const size_t reuse_threshold = 32;
+
+		return target_length >= length && (target_length < reuse_threshold || target_length - length < target_length / 2);
+	}
+
+	template <typename String> PUGI__FN bool strcpy_insitu(String& dest, xml_header& header, uintptr_t header_mask, const char_t* source)
+	{
+		assert(header);
+
+		if (header_mask == xml_memory_page_value_allocated_mask)
+		{
+			// new value does not need decoding
+			header &= ~xml_memory_page_value_lazy_mask;
+
+			invalidate_cached_value(header, dest);
+		}
+
+		size_t source_length = strlength(source);
+
+		if (source_length == 0)
+		{
+			// empty string and null pointer are equivalent, so just deallocate old memory
+			xml_allocator* alloc = get_page(header)->allocator;
+
+			if (header & header_mask) alloc->deallocate_string(dest);
+			
+			// mark the string as not allocated
+			dest = 0;
+			header &= ~header_mask;
+
+			return true;
+		}
+		else if (dest && strcpy_insitu_allow(source_length, header, header_mask, dest))
+		{
+			// we can reuse old buffer, so just copy the new data (including zero terminator)
+			memcpy(dest, source, (source_length + 1) * sizeof(char_t));
+			
+			return true;
+		}
+		else
+		{
+			xml_allocator* alloc = get_page(header)->allocator;
+
+			if (!alloc->reserve()) return false;
+
+			// allocate new buffer
+			char_t* buf = alloc->allocate_string(source_length + 1);
+			if (!buf) return false;
+
+			// the memory may have held another value that was converted before
+			if (header_mask == xml_memory_page_value_allocated_mask) invalidate_cached_value(header, buf);
+
+			// copy the string (including zero terminator)
+			memcpy(buf, source, (source_length + 1) * sizeof(char_t));
+
+			// deallocate old buffer (*after* the above to protect against overlapping memory and/or allocation failures)
+			if (header & header_mask) alloc->deallocate_string(dest);
+			
+			// the string is now allocated, so set the flag
+			dest = buf;
+			header |= header_mask;
+
+			return true;
+		}
+	}
+
+	// Open addressing hash set of names; the names point to the document buffer or to the document allocator memory
+	struct xml_name_table
+	{
+		char_t** slots;
+		size_t capacity;
+		size_t count;
+
+		xml_memory_resource* resource;
+	};
+
+	PUGI__FN unsigned int hash_name(const char_t* name, size_t length)
+	{
+		// Jenkins one-at-a-time hash (http://en.wikipedia.org/wiki/Jenkins_hash_function#one-at-a-time)
+		unsigned int result = 0;
+
+		for (size_t i = 0; i < length; ++i)
+		{
+			result += static_cast<unsigned int>(name[i]);
+			result += result << 10;
+			result ^= result >> 6;
+		}
+
+		result += result << 3;
+		result ^= result >> 11;
+		result += result << 15;
+
+		return result;
+	}
+
+	PUGI__FN xml_name_table* create_name_table(xml_memory_resource* resource)
+	{
+		void* memory = resource_allocate(sizeof(xml_name_table), resource);
+		if (!memory) return 0;
+
+		xml_name_table* result = static_cast<xml_name_table*>(memory);
+
+		result->slots = 0;
+		result->capacity = 0;
+		result->count = 0;
+		result->resource = resource;
+
+		return result;
+	}
+
+	PUGI__FN void destroy_name_table(xml_name_table* table)
+	{
+		if (table->slots) resource_deallocate(table->slots, table->resource);
+
+		resource_deallocate(table, table->resource);
+	}
+
+	PUGI__FN char_t** find_name_slot(const xml_name_table& table, const char_t* name, size_t length)
+	{
+		assert(table.capacity > table.count);
+
+		size_t mask = table.capacity - 1;
+		size_t bucket = hash_name(name, length) & mask;
+
+		// linear probing
+		while (table.slots[bucket] && !strequalrange(table.slots[bucket], name, length))
+			bucket = (bucket + 1) & mask;
+
+		return &table.slots[bucket];
+	}
+
+	PUGI__FN bool grow_name_table(xml_name_table& table)
+	{
+		size_t capacity = table.capacity ? table.capacity * 2 : 64;
+
+		char_t** slots = static_cast<char_t**>(resource_allocate(capacity * sizeof(char_t*), table.resource));
+		if (!slots) return false;
+
+		memset(slots, 0, capacity * sizeof(char_t*));
+
+		xml_name_table result = {slots, capacity, table.count, table.resource};
+
+		for (size_t i = 0; i < table.capacity; ++i)
+			if (table.slots[i])
+				*find_name_slot(result, table.slots[i], strlength(table.slots[i])) = table.slots[i];
+
+		if (table.slots) resource_deallocate(table.slots, table.resource);
+
+		table = result;
+
+		return true;
+	}
+
+	// Returns the table copy of the name; the name is added to the table as is, or copied to the allocator memory if alloc is not null
+	PUGI__FN char_t* intern_name(xml_name_table& table, char_t* name, size_t length, xml_allocator* alloc)
+	{
+		if (table.capacity)
+		{
+			char_t* result = *find_name_slot(table, name, length);
+			if (result) return result;
+		}
+
+		// keep load factor under 1/2
+		if ((table.count + 1) * 2 > table.capacity && !grow_name_table(table)) return 0;
+
+		char_t* result = name;
+
+		if (alloc)
+		{
+			result = alloc->allocate_string(length + 1);
+			if (!result) return 0;
+
+			memcpy(result, name, length * sizeof(char_t));
+			result[length] = 0;
+		}
+
+		*find_name_slot(table, name, length) = result;
+		table.count++;
+
+		return result;
+	}
+
+	// Returns the table copy of the name or null if no node has this name
+	PUGI__FN const char_t* find_name(const xml_name_table& table, const char_t* name)
+	{
+		return table.capacity ? *find_name_slot(table, name, strlength(name)) : 0;
+	}
+
+	// Name to search for; names found in the document name table are compared by pointer
+	struct xml_name_key
+	{
+		const char_t* name;
+		bool interned;
+
+		bool match(const char_t* rhs) const
+		{
+			return interned ? name == rhs : rhs && strequal(name, rhs);
+		}
+	};
+
+	PUGI__FN xml_name_key get_name_key(const xml_node_struct* node, const char_t* name)
+	{
+		xml_name_table* names = get_document(node).names;
+		const char_t* interned = names ? find_name(*names, name) : 0;
+
+		// names that are not in the table can still appear in the subtrees that are not parsed yet
+		xml_name_key result = {interned ? interned : name, interned != 0};
+
+		return result;
+	}
+
+	// Names of the documents with the name table are never modified in place since they are shared between nodes
+	template <typename Object> PUGI__FN bool set_name(Object* object, const char_t* source)
+	{
+		xml_document_struct& doc = get_document(object);
+		xml_name_table* names = doc.names;
+
+		if (!names) return strcpy_insitu(object->name, object->header, xml_memory_page_name_allocated_mask, source);
+
+		assert((object->header & xml_memory_page_name_allocated_mask) == 0);
+
+		if (!doc.reserve()) return false;
+
+		size_t length = strlength(source);
+		char_t* name = length ? intern_name(*names, const_cast<char_t*>(source), length, &doc) : 0;
+		if (length && !name) return false;
+
+		object->name = name;
+
+		return true;
+	}
+
+	struct gap
+	{
+		char_t* end;
+		size_t size;
+			
+		gap(): end(0), size(0)
+		{
+		}
+			
+		// Push new gap, move s count bytes further (skipping the gap).
+		// Collapse previous gap.
+		void push(char_t*& s, size_t count)
+		{
+			if (end) // there was a gap already; collapse it
+			{
+				// Move [old_gap_end, new_gap_start) to [old_gap_start, ...)
+				assert(s >= end);
+				memmove(end - size, end, reinterpret_cast<char*>(s) - reinterpret_cast<char*>(end));
+			}
+				
+			s += count; // end of current gap
+				
+			// "merge" two gaps
+			end = s;
+			size += count;
+		}
+			
+		// Collapse all gaps, return past-the-end pointer
+		char_t* flush(char_t* s)
+		{
+			if (end)
+			{
+				// Move [old_gap_end, current_pos) to [old_gap_start, ...)
+				assert(s >= end);
+				memmove(end - size, end, reinterpret_cast<char*>(s) - reinterpret_cast<char*>(end));
 
 				return s - size;
 			}
-			else return s;
+			else return s;
+		}
+	};
+	
+	PUGI__FN char_t* strconv_escape(char_t* s, gap& g)
+	{
+		char_t* stre = s + 1;
+
+		switch (*stre)
+		{
+			case '#':	// &#...
+			{
+				unsigned int ucsc = 0;
+
+				if (stre[1] == 'x') // &#x... (hex code)
+				{
+					stre += 2;
+
+					char_t ch = *stre;
+
+					if (ch == ';') return stre;
+
+					for (;;)
+					{
+						if (static_cast<unsigned int>(ch - '0') <= 9)
+							ucsc = 16 * ucsc + (ch - '0');
+						else if (static_cast<unsigned int>((ch | ' ') - 'a') <= 5)
+							ucsc = 16 * ucsc + ((ch | ' ') - 'a' + 10);
+						else if (ch == ';')
+							break;
+						else // cancel
+							return stre;
+
+						ch = *++stre;
+					}
+					
+					++stre;
+				}
+				else	// &#... (dec code)
+				{
+					char_t ch = *++stre;
+
+					if (ch == ';') return stre;
+
+					for (;;)
+					{
+						if (static_cast<unsigned int>(static_cast<unsigned int>(ch) - '0') <= 9)
+							ucsc = 10 * ucsc + (ch - '0');
+						else if (ch == ';')
+							break;
+						else // cancel
+							return stre;
+
+						ch = *++stre;
+					}
+					
+					++stre;
+				}
+
+			#ifdef PUGIXML_WCHAR_MODE
+				s = reinterpret_cast<char_t*>(wchar_writer::any(reinterpret_cast<wchar_writer::value_type>(s), ucsc));
+			#else
+				s = reinterpret_cast<char_t*>(utf8_writer::any(reinterpret_cast<uint8_t*>(s), ucsc));
+			#endif
+					
+				g.push(s, stre - s);
+				return stre;
+			}
+
+			case 'a':	// &a
+			{
+				++stre;
+
+				if (*stre == 'm') // &am
+				{
+					if (*++stre == 'p' && *++stre == ';') // &amp;
+					{
+						*s++ = '&';
+						++stre;
+							
+						g.push(s, stre - s);
+						return stre;
+					}
+				}
+				else if (*stre == 'p') // &ap
+				{
+					if (*++stre == 'o' && *++stre == 's' && *++stre == ';') // &apos;
+					{
+						*s++ = '\'';
+						++stre;
+
+						g.push(s, stre - s);
+						return stre;
+					}
+				}
+				break;
+			}
+
+			case 'g': // &g
+			{
+				if (*++stre == 't' && *++stre == ';') // &gt;
+				{
+					*s++ = '>';
+					++stre;
+					
+					g.push(s, stre - s);
+					return stre;
+				}
+				break;
+			}
+
+			case 'l': // &l
+			{
+				if (*++stre == 't' && *++stre == ';') // &lt;
+				{
+					*s++ = '<';
+					++stre;
+						
+					g.push(s, stre - s);
+					return stre;
+				}
+				break;
+			}
+
+			case 'q': // &q
+			{
+				if (*++stre == 'u' && *++stre == 'o' && *++stre == 't' && *++stre == ';') // &quot;
+				{
+					*s++ = '"';
+					++stre;
+					
+					g.push(s, stre - s);
+					return stre;
+				}
+				break;
+			}
+
+			default:
+				break;
+		}
+		
+		return stre;
+	}
+
+	// Parser utilities
+	#define PUGI__ENDSWITH(c, e)        ((c) == (e) || ((c) == 0 && endch == (e)))
+	#define PUGI__SKIPWS()              { while (PUGI__IS_CHARTYPE(*s, ct_space)) ++s; }
+	#define PUGI__OPTSET(OPT)           ( optmsk & (OPT) )
+	#define PUGI__PUSHNODE(TYPE)        { cursor = append_new_node(cursor, alloc, TYPE); if (!cursor) PUGI__THROW_ERROR(status_out_of_memory, s); }
+	#define PUGI__POPNODE()             { cursor = cursor->parent; }
+	#define PUGI__SCANFOR(X)            { while (*s != 0 && !(X)) ++s; }
+	#define PUGI__SCANWHILE(X)          { while (X) ++s; }
+	#define PUGI__SCANWHILE_UNROLL(X)   { for (;;) { char_t ss = s[0]; if (PUGI__UNLIKELY(!(X))) { break; } ss = s[1]; if (PUGI__UNLIKELY(!(X))) { s += 1; break; } ss = s[2]; if (PUGI__UNLIKELY(!(X))) { s += 2; break; } ss = s[3]; if (PUGI__UNLIKELY(!(X))) { s += 3; break; } s += 4; } }
+#if defined(PUGI__SIMD_SSE2) && !defined(PUGIXML_WCHAR_MODE)
+	#define PUGI__SCANCHARTYPE(CT)      { s = simd_scan_chartype<CT>(s); }
+#else
+	#define PUGI__SCANCHARTYPE(CT)      PUGI__SCANWHILE_UNROLL(!PUGI__IS_CHARTYPE(ss, CT))
+#endif
+	#define PUGI__ENDSEG()              { ch = *s; *s = 0; ++s; }
+	#define PUGI__THROW_ERROR(err, m)   return error_offset = m, error_status = err, static_cast<char_t*>(0)
+	#define PUGI__CHECK_ERROR(err, m)   { if (*s == 0) PUGI__THROW_ERROR(err, m); }
+
+	PUGI__FN char_t* strconv_comment(char_t* s, char_t endch)
+	{
+		gap g;
+		
+		while (true)
+		{
+			PUGI__SCANWHILE_UNROLL(!PUGI__IS_CHARTYPE(ss, ct_parse_comment));
+		
+			if (*s == '\r') // Either a single 0x0d or 0x0d 0x0a pair
+			{
+				*s++ = '\n'; // replace first one with 0x0a
+				
+				if (*s == '\n') g.push(s, 1);
+			}
+			else if (s[0] == '-' && s[1] == '-' && PUGI__ENDSWITH(s[2], '>')) // comment ends here
+			{
+				*g.flush(s) = 0;
+				
+				return s + (s[2] == '>' ? 3 : 2);
+			}
+			else if (*s == 0)
+			{
+				return 0;
+			}
+			else ++s;
+		}
+	}
+
+	PUGI__FN char_t* strconv_cdata(char_t* s, char_t endch)
+	{
+		gap g;
+			
+		while (true)
+		{
+			PUGI__SCANWHILE_UNROLL(!PUGI__IS_CHARTYPE(ss, ct_parse_cdata));
+			
+			if (*s == '\r') // Either a single 0x0d or 0x0d 0x0a pair
+			{
+				*s++ = '\n'; // replace first one with 0x0a
+				
+				if (*s == '\n') g.push(s, 1);
+			}
+			else if (s[0] == ']' && s[1] == ']' && PUGI__ENDSWITH(s[2], '>')) // CDATA ends here
+			{
+				*g.flush(s) = 0;
+				
+				return s + 1;
+			}
+			else if (*s == 0)
+			{
+				return 0;
+			}
+			else ++s;
+		}
+	}
+	
+	typedef char_t* (*strconv_pcdata_t)(char_t*);
+		
+	template <typename opt_trim, typename opt_eol, typename opt_escape> struct strconv_pcdata_impl
+	{
+		static char_t* parse(char_t* s)
+		{
+			gap g;
+
+			char_t* begin = s;
+
+			while (true)
+			{
+				PUGI__SCANCHARTYPE(ct_parse_pcdata);
+
+				if (*s == '<') // PCDATA ends here
+				{
+					char_t* end = g.flush(s);
+
+					if (opt_trim::value)
+						while (end > begin && PUGI__IS_CHARTYPE(end[-1], ct_space))
+							--end;
+
+					*end = 0;
+					
+					return s + 1;
+				}
+				else if (opt_eol::value && *s == '\r') // Either a single 0x0d or 0x0d 0x0a pair
+				{
+					*s++ = '\n'; // replace first one with 0x0a
+					
+					if (*s == '\n') g.push(s, 1);
+				}
+				else if (opt_escape::value && *s == '&')
+				{
+					s = strconv_escape(s, g);
+				}
+				else if (*s == 0)
+				{
+					char_t* end = g.flush(s);
+
+					if (opt_trim::value)
+						while (end > begin && PUGI__IS_CHARTYPE(end[-1], ct_space))
+							--end;
+
+					*end = 0;
+
+					return s;
+				}
+				else ++s;
+			}
+		}
+	};
+	
+	PUGI__FN strconv_pcdata_t get_strconv_pcdata(unsigned int optmask)
+	{
+		PUGI__STATIC_ASSERT(parse_escapes == 0x10 && parse_eol == 0x20 && parse_trim_pcdata == 0x0800);
+
+		switch (((optmask >> 4) & 3) | ((optmask >> 9) & 4)) // get bitmask for flags (eol escapes trim)
+		{
+		case 0: return strconv_pcdata_impl<opt_false, opt_false, opt_false>::parse;
+		case 1: return strconv_pcdata_impl<opt_false, opt_false, opt_true>::parse;
+		case 2: return strconv_pcdata_impl<opt_false, opt_true, opt_false>::parse;
+		case 3: return strconv_pcdata_impl<opt_false, opt_true, opt_true>::parse;
+		case 4: return strconv_pcdata_impl<opt_true, opt_false, opt_false>::parse;
+		case 5: return strconv_pcdata_impl<opt_true, opt_false, opt_true>::parse;
+		case 6: return strconv_pcdata_impl<opt_true, opt_true, opt_false>::parse;
+		case 7: return strconv_pcdata_impl<opt_true, opt_true, opt_true>::parse;
+		default: assert(false); return 0; // should not get here
+		}
+	}
+
+	typedef char_t* (*strconv_attribute_t)(char_t*, char_t);
+	
+	template <typename opt_escape> struct strconv_attribute_impl
+	{
+		static char_t* parse_wnorm(char_t* s, char_t end_quote)
+		{
+			gap g;
+
+			// trim leading whitespaces
+			if (PUGI__IS_CHARTYPE(*s, ct_space))
+			{
+				char_t* str = s;
+				
+				do ++str;
+				while (PUGI__IS_CHARTYPE(*str, ct_space));
+				
+				g.push(s, str - s);
+			}
+
+			while (true)
+			{
+				PUGI__SCANCHARTYPE(ct_parse_attr_ws | ct_space);
+				
+				if (*s == end_quote)
+				{
+					char_t* str = g.flush(s);
+					
+					do *str-- = 0;
+					while (PUGI__IS_CHARTYPE(*str, ct_space));
+				
+					return s + 1;
+				}
+				else if (PUGI__IS_CHARTYPE(*s, ct_space))
+				{
+					*s++ = ' ';
+		
+					if (PUGI__IS_CHARTYPE(*s, ct_space))
+					{
+						char_t* str = s + 1;
+						while (PUGI__IS_CHARTYPE(*str, ct_space)) ++str;
+						
+						g.push(s, str - s);
+					}
+				}
+				else if (opt_escape::value && *s == '&')
+				{
+					s = strconv_escape(s, g);
+				}
+				else if (!*s)
+				{
+					return 0;
+				}
+				else ++s;
+			}
+		}
+
+		static char_t* parse_wconv(char_t* s, char_t end_quote)
+		{
+			gap g;
+
+			while (true)
+			{
+				PUGI__SCANCHARTYPE(ct_parse_attr_ws);
+				
+				if (*s == end_quote)
+				{
+					*g.flush(s) = 0;
+				
+					return s + 1;
+				}
+				else if (PUGI__IS_CHARTYPE(*s, ct_space))
+				{
+					if (*s == '\r')
+					{
+						*s++ = ' ';
+				
+						if (*s == '\n') g.push(s, 1);
+					}
+					else *s++ = ' ';
+				}
+				else if (opt_escape::value && *s == '&')
+				{
+					s = strconv_escape(s, g);
+				}
+				else if (!*s)
+				{
+					return 0;
+				}
+				else ++s;
+			}
+		}
+
+		static char_t* parse_eol(char_t* s, char_t end_quote)
+		{
+			gap g;
+
+			while (true)
+			{
+				PUGI__SCANCHARTYPE(ct_parse_attr);
+				
+				if (*s == end_quote)
+				{
+					*g.flush(s) = 0;
+				
+					return s + 1;
+				}
+				else if (*s == '\r')
+				{
+					*s++ = '\n';
+					
+					if (*s == '\n') g.push(s, 1);
+				}
+				else if (opt_escape::value && *s == '&')
+				{
+					s = strconv_escape(s, g);
+				}
+				else if (!*s)
+				{
+					return 0;
+				}
+				else ++s;
+			}
+		}
+
+		static char_t* parse_simple(char_t* s, char_t end_quote)
+		{
+			gap g;
+
+			while (true)
+			{
+				PUGI__SCANCHARTYPE(ct_parse_attr);
+				
+				if (*s == end_quote)
+				{
+					*g.flush(s) = 0;
+				
+					return s + 1;
+				}
+				else if (opt_escape::value && *s == '&')
+				{
+					s = strconv_escape(s, g);
+				}
+				else if (!*s)
+				{
+					return 0;
+				}
+				else ++s;
+			}
+		}
+	};
+
+	PUGI__FN strconv_attribute_t get_strconv_attribute(unsigned int optmask)
+	{
+		PUGI__STATIC_ASSERT(parse_escapes == 0x10 && parse_eol == 0x20 && parse_wconv_attribute == 0x40 && parse_wnorm_attribute == 0x80);
+		
+		switch ((optmask >> 4) & 15) // get bitmask for flags (wconv wnorm eol escapes)
+		{
+		case 0:  return strconv_attribute_impl<opt_false>::parse_simple;
+		case 1:  return strconv_attribute_impl<opt_true>::parse_simple;
+		case 2:  return strconv_attribute_impl<opt_false>::parse_eol;
+		case 3:  return strconv_attribute_impl<opt_true>::parse_eol;
+		case 4:  return strconv_attribute_impl<opt_false>::parse_wconv;
+		case 5:  return strconv_attribute_impl<opt_true>::parse_wconv;
+		case 6:  return strconv_attribute_impl<opt_false>::parse_wconv;
+		case 7:  return strconv_attribute_impl<opt_true>::parse_wconv;
+		case 8:  return strconv_attribute_impl<opt_false>::parse_wnorm;
+		case 9:  return strconv_attribute_impl<opt_true>::parse_wnorm;
+		case 10: return strconv_attribute_impl<opt_false>::parse_wnorm;
+		case 11: return strconv_attribute_impl<opt_true>::parse_wnorm;
+		case 12: return strconv_attribute_impl<opt_false>::parse_wnorm;
+		case 13: return strconv_attribute_impl<opt_true>::parse_wnorm;
+		case 14: return strconv_attribute_impl<opt_false>::parse_wnorm;
+		case 15: return strconv_attribute_impl<opt_true>::parse_wnorm;
+		default: assert(false); return 0; // should not get here
+		}
+	}
+
+	// Lazy decoding: values are only scanned during parsing, the ones that need conversion are marked and converted on first access
+	PUGI__FN char_t* strconv_pcdata_lazy(char_t* s, xml_header& header, unsigned int optmsk)
+	{
+		char_t* begin = s;
+		bool decode = false;
+
+		while (true)
+		{
+			PUGI__SCANCHARTYPE(ct_parse_pcdata);
+
+			if (*s == '<' || *s == 0) break;
+
+			decode |= (*s == '&') ? PUGI__OPTSET(parse_escapes) != 0 : PUGI__OPTSET(parse_eol) != 0;
+			++s;
+		}
+
+		char_t* end = s;
+		bool tag = (*s == '<');
+
+		// trailing whitespace of a marked value is trimmed after conversion
+		if (decode)
+			header |= xml_memory_page_value_lazy_mask;
+		else if (PUGI__OPTSET(parse_trim_pcdata))
+			while (end > begin && PUGI__IS_CHARTYPE(end[-1], ct_space))
+				--end;
+
+		*end = 0;
+
+		return tag ? s + 1 : s;
+	}
+
+	template <int ct> PUGI__FN char_t* strconv_attribute_lazy(char_t* s, char_t end_quote, xml_header& header, unsigned int optmsk)
+	{
+		bool decode = false;
+
+		while (true)
+		{
+			PUGI__SCANCHARTYPE(ct);
+
+			if (*s == end_quote)
+			{
+				if (decode) header |= xml_memory_page_value_lazy_mask;
+
+				*s = 0;
+
+				return s + 1;
+			}
+			else if (*s == '&')
+				decode |= PUGI__OPTSET(parse_escapes) != 0;
+			else if (*s == '\r')
+				decode |= PUGI__OPTSET(parse_eol | parse_wconv_attribute | parse_wnorm_attribute) != 0;
+			else if (!*s)
+				return 0;
+			else if (*s != '"' && *s != '\'') // other whitespace is only in the set with whitespace conversion
+				decode = true;
+
+			++s;
+		}
+	}
+
+	typedef char_t* (*strconv_attribute_lazy_t)(char_t*, char_t, xml_header&, unsigned int);
+
+	PUGI__FN strconv_attribute_lazy_t get_strconv_attribute_lazy(unsigned int optmsk)
+	{
+		if (PUGI__OPTSET(parse_wnorm_attribute)) return strconv_attribute_lazy<ct_parse_attr_ws | ct_space>;
+		if (PUGI__OPTSET(parse_wconv_attribute)) return strconv_attribute_lazy<ct_parse_attr_ws>;
+
+		return strconv_attribute_lazy<ct_parse_attr>;
+	}
+
+	PUGI__FN_NO_INLINE void decode_lazy_value(xml_node_struct* node)
+	{
+		// element value holds the contents that were skipped with parse_lazy_subtrees
+		if (PUGI__NODETYPE(node) == node_element) return parse_lazy_subtree(node);
+
+		get_strconv_pcdata(get_document(node).lazy_options)(node->value);
+
+		node->header &= ~xml_memory_page_value_lazy_mask;
+	}
+
+	PUGI__FN_NO_INLINE void decode_lazy_value(xml_attribute_struct* attr)
+	{
+		// the value is zero-terminated, so zero works as the end quote
+		get_strconv_attribute(get_document(attr).lazy_options)(attr->value, 0);
+
+		attr->header &= ~xml_memory_page_value_lazy_mask;
+	}
+
+	// All lazy values and subtrees of the document are parsed with the same options; parsing falls back to immediate conversion if the options differ
+	PUGI__FN unsigned int get_lazy_parse_options(xml_document_struct& doc, unsigned int optmsk)
+	{
+		const unsigned int lazy_options = parse_lazy_decode | parse_lazy_subtrees;
+		const unsigned int ignored_options = parse_fragment | parse_parallel;
+
+		// the filter has to see the elements in document order before their contents are parsed
+		if (doc.filter) optmsk &= ~(parse_parallel | parse_lazy_subtrees);
+
+		if (!PUGI__OPTSET(lazy_options)) return optmsk;
+
+		if (doc.lazy_options && (doc.lazy_options | ignored_options) != (optmsk | ignored_options))
+			return optmsk & ~lazy_options;
+
+		doc.lazy_options = optmsk;
+
+		// subtree boundaries are only found by the serial parser
+		return PUGI__OPTSET(parse_lazy_subtrees) ? optmsk & ~parse_parallel : optmsk;
+	}
+
+	// Names are interned if parsing with parse_intern_names starts in an empty document
+	PUGI__FN bool init_name_table(xml_document_struct& doc, xml_node_struct* root, unsigned int optmsk)
+	{
+		if (PUGI__OPTSET(parse_intern_names) && !doc.names && root == &doc && !doc.first_child)
+		{
+			doc.names = create_name_table(doc._resource);
+			if (!doc.names) return false;
+		}
+
+		return true;
+	}
+
+	// Checks if the element is at the depth of lazily parsed subtrees (document element has depth 0)
+	PUGI__FN bool is_lazy_subtree_depth(xml_node_struct* node, unsigned int optmsk)
+	{
+		for (unsigned int depth = optmsk >> 24; depth > 0; --depth)
+		{
+			node = node->parent;
+			if (!node) return false;
+		}
+
+		return node->parent && !node->parent->parent;
+	}
+
+	// Returns the value of the node/attribute, converting it first if parsing was lazy
+	template <typename Object> inline char_t* get_value(Object* object)
+	{
+		if (object->header & xml_memory_page_value_lazy_mask) decode_lazy_value(object);
+
+		return object->value;
+	}
+
+	// returns the text stored in the element value with parse_embed_pcdata, or null if there is none
+	inline const char_t* get_embedded_pcdata(xml_node_struct* node)
+	{
+		return PUGI__NODETYPE(node) == node_element && node->value ? get_value(node) : 0;
+	}
+
+	inline xml_parse_result make_parse_result(xml_parse_status status, ptrdiff_t offset = 0)
+	{
+		xml_parse_result result;
+		result.status = status;
+		result.offset = offset;
+
+		return result;
+	}
+
+#ifdef PUGIXML_HAS_THREADS
+	static const size_t xml_parallel_min_chunk_size = 64 * 1024;
+	static const size_t xml_parallel_max_chunks = 64;
+
+	// Find start tags of document element children to split the buffer at, so that every chunk has roughly the same size; tail is
+	// set to the end tag of the document element. Returns 0 if the document can't be split (only constructs that can be skipped
+	// without parsing are recognized, so DOCTYPE and malformed input are left to the serial parser)
+	PUGI__FN size_t find_parallel_split_points(char_t* s, size_t length, char_t** splits, char_t*& tail)
+	{
+		size_t chunk_count = get_hardware_concurrency();
+
+		if (chunk_count < 2) chunk_count = 2;
+		if (chunk_count > xml_parallel_max_chunks) chunk_count = xml_parallel_max_chunks;
+		if (chunk_count > length / xml_parallel_min_chunk_size) chunk_count = length / xml_parallel_min_chunk_size;
+
+		if (chunk_count < 2) return 0;
+
+		const char_t* begin = s;
+		size_t chunk_size = length / chunk_count;
+		size_t count = 0;
+		size_t depth = 0;
+
+		for (;;)
+		{
+			PUGI__SCANFOR(*s == '<');
+			if (!*s) return 0;
+
+			if (s[1] == '/')
+			{
+				if (depth == 0) return 0;
+
+				// the document element is closed and its children were split
+				if (--depth == 0 && count)
+				{
+					tail = s;
+					return count;
+				}
+
+				PUGI__SCANFOR(*s == '>');
+			}
+			else if (s[1] == '?')
+			{
+				s += 2;
+				PUGI__SCANFOR(s[0] == '?' && s[1] == '>');
+			}
+			else if (s[1] == '!' && s[2] == '-' && s[3] == '-')
+			{
+				s += 4;
+				PUGI__SCANFOR(s[0] == '-' && s[1] == '-' && s[2] == '>');
+			}
+			else if (s[1] == '!' && s[2] == '[' && s[3] == 'C' && s[4] == 'D' && s[5] == 'A' && s[6] == 'T' && s[7] == 'A' && s[8] == '[')
+			{
+				s += 9;
+				PUGI__SCANFOR(s[0] == ']' && s[1] == ']' && s[2] == '>');
+			}
+			else if (PUGI__IS_CHARTYPE(s[1], ct_start_symbol))
+			{
+				if (depth == 1 && count + 1 < chunk_count && static_cast<size_t>(s - begin) >= (count + 1) * chunk_size)
+					splits[count++] = s;
+
+				// skip the tag; quoted attribute values can contain '>'
+				for (++s; *s && *s != '>'; ++s)
+				{
+					if (*s == '"' || *s == '\'')
+					{
+						char_t ch = *s++;
+
+						PUGI__SCANFOR(*s == ch);
+						if (!*s) return 0;
+					}
+				}
+
+				if (*s && s[-1] != '/') depth++;
+			}
+			else return 0;
+
+			if (!*s) return 0;
+
+			++s;
+		}
+	}
+#endif
+
+	PUGI__FN char_t* find_element_end(char_t* s, const xml_allocator& alloc);
+
+	struct xml_parser
+	{
+		xml_allocator alloc;
+		xml_name_table* names;
+		char_t* error_offset;
+		xml_parse_status error_status;
+
+		// filter for parsed elements and the element whose contents it skips
+		xml_parse_filter* filter;
+		xml_node_struct* skip;
+		
+		xml_parser(const xml_allocator& alloc_, xml_name_table* names_ = 0): alloc(alloc_), names(names_), error_offset(0), error_status(status_ok), filter(0), skip(0)
+		{
+		}
+
+		// Frees the element that was closed in a skipped subtree; its children were freed when they were closed, so the element and its
+		// attributes are usually the last allocations, and the memory is reused for the rest of the subtree
+		void discard_element(xml_node_struct* node)
+		{
+			assert(!node->first_child);
+
+			// the element that is skipped with its contents is detached from the tree when its start tag is parsed
+			if (node->prev_sibling_c) remove_node(node);
+
+			xml_attribute_struct* first = node->first_attribute;
+
+			for (xml_attribute_struct* attr = first ? static_cast<xml_attribute_struct*>(first->prev_attribute_c) : 0; attr; )
+			{
+				xml_attribute_struct* prev = (attr == first) ? 0 : static_cast<xml_attribute_struct*>(attr->prev_attribute_c);
+
+				if (!alloc.deallocate_last(attr, sizeof(xml_attribute_struct), xml_memory_kind_attribute)) destroy_attribute(attr, alloc);
+
+				attr = prev;
+			}
+
+			node->first_attribute = 0;
+
+			if (!alloc.deallocate_last(node, get_node_size(PUGI__NODETYPE(node)), xml_memory_kind_node)) destroy_node(node, alloc);
+		}
+
+		// Calls the filter for the element whose start tag was just parsed; cursor is the element itself unless it was closed with '/>'
+		void filter_element(xml_node_struct* element, xml_node_struct* cursor)
+		{
+			bool open = (element == cursor);
+
+			// elements in a skipped subtree are only parsed to check for errors
+			if (skip)
+			{
+				if (!open) discard_element(element);
+				return;
+			}
+
+			xml_node node(element);
+			xml_filter_action action = filter->filter(node);
+
+			if (action == filter_skip)
+			{
+				if (open)
+				{
+					remove_node(element);
+					skip = element;
+				}
+				else discard_element(element);
+			}
+			else if (action == filter_skip_children && open)
+			{
+				skip = element;
+			}
+		}
+
+		// Closes the element in a skipped subtree and returns its parent
+		xml_node_struct* close_skipped_element(xml_node_struct* node)
+		{
+			xml_node_struct* parent = node->parent;
+
+			if (node == skip)
+			{
+				skip = 0;
+
+				// the element that was skipped without its contents stays in the tree
+				if (node->prev_sibling_c) return parent;
+			}
+
+			discard_element(node);
+
+			return parent;
+		}
+
+		// DOCTYPE consists of nested sections of the following possible types:
+		// <!-- ... -->, <? ... ?>, "...", '...'
+		// <![...]]>
+		// <!...>
+		// First group can not contain nested groups
+		// Second group can contain nested groups of the same type
+		// Third group can contain all other groups
+		char_t* parse_doctype_primitive(char_t* s)
+		{
+			if (*s == '"' || *s == '\'')
+			{
+				// quoted string
+				char_t ch = *s++;
+				PUGI__SCANFOR(*s == ch);
+				if (!*s) PUGI__THROW_ERROR(status_bad_doctype, s);
+
+				s++;
+			}
+			else if (s[0] == '<' && s[1] == '?')
+			{
+				// <? ... ?>
+				s += 2;
+				PUGI__SCANFOR(s[0] == '?' && s[1] == '>'); // no need for ENDSWITH because ?> can't terminate proper doctype
+				if (!*s) PUGI__THROW_ERROR(status_bad_doctype, s);
+
+				s += 2;
+			}
+			else if (s[0] == '<' && s[1] == '!' && s[2] == '-' && s[3] == '-')
+			{
+				s += 4;
+				PUGI__SCANFOR(s[0] == '-' && s[1] == '-' && s[2] == '>'); // no need for ENDSWITH because --> can't terminate proper doctype
+				if (!*s) PUGI__THROW_ERROR(status_bad_doctype, s);
+
+				s += 3;
+			}
+			else PUGI__THROW_ERROR(status_bad_doctype, s);
+
+			return s;
+		}
+
+		char_t* parse_doctype_ignore(char_t* s)
+		{
+			assert(s[0] == '<' && s[1] == '!' && s[2] == '[');
+			s++;
+
+			while (*s)
+			{
+				if (s[0] == '<' && s[1] == '!' && s[2] == '[')
+				{
+					// nested ignore section
+					s = parse_doctype_ignore(s);
+					if (!s) return s;
+				}
+				else if (s[0] == ']' && s[1] == ']' && s[2] == '>')
+				{
+					// ignore section end
+					s += 3;
+
+					return s;
+				}
+				else s++;
+			}
+
+			PUGI__THROW_ERROR(status_bad_doctype, s);
+		}
+
+		char_t* parse_doctype_group(char_t* s, char_t endch, bool toplevel)
+		{
+			assert((s[0] == '<' || s[0] == 0) && s[1] == '!');
+			s++;
+
+			while (*s)
+			{
+				if (s[0] == '<' && s[1] == '!' && s[2] != '-')
+				{
+					if (s[2] == '[')
+					{
+						// ignore
+						s = parse_doctype_ignore(s);
+						if (!s) return s;
+					}
+					else
+					{
+						// some control group
+						s = parse_doctype_group(s, endch, false);
+						if (!s) return s;
+
+						// skip >
+						assert(*s == '>');
+						s++;
+					}
+				}
+				else if (s[0] == '<' || s[0] == '"' || s[0] == '\'')
+				{
+					// unknown tag (forbidden), or some primitive group
+					s = parse_doctype_primitive(s);
+					if (!s) return s;
+				}
+				else if (*s == '>')
+				{
+					return s;
+				}
+				else s++;
+			}
+
+			if (!toplevel || endch != '>') PUGI__THROW_ERROR(status_bad_doctype, s);
+
+			return s;
+		}
+
+		char_t* parse_exclamation(char_t* s, xml_node_struct* cursor, unsigned int optmsk, char_t endch)
+		{
+			// parse node contents, starting with exclamation mark
+			++s;
+
+			if (*s == '-') // '<!-...'
+			{
+				++s;
+
+				if (*s == '-') // '<!--...'
+				{
+					++s;
+
+					if (PUGI__OPTSET(parse_comments))
+					{
+						PUGI__PUSHNODE(node_comment); // Append a new node on the tree.
+						cursor->value = s; // Save the offset.
+					}
+
+					if (PUGI__OPTSET(parse_eol) && PUGI__OPTSET(parse_comments))
+					{
+						s = strconv_comment(s, endch);
+
+						if (!s) PUGI__THROW_ERROR(status_bad_comment, cursor->value);
+					}
+					else
+					{
+						// Scan for terminating '-->'.
+						PUGI__SCANFOR(s[0] == '-' && s[1] == '-' && PUGI__ENDSWITH(s[2], '>'));
+						PUGI__CHECK_ERROR(status_bad_comment, s);
+
+						if (PUGI__OPTSET(parse_comments))
+							*s = 0; // Zero-terminate this segment at the first terminating '-'.
+
+						s += (s[2] == '>' ? 3 : 2); // Step over the '\0->'.
+					}
+				}
+				else PUGI__THROW_ERROR(status_bad_comment, s);
+			}
+			else if (*s == '[')
+			{
+				// '<![CDATA[...'
+				if (*++s=='C' && *++s=='D' && *++s=='A' && *++s=='T' && *++s=='A' && *++s == '[')
+				{
+					++s;
+
+					if (PUGI__OPTSET(parse_cdata))
+					{
+						PUGI__PUSHNODE(node_cdata); // Append a new node on the tree.
+						cursor->value = s; // Save the offset.
+
+						if (PUGI__OPTSET(parse_eol))
+						{
+							s = strconv_cdata(s, endch);
+
+							if (!s) PUGI__THROW_ERROR(status_bad_cdata, cursor->value);
+						}
+						else
+						{
+							// Scan for terminating ']]>'.
+							PUGI__SCANFOR(s[0] == ']' && s[1] == ']' && PUGI__ENDSWITH(s[2], '>'));
+							PUGI__CHECK_ERROR(status_bad_cdata, s);
+
+							*s++ = 0; // Zero-terminate this segment.
+						}
+					}
+					else // Flagged for discard, but we still have to scan for the terminator.
+					{
+						// Scan for terminating ']]>'.
+						PUGI__SCANFOR(s[0] == ']' && s[1] == ']' && PUGI__ENDSWITH(s[2], '>'));
+						PUGI__CHECK_ERROR(status_bad_cdata, s);
+
+						++s;
+					}
+
+					s += (s[1] == '>' ? 2 : 1); // Step over the last ']>'.
+				}
+				else PUGI__THROW_ERROR(status_bad_cdata, s);
+			}
+			else if (s[0] == 'D' && s[1] == 'O' && s[2] == 'C' && s[3] == 'T' && s[4] == 'Y' && s[5] == 'P' && PUGI__ENDSWITH(s[6], 'E'))
+			{
+				s -= 2;
+
+				if (cursor->parent) PUGI__THROW_ERROR(status_bad_doctype, s);
+
+				char_t* mark = s + 9;
+
+				s = parse_doctype_group(s, endch, true);
+				if (!s) return s;
+
+				assert((*s == 0 && endch == '>') || *s == '>');
+				if (*s) *s++ = 0;
+
+				if (PUGI__OPTSET(parse_doctype))
+				{
+					while (PUGI__IS_CHARTYPE(*mark, ct_space)) ++mark;
+
+					PUGI__PUSHNODE(node_doctype);
+
+					cursor->value = mark;
+
+					PUGI__POPNODE();
+				}
+			}
+			else if (*s == 0 && endch == '-') PUGI__THROW_ERROR(status_bad_comment, s);
+			else if (*s == 0 && endch == '[') PUGI__THROW_ERROR(status_bad_cdata, s);
+			else PUGI__THROW_ERROR(status_unrecognized_tag, s);
+
+			return s;
+		}
+
+		char_t* parse_question(char_t* s, xml_node_struct*& ref_cursor, unsigned int optmsk, char_t endch)
+		{
+			// load into registers
+			xml_node_struct* cursor = ref_cursor;
+			char_t ch = 0;
+
+			// parse node contents, starting with question mark
+			++s;
+
+			// read PI target
+			char_t* target = s;
+
+			if (!PUGI__IS_CHARTYPE(*s, ct_start_symbol)) PUGI__THROW_ERROR(status_bad_pi, s);
+
+			PUGI__SCANWHILE(PUGI__IS_CHARTYPE(*s, ct_symbol));
+			PUGI__CHECK_ERROR(status_bad_pi, s);
+
+			// determine node type; stricmp / strcasecmp is not portable
+			bool declaration = (target[0] | ' ') == 'x' && (target[1] | ' ') == 'm' && (target[2] | ' ') == 'l' && target + 3 == s;
+
+			if (declaration ? PUGI__OPTSET(parse_declaration) : PUGI__OPTSET(parse_pi))
+			{
+				if (declaration)
+				{
+					// disallow non top-level declarations
+					if (cursor->parent) PUGI__THROW_ERROR(status_bad_pi, s);
+
+					PUGI__PUSHNODE(node_declaration);
+				}
+				else
+				{
+					PUGI__PUSHNODE(node_pi);
+				}
+
+				cursor->name = target;
+
+				PUGI__ENDSEG();
+
+				if (names && !(cursor->name = intern_name(*names, target, static_cast<size_t>(s - 1 - target), 0))) PUGI__THROW_ERROR(status_out_of_memory, target);
+
+				// parse value/attributes
+				if (ch == '?')
+				{
+					// empty node
+					if (!PUGI__ENDSWITH(*s, '>')) PUGI__THROW_ERROR(status_bad_pi, s);
+					s += (*s == '>');
+
+					PUGI__POPNODE();
+				}
+				else if (PUGI__IS_CHARTYPE(ch, ct_space))
+				{
+					PUGI__SKIPWS();
+
+					// scan for tag end
+					char_t* value = s;
+
+					PUGI__SCANFOR(s[0] == '?' && PUGI__ENDSWITH(s[1], '>'));
+					PUGI__CHECK_ERROR(status_bad_pi, s);
+
+					if (declaration)
+					{
+						// replace ending ? with / so that 'element' terminates properly
+						*s = '/';
+
+						// we exit from this function with cursor at node_declaration, which is a signal to parse() to go to LOC_ATTRIBUTES
+						s = value;
+					}
+					else
+					{
+						// store value and step over >
+						cursor->value = value;
+						PUGI__POPNODE();
+
+						PUGI__ENDSEG();
+
+						s += (*s == '>');
+					}
+				}
+				else PUGI__THROW_ERROR(status_bad_pi, s);
+			}
+			else
+			{
+				// scan for tag end
+				PUGI__SCANFOR(s[0] == '?' && PUGI__ENDSWITH(s[1], '>'));
+				PUGI__CHECK_ERROR(status_bad_pi, s);
+
+				s += (s[1] == '>' ? 2 : 1);
+			}
+
+			// store from registers
+			ref_cursor = cursor;
+
+			return s;
+		}
+
+		// Parses nodes into ref_cursor until the end of the buffer; returns the innermost unclosed element in ref_cursor
+		// If tag is true, the buffer starts right after '<'
+		char_t* parse_tree(char_t* s, xml_node_struct*& ref_cursor, unsigned int optmsk, char_t endch, bool tag)
+		{
+			strconv_attribute_t strconv_attribute = get_strconv_attribute(optmsk);
+			strconv_attribute_lazy_t strconv_attribute_lazy = get_strconv_attribute_lazy(optmsk);
+			strconv_pcdata_t strconv_pcdata = get_strconv_pcdata(optmsk);
+			
+			char_t ch = 0;
+			xml_node_struct* cursor = ref_cursor;
+			xml_node_struct* element = 0;
+			char_t* mark = s;
+
+			if (tag) goto LOC_TAG;
+
+			while (*s != 0)
+			{
+				if (*s == '<')
+				{
+					++s;
+
+				LOC_TAG:
+					if (PUGI__IS_CHARTYPE(*s, ct_start_symbol)) // '<#...'
+					{
+						PUGI__PUSHNODE(node_element); // Append a new node to the tree.
+
+						cursor->name = s;
+						element = cursor;
+
+						PUGI__SCANWHILE_UNROLL(PUGI__IS_CHARTYPE(ss, ct_symbol)); // Scan for a terminator.
+						PUGI__ENDSEG(); // Save char in 'ch', terminate & step over.
+
+						if (names && !skip && !(cursor->name = intern_name(*names, cursor->name, static_cast<size_t>(s - 1 - cursor->name), 0))) PUGI__THROW_ERROR(status_out_of_memory, s);
+
+						if (ch == '>')
+						{
+							// end of tag
+						}
+						else if (PUGI__IS_CHARTYPE(ch, ct_space))
+						{
+						LOC_ATTRIBUTES:
+							while (true)
+							{
+								PUGI__SKIPWS(); // Eat any whitespace.
+						
+								if (PUGI__IS_CHARTYPE(*s, ct_start_symbol)) // <... #...
+								{
+									xml_attribute_struct* a = append_new_attribute(cursor, alloc); // Make space for this attribute.
+									if (!a) PUGI__THROW_ERROR(status_out_of_memory, s);
+
+									a->name = s; // Save the offset.
+
+									PUGI__SCANWHILE_UNROLL(PUGI__IS_CHARTYPE(ss, ct_symbol)); // Scan for a terminator.
+									PUGI__CHECK_ERROR(status_bad_attribute, s); //$ redundant, left for performance
+
+									PUGI__ENDSEG(); // Save char in 'ch', terminate & step over.
+									PUGI__CHECK_ERROR(status_bad_attribute, s); //$ redundant, left for performance
+
+									if (names && !skip && !(a->name = intern_name(*names, a->name, static_cast<size_t>(s - 1 - a->name), 0))) PUGI__THROW_ERROR(status_out_of_memory, s);
+
+									if (PUGI__IS_CHARTYPE(ch, ct_space))
+									{
+										PUGI__SKIPWS(); // Eat any whitespace.
+										PUGI__CHECK_ERROR(status_bad_attribute, s); //$ redundant, left for performance
+
+										ch = *s;
+										++s;
+									}
+									
+									if (ch == '=') // '<... #=...'
+									{
+										PUGI__SKIPWS(); // Eat any whitespace.
+
+										if (*s == '"' || *s == '\'') // '<... #="...'
+										{
+											ch = *s; // Save quote char to avoid breaking on "''" -or- '""'.
+											++s; // Step over the quote.
+											a->value = s; // Save the offset.
+
+											s = PUGI__OPTSET(parse_lazy_decode) ? strconv_attribute_lazy(s, ch, a->header, optmsk) : strconv_attribute(s, ch);
+										
+											if (!s) PUGI__THROW_ERROR(status_bad_attribute, a->value);
+
+											// After this line the loop continues from the start;
+											// Whitespaces, / and > are ok, symbols and EOF are wrong,
+											// everything else will be detected
+											if (PUGI__IS_CHARTYPE(*s, ct_start_symbol)) PUGI__THROW_ERROR(status_bad_attribute, s);
+										}
+										else PUGI__THROW_ERROR(status_bad_attribute, s);
+									}
+									else PUGI__THROW_ERROR(status_bad_attribute, s);
+								}
+								else if (*s == '/')
+								{
+									++s;
+									
+									if (*s == '>')
+									{
+										PUGI__POPNODE();
+										s++;
+										break;
+									}
+									else if (*s == 0 && endch == '>')
+									{
+										PUGI__POPNODE();
+										break;
+									}
+									else PUGI__THROW_ERROR(status_bad_start_element, s);
+								}
+								else if (*s == '>')
+								{
+									++s;
+
+									break;
+								}
+								else if (*s == 0 && endch == '>')
+								{
+									break;
+								}
+								else PUGI__THROW_ERROR(status_bad_start_element, s);
+							}
+
+							// !!!
+						}
+						else if (ch == '/') // '<#.../'
+						{
+							if (!PUGI__ENDSWITH(*s, '>')) PUGI__THROW_ERROR(status_bad_start_element, s);
+
+							PUGI__POPNODE(); // Pop.
+
+							s += (*s == '>');
+						}
+						else if (ch == 0)
+						{
+							// we stepped over null terminator, backtrack & handle closing tag
+							--s;
+							
+							if (endch != '>') PUGI__THROW_ERROR(status_bad_start_element, s);
+						}
+						else PUGI__THROW_ERROR(status_bad_start_element, s);
+
+						if (filter && PUGI__NODETYPE(element) == node_element) filter_element(element, cursor);
+
+						// skip the contents of the element that was just opened, they are parsed on first access
+						if (PUGI__OPTSET(parse_lazy_subtrees) && !cursor->first_child && is_lazy_subtree_depth(cursor, optmsk))
+						{
+							char_t* end = find_element_end(s, alloc);
+
+							if (end && end != s)
+							{
+								cursor->value = s;
+								cursor->header |= xml_memory_page_value_lazy_mask;
+
+								// the contents are zero-terminated in place of the end tag's '<'
+								*end = 0;
+								s = end + 1;
+
+								goto LOC_TAG;
+							}
+						}
+					}
+					else if (*s == '/')
+					{
+						++s;
+
+						char_t* name = cursor->name;
+						if (!name) PUGI__THROW_ERROR(status_end_element_mismatch, s);
+						
+						while (PUGI__IS_CHARTYPE(*s, ct_symbol))
+						{
+							if (*s++ != *name++) PUGI__THROW_ERROR(status_end_element_mismatch, s);
+						}
+
+						if (*name)
+						{
+							if (*s == 0 && name[0] == endch && name[1] == 0) PUGI__THROW_ERROR(status_bad_end_element, s);
+							else PUGI__THROW_ERROR(status_end_element_mismatch, s);
+						}
+
+						if (skip) cursor = close_skipped_element(cursor); // Pop, freeing the skipped nodes.
+						else PUGI__POPNODE(); // Pop.
+
+						PUGI__SKIPWS();
+
+						if (*s == 0)
+						{
+							if (endch != '>') PUGI__THROW_ERROR(status_bad_end_element, s);
+						}
+						else
+						{
+							if (*s != '>') PUGI__THROW_ERROR(status_bad_end_element, s);
+							++s;
+						}
+					}
+					else if (*s == '?') // '<?...'
+					{
+						s = parse_question(s, cursor, skip ? optmsk & ~parse_pi : optmsk, endch);
+						if (!s) return s;
+
+						assert(cursor);
+						if (PUGI__NODETYPE(cursor) == node_declaration)
+						{
+							element = cursor;
+							goto LOC_ATTRIBUTES;
+						}
+					}
+					else if (*s == '!') // '<!...'
+					{
+						s = parse_exclamation(s, cursor, skip ? optmsk & ~(parse_comments | parse_cdata) : optmsk, endch);
+						if (!s) return s;
+					}
+					else if (*s == 0 && endch == '?') PUGI__THROW_ERROR(status_bad_pi, s);
+					else PUGI__THROW_ERROR(status_unrecognized_tag, s);
+				}
+				else
+				{
+					mark = s; // Save this offset while searching for a terminator.
+
+					PUGI__SKIPWS(); // Eat whitespace if no genuine PCDATA here.
+
+					if (*s == '<' || !*s)
+					{
+						// We skipped some whitespace characters because otherwise we would take the tag branch instead of PCDATA one
+						assert(mark != s);
+
+						if (!PUGI__OPTSET(parse_ws_pcdata | parse_ws_pcdata_single) || PUGI__OPTSET(parse_trim_pcdata))
+						{
+							continue;
+						}
+						else if (PUGI__OPTSET(parse_ws_pcdata_single))
+						{
+							if (s[0] != '<' || s[1] != '/' || cursor->first_child) continue;
+						}
+					}
+
+					if (!PUGI__OPTSET(parse_trim_pcdata))
+						s = mark;
+							
+					if ((cursor->parent || PUGI__OPTSET(parse_fragment)) && !skip)
+					{
+						if (PUGI__OPTSET(parse_embed_pcdata) && PUGI__NODETYPE(cursor) == node_element && !cursor->first_child && !cursor->value)
+						{
+							cursor->value = s; // Save the offset.
+
+							// lazy flag on elements marks unparsed contents, so embedded text is decoded right away
+							s = strconv_pcdata(s);
+						}
+						else
+						{
+							PUGI__PUSHNODE(node_pcdata); // Append a new node on the tree.
+							cursor->value = s; // Save the offset.
+
+							s = PUGI__OPTSET(parse_lazy_decode) ? strconv_pcdata_lazy(s, cursor->header, optmsk) : strconv_pcdata(s);
+								
+							PUGI__POPNODE(); // Pop since this is a standalone.
+						}
+						
+						if (!*s) break;
+					}
+					else
+					{
+						PUGI__SCANFOR(*s == '<'); // '...<'
+						if (!*s) break;
+						
+						++s;
+					}
+
+					// We're after '<'
+					goto LOC_TAG;
+				}
+			}
+
+			// store from registers
+			ref_cursor = cursor;
+
+			return s;
+		}
+
+		char_t* parse_tree_root(char_t* s, xml_node_struct* root, unsigned int optmsk, char_t endch)
+		{
+			xml_node_struct* cursor = root;
+
+			s = parse_tree(s, cursor, optmsk, endch, false);
+			if (!s) return s;
+
+			// check that last tag is closed
+			if (cursor != root) PUGI__THROW_ERROR(status_end_element_mismatch, s);
+
+			return s;
+		}
+
+	#ifdef PUGIXML_HAS_THREADS
+		char_t* parse_tree_parallel(char_t* s, char_t** splits, size_t split_count, char_t* tail, xml_node_struct* root, unsigned int optmsk, char_t endch);
+	#endif
+
+	#ifdef PUGIXML_WCHAR_MODE
+		static char_t* parse_skip_bom(char_t* s)
+		{
+			unsigned int bom = 0xfeff;
+			return (s[0] == static_cast<wchar_t>(bom)) ? s + 1 : s;
+		}
+	#else
+		static char_t* parse_skip_bom(char_t* s)
+		{
+			return (s[0] == '\xef' && s[1] == '\xbb' && s[2] == '\xbf') ? s + 3 : s;
+		}
+	#endif
+
+		static bool has_element_node_siblings(xml_node_struct* node)
+		{
+			while (node)
+			{
+				if (PUGI__NODETYPE(node) == node_element) return true;
+
+				node = node->next_sibling;
+			}
+
+			return false;
+		}
+
+		static xml_parse_result parse(char_t* buffer, size_t length, xml_document_struct* xmldoc, xml_node_struct* root, unsigned int optmsk)
+		{
+			// allocator object is a part of document object
+			xml_allocator& alloc_ = *static_cast<xml_allocator*>(xmldoc);
+
+			// early-out for empty documents
+			if (length == 0)
+				return make_parse_result(PUGI__OPTSET(parse_fragment) ? status_ok : status_no_document_element);
+
+			optmsk = get_lazy_parse_options(*xmldoc, optmsk);
+
+			if (!init_name_table(*xmldoc, root, optmsk)) return make_parse_result(status_out_of_memory);
+
+			// the name table is not synchronized
+			if (xmldoc->names) optmsk &= ~parse_parallel;
+
+		#ifdef PUGIXML_COMPACT
+			// neither is the document table for the pointers that don't fit into compact fields
+			optmsk &= ~parse_parallel;
+		#endif
+
+			// get last child of the root before parsing
+			xml_node_struct* last_root_child = root->first_child ? static_cast<xml_node_struct*>(root->first_child->prev_sibling_c) : 0;
+	
+			// create parser on stack
+			xml_parser parser(alloc_, xmldoc->names);
+			parser.filter = xmldoc->filter;
+
+			// save last character and make buffer zero-terminated (speeds up parsing)
+			char_t endch = buffer[length - 1];
+			buffer[length - 1] = 0;
+			
+			// skip BOM to make sure it does not end up as part of parse output
+			char_t* buffer_data = parse_skip_bom(buffer);
+
+			// perform actual parsing
+		#ifdef PUGIXML_HAS_THREADS
+			char_t* splits[xml_parallel_max_chunks];
+			char_t* tail = 0;
+			size_t split_count = PUGI__OPTSET(parse_parallel) ? find_parallel_split_points(buffer_data, length - static_cast<size_t>(buffer_data - buffer), splits, tail) : 0;
+
+			if (split_count)
+				parser.parse_tree_parallel(buffer_data, splits, split_count, tail, root, optmsk, endch);
+			else
+		#endif
+				parser.parse_tree_root(buffer_data, root, optmsk, endch);
+
+			// update allocator state
+			alloc_ = parser.alloc;
+
+			xml_parse_result result = make_parse_result(parser.error_status, parser.error_offset ? parser.error_offset - buffer : 0);
+			assert(result.offset >= 0 && static_cast<size_t>(result.offset) <= length);
+
+			if (result)
+			{
+				// since we removed last character, we have to handle the only possible false positive (stray <)
+				if (endch == '<')
+					return make_parse_result(status_unrecognized_tag, length - 1);
+
+				// check if there are any element nodes parsed
+				xml_node_struct* first_root_child_parsed = last_root_child ? last_root_child->next_sibling : root->first_child;
+
+				if (!PUGI__OPTSET(parse_fragment) && !has_element_node_siblings(first_root_child_parsed))
+					return make_parse_result(status_no_document_element, length - 1);
+			}
+			else
+			{
+				// roll back offset if it occurs on a null terminator in the source buffer
+				if (result.offset > 0 && static_cast<size_t>(result.offset) == length - 1 && endch == 0)
+					result.offset--;
+			}
+
+			return result;
+		}
+	};
+
+#ifdef PUGIXML_HAS_THREADS
+	struct xml_parse_chunk
+	{
+		xml_parser parser;
+		xml_node_struct parent;
+		xml_thread thread;
+
+		char_t* begin;
+		char_t* end;
+		unsigned int optmsk;
+
+		xml_parse_chunk(const xml_allocator& alloc, xml_node_struct* root, char_t* begin_, unsigned int optmsk_): parser(alloc), parent(0, node_element), begin(begin_), end(0), optmsk(optmsk_)
+		{
+			// PCDATA is only added to nodes that have a parent
+			parent.parent = root;
+		}
+
+		static void parse(void* data)
+		{
+			xml_parse_chunk* chunk = static_cast<xml_parse_chunk*>(data);
+			xml_node_struct* cursor = &chunk->parent;
+
+			// chunks start right after '<' of a start tag and end before the next one
+			chunk->end = chunk->parser.parse_tree(chunk->begin, cursor, chunk->optmsk, '<', true);
+
+			if (chunk->end && cursor != &chunk->parent)
+			{
+				chunk->parser.error_offset = chunk->end;
+				chunk->parser.error_status = status_end_element_mismatch;
+				chunk->end = 0;
+			}
+		}
+
+		xml_memory_page* first_page()
+		{
+			xml_memory_page* first = parser.alloc._root[xml_memory_kind_node];
+			while (first->prev) first = first->prev;
+
+			return first;
+		}
+
+		void merge_pages(xml_allocator& target)
+		{
+			for (int kind = 0; kind < xml_memory_kind_count; ++kind)
+				if (parser.alloc._root[kind]) parser.alloc._root[kind]->busy_size = parser.alloc._busy_size[kind];
+
+			xml_memory_page* first = first_page();
+
+			xml_memory_page* last = first;
+			while (last->next) last = last->next;
+
+			// insert pages after the current node page of the target, so that they are deleted when they become empty
+			xml_memory_page* prev = target._root[xml_memory_kind_node];
+
+			first->prev = prev;
+			last->next = prev->next;
+
+			if (prev->next) prev->next->prev = last;
+			prev->next = first;
+		}
+
+		void destroy_pages()
+		{
+			for (xml_memory_page* page = first_page(); page; )
+			{
+				xml_memory_page* next = page->next;
+
+				parser.alloc.deallocate_page(page);
+
+				page = next;
+			}
+		}
+
+		void append_children(xml_node_struct* node)
+		{
+			xml_node_struct* head = parent.first_child;
+			if (!head) return;
+
+			for (xml_node_struct* child = head; child; child = child->next_sibling)
+				child->parent = node;
+
+			if (node->first_child)
+			{
+				xml_node_struct* tail = node->first_child->prev_sibling_c;
+
+				tail->next_sibling = head;
+				node->first_child->prev_sibling_c = head->prev_sibling_c;
+				head->prev_sibling_c = tail;
+			}
+			else
+			{
+				node->first_child = head;
+			}
+		}
+	};
+
+	PUGI__FN char_t* xml_parser::parse_tree_parallel(char_t* s, char_t** splits, size_t split_count, char_t* tail, xml_node_struct* root, unsigned int optmsk, char_t endch)
+	{
+		// every chunk gets a separate page chain so that allocation does not need synchronization
+		xml_parse_chunk* chunks = static_cast<xml_parse_chunk*>(resource_allocate(split_count * sizeof(xml_parse_chunk), alloc._resource));
+		if (!chunks) PUGI__THROW_ERROR(status_out_of_memory, s);
+
+		size_t chunk_count = 0;
+
+		for (; chunk_count < split_count; ++chunk_count)
+		{
+			xml_memory_page* page = alloc.allocate_page(alloc._page_size);
+			if (!page) break;
+
+			xml_allocator chunk_alloc(page, alloc._page_size, alloc._resource);
+			chunk_alloc.set_page_size(alloc._page_size, alloc._page_size_limit);
+
+			new (&chunks[chunk_count]) xml_parse_chunk(chunk_alloc, root, splits[chunk_count] + 1, optmsk);
+		}
+
+		if (chunk_count < split_count)
+		{
+			for (size_t i = 0; i < chunk_count; ++i) chunks[i].destroy_pages();
+
+			resource_deallocate(chunks, alloc._resource);
+
+			PUGI__THROW_ERROR(status_out_of_memory, s);
+		}
+
+		// terminate chunks; this replaces '<' at every split point, which the chunk parsers skip
+		for (size_t i = 0; i < split_count; ++i) *splits[i] = 0;
+
+		*tail = 0;
+
+		// parse the first chunk on this thread and the rest on worker threads (or sequentially if threads can't be created)
+		size_t thread_count = 0;
+
+		while (thread_count < split_count && chunks[thread_count].thread.start(xml_parse_chunk::parse, &chunks[thread_count])) thread_count++;
+
+		for (size_t i = thread_count; i < split_count; ++i) xml_parse_chunk::parse(&chunks[i]);
+
+		xml_node_struct* cursor = root;
+		char_t* result = parse_tree(s, cursor, optmsk, '<', false);
+
+		// the first chunk has to end inside the document element
+		if (result && (cursor == root || cursor->parent != root))
+		{
+			error_offset = result;
+			error_status = status_end_element_mismatch;
+			result = 0;
+		}
+
+		for (size_t i = 0; i < thread_count; ++i) chunks[i].thread.join();
+
+		// stitch the tree in document order, keeping the chunks up to the first error to match the serial parser
+		for (size_t i = 0; i < split_count; ++i)
+		{
+			xml_parse_chunk& chunk = chunks[i];
+
+			if (result)
+			{
+				chunk.merge_pages(alloc);
+				chunk.append_children(cursor);
+
+				if (!chunk.end)
+				{
+					error_offset = chunk.parser.error_offset;
+					error_status = chunk.parser.error_status;
+					result = 0;
+				}
+			}
+			else chunk.destroy_pages();
+		}
+
+		resource_deallocate(chunks, alloc._resource);
+
+		if (!result) return result;
+
+		// the tail starts with the end tag of the document element
+		result = parse_tree(tail + 1, cursor, optmsk, endch, true);
+		if (!result) return result;
+
+		if (cursor != root) PUGI__THROW_ERROR(status_end_element_mismatch, result);
+
+		return result;
+	}
+#endif
+
+	// Incremental parsing
+	const size_t xml_incremental_buffer_size = 4096;
+
+	// Returns the length of the data prefix that can be decoded without knowing the data that follows
+	PUGI__FN size_t get_incremental_valid_length(xml_encoding encoding, const uint8_t* data, size_t size)
+	{
+		if (encoding == encoding_utf16_le || encoding == encoding_utf16_be)
+		{
+			size_t length = size & ~static_cast<size_t>(1);
+
+			// keep the leading surrogate until the trailing one arrives
+			if (length >= 2 && (data[encoding == encoding_utf16_le ? length - 1 : length - 2] & 0xfc) == 0xd8) length -= 2;
+
+			return length;
+		}
+
+		if (encoding == encoding_utf32_le || encoding == encoding_utf32_be)
+			return size & ~static_cast<size_t>(3);
+
+	#ifdef PUGIXML_WCHAR_MODE
+		if (encoding == encoding_utf8)
+		{
+			// keep the last sequence if it's incomplete
+			for (size_t i = 1; i <= 3 && i <= size; ++i)
+			{
+				uint8_t lead = data[size - i];
+
+				if ((lead & 0xc0) != 0x80)
+				{
+					size_t need = (lead < 0xc0) ? 1 : (lead < 0xe0) ? 2 : (lead < 0xf0) ? 3 : (lead < 0xf8) ? 4 : 1;
+
+					return (need > i) ? size - i : size;
+				}
+			}
+		}
+	#endif
+
+		return size;
+	}
+
+	// Returns the end of the first markup construct (including the preceding text) in a zero-terminated buffer, or 0 if the construct is incomplete
+	// The scan gives up on constructs the parser could read past (i.e. where the parse result may depend on the following data)
+	PUGI__FN char_t* find_markup_end(char_t* s, const xml_allocator& alloc)
+	{
+		// text; embedded zeroes stop the parser, so the rest has to wait until the end of the document
+		while (*s && *s != '<') ++s;
+
+		if (!*s) return 0;
+
+		if (s[1] == '!')
+		{
+			if (s[2] == '-' && s[3] == '-')
+			{
+				s += 4;
+				PUGI__SCANFOR(s[0] == '-' && s[1] == '-' && s[2] == '>');
+				if (!*s) return 0;
+
+				s += 3;
+			}
+			else if (s[2] == '[' && s[3] == 'C' && s[4] == 'D' && s[5] == 'A' && s[6] == 'T' && s[7] == 'A' && s[8] == '[')
+			{
+				s += 9;
+				PUGI__SCANFOR(s[0] == ']' && s[1] == ']' && s[2] == '>');
+				if (!*s) return 0;
+
+				s += 3;
+			}
+			else if (s[2] == 'D' && s[3] == 'O' && s[4] == 'C' && s[5] == 'T' && s[6] == 'Y' && s[7] == 'P' && s[8] == 'E')
+			{
+				// reuse parser logic to find the end of the nested DOCTYPE groups
+				xml_parser parser(alloc);
+
+				s = parser.parse_doctype_group(s, 0, true);
+				if (!s) return 0;
+
+				assert(*s == '>');
+				s++;
+			}
+			else return 0;
+		}
+		else if (s[1] == '?')
+		{
+			s += 2;
+
+			// declaration contents are parsed as attributes, so '?>' in a quoted value ends up inside the attribute
+			bool declaration = (s[0] | ' ') == 'x' && (s[1] | ' ') == 'm' && (s[2] | ' ') == 'l' && !PUGI__IS_CHARTYPE(s[3], ct_symbol);
+			char_t quote = 0;
+
+			for (; *s && !(s[0] == '?' && s[1] == '>'); ++s)
+				if (declaration && (*s == '"' || *s == '\'')) quote = (quote == 0) ? *s : (quote == *s) ? 0 : quote;
+
+			if (!*s || quote) return 0;
+
+			s += 2;
+		}
+		else if (s[1] == '/' || PUGI__IS_CHARTYPE(s[1], ct_start_symbol))
+		{
+			char_t quote = 0;
+
+			for (++s; *s && (quote || *s != '>'); ++s)
+				if (*s == '"' || *s == '\'') quote = (quote == 0) ? *s : (quote == *s) ? 0 : quote;
+
+			if (!*s) return 0;
+
+			s++;
+		}
+		else return 0;
+
+		return s;
+	}
+
+	// Returns the start of the end tag of the element with the contents starting at s, or 0 if the element is not closed in a zero-terminated buffer
+	PUGI__FN char_t* find_element_end(char_t* s, const xml_allocator& alloc)
+	{
+		size_t depth = 0;
+
+		while (true)
+		{
+			// skip text
+			while (true)
+			{
+				PUGI__SCANCHARTYPE(ct_parse_pcdata);
+
+				if (*s == '&' || *s == '\r') ++s;
+				else break;
+			}
+
+			if (!*s) return 0;
+
+			char_t* end = find_markup_end(s, alloc);
+			if (!end) return 0;
+
+			if (s[1] == '/')
+			{
+				if (depth == 0) return s;
+
+				depth--;
+			}
+			else if (PUGI__IS_CHARTYPE(s[1], ct_start_symbol) && end[-2] != '/')
+				depth++;
+
+			s = end;
+		}
+	}
+
+	PUGI__FN_NO_INLINE void parse_lazy_subtree(xml_node_struct* node)
+	{
+		xml_document_struct& doc = get_document(node);
+
+		char_t* contents = node->value;
+
+		node->value = 0;
+		node->header &= ~xml_memory_page_value_lazy_mask;
+
+		// nested elements are parsed right away; since errors can't be reported here, the nodes before the error are kept
+		xml_parser parser(doc, doc.names);
+		xml_node_struct* cursor = node;
+
+		parser.parse_tree(contents, cursor, doc.lazy_options & ~parse_lazy_subtrees, 0, false);
+
+		// update allocator state
+		static_cast<xml_allocator&>(doc) = parser.alloc;
+	}
+
+	// Returns the end of the last complete markup construct in a zero-terminated buffer; the data after it may be incomplete
+	PUGI__FN char_t* find_incremental_split_point(char_t* s, const xml_allocator& alloc)
+	{
+		char_t* split = s;
+
+		while ((s = find_markup_end(split, alloc)) != 0) split = s;
+
+		return split;
+	}
+
+	// Converts a chunk of data to native encoding without adding a null terminator; returns the data itself if no conversion is required
+	PUGI__FN bool convert_buffer_chunk(char_t*& out_buffer, size_t& out_length, xml_encoding encoding, const void* contents, size_t size, xml_memory_resource* resource)
+	{
+	#ifdef PUGIXML_WCHAR_MODE
+		if (encoding == get_wchar_encoding())
+	#else
+		if (encoding == encoding_utf8)
+	#endif
+		{
+			out_buffer = static_cast<char_t*>(const_cast<void*>(contents));
+			out_length = size / sizeof(char_t);
+
+			return true;
+		}
+
+		if (!convert_buffer(out_buffer, out_length, encoding, contents, size, resource, false)) return false;
+
+		// converted buffer is zero-terminated
+		assert(out_length > 0 && out_buffer[out_length - 1] == 0);
+		out_length--;
+
+		return true;
+	}
+
+	// Pull parsing
+	const size_t xml_reader_chunk_size = 16384;
+
+	struct xml_reader_event
+	{
+		xml_node_struct* node;
+		unsigned int depth;
+		bool end;
+	};
+
+	struct xml_reader_impl
+	{
+		static xml_reader_impl* create()
+		{
+			void* memory = xml_memory::allocate(sizeof(xml_reader_impl));
+			if (!memory) return 0;
+
+			xml_reader_impl* result = new (memory) xml_reader_impl();
+
+			if (!result->element)
+			{
+				destroy(result);
+				return 0;
+			}
+
+			return result;
+		}
+
+		static void destroy(void* ptr)
+		{
+			if (!ptr) return;
+
+			static_cast<xml_reader_impl*>(ptr)->~xml_reader_impl();
+
+			xml_memory::deallocate(ptr);
+		}
+
+		xml_reader_impl(): element(0), child(0), buffer(0), capacity(0), names(0), names_capacity(0), name_offsets(0), name_capacity(0), events(0), event_capacity(0)
+		{
+			xml_allocator& alloc = *static_cast<xml_document_struct*>(document.internal_object());
+
+			// placeholders are linked to the document nodes, so they are allocated in the document (element is null if the allocation fails)
+			xml_node_struct* e = allocate_node(alloc, node_element);
+			child = e ? allocate_node(alloc, node_pcdata) : 0;
+			element = child ? e : 0;
+
+			reset(0, parse_default, encoding_auto);
+		}
+
+		~xml_reader_impl()
+		{
+			release();
+
+			if (buffer) xml_memory::deallocate(buffer);
+			if (names) xml_memory::deallocate(names);
+			if (name_offsets) xml_memory::deallocate(name_offsets);
+			if (events) xml_memory::deallocate(events);
+		}
+
+		// nodes of the markup construct that is being reported are parsed into the document and destroyed afterwards
+		xml_document document;
+
+		// the innermost open element (its name is kept in the name stack) and a placeholder for its children that were already reported
+		xml_node_struct* element;
+		xml_node_struct* child;
+
+		xml_reader_source* source;
+		unsigned int options;
+		xml_encoding encoding;
+		xml_parse_result result;
+
+		char_t* buffer;
+		size_t size;
+		size_t capacity;
+		size_t start;
+		size_t offset;
+		char_t* stop;
+		bool eof;
+		bool done;
+
+		// raw data follows a size_t member so that it's aligned for decoding
+		size_t raw_size;
+		uint8_t raw[xml_reader_chunk_size + 4];
+
+		char_t* names;
+		size_t names_size;
+		size_t names_capacity;
+		size_t* name_offsets;
+		size_t name_capacity;
+
+		unsigned int depth;
+		bool has_children;
+		bool has_element;
+
+		xml_reader_event* events;
+		size_t event_count;
+		size_t event_capacity;
+		size_t event_index;
+
+		xml_reader_event current;
+
+		void reset(xml_reader_source* source_, unsigned int options_, xml_encoding encoding_)
+		{
+			release();
+
+			source = source_;
+			// nodes are read once, so parsing them right away is cheaper; text is reported as separate nodes
+			options = options_ & ~(parse_lazy_decode | parse_lazy_subtrees | parse_embed_pcdata);
+			encoding = encoding_;
+			result = make_parse_result(status_ok);
+
+			size = start = offset = 0;
+			stop = 0;
+
+			if (buffer) buffer[0] = 0;
+			eof = (source_ == 0);
+			done = true;
+			raw_size = 0;
+
+			names_size = 0;
+			depth = 0;
+			has_children = has_element = false;
+
+			current.node = 0;
+			current.depth = 0;
+			current.end = false;
+		}
+
+		void release()
+		{
+			xml_allocator& alloc = *static_cast<xml_document_struct*>(document.internal_object());
+			xml_node_struct* root = document.internal_object();
+
+			for (xml_node_struct* n = root->first_child; n; )
+			{
+				xml_node_struct* next = n->next_sibling;
+				destroy_node(n, alloc);
+				n = next;
+			}
+
+			root->first_child = 0;
+
+			if (element)
+			{
+				for (xml_node_struct* n = (element->first_child == child) ? child->next_sibling : element->first_child; n; )
+				{
+					xml_node_struct* next = n->next_sibling;
+					destroy_node(n, alloc);
+					n = next;
+				}
+
+				element->first_child = 0;
+				child->next_sibling = 0;
+				child->prev_sibling_c = child;
+			}
+
+			event_count = event_index = 0;
+		}
+
+		bool reserve(size_t length)
+		{
+			if (buffer && size + length <= capacity) return true;
+
+			size_t new_capacity = capacity * 2;
+
+			if (new_capacity < xml_reader_chunk_size) new_capacity = xml_reader_chunk_size;
+			if (new_capacity < size + length) new_capacity = size + length;
+
+			char_t* new_buffer = static_cast<char_t*>(xml_memory::allocate((new_capacity + 1) * sizeof(char_t)));
+			if (!new_buffer) return false;
+
+			if (buffer)
+			{
+				memcpy(new_buffer, buffer, size * sizeof(char_t));
+				xml_memory::deallocate(buffer);
+			}
+
+			buffer = new_buffer;
+			buffer[size] = 0;
+			capacity = new_capacity;
+
+			return true;
+		}
+
+		bool append(const void* contents, size_t length)
+		{
+			char_t* data = 0;
+			size_t count = 0;
+
+			if (!convert_buffer_chunk(data, count, encoding, contents, length, 0)) return false;
+
+			bool success = reserve(count);
+
+			if (success)
+			{
+				memcpy(buffer + size, data, count * sizeof(char_t));
+				size += count;
+				buffer[size] = 0;
+			}
+
+			// delete converted buffer if we performed a conversion
+			if (data != contents) xml_memory::deallocate(data);
+
+			return success;
+		}
+
+		bool fill()
+		{
+			assert(source && !eof);
+
+			// move unparsed data to the beginning of the buffer
+			if (start)
+			{
+				memmove(buffer, buffer + start, (size - start) * sizeof(char_t));
+
+				offset += start;
+				size -= start;
+				start = 0;
+
+				buffer[size] = 0;
+			}
+
+			size_t read = source->read(raw + raw_size, xml_reader_chunk_size);
+			assert(read <= xml_reader_chunk_size);
+
+			eof = (read == 0);
+			raw_size += read;
+
+			// encoding autodetection needs the first 4 bytes
+			if (encoding == encoding_auto)
+			{
+				if (raw_size < 4 && !eof) return true;
+
+				encoding = get_buffer_encoding(encoding_auto, raw, raw_size);
+			}
+
+			// keep the incomplete character until more data arrives
+			size_t length = eof ? raw_size : get_incremental_valid_length(encoding, raw, raw_size);
+
+			if (!append(raw, length)) return oom();
+
+			memmove(raw, raw + length, raw_size - length);
+			raw_size -= length;
+
+			return true;
+		}
+
+		bool push_name(const char_t* name)
+		{
+			size_t length = strlength(name) + 1;
+
+			if (depth == name_capacity)
+			{
+				size_t new_capacity = name_capacity ? name_capacity * 2 : 32;
+
+				size_t* new_offsets = static_cast<size_t*>(xml_memory::allocate(new_capacity * sizeof(size_t)));
+				if (!new_offsets) return false;
+
+				if (name_offsets)
+				{
+					memcpy(new_offsets, name_offsets, depth * sizeof(size_t));
+					xml_memory::deallocate(name_offsets);
+				}
+
+				name_offsets = new_offsets;
+				name_capacity = new_capacity;
+			}
+
+			if (names_size + length > names_capacity)
+			{
+				size_t new_capacity = (names_capacity * 2 > names_size + length) ? names_capacity * 2 : names_size + length + 256;
+
+				char_t* new_names = static_cast<char_t*>(xml_memory::allocate(new_capacity * sizeof(char_t)));
+				if (!new_names) return false;
+
+				if (names)
+				{
+					memcpy(new_names, names, names_size * sizeof(char_t));
+					xml_memory::deallocate(names);
+				}
+
+				names = new_names;
+				names_capacity = new_capacity;
+			}
+
+			memcpy(names + names_size, name, length * sizeof(char_t));
+
+			name_offsets[depth++] = names_size;
+			names_size += length;
+
+			return true;
 		}
-	};
-	
-	PUGI__FN char_t* strconv_escape(char_t* s, gap& g)
-	{
-		char_t* stre = s + 1;
 
-		switch (*stre)
+		bool add_event(xml_node_struct* node, unsigned int level, bool end)
 		{
-			case '#':	// &#...
+			if (event_count == event_capacity)
 			{
-				unsigned int ucsc = 0;
+				size_t new_capacity = event_capacity ? event_capacity * 2 : 8;
 
-				if (stre[1] == 'x') // &#x... (hex code)
+				xml_reader_event* new_events = static_cast<xml_reader_event*>(xml_memory::allocate(new_capacity * sizeof(xml_reader_event)));
+				if (!new_events) return false;
+
+				if (events)
 				{
-					stre += 2;
+					memcpy(new_events, events, event_count * sizeof(xml_reader_event));
+					xml_memory::deallocate(events);
+				}
 
-					char_t ch = *stre;
+				events = new_events;
+				event_capacity = new_capacity;
+			}
 
-					if (ch == ';') return stre;
+			xml_reader_event& e = events[event_count++];
 
-					for (;;)
-					{
-						if (static_cast<unsigned int>(ch - '0') <= 9)
-							ucsc = 16 * ucsc + (ch - '0');
-						else if (static_cast<unsigned int>((ch | ' ') - 'a') <= 5)
-							ucsc = 16 * ucsc + ((ch | ' ') - 'a' + 10);
-						else if (ch == ';')
-							break;
-						else // cancel
-							return stre;
+			e.node = node;
+			e.depth = level;
+			e.end = end;
+
+			if (!end && level == 0 && PUGI__NODETYPE(node) == node_element) has_element = true;
+
+			return true;
+		}
+
+		static bool is_open(xml_node_struct* node, xml_node_struct* cursor)
+		{
+			for (; cursor; cursor = cursor->parent)
+				if (cursor == node) return true;
+
+			return false;
+		}
+
+		// adds events for the parsed nodes in document order; elements that are still open only get the start event
+		bool add_events(xml_node_struct* node, unsigned int level, xml_node_struct* cursor)
+		{
+			for (; node; node = node->next_sibling)
+			{
+				if (!add_event(node, level, false)) return false;
+
+				if (PUGI__NODETYPE(node) == node_element)
+				{
+					if (!add_events(node->first_child, level + 1, cursor)) return false;
+
+					if (!is_open(node, cursor) && !add_event(node, level, true)) return false;
+				}
+			}
+
+			return true;
+		}
+
+		bool push_names(xml_node_struct* node, xml_node_struct* initial)
+		{
+			if (node == initial || node == document.internal_object()) return true;
+
+			return push_names(node->parent, initial) && push_name(node->name);
+		}
+
+		bool parse(char_t* s, char_t* end)
+		{
+			xml_allocator& alloc = *static_cast<xml_document_struct*>(document.internal_object());
+			xml_node_struct* root = document.internal_object();
+
+			if (!alloc.reserve()) return oom();
+
+			// set up the innermost open element; document node stands in for all other open elements
+			if (depth)
+			{
+				element->name = names + name_offsets[depth - 1];
+				element->parent = root;
+				element->first_child = has_children ? child : 0;
+
+				// the name of an element that was closed by the previous construct is not needed anymore
+				names_size = name_offsets[depth - 1] + strlength(element->name) + 1;
+			}
+			else names_size = 0;
+
+			xml_node_struct* initial = depth ? element : root;
+			xml_node_struct* cursor = initial;
+
+			// skip BOM to make sure it does not end up as part of parse output
+			if (offset + start == 0) s = xml_parser::parse_skip_bom(s);
+
+			// make the construct zero-terminated
+			char_t endch = *end;
+			*end = 0;
+
+			xml_parser parser(alloc);
+			char_t* r = parser.parse_tree(s, cursor, options, 0, false);
+
+			// update allocator state
+			alloc = parser.alloc;
+
+			*end = endch;
+			start = static_cast<size_t>(end - buffer);
+
+			if (!r)
+			{
+				size_t error_offset = offset + static_cast<size_t>(parser.error_offset - buffer);
+
+				// roll back offset if it occurs on a null terminator in the source buffer
+				if (eof && error_offset > 0 && error_offset == offset + size) error_offset--;
+
+				result = make_parse_result(parser.error_status, static_cast<ptrdiff_t>(error_offset));
+
+				return false;
+			}
+
+			// parser stops at an embedded zero
+			if (r != end) stop = r;
+
+			bool popped = (initial == element && !is_open(element, cursor));
+
+			if (!add_events((initial == element && has_children) ? child->next_sibling : initial->first_child, depth, cursor)) return oom();
+
+			if (popped)
+			{
+				if (!add_event(element, depth - 1, true)) return oom();
+
+				depth--;
+
+				if (!add_events(root->first_child, depth, cursor)) return oom();
+			}
+
+			// keep track of open elements
+			if (cursor != initial && cursor != root)
+			{
+				if (!push_names(cursor, initial)) return oom();
+
+				has_children = cursor->first_child != 0;
+			}
+			else has_children = has_children || popped || event_count != 0;
+
+			return true;
+		}
+
+		bool oom()
+		{
+			result = make_parse_result(status_out_of_memory);
+			return false;
+		}
+
+		void finish()
+		{
+			size_t length = offset + size;
+
+			if (depth)
+			{
+				// check that the last tag is closed; parsing stops at the first zero
+				size_t end_offset = stop ? offset + static_cast<size_t>(stop - buffer) : length;
+
+				result = make_parse_result(status_end_element_mismatch, static_cast<ptrdiff_t>((end_offset == length && end_offset > 0) ? end_offset - 1 : end_offset));
+			}
+			else if (!has_element && !(options & parse_fragment))
+				result = make_parse_result(status_no_document_element, static_cast<ptrdiff_t>(length));
+
+			done = true;
+		}
+
+		bool next()
+		{
+			// report the remaining nodes of the current markup construct
+			if (event_index < event_count)
+			{
+				current = events[event_index++];
+				return true;
+			}
+
+			current.node = 0;
+
+			while (result && !done)
+			{
+				release();
+
+				// parsing stopped at an embedded zero, just like it does for the document loaded into memory
+				if (stop)
+				{
+					finish();
+					return false;
+				}
+
+				// parse one markup construct at a time so that the nodes can be destroyed as soon as they are reported
+				char_t* s = buffer + start;
+				char_t* end = find_markup_end(s, *static_cast<xml_document_struct*>(document.internal_object()));
+
+				if (!end && !eof)
+				{
+					if (!fill()) return false;
+					continue;
+				}
+
+				if (!end) end = buffer + size;
+
+				if (end == s)
+				{
+					finish();
+					return false;
+				}
+
+				if (!parse(s, end)) return false;
+
+				if (event_count)
+				{
+					current = events[0];
+					event_index = 1;
+					return true;
+				}
+			}
+
+			return false;
+		}
+	};
+
+	// Output facilities
+	PUGI__FN xml_encoding get_write_native_encoding()
+	{
+	#ifdef PUGIXML_WCHAR_MODE
+		return get_wchar_encoding();
+	#else
+		return encoding_utf8;
+	#endif
+	}
+
+	PUGI__FN xml_encoding get_write_encoding(xml_encoding encoding)
+	{
+		// replace wchar encoding with utf implementation
+		if (encoding == encoding_wchar) return get_wchar_encoding();
+
+		// replace utf16 encoding with utf16 with specific endianness
+		if (encoding == encoding_utf16) return is_little_endian() ? encoding_utf16_le : encoding_utf16_be;
+
+		// replace utf32 encoding with utf32 with specific endianness
+		if (encoding == encoding_utf32) return is_little_endian() ? encoding_utf32_le : encoding_utf32_be;
+
+		// only do autodetection if no explicit encoding is requested
+		if (encoding != encoding_auto) return encoding;
+
+		// assume utf8 encoding
+		return encoding_utf8;
+	}
+
+#ifdef PUGIXML_WCHAR_MODE
+	PUGI__FN size_t get_valid_length(const char_t* data, size_t length)
+	{
+		if (length < 1) return 0;
+
+		// discard last character if it's the lead of a surrogate pair 
+		return (sizeof(wchar_t) == 2 && static_cast<unsigned int>(static_cast<uint16_t>(data[length - 1]) - 0xD800) < 0x400) ? length - 1 : length;
+	}
+
+	PUGI__FN size_t convert_buffer_output(char_t* r_char, uint8_t* r_u8, uint16_t* r_u16, uint32_t* r_u32, const char_t* data, size_t length, xml_encoding encoding)
+	{
+		// only endian-swapping is required
+		if (need_endian_swap_utf(encoding, get_wchar_encoding()))
+		{
+			convert_wchar_endian_swap(r_char, data, length);
+
+			return length * sizeof(char_t);
+		}
+	
+		// convert to utf8
+		if (encoding == encoding_utf8)
+		{
+			uint8_t* dest = r_u8;
+			uint8_t* end = utf_decoder<utf8_writer>::decode_wchar_block(data, length, dest);
+
+			return static_cast<size_t>(end - dest);
+		}
+
+		// convert to utf16
+		if (encoding == encoding_utf16_be || encoding == encoding_utf16_le)
+		{
+			uint16_t* dest = r_u16;
+
+			// convert to native utf16
+			uint16_t* end = utf_decoder<utf16_writer>::decode_wchar_block(data, length, dest);
+
+			// swap if necessary
+			xml_encoding native_encoding = is_little_endian() ? encoding_utf16_le : encoding_utf16_be;
+
+			if (native_encoding != encoding) convert_utf_endian_swap(dest, dest, static_cast<size_t>(end - dest));
+
+			return static_cast<size_t>(end - dest) * sizeof(uint16_t);
+		}
+
+		// convert to utf32
+		if (encoding == encoding_utf32_be || encoding == encoding_utf32_le)
+		{
+			uint32_t* dest = r_u32;
+
+			// convert to native utf32
+			uint32_t* end = utf_decoder<utf32_writer>::decode_wchar_block(data, length, dest);
+
+			// swap if necessary
+			xml_encoding native_encoding = is_little_endian() ? encoding_utf32_le : encoding_utf32_be;
+
+			if (native_encoding != encoding) convert_utf_endian_swap(dest, dest, static_cast<size_t>(end - dest));
+
+			return static_cast<size_t>(end - dest) * sizeof(uint32_t);
+		}
+
+		// convert to latin1
+		if (encoding == encoding_latin1)
+		{
+			uint8_t* dest = r_u8;
+			uint8_t* end = utf_decoder<latin1_writer>::decode_wchar_block(data, length, dest);
+
+			return static_cast<size_t>(end - dest);
+		}
+
+		assert(!"Invalid encoding");
+		return 0;
+	}
+#else
+	PUGI__FN size_t get_valid_length(const char_t* data, size_t length)
+	{
+		if (length < 5) return 0;
+
+		for (size_t i = 1; i <= 4; ++i)
+		{
+			uint8_t ch = static_cast<uint8_t>(data[length - i]);
+
+			// either a standalone character or a leading one
+			if ((ch & 0xc0) != 0x80) return length - i;
+		}
 
-						ch = *++stre;
-					}
-					
-					++stre;
-				}
-				else	// &#... (dec code)
-				{
-					char_t ch = *++stre;
+		// there are four non-leading characters at the end, sequence tail is broken so might as well process the whole chunk
+		return length;
+	}
 
-					if (ch == ';') return stre;
+	PUGI__FN size_t convert_buffer_output(char_t* /* r_char */, uint8_t* r_u8, uint16_t* r_u16, uint32_t* r_u32, const char_t* data, size_t length, xml_encoding encoding)
+	{
+		if (encoding == encoding_utf16_be || encoding == encoding_utf16_le)
+		{
+			uint16_t* dest = r_u16;
 
-					for (;;)
-					{
-						if (static_cast<unsigned int>(static_cast<unsigned int>(ch) - '0') <= 9)
-							ucsc = 10 * ucsc + (ch - '0');
-						else if (ch == ';')
-							break;
-						else // cancel
-							return stre;
+			// convert to native utf16
+			uint16_t* end = utf_decoder<utf16_writer>::decode_utf8_block(reinterpret_cast<const uint8_t*>(data), length, dest);
 
-						ch = *++stre;
-					}
-					
-					++stre;
-				}
+			// swap if necessary
+			xml_encoding native_encoding = is_little_endian() ? encoding_utf16_le : encoding_utf16_be;
 
-			#ifdef PUGIXML_WCHAR_MODE
-				s = reinterpret_cast<char_t*>(wchar_writer::any(reinterpret_cast<wchar_writer::value_type>(s), ucsc));
-			#else
-				s = reinterpret_cast<char_t*>(utf8_writer::any(reinterpret_cast<uint8_t*>(s), ucsc));
-			#endif
-					
-				g.push(s, stre - s);
-				return stre;
-			}
+			if (native_encoding != encoding) convert_utf_endian_swap(dest, dest, static_cast<size_t>(end - dest));
 
-			case 'a':	// &a
-			{
-				++stre;
+			return static_cast<size_t>(end - dest) * sizeof(uint16_t);
+		}
 
-				if (*stre == 'm') // &am
-				{
-					if (*++stre == 'p' && *++stre == ';') // &amp;
-					{
-						*s++ = '&';
-						++stre;
-							
-						g.push(s, stre - s);
-						return stre;
-					}
-				}
-				else if (*stre == 'p') // &ap
-				{
-					if (*++stre == 'o' && *++stre == 's' && *++stre == ';') // &apos;
-					{
-						*s++ = '\'';
-						++stre;
+		if (encoding == encoding_utf32_be || encoding == encoding_utf32_le)
+		{
+			uint32_t* dest = r_u32;
 
-						g.push(s, stre - s);
-						return stre;
-					}
-				}
-				break;
-			}
+			// convert to native utf32
+			uint32_t* end = utf_decoder<utf32_writer>::decode_utf8_block(reinterpret_cast<const uint8_t*>(data), length, dest);
 
-			case 'g': // &g
-			{
-				if (*++stre == 't' && *++stre == ';') // &gt;
-				{
-					*s++ = '>';
-					++stre;
-					
-					g.push(s, stre - s);
-					return stre;
-				}
-				break;
-			}
+			// swap if necessary
+			xml_encoding native_encoding = is_little_endian() ? encoding_utf32_le : encoding_utf32_be;
 
-			case 'l': // &l
-			{
-				if (*++stre == 't' && *++stre == ';') // &lt;
-				{
-					*s++ = '<';
-					++stre;
-						
-					g.push(s, stre - s);
-					return stre;
-				}
-				break;
-			}
+			if (native_encoding != encoding) convert_utf_endian_swap(dest, dest, static_cast<size_t>(end - dest));
 
-			case 'q': // &q
-			{
-				if (*++stre == 'u' && *++stre == 'o' && *++stre == 't' && *++stre == ';') // &quot;
-				{
-					*s++ = '"';
-					++stre;
-					
-					g.push(s, stre - s);
-					return stre;
-				}
-				break;
-			}
+			return static_cast<size_t>(end - dest) * sizeof(uint32_t);
+		}
 
-			default:
-				break;
+		if (encoding == encoding_latin1)
+		{
+			uint8_t* dest = r_u8;
+			uint8_t* end = utf_decoder<latin1_writer>::decode_utf8_block(reinterpret_cast<const uint8_t*>(data), length, dest);
+
+			return static_cast<size_t>(end - dest);
 		}
-		
-		return stre;
-	}
 
-	// Parser utilities
-	#define PUGI__ENDSWITH(c, e)        ((c) == (e) || ((c) == 0 && endch == (e)))
-	#define PUGI__SKIPWS()              { while (PUGI__IS_CHARTYPE(*s, ct_space)) ++s; }
-	#define PUGI__OPTSET(OPT)           ( optmsk & (OPT) )
-	#define PUGI__PUSHNODE(TYPE)        { cursor = append_new_node(cursor, alloc, TYPE); if (!cursor) PUGI__THROW_ERROR(status_out_of_memory, s); }
-	#define PUGI__POPNODE()             { cursor = cursor->parent; }
-	#define PUGI__SCANFOR(X)            { while (*s != 0 && !(X)) ++s; }
-	#define PUGI__SCANWHILE(X)          { while (X) ++s; }
-	#define PUGI__SCANWHILE_UNROLL(X)   { for (;;) { char_t ss = s[0]; if (PUGI__UNLIKELY(!(X))) { break; } ss = s[1]; if (PUGI__UNLIKELY(!(X))) { s += 1; break; } ss = s[2]; if (PUGI__UNLIKELY(!(X))) { s += 2; break; } ss = s[3]; if (PUGI__UNLIKELY(!(X))) { s += 3; break; } s += 4; } }
-	#define PUGI__ENDSEG()              { ch = *s; *s = 0; ++s; }
-	#define PUGI__THROW_ERROR(err, m)   return error_offset = m, error_status = err, static_cast<char_t*>(0)
-	#define PUGI__CHECK_ERROR(err, m)   { if (*s == 0) PUGI__THROW_ERROR(err, m); }
+		assert(!"Invalid encoding");
+		return 0;
+	}
+#endif
 
-	PUGI__FN char_t* strconv_comment(char_t* s, char_t endch)
+	class xml_buffered_writer
 	{
-		gap g;
-		
-		while (true)
+		xml_buffered_writer(const xml_buffered_writer&);
+		xml_buffered_writer& operator=(const xml_buffered_writer&);
+
+	public:
+		xml_buffered_writer(xml_writer& writer_, xml_encoding user_encoding): writer(writer_), bufsize(0), encoding(get_write_encoding(user_encoding))
 		{
-			PUGI__SCANWHILE_UNROLL(!PUGI__IS_CHARTYPE(ss, ct_parse_comment));
-		
-			if (*s == '\r') // Either a single 0x0d or 0x0d 0x0a pair
-			{
-				*s++ = '\n'; // replace first one with 0x0a
-				
-				if (*s == '\n') g.push(s, 1);
-			}
-			else if (s[0] == '-' && s[1] == '-' && PUGI__ENDSWITH(s[2], '>')) // comment ends here
-			{
-				*g.flush(s) = 0;
-				
-				return s + (s[2] == '>' ? 3 : 2);
-			}
-			else if (*s == 0)
-			{
-				return 0;
-			}
-			else ++s;
+			PUGI__STATIC_ASSERT(bufcapacity >= 8);
 		}
-	}
 
-	PUGI__FN char_t* strconv_cdata(char_t* s, char_t endch)
-	{
-		gap g;
-			
-		while (true)
+		~xml_buffered_writer()
 		{
-			PUGI__SCANWHILE_UNROLL(!PUGI__IS_CHARTYPE(ss, ct_parse_cdata));
-			
-			if (*s == '\r') // Either a single 0x0d or 0x0d 0x0a pair
-			{
-				*s++ = '\n'; // replace first one with 0x0a
-				
-				if (*s == '\n') g.push(s, 1);
-			}
-			else if (s[0] == ']' && s[1] == ']' && PUGI__ENDSWITH(s[2], '>')) // CDATA ends here
-			{
-				*g.flush(s) = 0;
-				
-				return s + 1;
-			}
-			else if (*s == 0)
-			{
-				return 0;
-			}
-			else ++s;
+			flush();
 		}
-	}
-	
-	typedef char_t* (*strconv_pcdata_t)(char_t*);
-		
-	template <typename opt_trim, typename opt_eol, typename opt_escape> struct strconv_pcdata_impl
-	{
-		static char_t* parse(char_t* s)
+
+		size_t flush()
 		{
-			gap g;
+			flush(buffer, bufsize);
+			bufsize = 0;
+			return 0;
+		}
 
-			char_t* begin = s;
+		void flush(const char_t* data, size_t size)
+		{
+			if (size == 0) return;
 
-			while (true)
+			// fast path, just write data
+			if (encoding == get_write_native_encoding())
+				writer.write(data, size * sizeof(char_t));
+			else
 			{
-				PUGI__SCANWHILE_UNROLL(!PUGI__IS_CHARTYPE(ss, ct_parse_pcdata));
+				// convert chunk
+				size_t result = convert_buffer_output(scratch.data_char, scratch.data_u8, scratch.data_u16, scratch.data_u32, data, size, encoding);
+				assert(result <= sizeof(scratch));
 
-				if (*s == '<') // PCDATA ends here
-				{
-					char_t* end = g.flush(s);
+				// write data
+				writer.write(scratch.data_u8, result);
+			}
+		}
 
-					if (opt_trim::value)
-						while (end > begin && PUGI__IS_CHARTYPE(end[-1], ct_space))
-							--end;
+		void write_direct(const char_t* data, size_t length)
+		{
+			// flush the remaining buffer contents
+			flush();
 
-					*end = 0;
-					
-					return s + 1;
-				}
-				else if (opt_eol::value && *s == '\r') // Either a single 0x0d or 0x0d 0x0a pair
-				{
-					*s++ = '\n'; // replace first one with 0x0a
-					
-					if (*s == '\n') g.push(s, 1);
-				}
-				else if (opt_escape::value && *s == '&')
+			// handle large chunks
+			if (length > bufcapacity)
+			{
+				if (encoding == get_write_native_encoding())
 				{
-					s = strconv_escape(s, g);
+					// fast path, can just write data chunk
+					writer.write(data, length * sizeof(char_t));
+					return;
 				}
-				else if (*s == 0)
-				{
-					char_t* end = g.flush(s);
 
-					if (opt_trim::value)
-						while (end > begin && PUGI__IS_CHARTYPE(end[-1], ct_space))
-							--end;
+				// need to convert in suitable chunks
+				while (length > bufcapacity)
+				{
+					// get chunk size by selecting such number of characters that are guaranteed to fit into scratch buffer
+					// and form a complete codepoint sequence (i.e. discard start of last codepoint if necessary)
+					size_t chunk_size = get_valid_length(data, bufcapacity);
+					assert(chunk_size);
 
-					*end = 0;
+					// convert chunk and write
+					flush(data, chunk_size);
 
-					return s;
+					// iterate
+					data += chunk_size;
+					length -= chunk_size;
 				}
-				else ++s;
+
+				// small tail is copied below
+				bufsize = 0;
 			}
-		}
-	};
-	
-	PUGI__FN strconv_pcdata_t get_strconv_pcdata(unsigned int optmask)
-	{
-		PUGI__STATIC_ASSERT(parse_escapes == 0x10 && parse_eol == 0x20 && parse_trim_pcdata == 0x0800);
 
-		switch (((optmask >> 4) & 3) | ((optmask >> 9) & 4)) // get bitmask for flags (eol escapes trim)
-		{
-		case 0: return strconv_pcdata_impl<opt_false, opt_false, opt_false>::parse;
-		case 1: return strconv_pcdata_impl<opt_false, opt_false, opt_true>::parse;
-		case 2: return strconv_pcdata_impl<opt_false, opt_true, opt_false>::parse;
-		case 3: return strconv_pcdata_impl<opt_false, opt_true, opt_true>::parse;
-		case 4: return strconv_pcdata_impl<opt_true, opt_false, opt_false>::parse;
-		case 5: return strconv_pcdata_impl<opt_true, opt_false, opt_true>::parse;
-		case 6: return strconv_pcdata_impl<opt_true, opt_true, opt_false>::parse;
-		case 7: return strconv_pcdata_impl<opt_true, opt_true, opt_true>::parse;
-		default: assert(false); return 0; // should not get here
+			memcpy(buffer + bufsize, data, length * sizeof(char_t));
+			bufsize += length;
 		}
-	}
 
-	typedef char_t* (*strconv_attribute_t)(char_t*, char_t);
-	
-	template <typename opt_escape> struct strconv_attribute_impl
-	{
-		static char_t* parse_wnorm(char_t* s, char_t end_quote)
+		void write_buffer(const char_t* data, size_t length)
 		{
-			gap g;
+			size_t offset = bufsize;
 
-			// trim leading whitespaces
-			if (PUGI__IS_CHARTYPE(*s, ct_space))
+			if (offset + length <= bufcapacity)
 			{
-				char_t* str = s;
-				
-				do ++str;
-				while (PUGI__IS_CHARTYPE(*str, ct_space));
-				
-				g.push(s, str - s);
+				memcpy(buffer + offset, data, length * sizeof(char_t));
+				bufsize = offset + length;
 			}
-
-			while (true)
+			else
 			{
-				PUGI__SCANWHILE_UNROLL(!PUGI__IS_CHARTYPE(ss, ct_parse_attr_ws | ct_space));
-				
-				if (*s == end_quote)
-				{
-					char_t* str = g.flush(s);
-					
-					do *str-- = 0;
-					while (PUGI__IS_CHARTYPE(*str, ct_space));
-				
-					return s + 1;
-				}
-				else if (PUGI__IS_CHARTYPE(*s, ct_space))
-				{
-					*s++ = ' ';
-		
-					if (PUGI__IS_CHARTYPE(*s, ct_space))
-					{
-						char_t* str = s + 1;
-						while (PUGI__IS_CHARTYPE(*str, ct_space)) ++str;
-						
-						g.push(s, str - s);
-					}
-				}
-				else if (opt_escape::value && *s == '&')
-				{
-					s = strconv_escape(s, g);
-				}
-				else if (!*s)
-				{
-					return 0;
-				}
-				else ++s;
+				write_direct(data, length);
 			}
 		}
 
-		static char_t* parse_wconv(char_t* s, char_t end_quote)
+		void write_string(const char_t* data)
 		{
-			gap g;
+			// write the part of the string that fits in the buffer
+			size_t offset = bufsize;
 
-			while (true)
+			while (*data && offset < bufcapacity)
+				buffer[offset++] = *data++;
+
+			// write the rest
+			if (offset < bufcapacity)
 			{
-				PUGI__SCANWHILE_UNROLL(!PUGI__IS_CHARTYPE(ss, ct_parse_attr_ws));
-				
-				if (*s == end_quote)
-				{
-					*g.flush(s) = 0;
-				
-					return s + 1;
-				}
-				else if (PUGI__IS_CHARTYPE(*s, ct_space))
-				{
-					if (*s == '\r')
-					{
-						*s++ = ' ';
-				
-						if (*s == '\n') g.push(s, 1);
-					}
-					else *s++ = ' ';
-				}
-				else if (opt_escape::value && *s == '&')
-				{
-					s = strconv_escape(s, g);
-				}
-				else if (!*s)
-				{
-					return 0;
-				}
-				else ++s;
+				bufsize = offset;
+			}
+			else
+			{
+				// backtrack a bit if we have split the codepoint
+				size_t length = offset - bufsize;
+				size_t extra = length - get_valid_length(data - length, length);
+
+				bufsize = offset - extra;
+
+				write_direct(data - extra, strlength(data) + extra);
 			}
 		}
 
-		static char_t* parse_eol(char_t* s, char_t end_quote)
+		void write(char_t d0)
 		{
-			gap g;
+			size_t offset = bufsize;
+			if (offset > bufcapacity - 1) offset = flush();
 
-			while (true)
-			{
-				PUGI__SCANWHILE_UNROLL(!PUGI__IS_CHARTYPE(ss, ct_parse_attr));
-				
-				if (*s == end_quote)
-				{
-					*g.flush(s) = 0;
-				
-					return s + 1;
-				}
-				else if (*s == '\r')
-				{
-					*s++ = '\n';
-					
-					if (*s == '\n') g.push(s, 1);
-				}
-				else if (opt_escape::value && *s == '&')
-				{
-					s = strconv_escape(s, g);
-				}
-				else if (!*s)
-				{
-					return 0;
-				}
-				else ++s;
-			}
+			buffer[offset + 0] = d0;
+			bufsize = offset + 1;
 		}
 
-		static char_t* parse_simple(char_t* s, char_t end_quote)
+		void write(char_t d0, char_t d1)
 		{
-			gap g;
+			size_t offset = bufsize;
+			if (offset > bufcapacity - 2) offset = flush();
 
-			while (true)
-			{
-				PUGI__SCANWHILE_UNROLL(!PUGI__IS_CHARTYPE(ss, ct_parse_attr));
-				
-				if (*s == end_quote)
-				{
-					*g.flush(s) = 0;
-				
-					return s + 1;
-				}
-				else if (opt_escape::value && *s == '&')
-				{
-					s = strconv_escape(s, g);
-				}
-				else if (!*s)
-				{
-					return 0;
-				}
-				else ++s;
-			}
+			buffer[offset + 0] = d0;
+			buffer[offset + 1] = d1;
+			bufsize = offset + 2;
 		}
-	};
 
-	PUGI__FN strconv_attribute_t get_strconv_attribute(unsigned int optmask)
-	{
-		PUGI__STATIC_ASSERT(parse_escapes == 0x10 && parse_eol == 0x20 && parse_wconv_attribute == 0x40 && parse_wnorm_attribute == 0x80);
-		
-		switch ((optmask >> 4) & 15) // get bitmask for flags (wconv wnorm eol escapes)
+		void write(char_t d0, char_t d1, char_t d2)
 		{
-		case 0:  return strconv_attribute_impl<opt_false>::parse_simple;
-		case 1:  return strconv_attribute_impl<opt_true>::parse_simple;
-		case 2:  return strconv_attribute_impl<opt_false>::parse_eol;
-		case 3:  return strconv_attribute_impl<opt_true>::parse_eol;
-		case 4:  return strconv_attribute_impl<opt_false>::parse_wconv;
-		case 5:  return strconv_attribute_impl<opt_true>::parse_wconv;
-		case 6:  return strconv_attribute_impl<opt_false>::parse_wconv;
-		case 7:  return strconv_attribute_impl<opt_true>::parse_wconv;
-		case 8:  return strconv_attribute_impl<opt_false>::parse_wnorm;
-		case 9:  return strconv_attribute_impl<opt_true>::parse_wnorm;
-		case 10: return strconv_attribute_impl<opt_false>::parse_wnorm;
-		case 11: return strconv_attribute_impl<opt_true>::parse_wnorm;
-		case 12: return strconv_attribute_impl<opt_false>::parse_wnorm;
-		case 13: return strconv_attribute_impl<opt_true>::parse_wnorm;
-		case 14: return strconv_attribute_impl<opt_false>::parse_wnorm;
-		case 15: return strconv_attribute_impl<opt_true>::parse_wnorm;
-		default: assert(false); return 0; // should not get here
+			size_t offset = bufsize;
+			if (offset > bufcapacity - 3) offset = flush();
+
+			buffer[offset + 0] = d0;
+			buffer[offset + 1] = d1;
+			buffer[offset + 2] = d2;
+			bufsize = offset + 3;
+		}
+
+		void write(char_t d0, char_t d1, char_t d2, char_t d3)
+		{
+			size_t offset = bufsize;
+			if (offset > bufcapacity - 4) offset = flush();
+
+			buffer[offset + 0] = d0;
+			buffer[offset + 1] = d1;
+			buffer[offset + 2] = d2;
+			buffer[offset + 3] = d3;
+			bufsize = offset + 4;
 		}
-	}
 
-	inline xml_parse_result make_parse_result(xml_parse_status status, ptrdiff_t offset = 0)
-	{
-		xml_parse_result result;
-		result.status = status;
-		result.offset = offset;
+		void write(char_t d0, char_t d1, char_t d2, char_t d3, char_t d4)
+		{
+			size_t offset = bufsize;
+			if (offset > bufcapacity - 5) offset = flush();
 
-		return result;
-	}
+			buffer[offset + 0] = d0;
+			buffer[offset + 1] = d1;
+			buffer[offset + 2] = d2;
+			buffer[offset + 3] = d3;
+			buffer[offset + 4] = d4;
+			bufsize = offset + 5;
+		}
 
-	struct xml_parser
-	{
-		xml_allocator alloc;
-		char_t* error_offset;
-		xml_parse_status error_status;
-		
-		xml_parser(const xml_allocator& alloc_): alloc(alloc_), error_offset(0), error_status(status_ok)
+		void write(char_t d0, char_t d1, char_t d2, char_t d3, char_t d4, char_t d5)
 		{
+			size_t offset = bufsize;
+			if (offset > bufcapacity - 6) offset = flush();
+
+			buffer[offset + 0] = d0;
+			buffer[offset + 1] = d1;
+			buffer[offset + 2] = d2;
+			buffer[offset + 3] = d3;
+			buffer[offset + 4] = d4;
+			buffer[offset + 5] = d5;
+			bufsize = offset + 6;
 		}
 
-		// DOCTYPE consists of nested sections of the following possible types:
-		// <!-- ... -->, <? ... ?>, "...", '...'
-		// <![...]]>
-		// <!...>
-		// First group can not contain nested groups
-		// Second group can contain nested groups of the same type
-		// Third group can contain all other groups
-		char_t* parse_doctype_primitive(char_t* s)
+		// utf8 maximum expansion: x4 (-> utf32)
+		// utf16 maximum expansion: x2 (-> utf32)
+		// utf32 maximum expansion: x1
+		enum
 		{
-			if (*s == '"' || *s == '\'')
-			{
-				// quoted string
-				char_t ch = *s++;
-				PUGI__SCANFOR(*s == ch);
-				if (!*s) PUGI__THROW_ERROR(status_bad_doctype, s);
-
-				s++;
-			}
-			else if (s[0] == '<' && s[1] == '?')
-			{
-				// <? ... ?>
-				s += 2;
-				PUGI__SCANFOR(s[0] == '?' && s[1] == '>'); // no need for ENDSWITH because ?> can't terminate proper doctype
-				if (!*s) PUGI__THROW_ERROR(status_bad_doctype, s);
+			bufcapacitybytes =
+			#ifdef PUGIXML_MEMORY_OUTPUT_STACK
+				PUGIXML_MEMORY_OUTPUT_STACK
+			#else
+				10240
+			#endif
+			,
+			bufcapacity = bufcapacitybytes / (sizeof(char_t) + 4)
+		};
 
-				s += 2;
-			}
-			else if (s[0] == '<' && s[1] == '!' && s[2] == '-' && s[3] == '-')
-			{
-				s += 4;
-				PUGI__SCANFOR(s[0] == '-' && s[1] == '-' && s[2] == '>'); // no need for ENDSWITH because --> can't terminate proper doctype
-				if (!*s) PUGI__THROW_ERROR(status_bad_doctype, s);
+		char_t buffer[bufcapacity];
 
-				s += 4;
-			}
-			else PUGI__THROW_ERROR(status_bad_doctype, s);
+		union
+		{
+			uint8_t data_u8[4 * bufcapacity];
+			uint16_t data_u16[2 * bufcapacity];
+			uint32_t data_u32[bufcapacity];
+			char_t data_char[bufcapacity];
+		} scratch;
 
-			return s;
-		}
+		xml_writer& writer;
+		size_t bufsize;
+		xml_encoding encoding;
+	};
 
-		char_t* parse_doctype_ignore(char_t* s)
+	PUGI__FN void text_output_escaped(xml_buffered_writer& writer, const char_t* s, chartypex_t type)
+	{
+		while (*s)
 		{
-			assert(s[0] == '<' && s[1] == '!' && s[2] == '[');
-			s++;
+			const char_t* prev = s;
+			
+			// While *s is a usual symbol
+			PUGI__SCANWHILE_UNROLL(!PUGI__IS_CHARTYPEX(ss, type));
+		
+			writer.write_buffer(prev, static_cast<size_t>(s - prev));
 
-			while (*s)
+			switch (*s)
 			{
-				if (s[0] == '<' && s[1] == '!' && s[2] == '[')
-				{
-					// nested ignore section
-					s = parse_doctype_ignore(s);
-					if (!s) return s;
-				}
-				else if (s[0] == ']' && s[1] == ']' && s[2] == '>')
+				case 0: break;
+				case '&':
+					writer.write('&', 'a', 'm', 'p', ';');
+					++s;
+					break;
+				case '<':
+					writer.write('&', 'l', 't', ';');
+					++s;
+					break;
+				case '>':
+					writer.write('&', 'g', 't', ';');
+					++s;
+					break;
+				case '"':
+					writer.write('&', 'q', 'u', 'o', 't', ';');
+					++s;
+					break;
+				default: // s is not a usual symbol
 				{
-					// ignore section end
-					s += 3;
+					unsigned int ch = static_cast<unsigned int>(*s++);
+					assert(ch < 32);
 
-					return s;
+					writer.write('&', '#', static_cast<char_t>((ch / 10) + '0'), static_cast<char_t>((ch % 10) + '0'), ';');
 				}
-				else s++;
 			}
-
-			PUGI__THROW_ERROR(status_bad_doctype, s);
 		}
+	}
 
-		char_t* parse_doctype_group(char_t* s, char_t endch, bool toplevel)
+	PUGI__FN void text_output(xml_buffered_writer& writer, const char_t* s, chartypex_t type, unsigned int flags)
+	{
+		if (flags & format_no_escapes)
+			writer.write_string(s);
+		else
+			text_output_escaped(writer, s, type);
+	}
+
+	PUGI__FN void text_output_cdata(xml_buffered_writer& writer, const char_t* s)
+	{
+		do
 		{
-			assert((s[0] == '<' || s[0] == 0) && s[1] == '!');
-			s++;
+			writer.write('<', '!', '[', 'C', 'D');
+			writer.write('A', 'T', 'A', '[');
 
-			while (*s)
-			{
-				if (s[0] == '<' && s[1] == '!' && s[2] != '-')
-				{
-					if (s[2] == '[')
-					{
-						// ignore
-						s = parse_doctype_ignore(s);
-						if (!s) return s;
-					}
-					else
-					{
-						// some control group
-						s = parse_doctype_group(s, endch, false);
-						if (!s) return s;
+			const char_t* prev = s;
 
-						// skip >
-						assert(*s == '>');
-						s++;
-					}
-				}
-				else if (s[0] == '<' || s[0] == '"' || s[0] == '\'')
-				{
-					// unknown tag (forbidden), or some primitive group
-					s = parse_doctype_primitive(s);
-					if (!s) return s;
-				}
-				else if (*s == '>')
-				{
-					return s;
-				}
-				else s++;
-			}
+			// look for ]]> sequence - we can't output it as is since it terminates CDATA
+			while (*s && !(s[0] == ']' && s[1] == ']' && s[2] == '>')) ++s;
 
-			if (!toplevel || endch != '>') PUGI__THROW_ERROR(status_bad_doctype, s);
+			// skip ]] if we stopped at ]]>, > will go to the next CDATA section
+			if (*s) s += 2;
 
-			return s;
+			writer.write_buffer(prev, static_cast<size_t>(s - prev));
+
+			writer.write(']', ']', '>');
 		}
+		while (*s);
+	}
 
-		char_t* parse_exclamation(char_t* s, xml_node_struct* cursor, unsigned int optmsk, char_t endch)
+	PUGI__FN void text_output_indent(xml_buffered_writer& writer, const char_t* indent, size_t indent_length, unsigned int depth)
+	{
+		switch (indent_length)
 		{
-			// parse node contents, starting with exclamation mark
-			++s;
+		case 1:
+		{
+			for (unsigned int i = 0; i < depth; ++i)
+				writer.write(indent[0]);
+			break;
+		}
 
-			if (*s == '-') // '<!-...'
-			{
-				++s;
+		case 2:
+		{
+			for (unsigned int i = 0; i < depth; ++i)
+				writer.write(indent[0], indent[1]);
+			break;
+		}
 
-				if (*s == '-') // '<!--...'
-				{
-					++s;
+		case 3:
+		{
+			for (unsigned int i = 0; i < depth; ++i)
+				writer.write(indent[0], indent[1], indent[2]);
+			break;
+		}
 
-					if (PUGI__OPTSET(parse_comments))
-					{
-						PUGI__PUSHNODE(node_comment); // Append a new node on the tree.
-						cursor->value = s; // Save the offset.
-					}
+		case 4:
+		{
+			for (unsigned int i = 0; i < depth; ++i)
+				writer.write(indent[0], indent[1], indent[2], indent[3]);
+			break;
+		}
+
+		default:
+		{
+			for (unsigned int i = 0; i < depth; ++i)
+				writer.write_buffer(indent, indent_length);
+		}
+		}
+	}
+
+	PUGI__FN void node_output_comment(xml_buffered_writer& writer, const char_t* s)
+	{
+		writer.write('<', '!', '-', '-');
 
-					if (PUGI__OPTSET(parse_eol) && PUGI__OPTSET(parse_comments))
-					{
-						s = strconv_comment(s, endch);
+		while (*s)
+		{
+			const char_t* prev = s;
 
-						if (!s) PUGI__THROW_ERROR(status_bad_comment, cursor->value);
-					}
-					else
-					{
-						// Scan for terminating '-->'.
-						PUGI__SCANFOR(s[0] == '-' && s[1] == '-' && PUGI__ENDSWITH(s[2], '>'));
-						PUGI__CHECK_ERROR(status_bad_comment, s);
+			// look for -\0 or -- sequence - we can't output it since -- is illegal in comment body
+			while (*s && !(s[0] == '-' && (s[1] == '-' || s[1] == 0))) ++s;
 
-						if (PUGI__OPTSET(parse_comments))
-							*s = 0; // Zero-terminate this segment at the first terminating '-'.
+			writer.write_buffer(prev, static_cast<size_t>(s - prev));
 
-						s += (s[2] == '>' ? 3 : 2); // Step over the '\0->'.
-					}
-				}
-				else PUGI__THROW_ERROR(status_bad_comment, s);
-			}
-			else if (*s == '[')
+			if (*s)
 			{
-				// '<![CDATA[...'
-				if (*++s=='C' && *++s=='D' && *++s=='A' && *++s=='T' && *++s=='A' && *++s == '[')
-				{
-					++s;
+				assert(*s == '-');
 
-					if (PUGI__OPTSET(parse_cdata))
-					{
-						PUGI__PUSHNODE(node_cdata); // Append a new node on the tree.
-						cursor->value = s; // Save the offset.
+				writer.write('-', ' ');
+				++s;
+			}
+		}
 
-						if (PUGI__OPTSET(parse_eol))
-						{
-							s = strconv_cdata(s, endch);
+		writer.write('-', '-', '>');
+	}
 
-							if (!s) PUGI__THROW_ERROR(status_bad_cdata, cursor->value);
-						}
-						else
-						{
-							// Scan for terminating ']]>'.
-							PUGI__SCANFOR(s[0] == ']' && s[1] == ']' && PUGI__ENDSWITH(s[2], '>'));
-							PUGI__CHECK_ERROR(status_bad_cdata, s);
+	PUGI__FN void node_output_attributes(xml_buffered_writer& writer, const xml_node node, unsigned int flags)
+	{
+		const char_t* default_name = PUGIXML_TEXT(":anonymous");
 
-							*s++ = 0; // Zero-terminate this segment.
-						}
-					}
-					else // Flagged for discard, but we still have to scan for the terminator.
-					{
-						// Scan for terminating ']]>'.
-						PUGI__SCANFOR(s[0] == ']' && s[1] == ']' && PUGI__ENDSWITH(s[2], '>'));
-						PUGI__CHECK_ERROR(status_bad_cdata, s);
+		for (xml_attribute a = node.first_attribute(); a; a = a.next_attribute())
+		{
+			writer.write(' ');
+			writer.write_string(a.name()[0] ? a.name() : default_name);
+			writer.write('=', '"');
 
-						++s;
-					}
+			text_output(writer, a.value(), ctx_special_attr, flags);
 
-					s += (s[1] == '>' ? 2 : 1); // Step over the last ']>'.
-				}
-				else PUGI__THROW_ERROR(status_bad_cdata, s);
-			}
-			else if (s[0] == 'D' && s[1] == 'O' && s[2] == 'C' && s[3] == 'T' && s[4] == 'Y' && s[5] == 'P' && PUGI__ENDSWITH(s[6], 'E'))
-			{
-				s -= 2;
+			writer.write('"');
+		}
+	}
 
-				if (cursor->parent) PUGI__THROW_ERROR(status_bad_doctype, s);
+	PUGI__FN bool node_output_start(xml_buffered_writer& writer, const xml_node node, unsigned int flags)
+	{
+		const char_t* default_name = PUGIXML_TEXT(":anonymous");
+		const char_t* name = node.name()[0] ? node.name() : default_name;
 
-				char_t* mark = s + 9;
+		writer.write('<');
+		writer.write_string(name);
 
-				s = parse_doctype_group(s, endch, true);
-				if (!s) return s;
+		if (node.first_attribute())
+			node_output_attributes(writer, node, flags);
 
-				assert((*s == 0 && endch == '>') || *s == '>');
-				if (*s) *s++ = 0;
+		// text embedded with parse_embed_pcdata is printed before the children
+		const char_t* text = get_embedded_pcdata(node.internal_object());
 
-				if (PUGI__OPTSET(parse_doctype))
+		if (flags & format_raw)
+		{
+			if (!node.first_child())
+			{
+				if (text)
 				{
-					while (PUGI__IS_CHARTYPE(*mark, ct_space)) ++mark;
-
-					PUGI__PUSHNODE(node_doctype);
-
-					cursor->value = mark;
-
-					PUGI__POPNODE();
+					writer.write('>');
+					text_output(writer, text, ctx_special_pcdata, flags);
+					writer.write('<', '/');
+					writer.write_string(name);
+					writer.write('>');
 				}
+				else
+					writer.write(' ', '/', '>');
 			}
-			else if (*s == 0 && endch == '-') PUGI__THROW_ERROR(status_bad_comment, s);
-			else if (*s == 0 && endch == '[') PUGI__THROW_ERROR(status_bad_cdata, s);
-			else PUGI__THROW_ERROR(status_unrecognized_tag, s);
+			else
+			{
+				writer.write('>');
 
-			return s;
+				return true;
+			}
 		}
-
-		char_t* parse_question(char_t* s, xml_node_struct*& ref_cursor, unsigned int optmsk, char_t endch)
+		else
 		{
-			// load into registers
-			xml_node_struct* cursor = ref_cursor;
-			char_t ch = 0;
+			xml_node first = node.first_child();
 
-			// parse node contents, starting with question mark
-			++s;
+			if (!first)
+			{
+				if (text)
+				{
+					writer.write('>');
+					text_output(writer, text, ctx_special_pcdata, flags);
+					writer.write('<', '/');
+					writer.write_string(name);
+					writer.write('>', '\n');
+				}
+				else
+					writer.write(' ', '/', '>', '\n');
+			}
+			else if (!text && !first.next_sibling() && (first.type() == node_pcdata || first.type() == node_cdata))
+			{
+				writer.write('>');
 
-			// read PI target
-			char_t* target = s;
+				if (first.type() == node_pcdata)
+					text_output(writer, first.value(), ctx_special_pcdata, flags);
+				else
+					text_output_cdata(writer, first.value());
 
-			if (!PUGI__IS_CHARTYPE(*s, ct_start_symbol)) PUGI__THROW_ERROR(status_bad_pi, s);
+				writer.write('<', '/');
+				writer.write_string(name);
+				writer.write('>', '\n');
+			}
+			else
+			{
+				writer.write('>', '\n');
 
-			PUGI__SCANWHILE(PUGI__IS_CHARTYPE(*s, ct_symbol));
-			PUGI__CHECK_ERROR(status_bad_pi, s);
+				return true;
+			}
+		}
 
-			// determine node type; stricmp / strcasecmp is not portable
-			bool declaration = (target[0] | ' ') == 'x' && (target[1] | ' ') == 'm' && (target[2] | ' ') == 'l' && target + 3 == s;
+		return false;
+	}
 
-			if (declaration ? PUGI__OPTSET(parse_declaration) : PUGI__OPTSET(parse_pi))
-			{
-				if (declaration)
-				{
-					// disallow non top-level declarations
-					if (cursor->parent) PUGI__THROW_ERROR(status_bad_pi, s);
+	PUGI__FN void node_output_end(xml_buffered_writer& writer, const xml_node node, unsigned int flags)
+	{
+		const char_t* default_name = PUGIXML_TEXT(":anonymous");
+		const char_t* name = node.name()[0] ? node.name() : default_name;
 
-					PUGI__PUSHNODE(node_declaration);
-				}
-				else
-				{
-					PUGI__PUSHNODE(node_pi);
-				}
+		writer.write('<', '/');
+		writer.write_string(name);
 
-				cursor->name = target;
+		if (flags & format_raw)
+			writer.write('>');
+		else
+			writer.write('>', '\n');
+	}
 
-				PUGI__ENDSEG();
+	PUGI__FN void node_output_simple(xml_buffered_writer& writer, const xml_node node, unsigned int flags)
+	{
+		const char_t* default_name = PUGIXML_TEXT(":anonymous");
 
-				// parse value/attributes
-				if (ch == '?')
-				{
-					// empty node
-					if (!PUGI__ENDSWITH(*s, '>')) PUGI__THROW_ERROR(status_bad_pi, s);
-					s += (*s == '>');
+		switch (node.type())
+		{
+			case node_pcdata:
+				text_output(writer, node.value(), ctx_special_pcdata, flags);
+				if ((flags & format_raw) == 0) writer.write('\n');
+				break;
 
-					PUGI__POPNODE();
-				}
-				else if (PUGI__IS_CHARTYPE(ch, ct_space))
-				{
-					PUGI__SKIPWS();
+			case node_cdata:
+				text_output_cdata(writer, node.value());
+				if ((flags & format_raw) == 0) writer.write('\n');
+				break;
 
-					// scan for tag end
-					char_t* value = s;
+			case node_comment:
+				node_output_comment(writer, node.value());
+				if ((flags & format_raw) == 0) writer.write('\n');
+				break;
 
-					PUGI__SCANFOR(s[0] == '?' && PUGI__ENDSWITH(s[1], '>'));
-					PUGI__CHECK_ERROR(status_bad_pi, s);
+			case node_pi:
+				writer.write('<', '?');
+				writer.write_string(node.name()[0] ? node.name() : default_name);
 
-					if (declaration)
-					{
-						// replace ending ? with / so that 'element' terminates properly
-						*s = '/';
+				if (node.value()[0])
+				{
+					writer.write(' ');
+					writer.write_string(node.value());
+				}
 
-						// we exit from this function with cursor at node_declaration, which is a signal to parse() to go to LOC_ATTRIBUTES
-						s = value;
-					}
-					else
-					{
-						// store value and step over >
-						cursor->value = value;
-						PUGI__POPNODE();
+				writer.write('?', '>');
+				if ((flags & format_raw) == 0) writer.write('\n');
+				break;
 
-						PUGI__ENDSEG();
+			case node_declaration:
+				writer.write('<', '?');
+				writer.write_string(node.name()[0] ? node.name() : default_name);
+				node_output_attributes(writer, node, flags);
+				writer.write('?', '>');
+				if ((flags & format_raw) == 0) writer.write('\n');
+				break;
 
-						s += (*s == '>');
-					}
-				}
-				else PUGI__THROW_ERROR(status_bad_pi, s);
-			}
-			else
-			{
-				// scan for tag end
-				PUGI__SCANFOR(s[0] == '?' && PUGI__ENDSWITH(s[1], '>'));
-				PUGI__CHECK_ERROR(status_bad_pi, s);
+			case node_doctype:
+				writer.write('<', '!', 'D', 'O', 'C');
+				writer.write('T', 'Y', 'P', 'E');
 
-				s += (s[1] == '>' ? 2 : 1);
-			}
+				if (node.value()[0])
+				{
+					writer.write(' ');
+					writer.write_string(node.value());
+				}
 
-			// store from registers
-			ref_cursor = cursor;
+				writer.write('>');
+				if ((flags & format_raw) == 0) writer.write('\n');
+				break;
 
-			return s;
+			default:
+				assert(!"Invalid node type");
 		}
+	}
+
+	PUGI__FN void node_output(xml_buffered_writer& writer, const xml_node root, const char_t* indent, unsigned int flags, unsigned int depth)
+	{
+		size_t indent_length = ((flags & (format_indent | format_raw)) == format_indent) ? strlength(indent) : 0;
+
+		xml_node node = root;
 
-		char_t* parse_tree(char_t* s, xml_node_struct* root, unsigned int optmsk, char_t endch)
+		do
 		{
-			strconv_attribute_t strconv_attribute = get_strconv_attribute(optmsk);
-			strconv_pcdata_t strconv_pcdata = get_strconv_pcdata(optmsk);
-			
-			char_t ch = 0;
-			xml_node_struct* cursor = root;
-			char_t* mark = s;
+			assert(node);
 
-			while (*s != 0)
+			// begin writing current node
+			if (indent_length)
+				text_output_indent(writer, indent, indent_length, depth);
+
+			if (node.type() == node_element)
 			{
-				if (*s == '<')
+				if (node_output_start(writer, node, flags))
 				{
-					++s;
+					const char_t* text = get_embedded_pcdata(node.internal_object());
 
-				LOC_TAG:
-					if (PUGI__IS_CHARTYPE(*s, ct_start_symbol)) // '<#...'
+					if (text)
 					{
-						PUGI__PUSHNODE(node_element); // Append a new node to the tree.
-
-						cursor->name = s;
-
-						PUGI__SCANWHILE_UNROLL(PUGI__IS_CHARTYPE(ss, ct_symbol)); // Scan for a terminator.
-						PUGI__ENDSEG(); // Save char in 'ch', terminate & step over.
-
-						if (ch == '>')
-						{
-							// end of tag
-						}
-						else if (PUGI__IS_CHARTYPE(ch, ct_space))
-						{
-						LOC_ATTRIBUTES:
-							while (true)
-							{
-								PUGI__SKIPWS(); // Eat any whitespace.
-						
-								if (PUGI__IS_CHARTYPE(*s, ct_start_symbol)) // <... #...
-								{
-									xml_attribute_struct* a = append_new_attribute(cursor, alloc); // Make space for this attribute.
-									if (!a) PUGI__THROW_ERROR(status_out_of_memory, s);
-
-									a->name = s; // Save the offset.
-
-									PUGI__SCANWHILE_UNROLL(PUGI__IS_CHARTYPE(ss, ct_symbol)); // Scan for a terminator.
-									PUGI__CHECK_ERROR(status_bad_attribute, s); //$ redundant, left for performance
+						if (indent_length)
+							text_output_indent(writer, indent, indent_length, depth + 1);
 
-									PUGI__ENDSEG(); // Save char in 'ch', terminate & step over.
-									PUGI__CHECK_ERROR(status_bad_attribute, s); //$ redundant, left for performance
+						text_output(writer, text, ctx_special_pcdata, flags);
+						if ((flags & format_raw) == 0) writer.write('\n');
+					}
 
-									if (PUGI__IS_CHARTYPE(ch, ct_space))
-									{
-										PUGI__SKIPWS(); // Eat any whitespace.
-										PUGI__CHECK_ERROR(status_bad_attribute, s); //$ redundant, left for performance
+					node = node.first_child();
+					depth++;
+					continue;
+				}
+			}
+			else if (node.type() == node_document)
+			{
+				if (node.first_child())
+				{
+					node = node.first_child();
+					continue;
+				}
+			}
+			else
+			{
+				node_output_simple(writer, node, flags);
+			}
 
-										ch = *s;
-										++s;
-									}
-									
-									if (ch == '=') // '<... #=...'
-									{
-										PUGI__SKIPWS(); // Eat any whitespace.
+			// continue to the next node
+			while (node != root)
+			{
+				if (node.next_sibling())
+				{
+					node = node.next_sibling();
+					break;
+				}
 
-										if (*s == '"' || *s == '\'') // '<... #="...'
-										{
-											ch = *s; // Save quote char to avoid breaking on "''" -or- '""'.
-											++s; // Step over the quote.
-											a->value = s; // Save the offset.
+				node = node.parent();
+				depth--;
 
-											s = strconv_attribute(s, ch);
-										
-											if (!s) PUGI__THROW_ERROR(status_bad_attribute, a->value);
+				// write closing node
+				if (node.type() == node_element)
+				{
+					if (indent_length)
+						text_output_indent(writer, indent, indent_length, depth);
 
-											// After this line the loop continues from the start;
-											// Whitespaces, / and > are ok, symbols and EOF are wrong,
-											// everything else will be detected
-											if (PUGI__IS_CHARTYPE(*s, ct_start_symbol)) PUGI__THROW_ERROR(status_bad_attribute, s);
-										}
-										else PUGI__THROW_ERROR(status_bad_attribute, s);
-									}
-									else PUGI__THROW_ERROR(status_bad_attribute, s);
-								}
-								else if (*s == '/')
-								{
-									++s;
-									
-									if (*s == '>')
-									{
-										PUGI__POPNODE();
-										s++;
-										break;
-									}
-									else if (*s == 0 && endch == '>')
-									{
-										PUGI__POPNODE();
-										break;
-									}
-									else PUGI__THROW_ERROR(status_bad_start_element, s);
-								}
-								else if (*s == '>')
-								{
-									++s;
+					node_output_end(writer, node, flags);
+				}
+			}
+		}
+		while (node != root);
+	}
 
-									break;
-								}
-								else if (*s == 0 && endch == '>')
-								{
-									break;
-								}
-								else PUGI__THROW_ERROR(status_bad_start_element, s);
-							}
+	PUGI__FN bool has_declaration(const xml_node node)
+	{
+		for (xml_node child = node.first_child(); child; child = child.next_sibling())
+		{
+			xml_node_type type = child.type();
 
-							// !!!
-						}
-						else if (ch == '/') // '<#.../'
-						{
-							if (!PUGI__ENDSWITH(*s, '>')) PUGI__THROW_ERROR(status_bad_start_element, s);
+			if (type == node_declaration) return true;
+			if (type == node_element) return false;
+		}
 
-							PUGI__POPNODE(); // Pop.
+		return false;
+	}
 
-							s += (*s == '>');
-						}
-						else if (ch == 0)
-						{
-							// we stepped over null terminator, backtrack & handle closing tag
-							--s;
-							
-							if (endch != '>') PUGI__THROW_ERROR(status_bad_start_element, s);
-						}
-						else PUGI__THROW_ERROR(status_bad_start_element, s);
-					}
-					else if (*s == '/')
-					{
-						++s;
+	PUGI__FN bool is_attribute_of(xml_attribute_struct* attr, xml_node_struct* node)
+	{
+		for (xml_attribute_struct* a = node->first_attribute; a; a = a->next_attribute)
+			if (a == attr)
+				return true;
 
-						char_t* name = cursor->name;
-						if (!name) PUGI__THROW_ERROR(status_end_element_mismatch, s);
-						
-						while (PUGI__IS_CHARTYPE(*s, ct_symbol))
-						{
-							if (*s++ != *name++) PUGI__THROW_ERROR(status_end_element_mismatch, s);
-						}
+		return false;
+	}
 
-						if (*name)
-						{
-							if (*s == 0 && name[0] == endch && name[1] == 0) PUGI__THROW_ERROR(status_bad_end_element, s);
-							else PUGI__THROW_ERROR(status_end_element_mismatch, s);
-						}
-							
-						PUGI__POPNODE(); // Pop.
+	PUGI__FN bool allow_insert_child(xml_node_type parent, xml_node_type child)
+	{
+		if (parent != node_document && parent != node_element) return false;
+		if (child == node_document || child == node_null) return false;
+		if (parent != node_document && (child == node_declaration || child == node_doctype)) return false;
 
-						PUGI__SKIPWS();
+		return true;
+	}
 
-						if (*s == 0)
-						{
-							if (endch != '>') PUGI__THROW_ERROR(status_bad_end_element, s);
-						}
-						else
-						{
-							if (*s != '>') PUGI__THROW_ERROR(status_bad_end_element, s);
-							++s;
-						}
-					}
-					else if (*s == '?') // '<?...'
-					{
-						s = parse_question(s, cursor, optmsk, endch);
-						if (!s) return s;
+	PUGI__FN bool allow_move(const xml_node parent, const xml_node child)
+	{
+		// check that child can be a child of parent
+		if (!allow_insert_child(parent.type(), child.type()))
+			return false;
 
-						assert(cursor);
-						if (PUGI__NODETYPE(cursor) == node_declaration) goto LOC_ATTRIBUTES;
-					}
-					else if (*s == '!') // '<!...'
-					{
-						s = parse_exclamation(s, cursor, optmsk, endch);
-						if (!s) return s;
-					}
-					else if (*s == 0 && endch == '?') PUGI__THROW_ERROR(status_bad_pi, s);
-					else PUGI__THROW_ERROR(status_unrecognized_tag, s);
-				}
-				else
-				{
-					mark = s; // Save this offset while searching for a terminator.
+		// check that node is not moved between documents
+		if (parent.root() != child.root())
+			return false;
 
-					PUGI__SKIPWS(); // Eat whitespace if no genuine PCDATA here.
+		// check that new parent is not in the child subtree
+		xml_node cur = parent;
 
-					if (*s == '<' || !*s)
-					{
-						// We skipped some whitespace characters because otherwise we would take the tag branch instead of PCDATA one
-						assert(mark != s);
+		while (cur)
+		{
+			if (cur == child)
+				return false;
 
-						if (!PUGI__OPTSET(parse_ws_pcdata | parse_ws_pcdata_single) || PUGI__OPTSET(parse_trim_pcdata))
-						{
-							continue;
-						}
-						else if (PUGI__OPTSET(parse_ws_pcdata_single))
-						{
-							if (s[0] != '<' || s[1] != '/' || cursor->first_child) continue;
-						}
-					}
+			cur = cur.parent();
+		}
 
-					if (!PUGI__OPTSET(parse_trim_pcdata))
-						s = mark;
-							
-					if (cursor->parent || PUGI__OPTSET(parse_fragment))
-					{
-						PUGI__PUSHNODE(node_pcdata); // Append a new node on the tree.
-						cursor->value = s; // Save the offset.
+		return true;
+	}
 
-						s = strconv_pcdata(s);
-								
-						PUGI__POPNODE(); // Pop since this is a standalone.
-						
-						if (!*s) break;
-					}
-					else
-					{
-						PUGI__SCANFOR(*s == '<'); // '...<'
-						if (!*s) break;
-						
-						++s;
-					}
+	template <typename String> PUGI__FN void node_copy_string(String& dest, xml_header& header, uintptr_t header_mask, char_t* source, xml_header& source_header, xml_allocator* alloc)
+	{
+		if (source)
+		{
+			if (alloc && (source_header & header_mask) == 0)
+			{
+				dest = source;
 
-					// We're after '<'
-					goto LOC_TAG;
-				}
+				// since strcpy_insitu can reuse document buffer memory we need to mark both source and dest as shared
+				header |= xml_memory_page_contents_shared_mask;
+				source_header |= xml_memory_page_contents_shared_mask;
 			}
-
-			// check that last tag is closed
-			if (cursor != root) PUGI__THROW_ERROR(status_end_element_mismatch, s);
-
-			return s;
+			else
+				strcpy_insitu(dest, header, header_mask, source);
 		}
+	}
 
-	#ifdef PUGIXML_WCHAR_MODE
-		static char_t* parse_skip_bom(char_t* s)
+	template <typename Object> PUGI__FN void node_copy_name(Object* dest, Object* source, xml_allocator* shared_alloc)
+	{
+		if (get_document(dest).names)
 		{
-			unsigned int bom = 0xfeff;
-			return (s[0] == static_cast<wchar_t>(bom)) ? s + 1 : s;
+			// names of the same document are already in the table
+			if (!source->name) return;
+
+			if (shared_alloc) dest->name = source->name;
+			else set_name(dest, source->name);
 		}
-	#else
-		static char_t* parse_skip_bom(char_t* s)
+		else
+			node_copy_string(dest->name, dest->header, xml_memory_page_name_allocated_mask, source->name, source->header, shared_alloc);
+	}
+
+	PUGI__FN void node_copy_contents(xml_node_struct* dn, xml_node_struct* sn, xml_allocator* shared_alloc)
+	{
+		node_copy_name(dn, sn, shared_alloc);
+		node_copy_string(dn->value, dn->header, xml_memory_page_value_allocated_mask, sn->value ? get_value(sn) : 0, sn->header, shared_alloc);
+
+		for (xml_attribute_struct* sa = sn->first_attribute; sa; sa = sa->next_attribute)
 		{
-			return (s[0] == '\xef' && s[1] == '\xbb' && s[2] == '\xbf') ? s + 3 : s;
+			xml_attribute_struct* da = append_new_attribute(dn, get_allocator(dn));
+
+			if (da)
+			{
+				node_copy_name(da, sa, shared_alloc);
+				node_copy_string(da->value, da->header, xml_memory_page_value_allocated_mask, sa->value ? get_value(sa) : 0, sa->header, shared_alloc);
+			}
 		}
-	#endif
+	}
 
-		static bool has_element_node_siblings(xml_node_struct* node)
+	PUGI__FN void node_copy_tree(xml_node_struct* dn, xml_node_struct* sn)
+	{
+		xml_allocator& alloc = get_allocator(dn);
+		xml_allocator* shared_alloc = (&alloc == &get_allocator(sn)) ? &alloc : 0;
+
+		node_copy_contents(dn, sn, shared_alloc);
+
+		xml_node_struct* dit = dn;
+		xml_node_struct* sit = get_first_child(sn);
+
+		while (sit && sit != sn)
 		{
-			while (node)
+			if (sit != dn)
 			{
-				if (PUGI__NODETYPE(node) == node_element) return true;
+				xml_node_struct* copy = append_new_node(dit, alloc, PUGI__NODETYPE(sit));
 
-				node = node->next_sibling;
+				if (copy)
+				{
+					node_copy_contents(copy, sit, shared_alloc);
+
+					if (get_first_child(sit))
+					{
+						dit = copy;
+						sit = sit->first_child;
+						continue;
+					}
+				}
 			}
 
-			return false;
+			// continue to the next node
+			do
+			{
+				if (sit->next_sibling)
+				{
+					sit = sit->next_sibling;
+					break;
+				}
+
+				sit = sit->parent;
+				dit = dit->parent;
+			}
+			while (sit != sn);
 		}
+	}
 
-		static xml_parse_result parse(char_t* buffer, size_t length, xml_document_struct* xmldoc, xml_node_struct* root, unsigned int optmsk)
-		{
-			// allocator object is a part of document object
-			xml_allocator& alloc_ = *static_cast<xml_allocator*>(xmldoc);
+	inline bool is_text_node(xml_node_struct* node)
+	{
+		xml_node_type type = PUGI__NODETYPE(node);
 
-			// early-out for empty documents
-			if (length == 0)
-				return make_parse_result(PUGI__OPTSET(parse_fragment) ? status_ok : status_no_document_element);
+		return type == node_pcdata || type == node_cdata;
+	}
 
-			// get last child of the root before parsing
-			xml_node_struct* last_root_child = root->first_child ? root->first_child->prev_sibling_c : 0;
-	
-			// create parser on stack
-			xml_parser parser(alloc_);
+	// get value with conversion functions
+	template <typename U> PUGI__FN bool string_to_integer(const char_t* value, U minneg, U maxpos, U& out_result)
+	{
+		const char_t* s = value;
 
-			// save last character and make buffer zero-terminated (speeds up parsing)
-			char_t endch = buffer[length - 1];
-			buffer[length - 1] = 0;
-			
-			// skip BOM to make sure it does not end up as part of parse output
-			char_t* buffer_data = parse_skip_bom(buffer);
+		while (PUGI__IS_CHARTYPE(*s, ct_space))
+			s++;
 
-			// perform actual parsing
-			parser.parse_tree(buffer_data, root, optmsk, endch);
+		bool negative = (*s == '-');
 
-			// update allocator state
-			alloc_ = parser.alloc;
+		s += (*s == '+' || *s == '-');
 
-			xml_parse_result result = make_parse_result(parser.error_status, parser.error_offset ? parser.error_offset - buffer : 0);
-			assert(result.offset >= 0 && static_cast<size_t>(result.offset) <= length);
+		U result = 0;
+		bool overflow = false;
+		const char_t* start;
 
-			if (result)
+		if (s[0] == '0' && (s[1] | ' ') == 'x')
+		{
+			s += 2;
+			start = s;
+
+			for (;; ++s)
 			{
-				// since we removed last character, we have to handle the only possible false positive (stray <)
-				if (endch == '<')
-					return make_parse_result(status_unrecognized_tag, length - 1);
+				unsigned int digit;
 
-				// check if there are any element nodes parsed
-				xml_node_struct* first_root_child_parsed = last_root_child ? last_root_child->next_sibling : root->first_child;
+				if (static_cast<unsigned int>(*s - '0') < 10)
+					digit = static_cast<unsigned int>(*s - '0');
+				else if (static_cast<unsigned int>((*s | ' ') - 'a') < 6)
+					digit = static_cast<unsigned int>((*s | ' ') - 'a' + 10);
+				else
+					break;
 
-				if (!PUGI__OPTSET(parse_fragment) && !has_element_node_siblings(first_root_child_parsed))
-					return make_parse_result(status_no_document_element, length - 1);
+				overflow |= (result >> (sizeof(U) * 8 - 4)) != 0;
+				result = static_cast<U>(result * 16 + digit);
 			}
-			else
+		}
+		else
+		{
+			start = s;
+
+			for (; static_cast<unsigned int>(*s - '0') < 10; ++s)
 			{
-				// roll back offset if it occurs on a null terminator in the source buffer
-				if (result.offset > 0 && static_cast<size_t>(result.offset) == length - 1 && endch == 0)
-					result.offset--;
-			}
+				unsigned int digit = static_cast<unsigned int>(*s - '0');
 
-			return result;
+				overflow |= result > (static_cast<U>(~U(0)) - digit) / 10;
+				result = static_cast<U>(result * 10 + digit);
+			}
 		}
+
+		bool digits = (s != start);
+
+		while (PUGI__IS_CHARTYPE(*s, ct_space))
+			s++;
+
+		// out of range values are clamped
+		bool clamped = overflow || result > (negative ? minneg : maxpos);
+
+		if (negative)
+			out_result = clamped ? static_cast<U>(0 - minneg) : static_cast<U>(0 - result);
+		else
+			out_result = clamped ? maxpos : result;
+
+		return digits && !clamped && *s == 0;
+	}
+
+	// powers of 10 that are exactly representable as double
+	static const double xml_exact_powers_of_10[] =
+	{
+		1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+		1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
 	};
 
-	// Output facilities
-	PUGI__FN xml_encoding get_write_native_encoding()
+	PUGI__FN char get_decimal_point()
 	{
-	#ifdef PUGIXML_WCHAR_MODE
-		return get_wchar_encoding();
+	#ifdef _WIN32_WCE
+		return '.';
 	#else
-		return encoding_utf8;
+		const char* point = localeconv()->decimal_point;
+
+		return (point && point[0]) ? point[0] : '.';
 	#endif
 	}
 
-	PUGI__FN xml_encoding get_write_encoding(xml_encoding encoding)
+	// Converts the number with strtod; the number is copied since strtod expects the decimal point of the current locale
+	PUGI__FN_NO_INLINE const char_t* string_to_double_strtod(const char_t* s, double& out_result)
 	{
-		// replace wchar encoding with utf implementation
-		if (encoding == encoding_wchar) return get_wchar_encoding();
+		size_t length = 0;
 
-		// replace utf16 encoding with utf16 with specific endianness
-		if (encoding == encoding_utf16) return is_little_endian() ? encoding_utf16_le : encoding_utf16_be;
+		while (PUGI__IS_CHARTYPEX(s[length], ctx_symbol) || s[length] == '+' || s[length] == '(' || s[length] == ')') length++;
 
-		// replace utf32 encoding with utf32 with specific endianness
-		if (encoding == encoding_utf32) return is_little_endian() ? encoding_utf32_le : encoding_utf32_be;
+		char buffer[64];
+		char* scratch = buffer;
 
-		// only do autodetection if no explicit encoding is requested
-		if (encoding != encoding_auto) return encoding;
+		if (length >= sizeof(buffer))
+		{
+			scratch = static_cast<char*>(xml_memory::allocate(length + 1));
 
-		// assume utf8 encoding
-		return encoding_utf8;
-	}
+			if (!scratch)
+			{
+				out_result = 0;
+				return s;
+			}
+		}
 
-#ifdef PUGIXML_WCHAR_MODE
-	PUGI__FN size_t get_valid_length(const char_t* data, size_t length)
-	{
-		if (length < 1) return 0;
+		char point = get_decimal_point();
 
-		// discard last character if it's the lead of a surrogate pair 
-		return (sizeof(wchar_t) == 2 && static_cast<unsigned int>(static_cast<uint16_t>(data[length - 1]) - 0xD800) < 0x400) ? length - 1 : length;
+		for (size_t i = 0; i < length; ++i)
+			scratch[i] = (s[i] == '.') ? point : static_cast<char>(s[i]);
+
+		scratch[length] = 0;
+
+		char* end = 0;
+		out_result = strtod(scratch, &end);
+
+		const char_t* result = s + (end - scratch);
+
+		if (scratch != buffer) xml_memory::deallocate(scratch);
+
+		return result;
 	}
 
-	PUGI__FN size_t convert_buffer_output(char_t* r_char, uint8_t* r_u8, uint16_t* r_u16, uint32_t* r_u32, const char_t* data, size_t length, xml_encoding encoding)
+	// Decimal numbers with at most 15 significant digits and small exponents are converted with one correctly rounded
+	// multiplication or division; the rest (including inf, nan and hexadecimal numbers) is converted with strtod
+	PUGI__FN bool string_to_double(const char_t* value, double& out_result)
 	{
-		// only endian-swapping is required
-		if (need_endian_swap_utf(encoding, get_wchar_encoding()))
-		{
-			convert_wchar_endian_swap(r_char, data, length);
+		const char_t* s = value;
 
-			return length * sizeof(char_t);
-		}
-	
-		// convert to utf8
-		if (encoding == encoding_utf8)
-		{
-			uint8_t* dest = r_u8;
-			uint8_t* end = utf_decoder<utf8_writer>::decode_wchar_block(data, length, dest);
+		while (PUGI__IS_CHARTYPE(*s, ct_space))
+			s++;
 
-			return static_cast<size_t>(end - dest);
-		}
+		const char_t* number = s;
 
-		// convert to utf16
-		if (encoding == encoding_utf16_be || encoding == encoding_utf16_le)
-		{
-			uint16_t* dest = r_u16;
+		bool negative = (*s == '-');
 
-			// convert to native utf16
-			uint16_t* end = utf_decoder<utf16_writer>::decode_wchar_block(data, length, dest);
+		s += (*s == '+' || *s == '-');
+
+		const char_t* digits = s;
+
+		double mantissa = 0;
+		int significant = 0;
+		int exponent = 0;
+
+		while (*s == '0') s++;
+
+		for (; static_cast<unsigned int>(*s - '0') < 10; ++s, ++significant)
+			mantissa = mantissa * 10 + (*s - '0');
 
-			// swap if necessary
-			xml_encoding native_encoding = is_little_endian() ? encoding_utf16_le : encoding_utf16_be;
+		if (*s == '.')
+		{
+			s++;
 
-			if (native_encoding != encoding) convert_utf_endian_swap(dest, dest, static_cast<size_t>(end - dest));
+			if (significant == 0)
+				for (; *s == '0'; ++s) exponent--;
 
-			return static_cast<size_t>(end - dest) * sizeof(uint16_t);
+			for (; static_cast<unsigned int>(*s - '0') < 10; ++s, ++significant, --exponent)
+				mantissa = mantissa * 10 + (*s - '0');
 		}
 
-		// convert to utf32
-		if (encoding == encoding_utf32_be || encoding == encoding_utf32_le)
+		bool valid = (s != digits) && !(s == digits + 1 && *digits == '.');
+
+		if (valid && (*s | ' ') == 'e')
 		{
-			uint32_t* dest = r_u32;
+			const char_t* e = s + 1;
 
-			// convert to native utf32
-			uint32_t* end = utf_decoder<utf32_writer>::decode_wchar_block(data, length, dest);
+			bool negative_exponent = (*e == '-');
 
-			// swap if necessary
-			xml_encoding native_encoding = is_little_endian() ? encoding_utf32_le : encoding_utf32_be;
+			e += (*e == '+' || *e == '-');
 
-			if (native_encoding != encoding) convert_utf_endian_swap(dest, dest, static_cast<size_t>(end - dest));
+			if (static_cast<unsigned int>(*e - '0') < 10)
+			{
+				int value_exponent = 0;
 
-			return static_cast<size_t>(end - dest) * sizeof(uint32_t);
+				// large exponents are clamped; the result is 0 or inf anyway
+				for (; static_cast<unsigned int>(*e - '0') < 10; ++e)
+					if (value_exponent < 100000) value_exponent = value_exponent * 10 + (*e - '0');
+
+				exponent += negative_exponent ? -value_exponent : value_exponent;
+				s = e;
+			}
 		}
 
-		// convert to latin1
-		if (encoding == encoding_latin1)
-		{
-			uint8_t* dest = r_u8;
-			uint8_t* end = utf_decoder<latin1_writer>::decode_wchar_block(data, length, dest);
+		const char_t* end = s;
 
-			return static_cast<size_t>(end - dest);
+		while (PUGI__IS_CHARTYPE(*end, ct_space))
+			end++;
+
+		// anything that is not a complete decimal number (including trailing garbage) is handled by strtod
+		valid = valid && *end == 0;
+
+		bool overflow = false;
+
+		if (valid && mantissa == 0)
+		{
+			out_result = negative ? -0.0 : 0.0;
 		}
+		else if (valid && significant <= 15 && exponent >= -22 && exponent <= 22 + (15 - significant))
+		{
+			// the mantissa is exact, so if it stays below 2^53 after scaling by 10^(exponent - 22) there is only one rounding
+			if (exponent > 22)
+			{
+				mantissa *= xml_exact_powers_of_10[exponent - 22];
+				exponent = 22;
+			}
 
-		assert(!"Invalid encoding");
-		return 0;
-	}
-#else
-	PUGI__FN size_t get_valid_length(const char_t* data, size_t length)
-	{
-		if (length < 5) return 0;
+			out_result = exponent < 0 ? mantissa / xml_exact_powers_of_10[-exponent] : mantissa * xml_exact_powers_of_10[exponent];
 
-		for (size_t i = 1; i <= 4; ++i)
+			if (negative) out_result = -out_result;
+		}
+		else
 		{
-			uint8_t ch = static_cast<uint8_t>(data[length - i]);
+			s = string_to_double_strtod(number, out_result);
 
-			// either a standalone character or a leading one
-			if ((ch & 0xc0) != 0x80) return length - i;
+			valid = (s != number);
+			overflow = (out_result > DBL_MAX || out_result < -DBL_MAX) && static_cast<unsigned int>(*digits - '0') < 10;
 		}
 
-		// there are four non-leading characters at the end, sequence tail is broken so might as well process the whole chunk
-		return length;
+		while (PUGI__IS_CHARTYPE(*s, ct_space))
+			s++;
+
+		return valid && !overflow && *s == 0;
 	}
 
-	PUGI__FN size_t convert_buffer_output(char_t* /* r_char */, uint8_t* r_u8, uint16_t* r_u16, uint32_t* r_u32, const char_t* data, size_t length, xml_encoding encoding)
+	PUGI__FN bool convert_value_int(const char_t* value, int& out_result)
 	{
-		if (encoding == encoding_utf16_be || encoding == encoding_utf16_le)
-		{
-			uint16_t* dest = r_u16;
+		unsigned int result;
+		bool success = string_to_integer<unsigned int>(value, 0 - static_cast<unsigned int>(INT_MIN), INT_MAX, result);
 
-			// convert to native utf16
-			uint16_t* end = utf_decoder<utf16_writer>::decode_utf8_block(reinterpret_cast<const uint8_t*>(data), length, dest);
+		out_result = static_cast<int>(result);
 
-			// swap if necessary
-			xml_encoding native_encoding = is_little_endian() ? encoding_utf16_le : encoding_utf16_be;
+		return success;
+	}
 
-			if (native_encoding != encoding) convert_utf_endian_swap(dest, dest, static_cast<size_t>(end - dest));
+	PUGI__FN bool convert_value_uint(const char_t* value, unsigned int& out_result)
+	{
+		return string_to_integer<unsigned int>(value, 0, UINT_MAX, out_result);
+	}
 
-			return static_cast<size_t>(end - dest) * sizeof(uint16_t);
-		}
+	PUGI__FN bool convert_value_double(const char_t* value, double& out_result)
+	{
+		return string_to_double(value, out_result);
+	}
 
-		if (encoding == encoding_utf32_be || encoding == encoding_utf32_le)
-		{
-			uint32_t* dest = r_u32;
+	PUGI__FN bool convert_value_float(const char_t* value, float& out_result)
+	{
+		double result;
+		bool success = string_to_double(value, result);
 
-			// convert to native utf32
-			uint32_t* end = utf_decoder<utf32_writer>::decode_utf8_block(reinterpret_cast<const uint8_t*>(data), length, dest);
+		// values that are too large for float become infinite
+		if (result > FLT_MAX || result < -FLT_MAX) success = success && (result > DBL_MAX || result < -DBL_MAX);
 
-			// swap if necessary
-			xml_encoding native_encoding = is_little_endian() ? encoding_utf32_le : encoding_utf32_be;
+		out_result = static_cast<float>(result);
 
-			if (native_encoding != encoding) convert_utf_endian_swap(dest, dest, static_cast<size_t>(end - dest));
+		return success;
+	}
 
-			return static_cast<size_t>(end - dest) * sizeof(uint32_t);
-		}
+#ifdef PUGIXML_HAS_LONG_LONG
+	PUGI__FN bool convert_value_llong(const char_t* value, long long& out_result)
+	{
+		const unsigned long long maxpos = ~0ULL >> 1;
 
-		if (encoding == encoding_latin1)
-		{
-			uint8_t* dest = r_u8;
-			uint8_t* end = utf_decoder<latin1_writer>::decode_utf8_block(reinterpret_cast<const uint8_t*>(data), length, dest);
+		unsigned long long result;
+		bool success = string_to_integer<unsigned long long>(value, maxpos + 1, maxpos, result);
 
-			return static_cast<size_t>(end - dest);
-		}
+		out_result = static_cast<long long>(result);
 
-		assert(!"Invalid encoding");
-		return 0;
+		return success;
 	}
-#endif
 
-	class xml_buffered_writer
+	PUGI__FN bool convert_value_ullong(const char_t* value, unsigned long long& out_result)
 	{
-		xml_buffered_writer(const xml_buffered_writer&);
-		xml_buffered_writer& operator=(const xml_buffered_writer&);
+		return string_to_integer<unsigned long long>(value, 0, ~0ULL, out_result);
+	}
+#endif
 
-	public:
-		xml_buffered_writer(xml_writer& writer_, xml_encoding user_encoding): writer(writer_), bufsize(0), encoding(get_write_encoding(user_encoding))
-		{
-			PUGI__STATIC_ASSERT(bufcapacity >= 8);
-		}
+	// conversion types for the value cache
+	enum value_cache_type
+	{
+		value_cache_int = 1,
+		value_cache_uint,
+		value_cache_double,
+		value_cache_float,
+		value_cache_llong,
+		value_cache_ullong
+	};
 
-		~xml_buffered_writer()
-		{
-			flush();
-		}
+	template <typename T, typename Object> PUGI__FN T get_value_number(Object* object, T def, bool* ok, value_cache_type type, bool (*convert)(const char_t*, T&))
+	{
+		const char_t* value = object ? get_value(object) : 0;
 
-		size_t flush()
-		{
-			flush(buffer, bufsize);
-			bufsize = 0;
-			return 0;
-		}
+		T result = def;
+		bool success = false;
 
-		void flush(const char_t* data, size_t size)
+		if (value)
 		{
-			if (size == 0) return;
+			xml_value_cache* cache = get_document(object).values;
+			xml_value_cache_entry* entry = cache ? find_cached_value(*cache, value, type) : 0;
 
-			// fast path, just write data
-			if (encoding == get_write_native_encoding())
-				writer.write(data, size * sizeof(char_t));
+			if (entry)
+			{
+				memcpy(&result, &entry->result, sizeof(result));
+				success = entry->success;
+			}
 			else
 			{
-				// convert chunk
-				size_t result = convert_buffer_output(scratch.data_char, scratch.data_u8, scratch.data_u16, scratch.data_u32, data, size, encoding);
-				assert(result <= sizeof(scratch));
+				success = convert(value, result);
 
-				// write data
-				writer.write(scratch.data_u8, result);
+				entry = cache ? add_cached_value(*cache, value) : 0;
+
+				if (entry)
+				{
+					entry->type = type;
+					entry->success = success;
+					memcpy(&entry->result, &result, sizeof(result));
+				}
 			}
 		}
 
-		void write_direct(const char_t* data, size_t length)
-		{
-			// flush the remaining buffer contents
-			flush();
+		if (!ok) return result;
 
-			// handle large chunks
-			if (length > bufcapacity)
-			{
-				if (encoding == get_write_native_encoding())
-				{
-					// fast path, can just write data chunk
-					writer.write(data, length * sizeof(char_t));
-					return;
-				}
+		*ok = success;
 
-				// need to convert in suitable chunks
-				while (length > bufcapacity)
-				{
-					// get chunk size by selecting such number of characters that are guaranteed to fit into scratch buffer
-					// and form a complete codepoint sequence (i.e. discard start of last codepoint if necessary)
-					size_t chunk_size = get_valid_length(data, bufcapacity);
-					assert(chunk_size);
+		return success ? result : def;
+	}
 
-					// convert chunk and write
-					flush(data, chunk_size);
+	PUGI__FN bool get_value_bool(const char_t* value, bool def)
+	{
+		if (!value) return def;
 
-					// iterate
-					data += chunk_size;
-					length -= chunk_size;
-				}
+		// only look at first char
+		char_t first = *value;
 
-				// small tail is copied below
-				bufsize = 0;
-			}
+		// 1*, t* (true), T* (True), y* (yes), Y* (YES)
+		return (first == '1' || first == 't' || first == 'T' || first == 'y' || first == 'Y');
+	}
 
-			memcpy(buffer + bufsize, data, length * sizeof(char_t));
-			bufsize += length;
-		}
+	// number formatting functions
+	static const char xml_digit_pairs[] =
+		"00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+		"40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+		"8081828384858687888990919293949596979899";
 
-		void write_buffer(const char_t* data, size_t length)
+	// Writes the number to the end of the buffer two digits at a time; returns the start of the string
+	template <typename U> PUGI__FN char_t* integer_to_string(char_t* begin, char_t* end, U value, bool negative)
+	{
+		char_t* s = end;
+		U rest = negative ? 0 - value : value;
+
+		while (rest >= 100)
 		{
-			size_t offset = bufsize;
+			unsigned int index = static_cast<unsigned int>(rest % 100) * 2;
+			rest /= 100;
 
-			if (offset + length <= bufcapacity)
-			{
-				memcpy(buffer + offset, data, length * sizeof(char_t));
-				bufsize = offset + length;
-			}
-			else
-			{
-				write_direct(data, length);
-			}
+			*--s = static_cast<char_t>(xml_digit_pairs[index + 1]);
+			*--s = static_cast<char_t>(xml_digit_pairs[index]);
 		}
 
-		void write_string(const char_t* data)
+		if (rest >= 10)
 		{
-			// write the part of the string that fits in the buffer
-			size_t offset = bufsize;
+			unsigned int index = static_cast<unsigned int>(rest) * 2;
 
-			while (*data && offset < bufcapacity)
-				buffer[offset++] = *data++;
+			*--s = static_cast<char_t>(xml_digit_pairs[index + 1]);
+			*--s = static_cast<char_t>(xml_digit_pairs[index]);
+		}
+		else
+		{
+			*--s = static_cast<char_t>('0' + rest);
+		}
 
-			// write the rest
-			if (offset < bufcapacity)
-			{
-				bufsize = offset;
-			}
-			else
-			{
-				// backtrack a bit if we have split the codepoint
-				size_t length = offset - bufsize;
-				size_t extra = length - get_valid_length(data - length, length);
+		if (negative) *--s = '-';
 
-				bufsize = offset - extra;
+		assert(s >= begin);
+		(void)begin;
 
-				write_direct(data - extra, strlength(data) + extra);
-			}
+		return s;
+	}
+
+	// 64-bit floating point number with a binary exponent; the value is f * 2^e
+	struct xml_diy_fp
+	{
+		uint64_t f;
+		int e;
+
+		xml_diy_fp(uint64_t f_, int e_): f(f_), e(e_)
+		{
 		}
 
-		void write(char_t d0)
+		xml_diy_fp normalize() const
 		{
-			size_t offset = bufsize;
-			if (offset > bufcapacity - 1) offset = flush();
+			xml_diy_fp result = *this;
 
-			buffer[offset + 0] = d0;
-			bufsize = offset + 1;
+			while (!(result.f >> 63))
+			{
+				result.f <<= 1;
+				result.e--;
+			}
+
+			return result;
 		}
 
-		void write(char_t d0, char_t d1)
+		xml_diy_fp operator-(const xml_diy_fp& rhs) const
 		{
-			size_t offset = bufsize;
-			if (offset > bufcapacity - 2) offset = flush();
+			assert(e == rhs.e && f >= rhs.f);
 
-			buffer[offset + 0] = d0;
-			buffer[offset + 1] = d1;
-			bufsize = offset + 2;
+			return xml_diy_fp(f - rhs.f, e);
 		}
 
-		void write(char_t d0, char_t d1, char_t d2)
+		xml_diy_fp operator*(const xml_diy_fp& rhs) const
 		{
-			size_t offset = bufsize;
-			if (offset > bufcapacity - 3) offset = flush();
+			// upper 64 bits of the 128-bit product, rounded
+			uint64_t a = f >> 32, b = f & 0xffffffffu, c = rhs.f >> 32, d = rhs.f & 0xffffffffu;
+			uint64_t ac = a * c, bc = b * c, ad = a * d, bd = b * d;
 
-			buffer[offset + 0] = d0;
-			buffer[offset + 1] = d1;
-			buffer[offset + 2] = d2;
-			bufsize = offset + 3;
+			uint64_t middle = (bd >> 32) + (ad & 0xffffffffu) + (bc & 0xffffffffu) + (1u << 31);
+
+			return xml_diy_fp(ac + (ad >> 32) + (bc >> 32) + (middle >> 32), e + rhs.e + 64);
 		}
+	};
 
-		void write(char_t d0, char_t d1, char_t d2, char_t d3)
+	// normalized 64-bit approximations of 10^k for k = -348, -340, ..., 340
+	static const uint32_t xml_cached_powers_f[] =
+	{
+		0xfa8fd5a0, 0x081c0288, 0xbaaee17f, 0xa23ebf76, 0x8b16fb20, 0x3055ac76, 0xcf42894a, 0x5dce35ea,
+		0x9a6bb0aa, 0x55653b2d, 0xe61acf03, 0x3d1a45df, 0xab70fe17, 0xc79ac6ca, 0xff77b1fc, 0xbebcdc4f,
+		0xbe5691ef, 0x416bd60c, 0x8dd01fad, 0x907ffc3c, 0xd3515c28, 0x31559a83, 0x9d71ac8f, 0xada6c9b5,
+		0xea9c2277, 0x23ee8bcb, 0xaecc4991, 0x4078536d, 0x823c1279, 0x5db6ce57, 0xc2109436, 0x4dfb5637,
+		0x9096ea6f, 0x3848984f, 0xd77485cb, 0x25823ac7, 0xa086cfcd, 0x97bf97f4, 0xef340a98, 0x172aace5,
+		0xb23867fb, 0x2a35b28e, 0x84c8d4df, 0xd2c63f3b, 0xc5dd4427, 0x1ad3cdba, 0x936b9fce, 0xbb25c996,
+		0xdbac6c24, 0x7d62a584, 0xa3ab6658, 0x0d5fdaf6, 0xf3e2f893, 0xdec3f126, 0xb5b5ada8, 0xaaff80b8,
+		0x87625f05, 0x6c7c4a8b, 0xc9bcff60, 0x34c13053, 0x964e858c, 0x91ba2655, 0xdff97724, 0x70297ebd,
+		0xa6dfbd9f, 0xb8e5b88f, 0xf8a95fcf, 0x88747d94, 0xb9447093, 0x8fa89bcf, 0x8a08f0f8, 0xbf0f156b,
+		0xcdb02555, 0x653131b6, 0x993fe2c6, 0xd07b7fac, 0xe45c10c4, 0x2a2b3b06, 0xaa242499, 0x697392d3,
+		0xfd87b5f2, 0x8300ca0e, 0xbce50864, 0x92111aeb, 0x8cbccc09, 0x6f5088cc, 0xd1b71758, 0xe219652c,
+		0x9c400000, 0x00000000, 0xe8d4a510, 0x00000000, 0xad78ebc5, 0xac620000, 0x813f3978, 0xf8940984,
+		0xc097ce7b, 0xc90715b3, 0x8f7e32ce, 0x7bea5c70, 0xd5d238a4, 0xabe98068, 0x9f4f2726, 0x179a2245,
+		0xed63a231, 0xd4c4fb27, 0xb0de6538, 0x8cc8ada8, 0x83c7088e, 0x1aab65db, 0xc45d1df9, 0x42711d9a,
+		0x924d692c, 0xa61be758, 0xda01ee64, 0x1a708dea, 0xa26da399, 0x9aef774a, 0xf209787b, 0xb47d6b85,
+		0xb454e4a1, 0x79dd1877, 0x865b8692, 0x5b9bc5c2, 0xc83553c5, 0xc8965d3d, 0x952ab45c, 0xfa97a0b3,
+		0xde469fbd, 0x99a05fe3, 0xa59bc234, 0xdb398c25, 0xf6c69a72, 0xa3989f5c, 0xb7dcbf53, 0x54e9bece,
+		0x88fcf317, 0xf22241e2, 0xcc20ce9b, 0xd35c78a5, 0x98165af3, 0x7b2153df, 0xe2a0b5dc, 0x971f303a,
+		0xa8d9d153, 0x5ce3b396, 0xfb9b7cd9, 0xa4a7443c, 0xbb764c4c, 0xa7a44410, 0x8bab8eef, 0xb6409c1a,
+		0xd01fef10, 0xa657842c, 0x9b10a4e5, 0xe9913129, 0xe7109bfb, 0xa19c0c9d, 0xac2820d9, 0x623bf429,
+		0x80444b5e, 0x7aa7cf85, 0xbf21e440, 0x03acdd2d, 0x8e679c2f, 0x5e44ff8f, 0xd433179d, 0x9c8cb841,
+		0x9e19db92, 0xb4e31ba9, 0xeb96bf6e, 0xbadf77d9, 0xaf87023b, 0x9bf0ee6b
+	};
+
+	static const short xml_cached_powers_e[] =
+	{
+		-1220, -1193, -1166, -1140, -1113, -1087, -1060, -1034, -1007, -980, -954, -927,
+		-901, -874, -847, -821, -794, -768, -741, -715, -688, -661, -635, -608,
+		-582, -555, -529, -502, -475, -449, -422, -396, -369, -343, -316, -289,
+		-263, -236, -210, -183, -157, -130, -103, -77, -50, -24, 3, 30,
+		56, 83, 109, 136, 162, 189, 216, 242, 269, 295, 322, 348,
+		375, 402, 428, 455, 481, 508, 534, 561, 588, 614, 641, 667,
+		694, 720, 747, 774, 800, 827, 853, 880, 907, 933, 960, 986,
+		1013, 1039, 1066
+	};
+
+	// Gets the cached power c = 10^-k such that the binary exponent of w * c is in [-60, -32] for normalized w with exponent e
+	PUGI__FN xml_diy_fp get_cached_power(int e, int& out_k)
+	{
+		double dk = (-61 - e) * 0.30102999566398114 + 347;
+
+		int k = static_cast<int>(dk);
+		if (dk - k > 0) k++;
+
+		unsigned int index = static_cast<unsigned int>(k >> 3) + 1;
+		assert(index < sizeof(xml_cached_powers_e) / sizeof(xml_cached_powers_e[0]));
+
+		out_k = 348 - static_cast<int>(index << 3);
+
+		uint64_t f = (static_cast<uint64_t>(xml_cached_powers_f[index * 2]) << 32) | xml_cached_powers_f[index * 2 + 1];
+
+		return xml_diy_fp(f, xml_cached_powers_e[index]);
+	}
+
+	PUGI__FN void grisu_round(char* buffer, int length, uint64_t delta, uint64_t rest, uint64_t ten_kappa, uint64_t wp_w)
+	{
+		// move the last digit towards the exact value while the result stays within the rounding interval
+		while (rest < wp_w && delta - rest >= ten_kappa && (rest + ten_kappa < wp_w || wp_w - rest > rest + ten_kappa - wp_w))
 		{
-			size_t offset = bufsize;
-			if (offset > bufcapacity - 4) offset = flush();
+			buffer[length - 1]--;
+			rest += ten_kappa;
+		}
+	}
+
+	// Generates the shortest digit string for a number in (m-, m+) where w is the scaled value and delta = m+ - m-
+	PUGI__FN int grisu_generate_digits(const xml_diy_fp& w, const xml_diy_fp& mp, uint64_t delta, char* buffer, int& k)
+	{
+		static const uint32_t powers_of_10[] = {1, 10, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000, 1000000000};
+
+		const xml_diy_fp one(static_cast<uint64_t>(1) << -mp.e, mp.e);
+		const uint64_t wp_w = (mp - w).f;
+
+		uint32_t p1 = static_cast<uint32_t>(mp.f >> -one.e);
+		uint64_t p2 = mp.f & (one.f - 1);
+
+		int kappa = 10;
+		while (kappa > 1 && p1 < powers_of_10[kappa - 1]) kappa--;
 
-			buffer[offset + 0] = d0;
-			buffer[offset + 1] = d1;
-			buffer[offset + 2] = d2;
-			buffer[offset + 3] = d3;
-			bufsize = offset + 4;
-		}
+		int length = 0;
 
-		void write(char_t d0, char_t d1, char_t d2, char_t d3, char_t d4)
+		// integral digits
+		while (kappa > 0)
 		{
-			size_t offset = bufsize;
-			if (offset > bufcapacity - 5) offset = flush();
+			uint32_t digit = p1 / powers_of_10[kappa - 1];
+			p1 %= powers_of_10[kappa - 1];
 
-			buffer[offset + 0] = d0;
-			buffer[offset + 1] = d1;
-			buffer[offset + 2] = d2;
-			buffer[offset + 3] = d3;
-			buffer[offset + 4] = d4;
-			bufsize = offset + 5;
-		}
+			if (digit || length) buffer[length++] = static_cast<char>('0' + digit);
 
-		void write(char_t d0, char_t d1, char_t d2, char_t d3, char_t d4, char_t d5)
-		{
-			size_t offset = bufsize;
-			if (offset > bufcapacity - 6) offset = flush();
+			kappa--;
 
-			buffer[offset + 0] = d0;
-			buffer[offset + 1] = d1;
-			buffer[offset + 2] = d2;
-			buffer[offset + 3] = d3;
-			buffer[offset + 4] = d4;
-			buffer[offset + 5] = d5;
-			bufsize = offset + 6;
-		}
+			uint64_t rest = (static_cast<uint64_t>(p1) << -one.e) + p2;
 
-		// utf8 maximum expansion: x4 (-> utf32)
-		// utf16 maximum expansion: x2 (-> utf32)
-		// utf32 maximum expansion: x1
-		enum
-		{
-			bufcapacitybytes =
-			#ifdef PUGIXML_MEMORY_OUTPUT_STACK
-				PUGIXML_MEMORY_OUTPUT_STACK
-			#else
-				10240
-			#endif
-			,
-			bufcapacity = bufcapacitybytes / (sizeof(char_t) + 4)
-		};
+			if (rest <= delta)
+			{
+				k += kappa;
+				grisu_round(buffer, length, delta, rest, static_cast<uint64_t>(powers_of_10[kappa]) << -one.e, wp_w);
 
-		char_t buffer[bufcapacity];
+				return length;
+			}
+		}
 
-		union
+		// fractional digits
+		uint64_t unit = 1;
+
+		for (;;)
 		{
-			uint8_t data_u8[4 * bufcapacity];
-			uint16_t data_u16[2 * bufcapacity];
-			uint32_t data_u32[bufcapacity];
-			char_t data_char[bufcapacity];
-		} scratch;
+			p2 *= 10;
+			delta *= 10;
+			unit *= 10;
 
-		xml_writer& writer;
-		size_t bufsize;
-		xml_encoding encoding;
-	};
+			char digit = static_cast<char>(p2 >> -one.e);
 
-	PUGI__FN void text_output_escaped(xml_buffered_writer& writer, const char_t* s, chartypex_t type)
-	{
-		while (*s)
-		{
-			const char_t* prev = s;
-			
-			// While *s is a usual symbol
-			PUGI__SCANWHILE_UNROLL(!PUGI__IS_CHARTYPEX(ss, type));
-		
-			writer.write_buffer(prev, static_cast<size_t>(s - prev));
+			if (digit || length) buffer[length++] = static_cast<char>('0' + digit);
 
-			switch (*s)
+			p2 &= one.f - 1;
+			kappa--;
+
+			if (p2 < delta)
 			{
-				case 0: break;
-				case '&':
-					writer.write('&', 'a', 'm', 'p', ';');
-					++s;
-					break;
-				case '<':
-					writer.write('&', 'l', 't', ';');
-					++s;
-					break;
-				case '>':
-					writer.write('&', 'g', 't', ';');
-					++s;
-					break;
-				case '"':
-					writer.write('&', 'q', 'u', 'o', 't', ';');
-					++s;
-					break;
-				default: // s is not a usual symbol
-				{
-					unsigned int ch = static_cast<unsigned int>(*s++);
-					assert(ch < 32);
+				k += kappa;
+				grisu_round(buffer, length, delta, p2, one.f, wp_w * unit);
 
-					writer.write('&', '#', static_cast<char_t>((ch / 10) + '0'), static_cast<char_t>((ch % 10) + '0'), ';');
-				}
+				return length;
 			}
 		}
 	}
 
-	PUGI__FN void text_output(xml_buffered_writer& writer, const char_t* s, chartypex_t type, unsigned int flags)
+	// Gets the shortest digits that convert back to the same number (Grisu2); the number is 0.d1d2...dn * 10^exponent
+	// significand and exponent describe the finite positive value, lower_closer is set if the next lower number is twice as close
+	PUGI__FN int grisu_digits(uint64_t significand, int exponent, bool lower_closer, char* buffer, int& out_exponent)
 	{
-		if (flags & format_no_escapes)
-			writer.write_string(s);
-		else
-			text_output_escaped(writer, s, type);
+		xml_diy_fp v(significand, exponent);
+
+		// boundaries are halfway to the adjacent numbers
+		xml_diy_fp mp = xml_diy_fp((v.f << 1) + 1, v.e - 1).normalize();
+		xml_diy_fp mm = lower_closer ? xml_diy_fp((v.f << 2) - 1, v.e - 2) : xml_diy_fp((v.f << 1) - 1, v.e - 1);
+
+		mm.f <<= mm.e - mp.e;
+		mm.e = mp.e;
+
+		int k;
+		xml_diy_fp c = get_cached_power(mp.e, k);
+
+		xml_diy_fp w = v.normalize() * c;
+		xml_diy_fp wp = mp * c;
+		xml_diy_fp wm = mm * c;
+
+		// account for the rounding error of the multiplication
+		wm.f++;
+		wp.f--;
+
+		int length = grisu_generate_digits(w, wp, wp.f - wm.f, buffer, k);
+
+		out_exponent = length + k;
+
+		return length;
 	}
 
-	PUGI__FN void text_output_cdata(xml_buffered_writer& writer, const char_t* s)
+	PUGI__FN int double_to_digits(double value, char* buffer, int& out_exponent)
 	{
-		do
-		{
-			writer.write('<', '!', '[', 'C', 'D');
-			writer.write('A', 'T', 'A', '[');
+		uint64_t bits;
+		memcpy(&bits, &value, sizeof(bits));
 
-			const char_t* prev = s;
+		uint64_t fraction = bits & ((static_cast<uint64_t>(1) << 52) - 1);
+		int biased = static_cast<int>((bits >> 52) & 0x7ff);
 
-			// look for ]]> sequence - we can't output it as is since it terminates CDATA
-			while (*s && !(s[0] == ']' && s[1] == ']' && s[2] == '>')) ++s;
+		if (biased == 0)
+			return grisu_digits(fraction, 1 - 1075, false, buffer, out_exponent);
+		else
+			return grisu_digits(fraction | (static_cast<uint64_t>(1) << 52), biased - 1075, fraction == 0 && biased > 1, buffer, out_exponent);
+	}
 
-			// skip ]] if we stopped at ]]>, > will go to the next CDATA section
-			if (*s) s += 2;
+	PUGI__FN int float_to_digits(float value, char* buffer, int& out_exponent)
+	{
+		uint32_t bits;
+		memcpy(&bits, &value, sizeof(bits));
 
-			writer.write_buffer(prev, static_cast<size_t>(s - prev));
+		uint32_t fraction = bits & ((1u << 23) - 1);
+		int biased = static_cast<int>((bits >> 23) & 0xff);
 
-			writer.write(']', ']', '>');
-		}
-		while (*s);
+		if (biased == 0)
+			return grisu_digits(fraction, 1 - 150, false, buffer, out_exponent);
+		else
+			return grisu_digits(fraction | (1u << 23), biased - 150, fraction == 0 && biased > 1, buffer, out_exponent);
 	}
 
-	PUGI__FN void text_output_indent(xml_buffered_writer& writer, const char_t* indent, size_t indent_length, unsigned int depth)
+	// Formats digits as %g does, but with all digits needed to get the same number back
+	PUGI__FN char_t* format_digits(char_t* s, const char* digits, int length, int exponent)
 	{
-		switch (indent_length)
-		{
-		case 1:
+		if (exponent <= -4 || exponent > 17)
 		{
-			for (unsigned int i = 0; i < depth; ++i)
-				writer.write(indent[0]);
-			break;
-		}
+			// scientific notation
+			*s++ = static_cast<char_t>(digits[0]);
 
-		case 2:
-		{
-			for (unsigned int i = 0; i < depth; ++i)
-				writer.write(indent[0], indent[1]);
-			break;
-		}
+			if (length > 1)
+			{
+				*s++ = '.';
 
-		case 3:
-		{
-			for (unsigned int i = 0; i < depth; ++i)
-				writer.write(indent[0], indent[1], indent[2]);
-			break;
+				for (int i = 1; i < length; ++i) *s++ = static_cast<char_t>(digits[i]);
+			}
+
+			int power = exponent - 1;
+
+			*s++ = 'e';
+			*s++ = power < 0 ? '-' : '+';
+
+			unsigned int abs_power = static_cast<unsigned int>(power < 0 ? -power : power);
+
+			if (abs_power >= 100) *s++ = static_cast<char_t>('0' + abs_power / 100);
+
+			*s++ = static_cast<char_t>(xml_digit_pairs[abs_power % 100 * 2]);
+			*s++ = static_cast<char_t>(xml_digit_pairs[abs_power % 100 * 2 + 1]);
 		}
+		else if (exponent <= 0)
+		{
+			*s++ = '0';
+			*s++ = '.';
 
-		case 4:
+			for (int i = exponent; i < 0; ++i) *s++ = '0';
+			for (int i = 0; i < length; ++i) *s++ = static_cast<char_t>(digits[i]);
+		}
+		else
 		{
-			for (unsigned int i = 0; i < depth; ++i)
-				writer.write(indent[0], indent[1], indent[2], indent[3]);
-			break;
+			for (int i = 0; i < exponent; ++i) *s++ = (i < length) ? static_cast<char_t>(digits[i]) : '0';
+
+			if (length > exponent)
+			{
+				*s++ = '.';
+
+				for (int i = exponent; i < length; ++i) *s++ = static_cast<char_t>(digits[i]);
+			}
 		}
 
-		default:
+		return s;
+	}
+
+	template <typename T> PUGI__FN char_t* floating_to_string(char_t* s, T value, int (*to_digits)(T, char*, int&))
+	{
+		// special values are printed the same way as by printf
+		if (value != value) return s + copy_ascii(s, "nan");
+
+		if (value < 0 || (value == 0 && 1 / value < 0))
 		{
-			for (unsigned int i = 0; i < depth; ++i)
-				writer.write_buffer(indent, indent_length);
-		}
+			*s++ = '-';
+			value = -value;
 		}
+
+		if (value == 0) return s + copy_ascii(s, "0");
+		if (value * 2 == value) return s + copy_ascii(s, "inf");
+
+		char digits[24];
+		int exponent;
+		int length = to_digits(value, digits, exponent);
+
+		// rounding of the last digit may leave trailing zeros
+		while (length > 1 && digits[length - 1] == '0') length--;
+
+		return format_digits(s, digits, length, exponent);
 	}
 
-	PUGI__FN void node_output_comment(xml_buffered_writer& writer, const char_t* s)
+	// set value with conversion functions
+	template <typename String> PUGI__FN bool set_value_buffer(String& dest, xml_header& header, uintptr_t header_mask, char_t* begin, char_t* end)
 	{
-		writer.write('<', '!', '-', '-');
+		*end = 0;
 
-		while (*s)
-		{
-			const char_t* prev = s;
+		return strcpy_insitu(dest, header, header_mask, begin);
+	}
 
-			// look for -\0 or -- sequence - we can't output it since -- is illegal in comment body
-			while (*s && !(s[0] == '-' && (s[1] == '-' || s[1] == 0))) ++s;
+	template <typename String> PUGI__FN bool set_value_convert(String& dest, xml_header& header, uintptr_t header_mask, int value)
+	{
+		char_t buf[64];
+		char_t* end = buf + sizeof(buf) / sizeof(buf[0]) - 1;
+		char_t* begin = integer_to_string<unsigned int>(buf, end, static_cast<unsigned int>(value), value < 0);
 
-			writer.write_buffer(prev, static_cast<size_t>(s - prev));
+		return set_value_buffer(dest, header, header_mask, begin, end);
+	}
 
-			if (*s)
-			{
-				assert(*s == '-');
+	template <typename String> PUGI__FN bool set_value_convert(String& dest, xml_header& header, uintptr_t header_mask, unsigned int value)
+	{
+		char_t buf[64];
+		char_t* end = buf + sizeof(buf) / sizeof(buf[0]) - 1;
+		char_t* begin = integer_to_string<unsigned int>(buf, end, value, false);
 
-				writer.write('-', ' ');
-				++s;
-			}
-		}
+		return set_value_buffer(dest, header, header_mask, begin, end);
+	}
 
-		writer.write('-', '-', '>');
+	template <typename String> PUGI__FN bool set_value_convert(String& dest, xml_header& header, uintptr_t header_mask, float value)
+	{
+		char_t buf[64];
+		char_t* end = floating_to_string<float>(buf, value, float_to_digits);
+
+		return set_value_buffer(dest, header, header_mask, buf, end);
 	}
 
-	PUGI__FN void node_output_attributes(xml_buffered_writer& writer, const xml_node node, unsigned int flags)
+	template <typename String> PUGI__FN bool set_value_convert(String& dest, xml_header& header, uintptr_t header_mask, double value)
 	{
-		const char_t* default_name = PUGIXML_TEXT(":anonymous");
+		char_t buf[64];
+		char_t* end = floating_to_string<double>(buf, value, double_to_digits);
 
-		for (xml_attribute a = node.first_attribute(); a; a = a.next_attribute())
-		{
-			writer.write(' ');
-			writer.write_string(a.name()[0] ? a.name() : default_name);
-			writer.write('=', '"');
+		return set_value_buffer(dest, header, header_mask, buf, end);
+	}
+	
+	template <typename String> PUGI__FN bool set_value_convert(String& dest, xml_header& header, uintptr_t header_mask, bool value)
+	{
+		return strcpy_insitu(dest, header, header_mask, value ? PUGIXML_TEXT("true") : PUGIXML_TEXT("false"));
+	}
+
+#ifdef PUGIXML_HAS_LONG_LONG
+	template <typename String> PUGI__FN bool set_value_convert(String& dest, xml_header& header, uintptr_t header_mask, long long value)
+	{
+		char_t buf[64];
+		char_t* end = buf + sizeof(buf) / sizeof(buf[0]) - 1;
+		char_t* begin = integer_to_string<unsigned long long>(buf, end, static_cast<unsigned long long>(value), value < 0);
+
+		return set_value_buffer(dest, header, header_mask, begin, end);
+	}
+
+	template <typename String> PUGI__FN bool set_value_convert(String& dest, xml_header& header, uintptr_t header_mask, unsigned long long value)
+	{
+		char_t buf[64];
+		char_t* end = buf + sizeof(buf) / sizeof(buf[0]) - 1;
+		char_t* begin = integer_to_string<unsigned long long>(buf, end, value, false);
+
+		return set_value_buffer(dest, header, header_mask, begin, end);
+	}
+#endif
+
+	// we need to get length of entire file to load it in memory; the only (relatively) sane way to do it is via seek/tell trick
+	PUGI__FN xml_parse_status get_file_size(FILE* file, size_t& out_result)
+	{
+	#if defined(PUGI__MSVC_CRT_VERSION) && PUGI__MSVC_CRT_VERSION >= 1400 && !defined(_WIN32_WCE)
+		// there are 64-bit versions of fseek/ftell, let's use them
+		typedef __int64 length_type;
+
+		_fseeki64(file, 0, SEEK_END);
+		length_type length = _ftelli64(file);
+		_fseeki64(file, 0, SEEK_SET);
+	#elif defined(__MINGW32__) && !defined(__NO_MINGW_LFS) && !defined(__STRICT_ANSI__)
+		// there are 64-bit versions of fseek/ftell, let's use them
+		typedef off64_t length_type;
+
+		fseeko64(file, 0, SEEK_END);
+		length_type length = ftello64(file);
+		fseeko64(file, 0, SEEK_SET);
+	#else
+		// if this is a 32-bit OS, long is enough; if this is a unix system, long is 64-bit, which is enough; otherwise we can't do anything anyway.
+		typedef long length_type;
+
+		fseek(file, 0, SEEK_END);
+		length_type length = ftell(file);
+		fseek(file, 0, SEEK_SET);
+	#endif
+
+		// check for I/O errors
+		if (length < 0) return status_io_error;
+		
+		// check for overflow
+		size_t result = static_cast<size_t>(length);
 
-			text_output(writer, a.value(), ctx_special_attr, flags);
+		if (static_cast<length_type>(result) != length) return status_out_of_memory;
 
-			writer.write('"');
-		}
+		// finalize
+		out_result = result;
+
+		return status_ok;
 	}
 
-	PUGI__FN bool node_output_start(xml_buffered_writer& writer, const xml_node node, unsigned int flags)
+	PUGI__FN size_t zero_terminate_buffer(void* buffer, size_t size, xml_encoding encoding) 
 	{
-		const char_t* default_name = PUGIXML_TEXT(":anonymous");
-		const char_t* name = node.name()[0] ? node.name() : default_name;
-
-		writer.write('<');
-		writer.write_string(name);
-
-		if (node.first_attribute())
-			node_output_attributes(writer, node, flags);
+		// We only need to zero-terminate if encoding conversion does not do it for us
+	#ifdef PUGIXML_WCHAR_MODE
+		xml_encoding wchar_encoding = get_wchar_encoding();
 
-		if (flags & format_raw)
+		if (encoding == wchar_encoding || need_endian_swap_utf(encoding, wchar_encoding))
 		{
-			if (!node.first_child())
-				writer.write(' ', '/', '>');
-			else
-			{
-				writer.write('>');
+			size_t length = size / sizeof(char_t);
 
-				return true;
-			}
+			static_cast<char_t*>(buffer)[length] = 0;
+			return (length + 1) * sizeof(char_t);
 		}
-		else
+	#else
+		if (encoding == encoding_utf8)
 		{
-			xml_node first = node.first_child();
-
-			if (!first)
-				writer.write(' ', '/', '>', '\n');
-			else if (!first.next_sibling() && (first.type() == node_pcdata || first.type() == node_cdata))
-			{
-				writer.write('>');
-
-				if (first.type() == node_pcdata)
-					text_output(writer, first.value(), ctx_special_pcdata, flags);
-				else
-					text_output_cdata(writer, first.value());
-
-				writer.write('<', '/');
-				writer.write_string(name);
-				writer.write('>', '\n');
-			}
-			else
-			{
-				writer.write('>', '\n');
-
-				return true;
-			}
+			static_cast<char*>(buffer)[size] = 0;
+			return size + 1;
 		}
+	#endif
 
-		return false;
-	}
-
-	PUGI__FN void node_output_end(xml_buffered_writer& writer, const xml_node node, unsigned int flags)
-	{
-		const char_t* default_name = PUGIXML_TEXT(":anonymous");
-		const char_t* name = node.name()[0] ? node.name() : default_name;
-
-		writer.write('<', '/');
-		writer.write_string(name);
-
-		if (flags & format_raw)
-			writer.write('>');
-		else
-			writer.write('>', '\n');
+		return size;
 	}
 
-	PUGI__FN void node_output_simple(xml_buffered_writer& writer, const xml_node node, unsigned int flags)
+#ifdef PUGIXML_HAS_THREADS
+	struct xml_file_source: xml_reader_source
 	{
-		const char_t* default_name = PUGIXML_TEXT(":anonymous");
+		FILE* file;
+		bool error;
 
-		switch (node.type())
+		xml_file_source(FILE* file_): file(file_), error(false)
 		{
-			case node_pcdata:
-				text_output(writer, node.value(), ctx_special_pcdata, flags);
-				if ((flags & format_raw) == 0) writer.write('\n');
-				break;
+		}
 
-			case node_cdata:
-				text_output_cdata(writer, node.value());
-				if ((flags & format_raw) == 0) writer.write('\n');
-				break;
+		virtual size_t read(void* data, size_t size)
+		{
+			size_t result = fread(data, 1, size, file);
+			if (result < size && ferror(file)) error = true;
 
-			case node_comment:
-				node_output_comment(writer, node.value());
-				if ((flags & format_raw) == 0) writer.write('\n');
-				break;
+			return error ? 0 : result;
+		}
+	};
 
-			case node_pi:
-				writer.write('<', '?');
-				writer.write_string(node.name()[0] ? node.name() : default_name);
+	const size_t xml_pipeline_block_size = 65536;
+	const size_t xml_pipeline_block_count = 2;
 
-				if (node.value()[0])
-				{
-					writer.write(' ');
-					writer.write_string(node.value());
-				}
+	// Blocks that are filled by the reader thread and consumed by the parser
+	struct xml_pipeline
+	{
+		xml_reader_source* source;
 
-				writer.write('?', '>');
-				if ((flags & format_raw) == 0) writer.write('\n');
-				break;
+		xml_semaphore free_blocks;
+		xml_semaphore full_blocks;
 
-			case node_declaration:
-				writer.write('<', '?');
-				writer.write_string(node.name()[0] ? node.name() : default_name);
-				node_output_attributes(writer, node, flags);
-				writer.write('?', '>');
-				if ((flags & format_raw) == 0) writer.write('\n');
-				break;
+		char* blocks;
+		size_t sizes[xml_pipeline_block_count];
 
-			case node_doctype:
-				writer.write('<', '!', 'D', 'O', 'C');
-				writer.write('T', 'Y', 'P', 'E');
+		static void read_blocks(void* data)
+		{
+			xml_pipeline* self = static_cast<xml_pipeline*>(data);
 
-				if (node.value()[0])
-				{
-					writer.write(' ');
-					writer.write_string(node.value());
-				}
+			for (size_t i = 0; ; i = (i + 1) % xml_pipeline_block_count)
+			{
+				// the parser stops the pipeline if it does not need more data
+				size_t size = self->free_blocks.wait() ? self->source->read(self->blocks + i * xml_pipeline_block_size, xml_pipeline_block_size) : 0;
 
-				writer.write('>');
-				if ((flags & format_raw) == 0) writer.write('\n');
-				break;
+				self->sizes[i] = size;
+				self->full_blocks.post();
 
-			default:
-				assert(!"Invalid node type");
+				// empty block marks the end of data
+				if (size == 0) break;
+			}
 		}
-	}
+	};
 
-	PUGI__FN void node_output(xml_buffered_writer& writer, const xml_node root, const char_t* indent, unsigned int flags, unsigned int depth)
+	// Reads the source on a separate thread while the blocks that were already read are parsed
+	PUGI__FN bool load_pipelined_impl(xml_document& doc, xml_reader_source& source, unsigned int options, xml_encoding encoding, xml_parse_result& result)
 	{
-		size_t indent_length = ((flags & (format_indent | format_raw)) == format_indent) ? strlength(indent) : 0;
+		xml_pipeline pipeline;
+		pipeline.source = &source;
 
-		xml_node node = root;
+		pipeline.blocks = static_cast<char*>(resource_allocate(xml_pipeline_block_size * xml_pipeline_block_count, doc.memory_resource()));
+		if (!pipeline.blocks) return false;
 
-		do
+		if (!pipeline.free_blocks.create(xml_pipeline_block_count))
 		{
-			assert(node);
+			resource_deallocate(pipeline.blocks, doc.memory_resource());
+			return false;
+		}
 
-			// begin writing current node
-			if (indent_length)
-				text_output_indent(writer, indent, indent_length, depth);
+		if (!pipeline.full_blocks.create(0))
+		{
+			pipeline.free_blocks.destroy();
+			resource_deallocate(pipeline.blocks, doc.memory_resource());
+			return false;
+		}
 
-			if (node.type() == node_element)
-			{
-				if (node_output_start(writer, node, flags))
-				{
-					node = node.first_child();
-					depth++;
-					continue;
-				}
-			}
-			else if (node.type() == node_document)
-			{
-				if (node.first_child())
-				{
-					node = node.first_child();
-					continue;
-				}
-			}
-			else
-			{
-				node_output_simple(writer, node, flags);
-			}
+		xml_incremental_parser parser(doc, options & ~parse_pipelined, encoding);
+		xml_thread thread;
 
-			// continue to the next node
-			while (node != root)
+		bool started = thread.start(xml_pipeline::read_blocks, &pipeline);
+
+		if (started)
+		{
+			for (size_t i = 0; ; i = (i + 1) % xml_pipeline_block_count)
 			{
-				if (node.next_sibling())
+				pipeline.full_blocks.wait();
+
+				size_t size = pipeline.sizes[i];
+				if (size == 0) break;
+
+				if (!parser.feed(pipeline.blocks + i * xml_pipeline_block_size, size))
 				{
-					node = node.next_sibling();
+					pipeline.free_blocks.stop();
 					break;
 				}
 
-				node = node.parent();
-				depth--;
+				pipeline.free_blocks.post();
+			}
 
-				// write closing node
-				if (node.type() == node_element)
-				{
-					if (indent_length)
-						text_output_indent(writer, indent, indent_length, depth);
+			thread.join();
 
-					node_output_end(writer, node, flags);
-				}
-			}
+			result = parser.finish();
 		}
-		while (node != root);
+
+		pipeline.full_blocks.destroy();
+		pipeline.free_blocks.destroy();
+		resource_deallocate(pipeline.blocks, doc.memory_resource());
+
+		return started;
 	}
+#endif
 
-	PUGI__FN bool has_declaration(const xml_node node)
+#ifdef PUGIXML_HAS_MMAP
+	PUGI__FN bool load_file_mmap_impl(xml_document& doc, FILE* file, size_t size, unsigned int options, xml_encoding encoding, xml_parse_result& result)
 	{
-		for (xml_node child = node.first_child(); child; child = child.next_sibling())
-		{
-			xml_node_type type = child.type();
+		// private mapping is writable since the document is parsed in place; the pages are copied on first write
+		void* mapping = mmap(0, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fileno(file), 0);
+		if (mapping == MAP_FAILED) return false;
 
-			if (type == node_declaration) return true;
-			if (type == node_element) return false;
+	#ifdef MADV_SEQUENTIAL
+		madvise(mapping, size, MADV_SEQUENTIAL);
+	#endif
+
+		result = doc.load_buffer_inplace(mapping, size, options, encoding);
+
+		xml_document_struct* xmldoc = static_cast<xml_document_struct*>(doc.internal_object());
+
+		// the document points to the mapping unless the contents were converted to a separate buffer
+		if (xmldoc->buffer == mapping)
+		{
+			xmldoc->mapping = mapping;
+			xmldoc->mapping_size = size;
 		}
+		else
+			munmap(mapping, size);
 
-		return false;
+		return true;
 	}
+#endif
 
-	PUGI__FN bool is_attribute_of(xml_attribute_struct* attr, xml_node_struct* node)
+	PUGI__FN xml_parse_result load_file_impl(xml_document& doc, FILE* file, unsigned int options, xml_encoding encoding)
 	{
-		for (xml_attribute_struct* a = node->first_attribute; a; a = a->next_attribute)
-			if (a == attr)
-				return true;
+		if (!file) return make_parse_result(status_file_not_found);
 
-		return false;
-	}
+		// get file size (can result in I/O errors)
+		size_t size = 0;
+		xml_parse_status size_status = get_file_size(file, size);
 
-	PUGI__FN bool allow_insert_child(xml_node_type parent, xml_node_type child)
-	{
-		if (parent != node_document && parent != node_element) return false;
-		if (child == node_document || child == node_null) return false;
-		if (parent != node_document && (child == node_declaration || child == node_doctype)) return false;
+		if (size_status != status_ok)
+		{
+			fclose(file);
+			return make_parse_result(size_status);
+		}
 
-		return true;
-	}
+	#ifdef PUGIXML_HAS_THREADS
+		if (options & parse_pipelined)
+		{
+			xml_file_source source(file);
+			xml_parse_result result;
 
-	PUGI__FN bool allow_move(const xml_node parent, const xml_node child)
-	{
-		// check that child can be a child of parent
-		if (!allow_insert_child(parent.type(), child.type()))
-			return false;
+			// fall back to reading the file on this thread if the reader thread can not be started
+			if (load_pipelined_impl(doc, source, options, encoding, result))
+			{
+				fclose(file);
 
-		// check that node is not moved between documents
-		if (parent.root() != child.root())
-			return false;
+				if (!source.error) return result;
 
-		// check that new parent is not in the child subtree
-		xml_node cur = parent;
+				doc.reset();
+				return make_parse_result(status_io_error);
+			}
+		}
+	#endif
 
-		while (cur)
+	#ifdef PUGIXML_HAS_MMAP
+		xml_parse_result result;
+
+		// fall back to reading the file if it can not be mapped
+		if (size > 0 && load_file_mmap_impl(doc, file, size, options, encoding, result))
 		{
-			if (cur == child)
-				return false;
+			fclose(file);
+			return result;
+		}
+	#endif
+		
+		size_t max_suffix_size = sizeof(char_t);
 
-			cur = cur.parent();
+		// allocate buffer for the whole file
+		char* contents = static_cast<char*>(resource_allocate(size + max_suffix_size, doc.memory_resource()));
+
+		if (!contents)
+		{
+			fclose(file);
+			return make_parse_result(status_out_of_memory);
 		}
 
-		return true;
-	}
+		// read file in memory
+		size_t read_size = fread(contents, 1, size, file);
+		fclose(file);
 
-	PUGI__FN void node_copy_string(char_t*& dest, uintptr_t& header, uintptr_t header_mask, char_t* source, uintptr_t& source_header, xml_allocator* alloc)
-	{
-		if (source)
+		if (read_size != size)
 		{
-			if (alloc && (source_header & header_mask) == 0)
-			{
-				dest = source;
-
-				// since strcpy_insitu can reuse document buffer memory we need to mark both source and dest as shared
-				header |= xml_memory_page_contents_shared_mask;
-				source_header |= xml_memory_page_contents_shared_mask;
-			}
-			else
-				strcpy_insitu(dest, header, header_mask, source);
+			resource_deallocate(contents, doc.memory_resource());
+			return make_parse_result(status_io_error);
 		}
+
+		xml_encoding real_encoding = get_buffer_encoding(encoding, contents, size);
+		
+		return doc.load_buffer_inplace_own(contents, zero_terminate_buffer(contents, size, real_encoding), options, real_encoding);
 	}
 
-	PUGI__FN void node_copy_contents(xml_node_struct* dn, xml_node_struct* sn, xml_allocator* shared_alloc)
+#ifndef PUGIXML_NO_STL
+	template <typename T> PUGI__FN xml_parse_result load_stream_noseek_impl(xml_document& doc, std::basic_istream<T>& stream, unsigned int options, xml_encoding encoding)
 	{
-		node_copy_string(dn->name, dn->header, xml_memory_page_name_allocated_mask, sn->name, sn->header, shared_alloc);
-		node_copy_string(dn->value, dn->header, xml_memory_page_value_allocated_mask, sn->value, sn->header, shared_alloc);
+		// the data is parsed as it arrives, and the parsed parts stay in the parser buffers, so the stream contents are not copied into a separate buffer
+		xml_incremental_parser parser(doc, options, encoding);
 
-		for (xml_attribute_struct* sa = sn->first_attribute; sa; sa = sa->next_attribute)
+		buffer_holder chunk(resource_allocate(xml_memory_page_size, doc.memory_resource()), resource_deallocate, doc.memory_resource());
+		if (!chunk.data) return make_parse_result(status_out_of_memory);
+
+		while (!stream.eof())
 		{
-			xml_attribute_struct* da = append_new_attribute(dn, get_allocator(dn));
+			stream.read(static_cast<T*>(chunk.data), static_cast<std::streamsize>(xml_memory_page_size / sizeof(T)));
 
-			if (da)
+			// read may set failbit | eofbit in case gcount() is less than read length, so check for other I/O errors
+			if (stream.bad() || (!stream.eof() && stream.fail()))
 			{
-				node_copy_string(da->name, da->header, xml_memory_page_name_allocated_mask, sa->name, sa->header, shared_alloc);
-				node_copy_string(da->value, da->header, xml_memory_page_value_allocated_mask, sa->value, sa->header, shared_alloc);
+				doc.reset();
+				return make_parse_result(status_io_error);
 			}
+
+			if (!parser.feed(chunk.data, static_cast<size_t>(stream.gcount()) * sizeof(T))) break;
 		}
+
+		return parser.finish();
 	}
 
-	PUGI__FN void node_copy_tree(xml_node_struct* dn, xml_node_struct* sn)
+	template <typename T> PUGI__FN xml_parse_status load_stream_data_seek(std::basic_istream<T>& stream, void** out_buffer, size_t* out_size, xml_memory_resource* resource)
 	{
-		xml_allocator& alloc = get_allocator(dn);
-		xml_allocator* shared_alloc = (&alloc == &get_allocator(sn)) ? &alloc : 0;
+		// get length of remaining data in stream
+		typename std::basic_istream<T>::pos_type pos = stream.tellg();
+		stream.seekg(0, std::ios::end);
+		std::streamoff length = stream.tellg() - pos;
+		stream.seekg(pos);
 
-		node_copy_contents(dn, sn, shared_alloc);
+		if (stream.fail() || pos < 0) return status_io_error;
 
-		xml_node_struct* dit = dn;
-		xml_node_struct* sit = sn->first_child;
+		// guard against huge files
+		size_t read_length = static_cast<size_t>(length);
 
-		while (sit && sit != sn)
-		{
-			if (sit != dn)
-			{
-				xml_node_struct* copy = append_new_node(dit, alloc, PUGI__NODETYPE(sit));
+		if (static_cast<std::streamsize>(read_length) != length || length < 0) return status_out_of_memory;
 
-				if (copy)
-				{
-					node_copy_contents(copy, sit, shared_alloc);
+		size_t max_suffix_size = sizeof(char_t);
 
-					if (sit->first_child)
-					{
-						dit = copy;
-						sit = sit->first_child;
-						continue;
-					}
-				}
-			}
+		// read stream data into memory (guard against stream exceptions with buffer holder)
+		buffer_holder buffer(resource_allocate(read_length * sizeof(T) + max_suffix_size, resource), resource_deallocate, resource);
+		if (!buffer.data) return status_out_of_memory;
 
-			// continue to the next node
-			do
-			{
-				if (sit->next_sibling)
-				{
-					sit = sit->next_sibling;
-					break;
-				}
+		stream.read(static_cast<T*>(buffer.data), static_cast<std::streamsize>(read_length));
 
-				sit = sit->parent;
-				dit = dit->parent;
-			}
-			while (sit != sn);
-		}
-	}
+		// read may set failbit | eofbit in case gcount() is less than read_length (i.e. line ending conversion), so check for other I/O errors
+		if (stream.bad() || (!stream.eof() && stream.fail())) return status_io_error;
 
-	inline bool is_text_node(xml_node_struct* node)
-	{
-		xml_node_type type = PUGI__NODETYPE(node);
+		// return buffer
+		size_t actual_length = static_cast<size_t>(stream.gcount());
+		assert(actual_length <= read_length);
+		
+		*out_buffer = buffer.release();
+		*out_size = actual_length * sizeof(T);
 
-		return type == node_pcdata || type == node_cdata;
+		return status_ok;
 	}
 
-	// get value with conversion functions
-	PUGI__FN int get_integer_base(const char_t* value)
+#ifdef PUGIXML_HAS_THREADS
+	template <typename T> struct xml_stream_source: xml_reader_source
 	{
-		const char_t* s = value;
-
-		while (PUGI__IS_CHARTYPE(*s, ct_space))
-			s++;
+		std::basic_istream<T>* stream;
+		bool error;
 
-		if (*s == '-')
-			s++;
+		xml_stream_source(std::basic_istream<T>& stream_): stream(&stream_), error(false)
+		{
+		}
 
-		return (s[0] == '0' && (s[1] == 'x' || s[1] == 'X')) ? 16 : 10;
-	}
+		virtual size_t read(void* data, size_t size)
+		{
+			if (stream->eof()) return 0;
 
-	PUGI__FN int get_value_int(const char_t* value, int def)
-	{
-		if (!value) return def;
+			stream->read(static_cast<T*>(data), static_cast<std::streamsize>(size / sizeof(T)));
 
-		int base = get_integer_base(value);
+			// read may set failbit | eofbit in case gcount() is less than read length, so check for other I/O errors
+			if (stream->bad() || (!stream->eof() && stream->fail()))
+			{
+				error = true;
+				return 0;
+			}
 
-	#ifdef PUGIXML_WCHAR_MODE
-		return static_cast<int>(wcstol(value, 0, base));
-	#else
-		return static_cast<int>(strtol(value, 0, base));
-	#endif
-	}
+			return static_cast<size_t>(stream->gcount()) * sizeof(T);
+		}
+	};
+#endif
 
-	PUGI__FN unsigned int get_value_uint(const char_t* value, unsigned int def)
+	template <typename T> PUGI__FN xml_parse_result load_stream_impl(xml_document& doc, std::basic_istream<T>& stream, unsigned int options, xml_encoding encoding)
 	{
-		if (!value) return def;
+		void* buffer = 0;
+		size_t size = 0;
+		xml_parse_status status = status_ok;
 
-		int base = get_integer_base(value);
+		// if stream has an error bit set, bail out (otherwise tellg() can fail and we'll clear error bits)
+		if (stream.fail()) return make_parse_result(status_io_error);
 
-	#ifdef PUGIXML_WCHAR_MODE
-		return static_cast<unsigned int>(wcstoul(value, 0, base));
-	#else
-		return static_cast<unsigned int>(strtoul(value, 0, base));
-	#endif
-	}
+	#ifdef PUGIXML_HAS_THREADS
+		// exceptions can not be propagated from the reader thread, so the streams that throw them are read on this thread
+		if ((options & parse_pipelined) && stream.exceptions() == std::ios::goodbit)
+		{
+			xml_stream_source<T> source(stream);
+			xml_parse_result result;
 
-	PUGI__FN double get_value_double(const char_t* value, double def)
-	{
-		if (!value) return def;
+			if (load_pipelined_impl(doc, source, options, encoding, result))
+			{
+				if (!source.error) return result;
 
-	#ifdef PUGIXML_WCHAR_MODE
-		return wcstod(value, 0);
-	#else
-		return strtod(value, 0);
+				doc.reset();
+				return make_parse_result(status_io_error);
+			}
+		}
 	#endif
-	}
-
-	PUGI__FN float get_value_float(const char_t* value, float def)
-	{
-		if (!value) return def;
 
-	#ifdef PUGIXML_WCHAR_MODE
-		return static_cast<float>(wcstod(value, 0));
-	#else
-		return static_cast<float>(strtod(value, 0));
-	#endif
-	}
+		// load stream to memory (using seek-based implementation if possible, since it's faster), or parse it while reading
+		if (stream.tellg() < 0)
+		{
+			stream.clear(); // clear error flags that could be set by a failing tellg
+			return load_stream_noseek_impl(doc, stream, options, encoding);
+		}
 
-	PUGI__FN bool get_value_bool(const char_t* value, bool def)
-	{
-		if (!value) return def;
+		status = load_stream_data_seek(stream, &buffer, &size, doc.memory_resource());
 
-		// only look at first char
-		char_t first = *value;
+		if (status != status_ok) return make_parse_result(status);
 
-		// 1*, t* (true), T* (True), y* (yes), Y* (YES)
-		return (first == '1' || first == 't' || first == 'T' || first == 'y' || first == 'Y');
+		xml_encoding real_encoding = get_buffer_encoding(encoding, buffer, size);
+		
+		return doc.load_buffer_inplace_own(buffer, zero_terminate_buffer(buffer, size, real_encoding), options, real_encoding);
 	}
+#endif
 
-#ifdef PUGIXML_HAS_LONG_LONG
-	PUGI__FN long long get_value_llong(const char_t* value, long long def)
+#if defined(PUGI__MSVC_CRT_VERSION) || defined(__BORLANDC__) || (defined(__MINGW32__) && !defined(__STRICT_ANSI__))
+	PUGI__FN FILE* open_file_wide(const wchar_t* path, const wchar_t* mode)
 	{
-		if (!value) return def;
-
-		int base = get_integer_base(value);
-
-	#ifdef PUGIXML_WCHAR_MODE
-		#ifdef PUGI__MSVC_CRT_VERSION
-			return _wcstoi64(value, 0, base);
-		#else
-			return wcstoll(value, 0, base);
-		#endif
-	#else
-		#ifdef PUGI__MSVC_CRT_VERSION
-			return _strtoi64(value, 0, base);
-		#else
-			return strtoll(value, 0, base);
-		#endif
-	#endif
+		return _wfopen(path, mode);
 	}
-
-	PUGI__FN unsigned long long get_value_ullong(const char_t* value, unsigned long long def)
+#else
+	PUGI__FN char* convert_path_heap(const wchar_t* str)
 	{
-		if (!value) return def;
+		assert(str);
 
-		int base = get_integer_base(value);
+		// first pass: get length in utf8 characters
+		size_t length = strlength_wide(str);
+		size_t size = as_utf8_begin(str, length);
 
-	#ifdef PUGIXML_WCHAR_MODE
-		#ifdef PUGI__MSVC_CRT_VERSION
-			return _wcstoui64(value, 0, base);
-		#else
-			return wcstoull(value, 0, base);
-		#endif
-	#else
-		#ifdef PUGI__MSVC_CRT_VERSION
-			return _strtoui64(value, 0, base);
-		#else
-			return strtoull(value, 0, base);
-		#endif
-	#endif
-	}
-#endif
+		// allocate resulting string
+		char* result = static_cast<char*>(xml_memory::allocate(size + 1));
+		if (!result) return 0;
 
-	// set value with conversion functions
-	PUGI__FN bool set_value_buffer(char_t*& dest, uintptr_t& header, uintptr_t header_mask, char (&buf)[128])
-	{
-	#ifdef PUGIXML_WCHAR_MODE
-		char_t wbuf[128];
-		impl::widen_ascii(wbuf, buf);
+		// second pass: convert to utf8
+		as_utf8_end(result, size, str, length);
 
-		return strcpy_insitu(dest, header, header_mask, wbuf);
-	#else
-		return strcpy_insitu(dest, header, header_mask, buf);
-	#endif
+		return result;
 	}
 
-	PUGI__FN bool set_value_convert(char_t*& dest, uintptr_t& header, uintptr_t header_mask, int value)
+	PUGI__FN FILE* open_file_wide(const wchar_t* path, const wchar_t* mode)
 	{
-		char buf[128];
-		sprintf(buf, "%d", value);
-	
-		return set_value_buffer(dest, header, header_mask, buf);
-	}
+		// there is no standard function to open wide paths, so our best bet is to try utf8 path
+		char* path_utf8 = convert_path_heap(path);
+		if (!path_utf8) return 0;
 
-	PUGI__FN bool set_value_convert(char_t*& dest, uintptr_t& header, uintptr_t header_mask, unsigned int value)
-	{
-		char buf[128];
-		sprintf(buf, "%u", value);
+		// convert mode to ASCII (we mirror _wfopen interface)
+		char mode_ascii[4] = {0};
+		for (size_t i = 0; mode[i]; ++i) mode_ascii[i] = static_cast<char>(mode[i]);
 
-		return set_value_buffer(dest, header, header_mask, buf);
-	}
+		// try to open the utf8 path
+		FILE* result = fopen(path_utf8, mode_ascii);
 
-	PUGI__FN bool set_value_convert(char_t*& dest, uintptr_t& header, uintptr_t header_mask, double value)
-	{
-		char buf[128];
-		sprintf(buf, "%g", value);
+		// free dummy buffer
+		xml_memory::deallocate(path_utf8);
 
-		return set_value_buffer(dest, header, header_mask, buf);
-	}
-	
-	PUGI__FN bool set_value_convert(char_t*& dest, uintptr_t& header, uintptr_t header_mask, bool value)
-	{
-		return strcpy_insitu(dest, header, header_mask, value ? PUGIXML_TEXT("true") : PUGIXML_TEXT("false"));
+		return result;
 	}
+#endif
 
-#ifdef PUGIXML_HAS_LONG_LONG
-	PUGI__FN bool set_value_convert(char_t*& dest, uintptr_t& header, uintptr_t header_mask, long long value)
+	PUGI__FN bool save_file_impl(const xml_document& doc, FILE* file, const char_t* indent, unsigned int flags, xml_encoding encoding)
 	{
-		char buf[128];
-		sprintf(buf, "%lld", value);
-	
-		return set_value_buffer(dest, header, header_mask, buf);
-	}
+		if (!file) return false;
 
-	PUGI__FN bool set_value_convert(char_t*& dest, uintptr_t& header, uintptr_t header_mask, unsigned long long value)
-	{
-		char buf[128];
-		sprintf(buf, "%llu", value);
-	
-		return set_value_buffer(dest, header, header_mask, buf);
+		xml_writer_file writer(file);
+		doc.save(writer, indent, flags, encoding);
+
+		int result = ferror(file);
+
+		fclose(file);
+
+		return result == 0;
 	}
-#endif
 
-	// we need to get length of entire file to load it in memory; the only (relatively) sane way to do it is via seek/tell trick
-	PUGI__FN xml_parse_status get_file_size(FILE* file, size_t& out_result)
+	PUGI__FN xml_parse_result load_buffer_impl(xml_document_struct* doc, xml_node_struct* root, void* contents, size_t size, unsigned int options, xml_encoding encoding, bool is_mutable, bool own, char_t** out_buffer)
 	{
-	#if defined(PUGI__MSVC_CRT_VERSION) && PUGI__MSVC_CRT_VERSION >= 1400 && !defined(_WIN32_WCE)
-		// there are 64-bit versions of fseek/ftell, let's use them
-		typedef __int64 length_type;
-
-		_fseeki64(file, 0, SEEK_END);
-		length_type length = _ftelli64(file);
-		_fseeki64(file, 0, SEEK_SET);
-	#elif defined(__MINGW32__) && !defined(__NO_MINGW_LFS) && !defined(__STRICT_ANSI__)
-		// there are 64-bit versions of fseek/ftell, let's use them
-		typedef off64_t length_type;
+		// check input buffer
+		assert(contents || size == 0);
 
-		fseeko64(file, 0, SEEK_END);
-		length_type length = ftello64(file);
-		fseeko64(file, 0, SEEK_SET);
-	#else
-		// if this is a 32-bit OS, long is enough; if this is a unix system, long is 64-bit, which is enough; otherwise we can't do anything anyway.
-		typedef long length_type;
+		// get actual encoding
+		xml_encoding buffer_encoding = impl::get_buffer_encoding(encoding, contents, size);
 
-		fseek(file, 0, SEEK_END);
-		length_type length = ftell(file);
-		fseek(file, 0, SEEK_SET);
-	#endif
+		// get private buffer
+		char_t* buffer = 0;
+		size_t length = 0;
 
-		// check for I/O errors
-		if (length < 0) return status_io_error;
+		if (!impl::convert_buffer(buffer, length, buffer_encoding, contents, size, doc->_resource, is_mutable)) return impl::make_parse_result(status_out_of_memory);
 		
-		// check for overflow
-		size_t result = static_cast<size_t>(length);
+		// delete original buffer if we performed a conversion
+		if (own && buffer != contents && contents) impl::resource_deallocate(contents, doc->_resource);
 
-		if (static_cast<length_type>(result) != length) return status_out_of_memory;
+		// store buffer for offset_debug
+		doc->buffer = buffer;
 
-		// finalize
-		out_result = result;
+		// new values can reuse the memory of the values that were converted before
+		if (doc->values) clear_value_cache(*doc->values);
 
-		return status_ok;
-	}
+		// the tree takes about as much memory as the text, so large documents start with large pages
+		doc->reserve_page_size(size);
 
-	PUGI__FN size_t zero_terminate_buffer(void* buffer, size_t size, xml_encoding encoding) 
-	{
-		// We only need to zero-terminate if encoding conversion does not do it for us
-	#ifdef PUGIXML_WCHAR_MODE
-		xml_encoding wchar_encoding = get_wchar_encoding();
+		// parse
+		xml_parse_result res = impl::xml_parser::parse(buffer, length, doc, root, options);
 
-		if (encoding == wchar_encoding || need_endian_swap_utf(encoding, wchar_encoding))
-		{
-			size_t length = size / sizeof(char_t);
+		// remember encoding
+		res.encoding = buffer_encoding;
 
-			static_cast<char_t*>(buffer)[length] = 0;
-			return (length + 1) * sizeof(char_t);
-		}
-	#else
-		if (encoding == encoding_utf8)
-		{
-			static_cast<char*>(buffer)[size] = 0;
-			return size + 1;
-		}
-	#endif
+		// grab onto buffer if it's our buffer, user is responsible for deallocating contents himself
+		if (own || buffer != contents) *out_buffer = buffer;
 
-		return size;
+		return res;
 	}
 
-	PUGI__FN xml_parse_result load_file_impl(xml_document& doc, FILE* file, unsigned int options, xml_encoding encoding)
+	struct xml_batch_item
 	{
-		if (!file) return make_parse_result(status_file_not_found);
+		xml_document* document;
 
-		// get file size (can result in I/O errors)
-		size_t size = 0;
-		xml_parse_status size_status = get_file_size(file, size);
+		const char* path;
+		const wchar_t* wide_path;
+		const void* contents;
+		size_t size;
 
-		if (size_status != status_ok)
-		{
-			fclose(file);
-			return make_parse_result(size_status);
-		}
-		
-		size_t max_suffix_size = sizeof(char_t);
+		unsigned int options;
+		xml_encoding encoding;
 
-		// allocate buffer for the whole file
-		char* contents = static_cast<char*>(xml_memory::allocate(size + max_suffix_size));
+		xml_parse_result result;
 
-		if (!contents)
+		void load()
 		{
-			fclose(file);
-			return make_parse_result(status_out_of_memory);
+			if (path)
+				result = document->load_file(path, options, encoding);
+			else if (wide_path)
+				result = document->load_file(wide_path, options, encoding);
+			else
+				result = document->load_buffer(contents, size, options, encoding);
 		}
+	};
 
-		// read file in memory
-		size_t read_size = fread(contents, 1, size, file);
-		fclose(file);
+#ifdef PUGIXML_HAS_THREADS
+	struct xml_batch_queue
+	{
+		xml_batch_item* items;
+		size_t size;
+		size_t next;
 
-		if (read_size != size)
+		xml_mutex mutex;
+
+		xml_batch_queue(xml_batch_item* items_, size_t size_): items(items_), size(size_), next(0)
 		{
-			xml_memory::deallocate(contents);
-			return make_parse_result(status_io_error);
 		}
 
-		xml_encoding real_encoding = get_buffer_encoding(encoding, contents, size);
-		
-		return doc.load_buffer_inplace_own(contents, zero_terminate_buffer(contents, size, real_encoding), options, real_encoding);
-	}
-
-#ifndef PUGIXML_NO_STL
-	template <typename T> struct xml_stream_chunk
-	{
-		static xml_stream_chunk* create()
+		xml_batch_item* take()
 		{
-			void* memory = xml_memory::allocate(sizeof(xml_stream_chunk));
-			
-			return new (memory) xml_stream_chunk();
+			mutex.lock();
+			xml_batch_item* result = next < size ? &items[next++] : 0;
+			mutex.unlock();
+
+			return result;
 		}
 
-		static void destroy(void* ptr)
+		static void run(void* data)
 		{
-			xml_stream_chunk* chunk = static_cast<xml_stream_chunk*>(ptr);
+			xml_batch_queue* queue = static_cast<xml_batch_queue*>(data);
 
-			// free chunk chain
-			while (chunk)
-			{
-				xml_stream_chunk* next_ = chunk->next;
+			// documents are independent, so every thread picks the next unclaimed one until the queue is empty
+			while (xml_batch_item* item = queue->take())
+				item->load();
+		}
+	};
 
-				xml_memory::deallocate(chunk);
+	PUGI__FN bool load_batch_parallel(xml_batch_item* items, size_t size, unsigned int thread_count)
+	{
+		xml_thread* threads = static_cast<xml_thread*>(xml_memory::allocate((thread_count - 1) * sizeof(xml_thread)));
+		if (!threads) return false;
 
-				chunk = next_;
-			}
-		}
+		xml_batch_queue queue(items, size);
 
-		xml_stream_chunk(): next(0), size(0)
+		if (!queue.mutex.create())
 		{
+			xml_memory::deallocate(threads);
+			return false;
 		}
 
-		xml_stream_chunk* next;
-		size_t size;
+		// the calling thread works on the queue as well
+		unsigned int started = 0;
 
-		T data[xml_memory_page_size / sizeof(T)];
-	};
+		while (started < thread_count - 1 && threads[started].start(xml_batch_queue::run, &queue)) started++;
 
-	template <typename T> PUGI__FN xml_parse_status load_stream_data_noseek(std::basic_istream<T>& stream, void** out_buffer, size_t* out_size)
-	{
-		buffer_holder chunks(0, xml_stream_chunk<T>::destroy);
+		xml_batch_queue::run(&queue);
 
-		// read file to a chunk list
-		size_t total = 0;
-		xml_stream_chunk<T>* last = 0;
+		for (unsigned int i = 0; i < started; ++i) threads[i].join();
 
-		while (!stream.eof())
-		{
-			// allocate new chunk
-			xml_stream_chunk<T>* chunk = xml_stream_chunk<T>::create();
-			if (!chunk) return status_out_of_memory;
+		queue.mutex.destroy();
+		xml_memory::deallocate(threads);
+
+		return true;
+	}
+#endif
+PUGI__NS_END
+
+namespace pugi
+{
+	PUGI__FN xml_writer_file::xml_writer_file(void* file_): file(file_)
+	{
+	}
 
-			// append chunk to list
-			if (last) last = last->next = chunk;
-			else chunks.data = last = chunk;
+	PUGI__FN void xml_writer_file::write(const void* data, size_t size)
+	{
+		size_t result = fwrite(data, 1, size, static_cast<FILE*>(file));
+		(void)!result; // unfortunately we can't do proper error handling here
+	}
 
-			// read data to chunk
-			stream.read(chunk->data, static_cast<std::streamsize>(sizeof(chunk->data) / sizeof(T)));
-			chunk->size = static_cast<size_t>(stream.gcount()) * sizeof(T);
+#ifndef PUGIXML_NO_STL
+	PUGI__FN xml_writer_stream::xml_writer_stream(std::basic_ostream<char, std::char_traits<char> >& stream): narrow_stream(&stream), wide_stream(0)
+	{
+	}
 
-			// read may set failbit | eofbit in case gcount() is less than read length, so check for other I/O errors
-			if (stream.bad() || (!stream.eof() && stream.fail())) return status_io_error;
+	PUGI__FN xml_writer_stream::xml_writer_stream(std::basic_ostream<wchar_t, std::char_traits<wchar_t> >& stream): narrow_stream(0), wide_stream(&stream)
+	{
+	}
 
-			// guard against huge files (chunk size is small enough to make this overflow check work)
-			if (total + chunk->size < total) return status_out_of_memory;
-			total += chunk->size;
+	PUGI__FN void xml_writer_stream::write(const void* data, size_t size)
+	{
+		if (narrow_stream)
+		{
+			assert(!wide_stream);
+			narrow_stream->write(reinterpret_cast<const char*>(data), static_cast<std::streamsize>(size));
 		}
+		else
+		{
+			assert(wide_stream);
+			assert(size % sizeof(wchar_t) == 0);
 
-		size_t max_suffix_size = sizeof(char_t);
+			wide_stream->write(reinterpret_cast<const wchar_t*>(data), static_cast<std::streamsize>(size / sizeof(wchar_t)));
+		}
+	}
+#endif
 
-		// copy chunk list to a contiguous buffer
-		char* buffer = static_cast<char*>(xml_memory::allocate(total + max_suffix_size));
-		if (!buffer) return status_out_of_memory;
+	PUGI__FN xml_tree_walker::xml_tree_walker(): _depth(0)
+	{
+	}
+	
+	PUGI__FN xml_tree_walker::~xml_tree_walker()
+	{
+	}
 
-		char* write = buffer;
+	PUGI__FN int xml_tree_walker::depth() const
+	{
+		return _depth;
+	}
 
-		for (xml_stream_chunk<T>* chunk = static_cast<xml_stream_chunk<T>*>(chunks.data); chunk; chunk = chunk->next)
-		{
-			assert(write + chunk->size <= buffer + total);
-			memcpy(write, chunk->data, chunk->size);
-			write += chunk->size;
-		}
+	PUGI__FN bool xml_tree_walker::begin(xml_node&)
+	{
+		return true;
+	}
 
-		assert(write == buffer + total);
+	PUGI__FN bool xml_tree_walker::end(xml_node&)
+	{
+		return true;
+	}
 
-		// return buffer
-		*out_buffer = buffer;
-		*out_size = total;
+	PUGI__FN xml_attribute::xml_attribute(): _attr(0)
+	{
+	}
 
-		return status_ok;
+	PUGI__FN xml_attribute::xml_attribute(xml_attribute_struct* attr): _attr(attr)
+	{
 	}
 
-	template <typename T> PUGI__FN xml_parse_status load_stream_data_seek(std::basic_istream<T>& stream, void** out_buffer, size_t* out_size)
+	PUGI__FN static void unspecified_bool_xml_attribute(xml_attribute***)
 	{
-		// get length of remaining data in stream
-		typename std::basic_istream<T>::pos_type pos = stream.tellg();
-		stream.seekg(0, std::ios::end);
-		std::streamoff length = stream.tellg() - pos;
-		stream.seekg(pos);
+	}
 
-		if (stream.fail() || pos < 0) return status_io_error;
+	PUGI__FN xml_attribute::operator xml_attribute::unspecified_bool_type() const
+	{
+		return _attr ? unspecified_bool_xml_attribute : 0;
+	}
 
-		// guard against huge files
-		size_t read_length = static_cast<size_t>(length);
+	PUGI__FN bool xml_attribute::operator!() const
+	{
+		return !_attr;
+	}
 
-		if (static_cast<std::streamsize>(read_length) != length || length < 0) return status_out_of_memory;
+	PUGI__FN bool xml_attribute::operator==(const xml_attribute& r) const
+	{
+		return (_attr == r._attr);
+	}
+	
+	PUGI__FN bool xml_attribute::operator!=(const xml_attribute& r) const
+	{
+		return (_attr != r._attr);
+	}
 
-		size_t max_suffix_size = sizeof(char_t);
+	PUGI__FN bool xml_attribute::operator<(const xml_attribute& r) const
+	{
+		return (_attr < r._attr);
+	}
+	
+	PUGI__FN bool xml_attribute::operator>(const xml_attribute& r) const
+	{
+		return (_attr > r._attr);
+	}
+	
+	PUGI__FN bool xml_attribute::operator<=(const xml_attribute& r) const
+	{
+		return (_attr <= r._attr);
+	}
+	
+	PUGI__FN bool xml_attribute::operator>=(const xml_attribute& r) const
+	{
+		return (_attr >= r._attr);
+	}
 
-		// read stream data into memory (guard against stream exceptions with buffer holder)
-		buffer_holder buffer(xml_memory::allocate(read_length * sizeof(T) + max_suffix_size), xml_memory::deallocate);
-		if (!buffer.data) return status_out_of_memory;
+	PUGI__FN xml_attribute xml_attribute::next_attribute() const
+	{
+		return _attr ? xml_attribute(_attr->next_attribute) : xml_attribute();
+	}
 
-		stream.read(static_cast<T*>(buffer.data), static_cast<std::streamsize>(read_length));
+	PUGI__FN xml_attribute xml_attribute::previous_attribute() const
+	{
+		return _attr && _attr->prev_attribute_c->next_attribute ? xml_attribute(_attr->prev_attribute_c) : xml_attribute();
+	}
 
-		// read may set failbit | eofbit in case gcount() is less than read_length (i.e. line ending conversion), so check for other I/O errors
-		if (stream.bad() || (!stream.eof() && stream.fail())) return status_io_error;
+	PUGI__FN const char_t* xml_attribute::as_string(const char_t* def) const
+	{
+		return (_attr && _attr->value) ? impl::get_value(_attr) : def;
+	}
 
-		// return buffer
-		size_t actual_length = static_cast<size_t>(stream.gcount());
-		assert(actual_length <= read_length);
-		
-		*out_buffer = buffer.release();
-		*out_size = actual_length * sizeof(T);
+	PUGI__FN int xml_attribute::as_int(int def, bool* ok) const
+	{
+		return impl::get_value_number<int>(_attr, def, ok, impl::value_cache_int, impl::convert_value_int);
+	}
 
-		return status_ok;
+	PUGI__FN unsigned int xml_attribute::as_uint(unsigned int def, bool* ok) const
+	{
+		return impl::get_value_number<unsigned int>(_attr, def, ok, impl::value_cache_uint, impl::convert_value_uint);
 	}
 
-	template <typename T> PUGI__FN xml_parse_result load_stream_impl(xml_document& doc, std::basic_istream<T>& stream, unsigned int options, xml_encoding encoding)
+	PUGI__FN double xml_attribute::as_double(double def, bool* ok) const
 	{
-		void* buffer = 0;
-		size_t size = 0;
-		xml_parse_status status = status_ok;
+		return impl::get_value_number<double>(_attr, def, ok, impl::value_cache_double, impl::convert_value_double);
+	}
 
-		// if stream has an error bit set, bail out (otherwise tellg() can fail and we'll clear error bits)
-		if (stream.fail()) return make_parse_result(status_io_error);
+	PUGI__FN float xml_attribute::as_float(float def, bool* ok) const
+	{
+		return impl::get_value_number<float>(_attr, def, ok, impl::value_cache_float, impl::convert_value_float);
+	}
 
-		// load stream to memory (using seek-based implementation if possible, since it's faster and takes less memory)
-		if (stream.tellg() < 0)
-		{
-			stream.clear(); // clear error flags that could be set by a failing tellg
-			status = load_stream_data_noseek(stream, &buffer, &size);
-		}
-		else
-			status = load_stream_data_seek(stream, &buffer, &size);
+	PUGI__FN bool xml_attribute::as_bool(bool def) const
+	{
+		return impl::get_value_bool(_attr ? impl::get_value(_attr) : 0, def);
+	}
 
-		if (status != status_ok) return make_parse_result(status);
+#ifdef PUGIXML_HAS_LONG_LONG
+	PUGI__FN long long xml_attribute::as_llong(long long def, bool* ok) const
+	{
+		return impl::get_value_number<long long>(_attr, def, ok, impl::value_cache_llong, impl::convert_value_llong);
+	}
 
-		xml_encoding real_encoding = get_buffer_encoding(encoding, buffer, size);
-		
-		return doc.load_buffer_inplace_own(buffer, zero_terminate_buffer(buffer, size, real_encoding), options, real_encoding);
+	PUGI__FN unsigned long long xml_attribute::as_ullong(unsigned long long def, bool* ok) const
+	{
+		return impl::get_value_number<unsigned long long>(_attr, def, ok, impl::value_cache_ullong, impl::convert_value_ullong);
 	}
 #endif
 
-#if defined(PUGI__MSVC_CRT_VERSION) || defined(__BORLANDC__) || (defined(__MINGW32__) && !defined(__STRICT_ANSI__))
-	PUGI__FN FILE* open_file_wide(const wchar_t* path, const wchar_t* mode)
+	PUGI__FN bool xml_attribute::empty() const
 	{
-		return _wfopen(path, mode);
+		return !_attr;
 	}
-#else
-	PUGI__FN char* convert_path_heap(const wchar_t* str)
-	{
-		assert(str);
 
-		// first pass: get length in utf8 characters
-		size_t length = strlength_wide(str);
-		size_t size = as_utf8_begin(str, length);
+	PUGI__FN const char_t* xml_attribute::name() const
+	{
+		return (_attr && _attr->name) ? _attr->name : PUGIXML_TEXT("");
+	}
 
-		// allocate resulting string
-		char* result = static_cast<char*>(xml_memory::allocate(size + 1));
-		if (!result) return 0;
+	PUGI__FN const char_t* xml_attribute::value() const
+	{
+		return (_attr && _attr->value) ? impl::get_value(_attr) : PUGIXML_TEXT("");
+	}
 
-		// second pass: convert to utf8
-		as_utf8_end(result, size, str, length);
+	PUGI__FN size_t xml_attribute::hash_value() const
+	{
+		return static_cast<size_t>(reinterpret_cast<uintptr_t>(_attr) / sizeof(xml_attribute_struct));
+	}
 
-		return result;
+	PUGI__FN xml_attribute_struct* xml_attribute::internal_object() const
+	{
+		return _attr;
 	}
 
-	PUGI__FN FILE* open_file_wide(const wchar_t* path, const wchar_t* mode)
+	PUGI__FN xml_attribute& xml_attribute::operator=(const char_t* rhs)
 	{
-		// there is no standard function to open wide paths, so our best bet is to try utf8 path
-		char* path_utf8 = convert_path_heap(path);
-		if (!path_utf8) return 0;
+		set_value(rhs);
+		return *this;
+	}
+	
+	PUGI__FN xml_attribute& xml_attribute::operator=(int rhs)
+	{
+		set_value(rhs);
+		return *this;
+	}
 
-		// convert mode to ASCII (we mirror _wfopen interface)
-		char mode_ascii[4] = {0};
-		for (size_t i = 0; mode[i]; ++i) mode_ascii[i] = static_cast<char>(mode[i]);
+	PUGI__FN xml_attribute& xml_attribute::operator=(unsigned int rhs)
+	{
+		set_value(rhs);
+		return *this;
+	}
 
-		// try to open the utf8 path
-		FILE* result = fopen(path_utf8, mode_ascii);
+	PUGI__FN xml_attribute& xml_attribute::operator=(float rhs)
+	{
+		set_value(rhs);
+		return *this;
+	}
+	
+	PUGI__FN xml_attribute& xml_attribute::operator=(double rhs)
+	{
+		set_value(rhs);
+		return *this;
+	}
+	
+	PUGI__FN xml_attribute& xml_attribute::operator=(bool rhs)
+	{
+		set_value(rhs);
+		return *this;
+	}
 
-		// free dummy buffer
-		xml_memory::deallocate(path_utf8);
+#ifdef PUGIXML_HAS_LONG_LONG
+	PUGI__FN xml_attribute& xml_attribute::operator=(long long rhs)
+	{
+		set_value(rhs);
+		return *this;
+	}
 
-		return result;
+	PUGI__FN xml_attribute& xml_attribute::operator=(unsigned long long rhs)
+	{
+		set_value(rhs);
+		return *this;
 	}
 #endif
 
-	PUGI__FN bool save_file_impl(const xml_document& doc, FILE* file, const char_t* indent, unsigned int flags, xml_encoding encoding)
+	PUGI__FN bool xml_attribute::set_name(const char_t* rhs)
 	{
-		if (!file) return false;
+		if (!_attr) return false;
+		
+		return impl::set_name(_attr, rhs);
+	}
+		
+	PUGI__FN bool xml_attribute::set_value(const char_t* rhs)
+	{
+		if (!_attr) return false;
 
-		xml_writer_file writer(file);
-		doc.save(writer, indent, flags, encoding);
+		return impl::strcpy_insitu(_attr->value, _attr->header, impl::xml_memory_page_value_allocated_mask, rhs);
+	}
 
-		int result = ferror(file);
+	PUGI__FN bool xml_attribute::set_value(int rhs)
+	{
+		if (!_attr) return false;
 
-		fclose(file);
+		return impl::set_value_convert(_attr->value, _attr->header, impl::xml_memory_page_value_allocated_mask, rhs);
+	}
 
-		return result == 0;
+	PUGI__FN bool xml_attribute::set_value(unsigned int rhs)
+	{
+		if (!_attr) return false;
+
+		return impl::set_value_convert(_attr->value, _attr->header, impl::xml_memory_page_value_allocated_mask, rhs);
 	}
 
-	PUGI__FN xml_parse_result load_buffer_impl(xml_document_struct* doc, xml_node_struct* root, void* contents, size_t size, unsigned int options, xml_encoding encoding, bool is_mutable, bool own, char_t** out_buffer)
+	PUGI__FN bool xml_attribute::set_value(float rhs)
 	{
-		// check input buffer
-		assert(contents || size == 0);
+		if (!_attr) return false;
 
-		// get actual encoding
-		xml_encoding buffer_encoding = impl::get_buffer_encoding(encoding, contents, size);
+		return impl::set_value_convert(_attr->value, _attr->header, impl::xml_memory_page_value_allocated_mask, rhs);
+	}
+	
+	PUGI__FN bool xml_attribute::set_value(double rhs)
+	{
+		if (!_attr) return false;
 
-		// get private buffer
-		char_t* buffer = 0;
-		size_t length = 0;
+		return impl::set_value_convert(_attr->value, _attr->header, impl::xml_memory_page_value_allocated_mask, rhs);
+	}
+	
+	PUGI__FN bool xml_attribute::set_value(bool rhs)
+	{
+		if (!_attr) return false;
 
-		if (!impl::convert_buffer(buffer, length, buffer_encoding, contents, size, is_mutable)) return impl::make_parse_result(status_out_of_memory);
-		
-		// delete original buffer if we performed a conversion
-		if (own && buffer != contents && contents) impl::xml_memory::deallocate(contents);
+		return impl::set_value_convert(_attr->value, _attr->header, impl::xml_memory_page_value_allocated_mask, rhs);
+	}
 
-		// store buffer for offset_debug
-		doc->buffer = buffer;
+#ifdef PUGIXML_HAS_LONG_LONG
+	PUGI__FN bool xml_attribute::set_value(long long rhs)
+	{
+		if (!_attr) return false;
 
-		// parse
-		xml_parse_result res = impl::xml_parser::parse(buffer, length, doc, root, options);
+		return impl::set_value_convert(_attr->value, _attr->header, impl::xml_memory_page_value_allocated_mask, rhs);
+	}
 
-		// remember encoding
-		res.encoding = buffer_encoding;
+	PUGI__FN bool xml_attribute::set_value(unsigned long long rhs)
+	{
+		if (!_attr) return false;
 
-		// grab onto buffer if it's our buffer, user is responsible for deallocating contents himself
-		if (own || buffer != contents) *out_buffer = buffer;
+		return impl::set_value_convert(_attr->value, _attr->header, impl::xml_memory_page_value_allocated_mask, rhs);
+	}
+#endif
 
-		return res;
+#ifdef __BORLANDC__
+	PUGI__FN bool operator&&(const xml_attribute& lhs, bool rhs)
+	{
+		return (bool)lhs && rhs;
 	}
-PUGI__NS_END
 
-namespace pugi
-{
-	PUGI__FN xml_writer_file::xml_writer_file(void* file_): file(file_)
+	PUGI__FN bool operator||(const xml_attribute& lhs, bool rhs)
 	{
+		return (bool)lhs || rhs;
 	}
+#endif
 
-	PUGI__FN void xml_writer_file::write(const void* data, size_t size)
+	PUGI__FN xml_node::xml_node(): _root(0)
 	{
-		size_t result = fwrite(data, 1, size, static_cast<FILE*>(file));
-		(void)!result; // unfortunately we can't do proper error handling here
 	}
 
-#ifndef PUGIXML_NO_STL
-	PUGI__FN xml_writer_stream::xml_writer_stream(std::basic_ostream<char, std::char_traits<char> >& stream): narrow_stream(&stream), wide_stream(0)
+	PUGI__FN xml_node::xml_node(xml_node_struct* p): _root(p)
+	{
+	}
+	
+	PUGI__FN static void unspecified_bool_xml_node(xml_node***)
 	{
 	}
 
-	PUGI__FN xml_writer_stream::xml_writer_stream(std::basic_ostream<wchar_t, std::char_traits<wchar_t> >& stream): narrow_stream(0), wide_stream(&stream)
+	PUGI__FN xml_node::operator xml_node::unspecified_bool_type() const
 	{
+		return _root ? unspecified_bool_xml_node : 0;
 	}
 
-	PUGI__FN void xml_writer_stream::write(const void* data, size_t size)
+	PUGI__FN bool xml_node::operator!() const
 	{
-		if (narrow_stream)
-		{
-			assert(!wide_stream);
-			narrow_stream->write(reinterpret_cast<const char*>(data), static_cast<std::streamsize>(size));
-		}
-		else
-		{
-			assert(wide_stream);
-			assert(size % sizeof(wchar_t) == 0);
+		return !_root;
+	}
 
-			wide_stream->write(reinterpret_cast<const wchar_t*>(data), static_cast<std::streamsize>(size / sizeof(wchar_t)));
-		}
+	PUGI__FN xml_node::iterator xml_node::begin() const
+	{
+		return iterator(_root ? impl::get_first_child(_root) : 0, _root);
 	}
-#endif
 
-	PUGI__FN xml_tree_walker::xml_tree_walker(): _depth(0)
+	PUGI__FN xml_node::iterator xml_node::end() const
 	{
+		return iterator(0, _root);
 	}
 	
-	PUGI__FN xml_tree_walker::~xml_tree_walker()
+	PUGI__FN xml_node::attribute_iterator xml_node::attributes_begin() const
 	{
+		return attribute_iterator(_root ? static_cast<xml_attribute_struct*>(_root->first_attribute) : 0, _root);
 	}
 
-	PUGI__FN int xml_tree_walker::depth() const
+	PUGI__FN xml_node::attribute_iterator xml_node::attributes_end() const
 	{
-		return _depth;
+		return attribute_iterator(0, _root);
 	}
-
-	PUGI__FN bool xml_tree_walker::begin(xml_node&)
+	
+	PUGI__FN xml_object_range<xml_node_iterator> xml_node::children() const
 	{
-		return true;
+		return xml_object_range<xml_node_iterator>(begin(), end());
 	}
 
-	PUGI__FN bool xml_tree_walker::end(xml_node&)
+	PUGI__FN xml_object_range<xml_named_node_iterator> xml_node::children(const char_t* name_) const
 	{
-		return true;
+		return xml_object_range<xml_named_node_iterator>(xml_named_node_iterator(child(name_)._root, _root, name_), xml_named_node_iterator(0, _root, name_));
 	}
 
-	PUGI__FN xml_attribute::xml_attribute(): _attr(0)
+	PUGI__FN xml_object_range<xml_attribute_iterator> xml_node::attributes() const
 	{
+		return xml_object_range<xml_attribute_iterator>(attributes_begin(), attributes_end());
 	}
 
-	PUGI__FN xml_attribute::xml_attribute(xml_attribute_struct* attr): _attr(attr)
+	PUGI__FN bool xml_node::operator==(const xml_node& r) const
 	{
+		return (_root == r._root);
 	}
 
-	PUGI__FN static void unspecified_bool_xml_attribute(xml_attribute***)
+	PUGI__FN bool xml_node::operator!=(const xml_node& r) const
 	{
+		return (_root != r._root);
 	}
 
-	PUGI__FN xml_attribute::operator xml_attribute::unspecified_bool_type() const
+	PUGI__FN bool xml_node::operator<(const xml_node& r) const
+	{
+		return (_root < r._root);
+	}
+	
+	PUGI__FN bool xml_node::operator>(const xml_node& r) const
+	{
+		return (_root > r._root);
+	}
+	
+	PUGI__FN bool xml_node::operator<=(const xml_node& r) const
 	{
-		return _attr ? unspecified_bool_xml_attribute : 0;
+		return (_root <= r._root);
 	}
-
-	PUGI__FN bool xml_attribute::operator!() const
+	
+	PUGI__FN bool xml_node::operator>=(const xml_node& r) const
 	{
-		return !_attr;
+		return (_root >= r._root);
 	}
 
-	PUGI__FN bool xml_attribute::operator==(const xml_attribute& r) const
+	PUGI__FN bool xml_node::empty() const
 	{
-		return (_attr == r._attr);
+		return !_root;
 	}
 	
-	PUGI__FN bool xml_attribute::operator!=(const xml_attribute& r) const
+	PUGI__FN const char_t* xml_node::name() const
 	{
-		return (_attr != r._attr);
+		return (_root && _root->name) ? _root->name : PUGIXML_TEXT("");
 	}
 
-	PUGI__FN bool xml_attribute::operator<(const xml_attribute& r) const
+	PUGI__FN xml_node_type xml_node::type() const
 	{
-		return (_attr < r._attr);
+		return _root ? PUGI__NODETYPE(_root) : node_null;
 	}
 	
-	PUGI__FN bool xml_attribute::operator>(const xml_attribute& r) const
+	PUGI__FN const char_t* xml_node::value() const
 	{
-		return (_attr > r._attr);
+		// element value is only used for the contents that are not parsed yet
+		return (_root && _root->value && PUGI__NODETYPE(_root) != node_element) ? impl::get_value(_root) : PUGIXML_TEXT("");
 	}
 	
-	PUGI__FN bool xml_attribute::operator<=(const xml_attribute& r) const
+	PUGI__FN xml_node xml_node::child(const char_t* name_) const
 	{
-		return (_attr <= r._attr);
+		if (!_root) return xml_node();
+
+		impl::xml_name_key key = impl::get_name_key(_root, name_);
+
+		for (xml_node_struct* i = impl::get_first_child(_root); i; i = i->next_sibling)
+			if (key.match(i->name)) return xml_node(i);
+
+		return xml_node();
+	}
+
+	PUGI__FN xml_attribute xml_node::attribute(const char_t* name_) const
+	{
+		if (!_root) return xml_attribute();
+
+		impl::xml_name_key key = impl::get_name_key(_root, name_);
+
+		for (xml_attribute_struct* i = _root->first_attribute; i; i = i->next_attribute)
+			if (key.match(i->name))
+				return xml_attribute(i);
+		
+		return xml_attribute();
 	}
 	
-	PUGI__FN bool xml_attribute::operator>=(const xml_attribute& r) const
+	PUGI__FN xml_node xml_node::next_sibling(const char_t* name_) const
 	{
-		return (_attr >= r._attr);
+		if (!_root) return xml_node();
+
+		impl::xml_name_key key = impl::get_name_key(_root, name_);
+		
+		for (xml_node_struct* i = _root->next_sibling; i; i = i->next_sibling)
+			if (key.match(i->name)) return xml_node(i);
+
+		return xml_node();
 	}
 
-	PUGI__FN xml_attribute xml_attribute::next_attribute() const
+	PUGI__FN xml_node xml_node::next_sibling() const
 	{
-		return _attr ? xml_attribute(_attr->next_attribute) : xml_attribute();
+		return _root ? xml_node(_root->next_sibling) : xml_node();
 	}
 
-	PUGI__FN xml_attribute xml_attribute::previous_attribute() const
+	PUGI__FN xml_node xml_node::previous_sibling(const char_t* name_) const
 	{
-		return _attr && _attr->prev_attribute_c->next_attribute ? xml_attribute(_attr->prev_attribute_c) : xml_attribute();
+		if (!_root) return xml_node();
+
+		impl::xml_name_key key = impl::get_name_key(_root, name_);
+		
+		for (xml_node_struct* i = _root->prev_sibling_c; i->next_sibling; i = i->prev_sibling_c)
+			if (key.match(i->name)) return xml_node(i);
+
+		return xml_node();
 	}
 
-	PUGI__FN const char_t* xml_attribute::as_string(const char_t* def) const
+	PUGI__FN xml_node xml_node::previous_sibling() const
 	{
-		return (_attr && _attr->value) ? _attr->value : def;
+		if (!_root) return xml_node();
+		
+		if (_root->prev_sibling_c->next_sibling) return xml_node(_root->prev_sibling_c);
+		else return xml_node();
 	}
 
-	PUGI__FN int xml_attribute::as_int(int def) const
+	PUGI__FN xml_node xml_node::parent() const
 	{
-		return impl::get_value_int(_attr ? _attr->value : 0, def);
+		return _root ? xml_node(_root->parent) : xml_node();
 	}
 
-	PUGI__FN unsigned int xml_attribute::as_uint(unsigned int def) const
+	PUGI__FN xml_node xml_node::root() const
 	{
-		return impl::get_value_uint(_attr ? _attr->value : 0, def);
+		if (!_root) return xml_node();
+
+		impl::xml_memory_page* page = impl::get_page(_root->header);
+
+		return xml_node(static_cast<impl::xml_document_struct*>(page->allocator));
 	}
 
-	PUGI__FN double xml_attribute::as_double(double def) const
+	PUGI__FN xml_text xml_node::text() const
 	{
-		return impl::get_value_double(_attr ? _attr->value : 0, def);
+		return xml_text(_root);
 	}
 
-	PUGI__FN float xml_attribute::as_float(float def) const
+	PUGI__FN const char_t* xml_node::child_value() const
 	{
-		return impl::get_value_float(_attr ? _attr->value : 0, def);
+		if (!_root) return PUGIXML_TEXT("");
+
+		const char_t* text = impl::get_embedded_pcdata(_root);
+		if (text) return text;
+		
+		for (xml_node_struct* i = impl::get_first_child(_root); i; i = i->next_sibling)
+			if (i->value && impl::is_text_node(i))
+				return impl::get_value(i);
+
+		return PUGIXML_TEXT("");
 	}
 
-	PUGI__FN bool xml_attribute::as_bool(bool def) const
+	PUGI__FN const char_t* xml_node::child_value(const char_t* name_) const
 	{
-		return impl::get_value_bool(_attr ? _attr->value : 0, def);
+		return child(name_).child_value();
 	}
 
-#ifdef PUGIXML_HAS_LONG_LONG
-	PUGI__FN long long xml_attribute::as_llong(long long def) const
+	PUGI__FN xml_attribute xml_node::first_attribute() const
 	{
-		return impl::get_value_llong(_attr ? _attr->value : 0, def);
+		return _root ? xml_attribute(_root->first_attribute) : xml_attribute();
 	}
 
-	PUGI__FN unsigned long long xml_attribute::as_ullong(unsigned long long def) const
+	PUGI__FN xml_attribute xml_node::last_attribute() const
 	{
-		return impl::get_value_ullong(_attr ? _attr->value : 0, def);
+		return _root && _root->first_attribute ? xml_attribute(_root->first_attribute->prev_attribute_c) : xml_attribute();
 	}
-#endif
 
-	PUGI__FN bool xml_attribute::empty() const
+	PUGI__FN xml_node xml_node::first_child() const
 	{
-		return !_attr;
+		return _root ? xml_node(impl::get_first_child(_root)) : xml_node();
 	}
 
-	PUGI__FN const char_t* xml_attribute::name() const
+	PUGI__FN xml_node xml_node::last_child() const
 	{
-		return (_attr && _attr->name) ? _attr->name : PUGIXML_TEXT("");
+		return _root && impl::get_first_child(_root) ? xml_node(_root->first_child->prev_sibling_c) : xml_node();
 	}
 
-	PUGI__FN const char_t* xml_attribute::value() const
+	PUGI__FN bool xml_node::set_name(const char_t* rhs)
 	{
-		return (_attr && _attr->value) ? _attr->value : PUGIXML_TEXT("");
-	}
+		switch (type())
+		{
+		case node_pi:
+		case node_declaration:
+		case node_element:
+			return impl::set_name(_root, rhs);
 
-	PUGI__FN size_t xml_attribute::hash_value() const
+		default:
+			return false;
+		}
+	}
+		
+	PUGI__FN bool xml_node::set_value(const char_t* rhs)
 	{
-		return static_cast<size_t>(reinterpret_cast<uintptr_t>(_attr) / sizeof(xml_attribute_struct));
+		switch (type())
+		{
+		case node_pi:
+		case node_cdata:
+		case node_pcdata:
+		case node_comment:
+		case node_doctype:
+			return impl::strcpy_insitu(_root->value, _root->header, impl::xml_memory_page_value_allocated_mask, rhs);
+
+		default:
+			return false;
+		}
 	}
 
-	PUGI__FN xml_attribute_struct* xml_attribute::internal_object() const
+	PUGI__FN xml_attribute xml_node::append_attribute(const char_t* name_)
 	{
-		return _attr;
+		if (type() != node_element && type() != node_declaration) return xml_attribute();
+		
+		xml_attribute a(impl::allocate_attribute(impl::get_allocator(_root)));
+		if (!a) return xml_attribute();
+
+		impl::append_attribute(a._attr, _root);
+
+		a.set_name(name_);
+		
+		return a;
 	}
 
-	PUGI__FN xml_attribute& xml_attribute::operator=(const char_t* rhs)
+	PUGI__FN xml_attribute xml_node::prepend_attribute(const char_t* name_)
 	{
-		set_value(rhs);
-		return *this;
+		if (type() != node_element && type() != node_declaration) return xml_attribute();
+		
+		xml_attribute a(impl::allocate_attribute(impl::get_allocator(_root)));
+		if (!a) return xml_attribute();
+
+		impl::prepend_attribute(a._attr, _root);
+
+		a.set_name(name_);
+
+		return a;
 	}
-	
-	PUGI__FN xml_attribute& xml_attribute::operator=(int rhs)
+
+	PUGI__FN xml_attribute xml_node::insert_attribute_after(const char_t* name_, const xml_attribute& attr)
 	{
-		set_value(rhs);
-		return *this;
+		if (type() != node_element && type() != node_declaration) return xml_attribute();
+		if (!attr || !impl::is_attribute_of(attr._attr, _root)) return xml_attribute();
+		
+		xml_attribute a(impl::allocate_attribute(impl::get_allocator(_root)));
+		if (!a) return xml_attribute();
+
+		impl::insert_attribute_after(a._attr, attr._attr, _root);
+
+		a.set_name(name_);
+
+		return a;
 	}
 
-	PUGI__FN xml_attribute& xml_attribute::operator=(unsigned int rhs)
+	PUGI__FN xml_attribute xml_node::insert_attribute_before(const char_t* name_, const xml_attribute& attr)
 	{
-		set_value(rhs);
-		return *this;
+		if (type() != node_element && type() != node_declaration) return xml_attribute();
+		if (!attr || !impl::is_attribute_of(attr._attr, _root)) return xml_attribute();
+		
+		xml_attribute a(impl::allocate_attribute(impl::get_allocator(_root)));
+		if (!a) return xml_attribute();
+
+		impl::insert_attribute_before(a._attr, attr._attr, _root);
+
+		a.set_name(name_);
+
+		return a;
 	}
 
-	PUGI__FN xml_attribute& xml_attribute::operator=(double rhs)
+	PUGI__FN xml_attribute xml_node::append_copy(const xml_attribute& proto)
 	{
-		set_value(rhs);
-		return *this;
+		if (!proto) return xml_attribute();
+
+		xml_attribute result = append_attribute(proto.name());
+		result.set_value(proto.value());
+
+		return result;
 	}
-	
-	PUGI__FN xml_attribute& xml_attribute::operator=(bool rhs)
+
+	PUGI__FN xml_attribute xml_node::prepend_copy(const xml_attribute& proto)
 	{
-		set_value(rhs);
-		return *this;
+		if (!proto) return xml_attribute();
+
+		xml_attribute result = prepend_attribute(proto.name());
+		result.set_value(proto.value());
+
+		return result;
 	}
 
-#ifdef PUGIXML_HAS_LONG_LONG
-	PUGI__FN xml_attribute& xml_attribute::operator=(long long rhs)
+	PUGI__FN xml_attribute xml_node::insert_copy_after(const xml_attribute& proto, const xml_attribute& attr)
 	{
-		set_value(rhs);
-		return *this;
+		if (!proto) return xml_attribute();
+
+		xml_attribute result = insert_attribute_after(proto.name(), attr);
+		result.set_value(proto.value());
+
+		return result;
 	}
 
-	PUGI__FN xml_attribute& xml_attribute::operator=(unsigned long long rhs)
+	PUGI__FN xml_attribute xml_node::insert_copy_before(const xml_attribute& proto, const xml_attribute& attr)
 	{
-		set_value(rhs);
-		return *this;
+		if (!proto) return xml_attribute();
+
+		xml_attribute result = insert_attribute_before(proto.name(), attr);
+		result.set_value(proto.value());
+
+		return result;
 	}
-#endif
 
-	PUGI__FN bool xml_attribute::set_name(const char_t* rhs)
+	PUGI__FN xml_node xml_node::append_child(xml_node_type type_)
 	{
-		if (!_attr) return false;
+		if (!impl::allow_insert_child(this->type(), type_)) return xml_node();
+
+		impl::load_lazy_subtree(_root);
 		
-		return impl::strcpy_insitu(_attr->name, _attr->header, impl::xml_memory_page_name_allocated_mask, rhs);
+		xml_node n(impl::allocate_node(impl::get_allocator(_root), type_));
+		if (!n) return xml_node();
+
+		impl::append_node(n._root, _root);
+
+		if (type_ == node_declaration) n.set_name(PUGIXML_TEXT("xml"));
+
+		return n;
 	}
-		
-	PUGI__FN bool xml_attribute::set_value(const char_t* rhs)
+
+	PUGI__FN xml_node xml_node::prepend_child(xml_node_type type_)
 	{
-		if (!_attr) return false;
+		if (!impl::allow_insert_child(this->type(), type_)) return xml_node();
+
+		impl::load_lazy_subtree(_root);
+		
+		xml_node n(impl::allocate_node(impl::get_allocator(_root), type_));
+		if (!n) return xml_node();
 
-		return impl::strcpy_insitu(_attr->value, _attr->header, impl::xml_memory_page_value_allocated_mask, rhs);
+		impl::prepend_node(n._root, _root);
+				
+		if (type_ == node_declaration) n.set_name(PUGIXML_TEXT("xml"));
+
+		return n;
 	}
 
-	PUGI__FN bool xml_attribute::set_value(int rhs)
+	PUGI__FN xml_node xml_node::insert_child_before(xml_node_type type_, const xml_node& node)
 	{
-		if (!_attr) return false;
+		if (!impl::allow_insert_child(this->type(), type_)) return xml_node();
+		if (!node._root || node._root->parent != _root) return xml_node();
+	
+		xml_node n(impl::allocate_node(impl::get_allocator(_root), type_));
+		if (!n) return xml_node();
 
-		return impl::set_value_convert(_attr->value, _attr->header, impl::xml_memory_page_value_allocated_mask, rhs);
-	}
+		impl::insert_node_before(n._root, node._root);
 
-	PUGI__FN bool xml_attribute::set_value(unsigned int rhs)
-	{
-		if (!_attr) return false;
+		if (type_ == node_declaration) n.set_name(PUGIXML_TEXT("xml"));
 
-		return impl::set_value_convert(_attr->value, _attr->header, impl::xml_memory_page_value_allocated_mask, rhs);
+		return n;
 	}
 
-	PUGI__FN bool xml_attribute::set_value(double rhs)
+	PUGI__FN xml_node xml_node::insert_child_after(xml_node_type type_, const xml_node& node)
 	{
-		if (!_attr) return false;
-
-		return impl::set_value_convert(_attr->value, _attr->header, impl::xml_memory_page_value_allocated_mask, rhs);
-	}
+		if (!impl::allow_insert_child(this->type(), type_)) return xml_node();
+		if (!node._root || node._root->parent != _root) return xml_node();
 	
-	PUGI__FN bool xml_attribute::set_value(bool rhs)
-	{
-		if (!_attr) return false;
+		xml_node n(impl::allocate_node(impl::get_allocator(_root), type_));
+		if (!n) return xml_node();
 
-		return impl::set_value_convert(_attr->value, _attr->header, impl::xml_memory_page_value_allocated_mask, rhs);
-	}
+		impl::insert_node_after(n._root, node._root);
 
-#ifdef PUGIXML_HAS_LONG_LONG
-	PUGI__FN bool xml_attribute::set_value(long long rhs)
-	{
-		if (!_attr) return false;
+		if (type_ == node_declaration) n.set_name(PUGIXML_TEXT("xml"));
 
-		return impl::set_value_convert(_attr->value, _attr->header, impl::xml_memory_page_value_allocated_mask, rhs);
+		return n;
 	}
 
-	PUGI__FN bool xml_attribute::set_value(unsigned long long rhs)
+	PUGI__FN xml_node xml_node::append_child(const char_t* name_)
 	{
-		if (!_attr) return false;
+		xml_node result = append_child(node_element);
 
-		return impl::set_value_convert(_attr->value, _attr->header, impl::xml_memory_page_value_allocated_mask, rhs);
-	}
-#endif
+		result.set_name(name_);
 
-#ifdef __BORLANDC__
-	PUGI__FN bool operator&&(const xml_attribute& lhs, bool rhs)
-	{
-		return (bool)lhs && rhs;
+		return result;
 	}
 
-	PUGI__FN bool operator||(const xml_attribute& lhs, bool rhs)
+	PUGI__FN xml_node xml_node::prepend_child(const char_t* name_)
 	{
-		return (bool)lhs || rhs;
-	}
-#endif
+		xml_node result = prepend_child(node_element);
 
-	PUGI__FN xml_node::xml_node(): _root(0)
-	{
-	}
+		result.set_name(name_);
 
-	PUGI__FN xml_node::xml_node(xml_node_struct* p): _root(p)
-	{
-	}
-	
-	PUGI__FN static void unspecified_bool_xml_node(xml_node***)
-	{
+		return result;
 	}
 
-	PUGI__FN xml_node::operator xml_node::unspecified_bool_type() const
+	PUGI__FN xml_node xml_node::insert_child_after(const char_t* name_, const xml_node& node)
 	{
-		return _root ? unspecified_bool_xml_node : 0;
-	}
+		xml_node result = insert_child_after(node_element, node);
 
-	PUGI__FN bool xml_node::operator!() const
-	{
-		return !_root;
-	}
+		result.set_name(name_);
 
-	PUGI__FN xml_node::iterator xml_node::begin() const
-	{
-		return iterator(_root ? _root->first_child : 0, _root);
+		return result;
 	}
 
-	PUGI__FN xml_node::iterator xml_node::end() const
-	{
-		return iterator(0, _root);
-	}
-	
-	PUGI__FN xml_node::attribute_iterator xml_node::attributes_begin() const
+	PUGI__FN xml_node xml_node::insert_child_before(const char_t* name_, const xml_node& node)
 	{
-		return attribute_iterator(_root ? _root->first_attribute : 0, _root);
-	}
+		xml_node result = insert_child_before(node_element, node);
 
-	PUGI__FN xml_node::attribute_iterator xml_node::attributes_end() const
-	{
-		return attribute_iterator(0, _root);
-	}
-	
-	PUGI__FN xml_object_range<xml_node_iterator> xml_node::children() const
-	{
-		return xml_object_range<xml_node_iterator>(begin(), end());
-	}
+		result.set_name(name_);
 
-	PUGI__FN xml_object_range<xml_named_node_iterator> xml_node::children(const char_t* name_) const
-	{
-		return xml_object_range<xml_named_node_iterator>(xml_named_node_iterator(child(name_)._root, _root, name_), xml_named_node_iterator(0, _root, name_));
+		return result;
 	}
 
-	PUGI__FN xml_object_range<xml_attribute_iterator> xml_node::attributes() const
+	PUGI__FN xml_node xml_node::append_copy(const xml_node& proto)
 	{
-		return xml_object_range<xml_attribute_iterator>(attributes_begin(), attributes_end());
-	}
+		xml_node result = append_child(proto.type());
 
-	PUGI__FN bool xml_node::operator==(const xml_node& r) const
-	{
-		return (_root == r._root);
-	}
+		if (result) impl::node_copy_tree(result.internal_object(), proto.internal_object());
 
-	PUGI__FN bool xml_node::operator!=(const xml_node& r) const
-	{
-		return (_root != r._root);
+		return result;
 	}
 
-	PUGI__FN bool xml_node::operator<(const xml_node& r) const
-	{
-		return (_root < r._root);
-	}
-	
-	PUGI__FN bool xml_node::operator>(const xml_node& r) const
-	{
-		return (_root > r._root);
-	}
-	
-	PUGI__FN bool xml_node::operator<=(const xml_node& r) const
-	{
-		return (_root <= r._root);
-	}
-	
-	PUGI__FN bool xml_node::operator>=(const xml_node& r) const
+	PUGI__FN xml_node xml_node::prepend_copy(const xml_node& proto)
 	{
-		return (_root >= r._root);
-	}
+		xml_node result = prepend_child(proto.type());
 
-	PUGI__FN bool xml_node::empty() const
-	{
-		return !_root;
-	}
-	
-	PUGI__FN const char_t* xml_node::name() const
-	{
-		return (_root && _root->name) ? _root->name : PUGIXML_TEXT("");
-	}
+		if (result) impl::node_copy_tree(result.internal_object(), proto.internal_object());
 
-	PUGI__FN xml_node_type xml_node::type() const
-	{
-		return _root ? PUGI__NODETYPE(_root) : node_null;
-	}
-	
-	PUGI__FN const char_t* xml_node::value() const
-	{
-		return (_root && _root->value) ? _root->value : PUGIXML_TEXT("");
+		return result;
 	}
-	
-	PUGI__FN xml_node xml_node::child(const char_t* name_) const
+
+	PUGI__FN xml_node xml_node::insert_copy_after(const xml_node& proto, const xml_node& node)
 	{
-		if (!_root) return xml_node();
+		xml_node result = insert_child_after(proto.type(), node);
 
-		for (xml_node_struct* i = _root->first_child; i; i = i->next_sibling)
-			if (i->name && impl::strequal(name_, i->name)) return xml_node(i);
+		if (result) impl::node_copy_tree(result.internal_object(), proto.internal_object());
 
-		return xml_node();
+		return result;
 	}
 
-	PUGI__FN xml_attribute xml_node::attribute(const char_t* name_) const
+	PUGI__FN xml_node xml_node::insert_copy_before(const xml_node& proto, const xml_node& node)
 	{
-		if (!_root) return xml_attribute();
+		xml_node result = insert_child_before(proto.type(), node);
 
-		for (xml_attribute_struct* i = _root->first_attribute; i; i = i->next_attribute)
-			if (i->name && impl::strequal(name_, i->name))
-				return xml_attribute(i);
-		
-		return xml_attribute();
-	}
-	
-	PUGI__FN xml_node xml_node::next_sibling(const char_t* name_) const
-	{
-		if (!_root) return xml_node();
-		
-		for (xml_node_struct* i = _root->next_sibling; i; i = i->next_sibling)
-			if (i->name && impl::strequal(name_, i->name)) return xml_node(i);
+		if (result) impl::node_copy_tree(result.internal_object(), proto.internal_object());
 
-		return xml_node();
+		return result;
 	}
 
-	PUGI__FN xml_node xml_node::next_sibling() const
+	PUGI__FN xml_node xml_node::append_move(const xml_node& moved)
 	{
-		return _root ? xml_node(_root->next_sibling) : xml_node();
-	}
+		if (!impl::allow_move(*this, moved)) return xml_node();
+		if (!impl::get_allocator(_root).reserve()) return xml_node();
 
-	PUGI__FN xml_node xml_node::previous_sibling(const char_t* name_) const
-	{
-		if (!_root) return xml_node();
-		
-		for (xml_node_struct* i = _root->prev_sibling_c; i->next_sibling; i = i->prev_sibling_c)
-			if (i->name && impl::strequal(name_, i->name)) return xml_node(i);
+		impl::load_lazy_subtree(_root);
 
-		return xml_node();
-	}
+		// disable document_buffer_order optimization since moving nodes around changes document order without changing buffer pointers
+		impl::get_document(_root).header |= impl::xml_memory_page_contents_shared_mask;
 
-	PUGI__FN xml_node xml_node::previous_sibling() const
-	{
-		if (!_root) return xml_node();
-		
-		if (_root->prev_sibling_c->next_sibling) return xml_node(_root->prev_sibling_c);
-		else return xml_node();
-	}
+		impl::remove_node(moved._root);
+		impl::append_node(moved._root, _root);
 
-	PUGI__FN xml_node xml_node::parent() const
-	{
-		return _root ? xml_node(_root->parent) : xml_node();
+		return moved;
 	}
 
-	PUGI__FN xml_node xml_node::root() const
+	PUGI__FN xml_node xml_node::prepend_move(const xml_node& moved)
 	{
-		if (!_root) return xml_node();
+		if (!impl::allow_move(*this, moved)) return xml_node();
+		if (!impl::get_allocator(_root).reserve()) return xml_node();
 
-		impl::xml_memory_page* page = reinterpret_cast<impl::xml_memory_page*>(_root->header & impl::xml_memory_page_pointer_mask);
+		impl::load_lazy_subtree(_root);
 
-		return xml_node(static_cast<impl::xml_document_struct*>(page->allocator));
+		// disable document_buffer_order optimization since moving nodes around changes document order without changing buffer pointers
+		impl::get_document(_root).header |= impl::xml_memory_page_contents_shared_mask;
+
+		impl::remove_node(moved._root);
+		impl::prepend_node(moved._root, _root);
+
+		return moved;
 	}
 
-	PUGI__FN xml_text xml_node::text() const
+	PUGI__FN xml_node xml_node::insert_move_after(const xml_node& moved, const xml_node& node)
 	{
-		return xml_text(_root);
+		if (!impl::allow_move(*this, moved)) return xml_node();
+		if (!impl::get_allocator(_root).reserve()) return xml_node();
+		if (!node._root || node._root->parent != _root) return xml_node();
+		if (moved._root == node._root) return xml_node();
+
+		// disable document_buffer_order optimization since moving nodes around changes document order without changing buffer pointers
+		impl::get_document(_root).header |= impl::xml_memory_page_contents_shared_mask;
+
+		impl::remove_node(moved._root);
+		impl::insert_node_after(moved._root, node._root);
+
+		return moved;
 	}
 
-	PUGI__FN const char_t* xml_node::child_value() const
+	PUGI__FN xml_node xml_node::insert_move_before(const xml_node& moved, const xml_node& node)
 	{
-		if (!_root) return PUGIXML_TEXT("");
-		
-		for (xml_node_struct* i = _root->first_child; i; i = i->next_sibling)
-			if (i->value && impl::is_text_node(i))
-				return i->value;
+		if (!impl::allow_move(*this, moved)) return xml_node();
+		if (!impl::get_allocator(_root).reserve()) return xml_node();
+		if (!node._root || node._root->parent != _root) return xml_node();
+		if (moved._root == node._root) return xml_node();
+
+		// disable document_buffer_order optimization since moving nodes around changes document order without changing buffer pointers
+		impl::get_document(_root).header |= impl::xml_memory_page_contents_shared_mask;
 
-		return PUGIXML_TEXT("");
-	}
+		impl::remove_node(moved._root);
+		impl::insert_node_before(moved._root, node._root);
 
-	PUGI__FN const char_t* xml_node::child_value(const char_t* name_) const
-	{
-		return child(name_).child_value();
+		return moved;
 	}
 
-	PUGI__FN xml_attribute xml_node::first_attribute() const
+	PUGI__FN bool xml_node::remove_attribute(const char_t* name_)
 	{
-		return _root ? xml_attribute(_root->first_attribute) : xml_attribute();
+		return remove_attribute(attribute(name_));
 	}
 
-	PUGI__FN xml_attribute xml_node::last_attribute() const
+	PUGI__FN bool xml_node::remove_attribute(const xml_attribute& a)
 	{
-		return _root && _root->first_attribute ? xml_attribute(_root->first_attribute->prev_attribute_c) : xml_attribute();
-	}
+		if (!_root || !a._attr) return false;
+		if (!impl::is_attribute_of(a._attr, _root)) return false;
 
-	PUGI__FN xml_node xml_node::first_child() const
-	{
-		return _root ? xml_node(_root->first_child) : xml_node();
+		impl::xml_allocator& alloc = impl::get_allocator(_root);
+		if (!alloc.reserve()) return false;
+
+		impl::remove_attribute(a._attr, _root);
+		impl::destroy_attribute(a._attr, alloc);
+
+		return true;
 	}
 
-	PUGI__FN xml_node xml_node::last_child() const
+	PUGI__FN bool xml_node::remove_child(const char_t* name_)
 	{
-		return _root && _root->first_child ? xml_node(_root->first_child->prev_sibling_c) : xml_node();
+		return remove_child(child(name_));
 	}
 
-	PUGI__FN bool xml_node::set_name(const char_t* rhs)
+	PUGI__FN bool xml_node::remove_child(const xml_node& n)
 	{
-		switch (type())
-		{
-		case node_pi:
-		case node_declaration:
-		case node_element:
-			return impl::strcpy_insitu(_root->name, _root->header, impl::xml_memory_page_name_allocated_mask, rhs);
+		if (!_root || !n._root || n._root->parent != _root) return false;
 
-		default:
-			return false;
-		}
-	}
-		
-	PUGI__FN bool xml_node::set_value(const char_t* rhs)
-	{
-		switch (type())
-		{
-		case node_pi:
-		case node_cdata:
-		case node_pcdata:
-		case node_comment:
-		case node_doctype:
-			return impl::strcpy_insitu(_root->value, _root->header, impl::xml_memory_page_value_allocated_mask, rhs);
+		impl::xml_allocator& alloc = impl::get_allocator(_root);
+		if (!alloc.reserve()) return false;
 
-		default:
-			return false;
-		}
+		impl::remove_node(n._root);
+		impl::destroy_node(n._root, alloc);
+
+		return true;
 	}
 
-	PUGI__FN xml_attribute xml_node::append_attribute(const char_t* name_)
+	PUGI__FN xml_parse_result xml_node::append_buffer(const void* contents, size_t size, unsigned int options, xml_encoding encoding)
 	{
-		if (type() != node_element && type() != node_declaration) return xml_attribute();
-		
-		xml_attribute a(impl::allocate_attribute(impl::get_allocator(_root)));
-		if (!a) return xml_attribute();
+		// append_buffer is only valid for elements/documents
+		if (!impl::allow_insert_child(type(), node_element)) return impl::make_parse_result(status_append_invalid_root);
 
-		impl::append_attribute(a._attr, _root);
+		impl::load_lazy_subtree(_root);
 
-		a.set_name(name_);
-		
-		return a;
-	}
+		// get document node
+		impl::xml_document_struct* doc = static_cast<impl::xml_document_struct*>(root()._root);
+		assert(doc);
 
-	PUGI__FN xml_attribute xml_node::prepend_attribute(const char_t* name_)
-	{
-		if (type() != node_element && type() != node_declaration) return xml_attribute();
+		// disable document_buffer_order optimization since in a document with multiple buffers comparing buffer pointers does not make sense
+		doc->header |= impl::xml_memory_page_contents_shared_mask;
 		
-		xml_attribute a(impl::allocate_attribute(impl::get_allocator(_root)));
-		if (!a) return xml_attribute();
-
-		impl::prepend_attribute(a._attr, _root);
+		// get extra buffer element (we'll store the document fragment buffer there so that we can deallocate it later)
+		impl::xml_extra_buffer* extra = doc->reserve() ? impl::allocate_extra_buffer(*doc) : 0;
 
-		a.set_name(name_);
+		if (!extra) return impl::make_parse_result(status_out_of_memory);
 
-		return a;
-	}
+		// save name; name of the root has to be NULL before parsing - otherwise closing node mismatches will not be detected at the top level
+		char_t* rootname = _root->name;
+		_root->name = 0;
 
-	PUGI__FN xml_attribute xml_node::insert_attribute_after(const char_t* name_, const xml_attribute& attr)
-	{
-		if (type() != node_element && type() != node_declaration) return xml_attribute();
-		if (!attr || !impl::is_attribute_of(attr._attr, _root)) return xml_attribute();
-		
-		xml_attribute a(impl::allocate_attribute(impl::get_allocator(_root)));
-		if (!a) return xml_attribute();
+		// parse
+		char_t* buffer = 0;
+		xml_parse_result res = impl::load_buffer_impl(doc, _root, const_cast<void*>(contents), size, options, encoding, false, false, &buffer);
 
-		impl::insert_attribute_after(a._attr, attr._attr, _root);
+		// restore name
+		_root->name = rootname;
 
-		a.set_name(name_);
+		// add extra buffer to the list
+		extra->buffer = buffer;
+		extra->next = doc->extra_buffers;
+		doc->extra_buffers = extra;
 
-		return a;
+		return res;
 	}
 
-	PUGI__FN xml_attribute xml_node::insert_attribute_before(const char_t* name_, const xml_attribute& attr)
+	PUGI__FN xml_node xml_node::find_child_by_attribute(const char_t* name_, const char_t* attr_name, const char_t* attr_value) const
 	{
-		if (type() != node_element && type() != node_declaration) return xml_attribute();
-		if (!attr || !impl::is_attribute_of(attr._attr, _root)) return xml_attribute();
-		
-		xml_attribute a(impl::allocate_attribute(impl::get_allocator(_root)));
-		if (!a) return xml_attribute();
-
-		impl::insert_attribute_before(a._attr, attr._attr, _root);
+		if (!_root) return xml_node();
 
-		a.set_name(name_);
+		impl::xml_name_key key = impl::get_name_key(_root, name_);
+		impl::xml_name_key attr_key = impl::get_name_key(_root, attr_name);
+		
+		for (xml_node_struct* i = impl::get_first_child(_root); i; i = i->next_sibling)
+			if (key.match(i->name))
+			{
+				for (xml_attribute_struct* a = i->first_attribute; a; a = a->next_attribute)
+					if (attr_key.match(a->name) && impl::strequal(attr_value, a->value ? impl::get_value(a) : PUGIXML_TEXT("")))
+						return xml_node(i);
+			}
 
-		return a;
+		return xml_node();
 	}
 
-	PUGI__FN xml_attribute xml_node::append_copy(const xml_attribute& proto)
+	PUGI__FN xml_node xml_node::find_child_by_attribute(const char_t* attr_name, const char_t* attr_value) const
 	{
-		if (!proto) return xml_attribute();
+		if (!_root) return xml_node();
 
-		xml_attribute result = append_attribute(proto.name());
-		result.set_value(proto.value());
+		impl::xml_name_key attr_key = impl::get_name_key(_root, attr_name);
+		
+		for (xml_node_struct* i = impl::get_first_child(_root); i; i = i->next_sibling)
+			for (xml_attribute_struct* a = i->first_attribute; a; a = a->next_attribute)
+				if (attr_key.match(a->name) && impl::strequal(attr_value, a->value ? impl::get_value(a) : PUGIXML_TEXT("")))
+					return xml_node(i);
 
-		return result;
+		return xml_node();
 	}
 
-	PUGI__FN xml_attribute xml_node::prepend_copy(const xml_attribute& proto)
+#ifndef PUGIXML_NO_STL
+	PUGI__FN string_t xml_node::path(char_t delimiter) const
 	{
-		if (!proto) return xml_attribute();
+		xml_node cursor = *this; // Make a copy.
+		
+		string_t result = cursor.name();
 
-		xml_attribute result = prepend_attribute(proto.name());
-		result.set_value(proto.value());
+		while (cursor.parent())
+		{
+			cursor = cursor.parent();
+			
+			string_t temp = cursor.name();
+			temp += delimiter;
+			temp += result;
+			result.swap(temp);
+		}
 
 		return result;
 	}
+#endif
 
-	PUGI__FN xml_attribute xml_node::insert_copy_after(const xml_attribute& proto, const xml_attribute& attr)
+	PUGI__FN xml_node xml_node::first_element_by_path(const char_t* path_, char_t delimiter) const
 	{
-		if (!proto) return xml_attribute();
+		xml_node found = *this; // Current search context.
 
-		xml_attribute result = insert_attribute_after(proto.name(), attr);
-		result.set_value(proto.value());
+		if (!_root || !path_ || !path_[0]) return found;
 
-		return result;
-	}
+		if (path_[0] == delimiter)
+		{
+			// Absolute path; e.g. '/foo/bar'
+			found = found.root();
+			++path_;
+		}
 
-	PUGI__FN xml_attribute xml_node::insert_copy_before(const xml_attribute& proto, const xml_attribute& attr)
-	{
-		if (!proto) return xml_attribute();
+		const char_t* path_segment = path_;
 
-		xml_attribute result = insert_attribute_before(proto.name(), attr);
-		result.set_value(proto.value());
+		while (*path_segment == delimiter) ++path_segment;
 
-		return result;
-	}
+		const char_t* path_segment_end = path_segment;
 
-	PUGI__FN xml_node xml_node::append_child(xml_node_type type_)
-	{
-		if (!impl::allow_insert_child(this->type(), type_)) return xml_node();
-		
-		xml_node n(impl::allocate_node(impl::get_allocator(_root), type_));
-		if (!n) return xml_node();
+		while (*path_segment_end && *path_segment_end != delimiter) ++path_segment_end;
 
-		impl::append_node(n._root, _root);
+		if (path_segment == path_segment_end) return found;
 
-		if (type_ == node_declaration) n.set_name(PUGIXML_TEXT("xml"));
+		const char_t* next_segment = path_segment_end;
 
-		return n;
+		while (*next_segment == delimiter) ++next_segment;
+
+		if (*path_segment == '.' && path_segment + 1 == path_segment_end)
+			return found.first_element_by_path(next_segment, delimiter);
+		else if (*path_segment == '.' && *(path_segment+1) == '.' && path_segment + 2 == path_segment_end)
+			return found.parent().first_element_by_path(next_segment, delimiter);
+		else
+		{
+			for (xml_node_struct* j = impl::get_first_child(found._root); j; j = j->next_sibling)
+			{
+				if (j->name && impl::strequalrange(j->name, path_segment, static_cast<size_t>(path_segment_end - path_segment)))
+				{
+					xml_node subsearch = xml_node(j).first_element_by_path(next_segment, delimiter);
+
+					if (subsearch) return subsearch;
+				}
+			}
+
+			return xml_node();
+		}
 	}
 
-	PUGI__FN xml_node xml_node::prepend_child(xml_node_type type_)
+	PUGI__FN bool xml_node::traverse(xml_tree_walker& walker)
 	{
-		if (!impl::allow_insert_child(this->type(), type_)) return xml_node();
+		walker._depth = -1;
 		
-		xml_node n(impl::allocate_node(impl::get_allocator(_root), type_));
-		if (!n) return xml_node();
+		xml_node arg_begin = *this;
+		if (!walker.begin(arg_begin)) return false;
+
+		xml_node cur = first_child();
+				
+		if (cur)
+		{
+			++walker._depth;
+
+			do 
+			{
+				xml_node arg_for_each = cur;
+				if (!walker.for_each(arg_for_each))
+					return false;
+						
+				if (cur.first_child())
+				{
+					++walker._depth;
+					cur = cur.first_child();
+				}
+				else if (cur.next_sibling())
+					cur = cur.next_sibling();
+				else
+				{
+					// Borland C++ workaround
+					while (!cur.next_sibling() && cur != *this && !cur.parent().empty())
+					{
+						--walker._depth;
+						cur = cur.parent();
+					}
+						
+					if (cur != *this)
+						cur = cur.next_sibling();
+				}
+			}
+			while (cur && cur != *this);
+		}
 
-		impl::prepend_node(n._root, _root);
-				
-		if (type_ == node_declaration) n.set_name(PUGIXML_TEXT("xml"));
+		assert(walker._depth == -1);
 
-		return n;
+		xml_node arg_end = *this;
+		return walker.end(arg_end);
 	}
 
-	PUGI__FN xml_node xml_node::insert_child_before(xml_node_type type_, const xml_node& node)
+	PUGI__FN size_t xml_node::hash_value() const
 	{
-		if (!impl::allow_insert_child(this->type(), type_)) return xml_node();
-		if (!node._root || node._root->parent != _root) return xml_node();
-	
-		xml_node n(impl::allocate_node(impl::get_allocator(_root), type_));
-		if (!n) return xml_node();
-
-		impl::insert_node_before(n._root, node._root);
-
-		if (type_ == node_declaration) n.set_name(PUGIXML_TEXT("xml"));
-
-		return n;
+		return static_cast<size_t>(reinterpret_cast<uintptr_t>(_root) / sizeof(xml_node_struct));
 	}
 
-	PUGI__FN xml_node xml_node::insert_child_after(xml_node_type type_, const xml_node& node)
+	PUGI__FN xml_node_struct* xml_node::internal_object() const
 	{
-		if (!impl::allow_insert_child(this->type(), type_)) return xml_node();
-		if (!node._root || node._root->parent != _root) return xml_node();
-	
-		xml_node n(impl::allocate_node(impl::get_allocator(_root), type_));
-		if (!n) return xml_node();
-
-		impl::insert_node_after(n._root, node._root);
-
-		if (type_ == node_declaration) n.set_name(PUGIXML_TEXT("xml"));
-
-		return n;
+		return _root;
 	}
 
-	PUGI__FN xml_node xml_node::append_child(const char_t* name_)
+	PUGI__FN void xml_node::print(xml_writer& writer, const char_t* indent, unsigned int flags, xml_encoding encoding, unsigned int depth) const
 	{
-		xml_node result = append_child(node_element);
+		if (!_root) return;
 
-		result.set_name(name_);
+		impl::xml_buffered_writer buffered_writer(writer, encoding);
 
-		return result;
+		impl::node_output(buffered_writer, *this, indent, flags, depth);
 	}
 
-	PUGI__FN xml_node xml_node::prepend_child(const char_t* name_)
+#ifndef PUGIXML_NO_STL
+	PUGI__FN void xml_node::print(std::basic_ostream<char, std::char_traits<char> >& stream, const char_t* indent, unsigned int flags, xml_encoding encoding, unsigned int depth) const
 	{
-		xml_node result = prepend_child(node_element);
-
-		result.set_name(name_);
+		xml_writer_stream writer(stream);
 
-		return result;
+		print(writer, indent, flags, encoding, depth);
 	}
 
-	PUGI__FN xml_node xml_node::insert_child_after(const char_t* name_, const xml_node& node)
+	PUGI__FN void xml_node::print(std::basic_ostream<wchar_t, std::char_traits<wchar_t> >& stream, const char_t* indent, unsigned int flags, unsigned int depth) const
 	{
-		xml_node result = insert_child_after(node_element, node);
-
-		result.set_name(name_);
+		xml_writer_stream writer(stream);
 
-		return result;
+		print(writer, indent, flags, encoding_wchar, depth);
 	}
+#endif
 
-	PUGI__FN xml_node xml_node::insert_child_before(const char_t* name_, const xml_node& node)
+	PUGI__FN ptrdiff_t xml_node::offset_debug() const
 	{
-		xml_node result = insert_child_before(node_element, node);
+		xml_node_struct* r = root()._root;
 
-		result.set_name(name_);
+		if (!r) return -1;
 
-		return result;
-	}
+		const char_t* buffer = static_cast<impl::xml_document_struct*>(r)->buffer;
 
-	PUGI__FN xml_node xml_node::append_copy(const xml_node& proto)
-	{
-		xml_node result = append_child(proto.type());
+		if (!buffer) return -1;
 
-		if (result) impl::node_copy_tree(result.internal_object(), proto.internal_object());
+		switch (type())
+		{
+		case node_document:
+			return 0;
 
-		return result;
-	}
+		case node_element:
+		case node_declaration:
+		case node_pi:
+			// interned names point to the first occurrence of the name
+			if (static_cast<impl::xml_document_struct*>(r)->names) return -1;
 
-	PUGI__FN xml_node xml_node::prepend_copy(const xml_node& proto)
-	{
-		xml_node result = prepend_child(proto.type());
+			return (_root->header & impl::xml_memory_page_name_allocated_or_shared_mask) ? -1 : _root->name - buffer;
 
-		if (result) impl::node_copy_tree(result.internal_object(), proto.internal_object());
+		case node_pcdata:
+		case node_cdata:
+		case node_comment:
+		case node_doctype:
+			return (_root->header & impl::xml_memory_page_value_allocated_or_shared_mask) ? -1 : _root->value - buffer;
 
-		return result;
+		default:
+			return -1;
+		}
 	}
 
-	PUGI__FN xml_node xml_node::insert_copy_after(const xml_node& proto, const xml_node& node)
+#ifdef __BORLANDC__
+	PUGI__FN bool operator&&(const xml_node& lhs, bool rhs)
 	{
-		xml_node result = insert_child_after(proto.type(), node);
-
-		if (result) impl::node_copy_tree(result.internal_object(), proto.internal_object());
-
-		return result;
+		return (bool)lhs && rhs;
 	}
 
-	PUGI__FN xml_node xml_node::insert_copy_before(const xml_node& proto, const xml_node& node)
+	PUGI__FN bool operator||(const xml_node& lhs, bool rhs)
 	{
-		xml_node result = insert_child_before(proto.type(), node);
-
-		if (result) impl::node_copy_tree(result.internal_object(), proto.internal_object());
-
-		return result;
+		return (bool)lhs || rhs;
 	}
+#endif
 
-	PUGI__FN xml_node xml_node::append_move(const xml_node& moved)
+	PUGI__FN xml_text::xml_text(xml_node_struct* root): _root(root)
 	{
-		if (!impl::allow_move(*this, moved)) return xml_node();
-
-		// disable document_buffer_order optimization since moving nodes around changes document order without changing buffer pointers
-		impl::get_document(_root).header |= impl::xml_memory_page_contents_shared_mask;
-
-		impl::remove_node(moved._root);
-		impl::append_node(moved._root, _root);
-
-		return moved;
 	}
 
-	PUGI__FN xml_node xml_node::prepend_move(const xml_node& moved)
+	PUGI__FN xml_node_struct* xml_text::_data() const
 	{
-		if (!impl::allow_move(*this, moved)) return xml_node();
+		if (!_root || impl::is_text_node(_root)) return _root;
 
-		// disable document_buffer_order optimization since moving nodes around changes document order without changing buffer pointers
-		impl::get_document(_root).header |= impl::xml_memory_page_contents_shared_mask;
+		// text embedded with parse_embed_pcdata is stored in the element itself
+		if (impl::get_embedded_pcdata(_root)) return _root;
 
-		impl::remove_node(moved._root);
-		impl::prepend_node(moved._root, _root);
+		for (xml_node_struct* node = impl::get_first_child(_root); node; node = node->next_sibling)
+			if (impl::is_text_node(node))
+				return node;
 
-		return moved;
+		return 0;
 	}
 
-	PUGI__FN xml_node xml_node::insert_move_after(const xml_node& moved, const xml_node& node)
+	PUGI__FN xml_node_struct* xml_text::_data_new()
 	{
-		if (!impl::allow_move(*this, moved)) return xml_node();
-		if (!node._root || node._root->parent != _root) return xml_node();
-		if (moved._root == node._root) return xml_node();
-
-		// disable document_buffer_order optimization since moving nodes around changes document order without changing buffer pointers
-		impl::get_document(_root).header |= impl::xml_memory_page_contents_shared_mask;
-
-		impl::remove_node(moved._root);
-		impl::insert_node_after(moved._root, node._root);
+		xml_node_struct* d = _data();
+		if (d) return d;
 
-		return moved;
+		return xml_node(_root).append_child(node_pcdata).internal_object();
 	}
 
-	PUGI__FN xml_node xml_node::insert_move_before(const xml_node& moved, const xml_node& node)
+	PUGI__FN xml_text::xml_text(): _root(0)
 	{
-		if (!impl::allow_move(*this, moved)) return xml_node();
-		if (!node._root || node._root->parent != _root) return xml_node();
-		if (moved._root == node._root) return xml_node();
-
-		// disable document_buffer_order optimization since moving nodes around changes document order without changing buffer pointers
-		impl::get_document(_root).header |= impl::xml_memory_page_contents_shared_mask;
-
-		impl::remove_node(moved._root);
-		impl::insert_node_before(moved._root, node._root);
-
-		return moved;
 	}
 
-	PUGI__FN bool xml_node::remove_attribute(const char_t* name_)
+	PUGI__FN static void unspecified_bool_xml_text(xml_text***)
 	{
-		return remove_attribute(attribute(name_));
 	}
 
-	PUGI__FN bool xml_node::remove_attribute(const xml_attribute& a)
+	PUGI__FN xml_text::operator xml_text::unspecified_bool_type() const
 	{
-		if (!_root || !a._attr) return false;
-		if (!impl::is_attribute_of(a._attr, _root)) return false;
-
-		impl::remove_attribute(a._attr, _root);
-		impl::destroy_attribute(a._attr, impl::get_allocator(_root));
-
-		return true;
+		return _data() ? unspecified_bool_xml_text : 0;
 	}
 
-	PUGI__FN bool xml_node::remove_child(const char_t* name_)
+	PUGI__FN bool xml_text::operator!() const
 	{
-		return remove_child(child(name_));
+		return !_data();
 	}
 
-	PUGI__FN bool xml_node::remove_child(const xml_node& n)
+	PUGI__FN bool xml_text::empty() const
 	{
-		if (!_root || !n._root || n._root->parent != _root) return false;
+		return _data() == 0;
+	}
 
-		impl::remove_node(n._root);
-		impl::destroy_node(n._root, impl::get_allocator(_root));
+	PUGI__FN const char_t* xml_text::get() const
+	{
+		xml_node_struct* d = _data();
 
-		return true;
+		return (d && d->value) ? impl::get_value(d) : PUGIXML_TEXT("");
 	}
 
-	PUGI__FN xml_parse_result xml_node::append_buffer(const void* contents, size_t size, unsigned int options, xml_encoding encoding)
+	PUGI__FN const char_t* xml_text::as_string(const char_t* def) const
 	{
-		// append_buffer is only valid for elements/documents
-		if (!impl::allow_insert_child(type(), node_element)) return impl::make_parse_result(status_append_invalid_root);
-
-		// get document node
-		impl::xml_document_struct* doc = static_cast<impl::xml_document_struct*>(root()._root);
-		assert(doc);
+		xml_node_struct* d = _data();
 
-		// disable document_buffer_order optimization since in a document with multiple buffers comparing buffer pointers does not make sense
-		doc->header |= impl::xml_memory_page_contents_shared_mask;
-		
-		// get extra buffer element (we'll store the document fragment buffer there so that we can deallocate it later)
-		impl::xml_memory_page* page = 0;
-		impl::xml_extra_buffer* extra = static_cast<impl::xml_extra_buffer*>(doc->allocate_memory(sizeof(impl::xml_extra_buffer), page));
-		(void)page;
+		return (d && d->value) ? impl::get_value(d) : def;
+	}
 
-		if (!extra) return impl::make_parse_result(status_out_of_memory);
+	PUGI__FN int xml_text::as_int(int def, bool* ok) const
+	{
+		xml_node_struct* d = _data();
 
-		// save name; name of the root has to be NULL before parsing - otherwise closing node mismatches will not be detected at the top level
-		char_t* rootname = _root->name;
-		_root->name = 0;
+		return impl::get_value_number<int>(d, def, ok, impl::value_cache_int, impl::convert_value_int);
+	}
 
-		// parse
-		char_t* buffer = 0;
-		xml_parse_result res = impl::load_buffer_impl(doc, _root, const_cast<void*>(contents), size, options, encoding, false, false, &buffer);
+	PUGI__FN unsigned int xml_text::as_uint(unsigned int def, bool* ok) const
+	{
+		xml_node_struct* d = _data();
 
-		// restore name
-		_root->name = rootname;
+		return impl::get_value_number<unsigned int>(d, def, ok, impl::value_cache_uint, impl::convert_value_uint);
+	}
 
-		// add extra buffer to the list
-		extra->buffer = buffer;
-		extra->next = doc->extra_buffers;
-		doc->extra_buffers = extra;
+	PUGI__FN double xml_text::as_double(double def, bool* ok) const
+	{
+		xml_node_struct* d = _data();
 
-		return res;
+		return impl::get_value_number<double>(d, def, ok, impl::value_cache_double, impl::convert_value_double);
 	}
 
-	PUGI__FN xml_node xml_node::find_child_by_attribute(const char_t* name_, const char_t* attr_name, const char_t* attr_value) const
+	PUGI__FN float xml_text::as_float(float def, bool* ok) const
 	{
-		if (!_root) return xml_node();
-		
-		for (xml_node_struct* i = _root->first_child; i; i = i->next_sibling)
-			if (i->name && impl::strequal(name_, i->name))
-			{
-				for (xml_attribute_struct* a = i->first_attribute; a; a = a->next_attribute)
-					if (a->name && impl::strequal(attr_name, a->name) && impl::strequal(attr_value, a->value ? a->value : PUGIXML_TEXT("")))
-						return xml_node(i);
-			}
+		xml_node_struct* d = _data();
 
-		return xml_node();
+		return impl::get_value_number<float>(d, def, ok, impl::value_cache_float, impl::convert_value_float);
 	}
 
-	PUGI__FN xml_node xml_node::find_child_by_attribute(const char_t* attr_name, const char_t* attr_value) const
+	PUGI__FN bool xml_text::as_bool(bool def) const
 	{
-		if (!_root) return xml_node();
-		
-		for (xml_node_struct* i = _root->first_child; i; i = i->next_sibling)
-			for (xml_attribute_struct* a = i->first_attribute; a; a = a->next_attribute)
-				if (a->name && impl::strequal(attr_name, a->name) && impl::strequal(attr_value, a->value ? a->value : PUGIXML_TEXT("")))
-					return xml_node(i);
+		xml_node_struct* d = _data();
 
-		return xml_node();
+		return impl::get_value_bool(d ? impl::get_value(d) : 0, def);
 	}
 
-#ifndef PUGIXML_NO_STL
-	PUGI__FN string_t xml_node::path(char_t delimiter) const
-	{
-		xml_node cursor = *this; // Make a copy.
-		
-		string_t result = cursor.name();
+#ifdef PUGIXML_HAS_LONG_LONG
+	PUGI__FN long long xml_text::as_llong(long long def, bool* ok) const
+	{
+		xml_node_struct* d = _data();
 
-		while (cursor.parent())
-		{
-			cursor = cursor.parent();
-			
-			string_t temp = cursor.name();
-			temp += delimiter;
-			temp += result;
-			result.swap(temp);
-		}
+		return impl::get_value_number<long long>(d, def, ok, impl::value_cache_llong, impl::convert_value_llong);
+	}
 
-		return result;
+	PUGI__FN unsigned long long xml_text::as_ullong(unsigned long long def, bool* ok) const
+	{
+		xml_node_struct* d = _data();
+
+		return impl::get_value_number<unsigned long long>(d, def, ok, impl::value_cache_ullong, impl::convert_value_ullong);
 	}
 #endif
 
-	PUGI__FN xml_node xml_node::first_element_by_path(const char_t* path_, char_t delimiter) const
+	PUGI__FN bool xml_text::set(const char_t* rhs)
 	{
-		xml_node found = *this; // Current search context.
-
-		if (!_root || !path_ || !path_[0]) return found;
+		xml_node_struct* dn = _data_new();
 
-		if (path_[0] == delimiter)
-		{
-			// Absolute path; e.g. '/foo/bar'
-			found = found.root();
-			++path_;
-		}
+		return dn ? impl::strcpy_insitu(dn->value, dn->header, impl::xml_memory_page_value_allocated_mask, rhs) : false;
+	}
 
-		const char_t* path_segment = path_;
+	PUGI__FN bool xml_text::set(int rhs)
+	{
+		xml_node_struct* dn = _data_new();
 
-		while (*path_segment == delimiter) ++path_segment;
+		return dn ? impl::set_value_convert(dn->value, dn->header, impl::xml_memory_page_value_allocated_mask, rhs) : false;
+	}
 
-		const char_t* path_segment_end = path_segment;
+	PUGI__FN bool xml_text::set(unsigned int rhs)
+	{
+		xml_node_struct* dn = _data_new();
 
-		while (*path_segment_end && *path_segment_end != delimiter) ++path_segment_end;
+		return dn ? impl::set_value_convert(dn->value, dn->header, impl::xml_memory_page_value_allocated_mask, rhs) : false;
+	}
 
-		if (path_segment == path_segment_end) return found;
+	PUGI__FN bool xml_text::set(float rhs)
+	{
+		xml_node_struct* dn = _data_new();
 
-		const char_t* next_segment = path_segment_end;
+		return dn ? impl::set_value_convert(dn->value, dn->header, impl::xml_memory_page_value_allocated_mask, rhs) : false;
+	}
 
-		while (*next_segment == delimiter) ++next_segment;
+	PUGI__FN bool xml_text::set(double rhs)
+	{
+		xml_node_struct* dn = _data_new();
 
-		if (*path_segment == '.' && path_segment + 1 == path_segment_end)
-			return found.first_element_by_path(next_segment, delimiter);
-		else if (*path_segment == '.' && *(path_segment+1) == '.' && path_segment + 2 == path_segment_end)
-			return found.parent().first_element_by_path(next_segment, delimiter);
-		else
-		{
-			for (xml_node_struct* j = found._root->first_child; j; j = j->next_sibling)
-			{
-				if (j->name && impl::strequalrange(j->name, path_segment, static_cast<size_t>(path_segment_end - path_segment)))
-				{
-					xml_node subsearch = xml_node(j).first_element_by_path(next_segment, delimiter);
+		return dn ? impl::set_value_convert(dn->value, dn->header, impl::xml_memory_page_value_allocated_mask, rhs) : false;
+	}
 
-					if (subsearch) return subsearch;
-				}
-			}
+	PUGI__FN bool xml_text::set(bool rhs)
+	{
+		xml_node_struct* dn = _data_new();
 
-			return xml_node();
-		}
+		return dn ? impl::set_value_convert(dn->value, dn->header, impl::xml_memory_page_value_allocated_mask, rhs) : false;
 	}
 
-	PUGI__FN bool xml_node::traverse(xml_tree_walker& walker)
+#ifdef PUGIXML_HAS_LONG_LONG
+	PUGI__FN bool xml_text::set(long long rhs)
 	{
-		walker._depth = -1;
-		
-		xml_node arg_begin = *this;
-		if (!walker.begin(arg_begin)) return false;
+		xml_node_struct* dn = _data_new();
 
-		xml_node cur = first_child();
-				
-		if (cur)
-		{
-			++walker._depth;
+		return dn ? impl::set_value_convert(dn->value, dn->header, impl::xml_memory_page_value_allocated_mask, rhs) : false;
+	}
 
-			do 
-			{
-				xml_node arg_for_each = cur;
-				if (!walker.for_each(arg_for_each))
-					return false;
-						
-				if (cur.first_child())
-				{
-					++walker._depth;
-					cur = cur.first_child();
-				}
-				else if (cur.next_sibling())
-					cur = cur.next_sibling();
-				else
-				{
-					// Borland C++ workaround
-					while (!cur.next_sibling() && cur != *this && !cur.parent().empty())
-					{
-						--walker._depth;
-						cur = cur.parent();
-					}
-						
-					if (cur != *this)
-						cur = cur.next_sibling();
-				}
-			}
-			while (cur && cur != *this);
-		}
+	PUGI__FN bool xml_text::set(unsigned long long rhs)
+	{
+		xml_node_struct* dn = _data_new();
 
-		assert(walker._depth == -1);
+		return dn ? impl::set_value_convert(dn->value, dn->header, impl::xml_memory_page_value_allocated_mask, rhs) : false;
+	}
+#endif
 
-		xml_node arg_end = *this;
-		return walker.end(arg_end);
+	PUGI__FN xml_text& xml_text::operator=(const char_t* rhs)
+	{
+		set(rhs);
+		return *this;
 	}
 
-	PUGI__FN size_t xml_node::hash_value() const
+	PUGI__FN xml_text& xml_text::operator=(int rhs)
 	{
-		return static_cast<size_t>(reinterpret_cast<uintptr_t>(_root) / sizeof(xml_node_struct));
+		set(rhs);
+		return *this;
 	}
 
-	PUGI__FN xml_node_struct* xml_node::internal_object() const
+	PUGI__FN xml_text& xml_text::operator=(unsigned int rhs)
 	{
-		return _root;
+		set(rhs);
+		return *this;
 	}
 
-	PUGI__FN void xml_node::print(xml_writer& writer, const char_t* indent, unsigned int flags, xml_encoding encoding, unsigned int depth) const
+	PUGI__FN xml_text& xml_text::operator=(float rhs)
 	{
-		if (!_root) return;
+		set(rhs);
+		return *this;
+	}
 
-		impl::xml_buffered_writer buffered_writer(writer, encoding);
+	PUGI__FN xml_text& xml_text::operator=(double rhs)
+	{
+		set(rhs);
+		return *this;
+	}
 
-		impl::node_output(buffered_writer, *this, indent, flags, depth);
+	PUGI__FN xml_text& xml_text::operator=(bool rhs)
+	{
+		set(rhs);
+		return *this;
 	}
 
-#ifndef PUGIXML_NO_STL
-	PUGI__FN void xml_node::print(std::basic_ostream<char, std::char_traits<char> >& stream, const char_t* indent, unsigned int flags, xml_encoding encoding, unsigned int depth) const
+#ifdef PUGIXML_HAS_LONG_LONG
+	PUGI__FN xml_text& xml_text::operator=(long long rhs)
 	{
-		xml_writer_stream writer(stream);
+		set(rhs);
+		return *this;
+	}
 
-		print(writer, indent, flags, encoding, depth);
+	PUGI__FN xml_text& xml_text::operator=(unsigned long long rhs)
+	{
+		set(rhs);
+		return *this;
 	}
+#endif
 
-	PUGI__FN void xml_node::print(std::basic_ostream<wchar_t, std::char_traits<wchar_t> >& stream, const char_t* indent, unsigned int flags, unsigned int depth) const
+	PUGI__FN xml_node xml_text::data() const
 	{
-		xml_writer_stream writer(stream);
+		return xml_node(_data());
+	}
 
-		print(writer, indent, flags, encoding_wchar, depth);
+#ifdef __BORLANDC__
+	PUGI__FN bool operator&&(const xml_text& lhs, bool rhs)
+	{
+		return (bool)lhs && rhs;
+	}
+
+	PUGI__FN bool operator||(const xml_text& lhs, bool rhs)
+	{
+		return (bool)lhs || rhs;
 	}
 #endif
 
-	PUGI__FN ptrdiff_t xml_node::offset_debug() const
+	PUGI__FN xml_node_iterator::xml_node_iterator()
 	{
-		xml_node_struct* r = root()._root;
+	}
 
-		if (!r) return -1;
+	PUGI__FN xml_node_iterator::xml_node_iterator(const xml_node& node): _wrap(node), _parent(node.parent())
+	{
+	}
 
-		const char_t* buffer = static_cast<impl::xml_document_struct*>(r)->buffer;
+	PUGI__FN xml_node_iterator::xml_node_iterator(xml_node_struct* ref, xml_node_struct* parent): _wrap(ref), _parent(parent)
+	{
+	}
 
-		if (!buffer) return -1;
+	PUGI__FN bool xml_node_iterator::operator==(const xml_node_iterator& rhs) const
+	{
+		return _wrap._root == rhs._wrap._root && _parent._root == rhs._parent._root;
+	}
+	
+	PUGI__FN bool xml_node_iterator::operator!=(const xml_node_iterator& rhs) const
+	{
+		return _wrap._root != rhs._wrap._root || _parent._root != rhs._parent._root;
+	}
 
-		switch (type())
-		{
-		case node_document:
-			return 0;
+	PUGI__FN xml_node& xml_node_iterator::operator*() const
+	{
+		assert(_wrap._root);
+		return _wrap;
+	}
 
-		case node_element:
-		case node_declaration:
-		case node_pi:
-			return (_root->header & impl::xml_memory_page_name_allocated_or_shared_mask) ? -1 : _root->name - buffer;
+	PUGI__FN xml_node* xml_node_iterator::operator->() const
+	{
+		assert(_wrap._root);
+		return const_cast<xml_node*>(&_wrap); // BCC32 workaround
+	}
 
-		case node_pcdata:
-		case node_cdata:
-		case node_comment:
-		case node_doctype:
-			return (_root->header & impl::xml_memory_page_value_allocated_or_shared_mask) ? -1 : _root->value - buffer;
+	PUGI__FN const xml_node_iterator& xml_node_iterator::operator++()
+	{
+		assert(_wrap._root);
+		_wrap._root = _wrap._root->next_sibling;
+		return *this;
+	}
 
-		default:
-			return -1;
-		}
+	PUGI__FN xml_node_iterator xml_node_iterator::operator++(int)
+	{
+		xml_node_iterator temp = *this;
+		++*this;
+		return temp;
+	}
+
+	PUGI__FN const xml_node_iterator& xml_node_iterator::operator--()
+	{
+		_wrap = _wrap._root ? _wrap.previous_sibling() : _parent.last_child();
+		return *this;
+	}
+
+	PUGI__FN xml_node_iterator xml_node_iterator::operator--(int)
+	{
+		xml_node_iterator temp = *this;
+		--*this;
+		return temp;
 	}
 
-#ifdef __BORLANDC__
-	PUGI__FN bool operator&&(const xml_node& lhs, bool rhs)
+	PUGI__FN xml_attribute_iterator::xml_attribute_iterator()
 	{
-		return (bool)lhs && rhs;
 	}
 
-	PUGI__FN bool operator||(const xml_node& lhs, bool rhs)
+	PUGI__FN xml_attribute_iterator::xml_attribute_iterator(const xml_attribute& attr, const xml_node& parent): _wrap(attr), _parent(parent)
 	{
-		return (bool)lhs || rhs;
 	}
-#endif
 
-	PUGI__FN xml_text::xml_text(xml_node_struct* root): _root(root)
+	PUGI__FN xml_attribute_iterator::xml_attribute_iterator(xml_attribute_struct* ref, xml_node_struct* parent): _wrap(ref), _parent(parent)
 	{
 	}
 
-	PUGI__FN xml_node_struct* xml_text::_data() const
+	PUGI__FN bool xml_attribute_iterator::operator==(const xml_attribute_iterator& rhs) const
 	{
-		if (!_root || impl::is_text_node(_root)) return _root;
-
-		for (xml_node_struct* node = _root->first_child; node; node = node->next_sibling)
-			if (impl::is_text_node(node))
-				return node;
-
-		return 0;
+		return _wrap._attr == rhs._wrap._attr && _parent._root == rhs._parent._root;
 	}
-
-	PUGI__FN xml_node_struct* xml_text::_data_new()
+	
+	PUGI__FN bool xml_attribute_iterator::operator!=(const xml_attribute_iterator& rhs) const
 	{
-		xml_node_struct* d = _data();
-		if (d) return d;
-
-		return xml_node(_root).append_child(node_pcdata).internal_object();
+		return _wrap._attr != rhs._wrap._attr || _parent._root != rhs._parent._root;
 	}
 
-	PUGI__FN xml_text::xml_text(): _root(0)
+	PUGI__FN xml_attribute& xml_attribute_iterator::operator*() const
 	{
+		assert(_wrap._attr);
+		return _wrap;
 	}
 
-	PUGI__FN static void unspecified_bool_xml_text(xml_text***)
+	PUGI__FN xml_attribute* xml_attribute_iterator::operator->() const
 	{
+		assert(_wrap._attr);
+		return const_cast<xml_attribute*>(&_wrap); // BCC32 workaround
 	}
 
-	PUGI__FN xml_text::operator xml_text::unspecified_bool_type() const
+	PUGI__FN const xml_attribute_iterator& xml_attribute_iterator::operator++()
 	{
-		return _data() ? unspecified_bool_xml_text : 0;
+		assert(_wrap._attr);
+		_wrap._attr = _wrap._attr->next_attribute;
+		return *this;
 	}
 
-	PUGI__FN bool xml_text::operator!() const
+	PUGI__FN xml_attribute_iterator xml_attribute_iterator::operator++(int)
 	{
-		return !_data();
+		xml_attribute_iterator temp = *this;
+		++*this;
+		return temp;
 	}
 
-	PUGI__FN bool xml_text::empty() const
+	PUGI__FN const xml_attribute_iterator& xml_attribute_iterator::operator--()
 	{
-		return _data() == 0;
+		_wrap = _wrap._attr ? _wrap.previous_attribute() : _parent.last_attribute();
+		return *this;
 	}
 
-	PUGI__FN const char_t* xml_text::get() const
+	PUGI__FN xml_attribute_iterator xml_attribute_iterator::operator--(int)
 	{
-		xml_node_struct* d = _data();
-
-		return (d && d->value) ? d->value : PUGIXML_TEXT("");
+		xml_attribute_iterator temp = *this;
+		--*this;
+		return temp;
 	}
 
-	PUGI__FN const char_t* xml_text::as_string(const char_t* def) const
+	PUGI__FN xml_named_node_iterator::xml_named_node_iterator(): _name(0)
 	{
-		xml_node_struct* d = _data();
-
-		return (d && d->value) ? d->value : def;
 	}
 
-	PUGI__FN int xml_text::as_int(int def) const
+	PUGI__FN xml_named_node_iterator::xml_named_node_iterator(const xml_node& node, const char_t* name): _wrap(node), _parent(node.parent()), _name(name)
 	{
-		xml_node_struct* d = _data();
-
-		return impl::get_value_int(d ? d->value : 0, def);
 	}
 
-	PUGI__FN unsigned int xml_text::as_uint(unsigned int def) const
+	PUGI__FN xml_named_node_iterator::xml_named_node_iterator(xml_node_struct* ref, xml_node_struct* parent, const char_t* name): _wrap(ref), _parent(parent), _name(name)
 	{
-		xml_node_struct* d = _data();
-
-		return impl::get_value_uint(d ? d->value : 0, def);
 	}
 
-	PUGI__FN double xml_text::as_double(double def) const
+	PUGI__FN bool xml_named_node_iterator::operator==(const xml_named_node_iterator& rhs) const
 	{
-		xml_node_struct* d = _data();
-
-		return impl::get_value_double(d ? d->value : 0, def);
+		return _wrap._root == rhs._wrap._root && _parent._root == rhs._parent._root;
 	}
 
-	PUGI__FN float xml_text::as_float(float def) const
+	PUGI__FN bool xml_named_node_iterator::operator!=(const xml_named_node_iterator& rhs) const
 	{
-		xml_node_struct* d = _data();
-
-		return impl::get_value_float(d ? d->value : 0, def);
+		return _wrap._root != rhs._wrap._root || _parent._root != rhs._parent._root;
 	}
 
-	PUGI__FN bool xml_text::as_bool(bool def) const
+	PUGI__FN xml_node& xml_named_node_iterator::operator*() const
 	{
-		xml_node_struct* d = _data();
-
-		return impl::get_value_bool(d ? d->value : 0, def);
+		assert(_wrap._root);
+		return _wrap;
 	}
 
-#ifdef PUGIXML_HAS_LONG_LONG
-	PUGI__FN long long xml_text::as_llong(long long def) const
+	PUGI__FN xml_node* xml_named_node_iterator::operator->() const
 	{
-		xml_node_struct* d = _data();
-
-		return impl::get_value_llong(d ? d->value : 0, def);
+		assert(_wrap._root);
+		return const_cast<xml_node*>(&_wrap); // BCC32 workaround
 	}
 
-	PUGI__FN unsigned long long xml_text::as_ullong(unsigned long long def) const
+	PUGI__FN const xml_named_node_iterator& xml_named_node_iterator::operator++()
 	{
-		xml_node_struct* d = _data();
+		assert(_wrap._root);
+		_wrap = _wrap.next_sibling(_name);
+		return *this;
+	}
 
-		return impl::get_value_ullong(d ? d->value : 0, def);
+	PUGI__FN xml_named_node_iterator xml_named_node_iterator::operator++(int)
+	{
+		xml_named_node_iterator temp = *this;
+		++*this;
+		return temp;
 	}
-#endif
 
-	PUGI__FN bool xml_text::set(const char_t* rhs)
+	PUGI__FN const xml_named_node_iterator& xml_named_node_iterator::operator--()
 	{
-		xml_node_struct* dn = _data_new();
+		if (_wrap._root)
+			_wrap = _wrap.previous_sibling(_name);
+		else
+		{
+			_wrap = _parent.last_child();
 
-		return dn ? impl::strcpy_insitu(dn->value, dn->header, impl::xml_memory_page_value_allocated_mask, rhs) : false;
+			if (!impl::strequal(_wrap.name(), _name))
+				_wrap = _wrap.previous_sibling(_name);
+		}
+
+		return *this;
 	}
 
-	PUGI__FN bool xml_text::set(int rhs)
+	PUGI__FN xml_named_node_iterator xml_named_node_iterator::operator--(int)
 	{
-		xml_node_struct* dn = _data_new();
-
-		return dn ? impl::set_value_convert(dn->value, dn->header, impl::xml_memory_page_value_allocated_mask, rhs) : false;
+		xml_named_node_iterator temp = *this;
+		--*this;
+		return temp;
 	}
 
-	PUGI__FN bool xml_text::set(unsigned int rhs)
+	PUGI__FN xml_parse_result::xml_parse_result(): status(status_internal_error), offset(0), encoding(encoding_auto)
 	{
-		xml_node_struct* dn = _data_new();
+	}
 
-		return dn ? impl::set_value_convert(dn->value, dn->header, impl::xml_memory_page_value_allocated_mask, rhs) : false;
+	PUGI__FN xml_parse_result::operator bool() const
+	{
+		return status == status_ok;
 	}
 
-	PUGI__FN bool xml_text::set(double rhs)
+	PUGI__FN const char* xml_parse_result::description() const
 	{
-		xml_node_struct* dn = _data_new();
+		switch (status)
+		{
+		case status_ok: return "No error";
 
-		return dn ? impl::set_value_convert(dn->value, dn->header, impl::xml_memory_page_value_allocated_mask, rhs) : false;
+		case status_file_not_found: return "File was not found";
+		case status_io_error: return "Error reading from file/stream";
+		case status_out_of_memory: return "Could not allocate memory";
+		case status_internal_error: return "Internal error occurred";
+
+		case status_unrecognized_tag: return "Could not determine tag type";
+
+		case status_bad_pi: return "Error parsing document declaration/processing instruction";
+		case status_bad_comment: return "Error parsing comment";
+		case status_bad_cdata: return "Error parsing CDATA section";
+		case status_bad_doctype: return "Error parsing document type declaration";
+		case status_bad_pcdata: return "Error parsing PCDATA section";
+		case status_bad_start_element: return "Error parsing start element tag";
+		case status_bad_attribute: return "Error parsing element attribute";
+		case status_bad_end_element: return "Error parsing end element tag";
+		case status_end_element_mismatch: return "Start-end tags mismatch";
+
+		case status_append_invalid_root: return "Unable to append nodes: root is not an element or document";
+
+		case status_no_document_element: return "No document element found";
+
+		default: return "Unknown error";
+		}
 	}
 
-	PUGI__FN bool xml_text::set(bool rhs)
+	PUGI__FN xml_parse_filter::~xml_parse_filter()
 	{
-		xml_node_struct* dn = _data_new();
+	}
 
-		return dn ? impl::set_value_convert(dn->value, dn->header, impl::xml_memory_page_value_allocated_mask, rhs) : false;
+	PUGI__FN xml_memory_resource::~xml_memory_resource()
+	{
 	}
 
-#ifdef PUGIXML_HAS_LONG_LONG
-	PUGI__FN bool xml_text::set(long long rhs)
+	PUGI__FN xml_document::xml_document(): _buffer(0), _filter(0), _resource(0), _value_cache(false), _initial_page_size(impl::xml_memory_page_size), _maximum_page_size(impl::xml_memory_page_size)
 	{
-		xml_node_struct* dn = _data_new();
+		create();
+	}
 
-		return dn ? impl::set_value_convert(dn->value, dn->header, impl::xml_memory_page_value_allocated_mask, rhs) : false;
+	PUGI__FN xml_document::xml_document(xml_memory_resource* resource): _buffer(0), _filter(0), _resource(resource), _value_cache(false), _initial_page_size(impl::xml_memory_page_size), _maximum_page_size(impl::xml_memory_page_size)
+	{
+		create();
 	}
 
-	PUGI__FN bool xml_text::set(unsigned long long rhs)
+	PUGI__FN xml_document::xml_document(void* memory, size_t size): _buffer(0), _filter(0), _resource(0), _value_cache(false), _initial_page_size(impl::xml_memory_page_size_min * 4), _maximum_page_size(impl::xml_memory_page_size)
 	{
-		xml_node_struct* dn = _data_new();
+		// the resource lives at the end of the document storage, so that all of the block is available for the document
+		_resource = new (_memory + sizeof(_memory) - sizeof(impl::xml_fixed_memory_resource)) impl::xml_fixed_memory_resource(memory, size);
 
-		return dn ? impl::set_value_convert(dn->value, dn->header, impl::xml_memory_page_value_allocated_mask, rhs) : false;
+		create();
 	}
-#endif
 
-	PUGI__FN xml_text& xml_text::operator=(const char_t* rhs)
+	PUGI__FN xml_document::~xml_document()
 	{
-		set(rhs);
-		return *this;
+		destroy();
 	}
 
-	PUGI__FN xml_text& xml_text::operator=(int rhs)
+	PUGI__FN void xml_document::reset()
 	{
-		set(rhs);
-		return *this;
+		destroy();
+		create();
 	}
 
-	PUGI__FN xml_text& xml_text::operator=(unsigned int rhs)
+	PUGI__FN void xml_document::reset(const xml_document& proto)
 	{
-		set(rhs);
-		return *this;
+		reset();
+
+		for (xml_node cur = proto.first_child(); cur; cur = cur.next_sibling())
+			append_copy(cur);
 	}
 
-	PUGI__FN xml_text& xml_text::operator=(double rhs)
+	PUGI__FN void xml_document::create()
 	{
-		set(rhs);
-		return *this;
+		assert(!_root);
+
+		// initialize sentinel page
+		PUGI__STATIC_ASSERT(sizeof(impl::xml_memory_page) + sizeof(impl::xml_document_struct) + impl::xml_memory_page_alignment - sizeof(void*) + sizeof(impl::xml_fixed_memory_resource) <= sizeof(_memory));
+
+		// align upwards to page boundary
+		void* page_memory = reinterpret_cast<void*>((reinterpret_cast<uintptr_t>(_memory) + (impl::xml_memory_page_alignment - 1)) & ~(impl::xml_memory_page_alignment - 1));
+
+		// prepare page structure
+		impl::xml_memory_page* page = impl::xml_memory_page::construct(page_memory);
+		assert(page);
+
+		// allocate new root; the sentinel page has no space left, so the first allocation gets a new page
+		_root = new (reinterpret_cast<char*>(page) + sizeof(impl::xml_memory_page)) impl::xml_document_struct(page, _resource);
+		_root->prev_sibling_c = _root;
+
+		// setup sentinel page
+		page->allocator = static_cast<impl::xml_document_struct*>(_root);
+
+		// the filter, the value cache and the page size settings are properties of the document object, so they are kept when the document is reset
+		static_cast<impl::xml_document_struct*>(_root)->filter = _filter;
+
+		static_cast<impl::xml_document_struct*>(_root)->set_page_size(_initial_page_size, _maximum_page_size);
+
+		// the cache is an optimization, so the document works without it if there is not enough memory
+		if (_value_cache) static_cast<impl::xml_document_struct*>(_root)->values = impl::create_value_cache(_resource);
+
+		// verify the document allocation; the end of the storage is reserved for the resource of fixed memory documents
+		assert(reinterpret_cast<char*>(_root) + sizeof(impl::xml_document_struct) <= _memory + sizeof(_memory) - sizeof(impl::xml_fixed_memory_resource));
 	}
 
-	PUGI__FN xml_text& xml_text::operator=(bool rhs)
+	PUGI__FN void xml_document::destroy()
 	{
-		set(rhs);
-		return *this;
-	}
+		assert(_root);
+
+		// destroy static storage
+		if (_buffer)
+		{
+			impl::resource_deallocate(_buffer, _resource);
+			_buffer = 0;
+		}
+
+	#ifdef PUGIXML_HAS_MMAP
+		// destroy file mapping
+		if (static_cast<impl::xml_document_struct*>(_root)->mapping)
+			munmap(static_cast<impl::xml_document_struct*>(_root)->mapping, static_cast<impl::xml_document_struct*>(_root)->mapping_size);
+	#endif
+
+		// destroy name table
+		if (static_cast<impl::xml_document_struct*>(_root)->names)
+			impl::destroy_name_table(static_cast<impl::xml_document_struct*>(_root)->names);
+
+		// destroy value cache
+		if (static_cast<impl::xml_document_struct*>(_root)->values)
+			impl::destroy_value_cache(static_cast<impl::xml_document_struct*>(_root)->values);
+
+	#ifdef PUGIXML_COMPACT
+		// destroy hash table for the pointers that don't fit into compact fields
+		impl::compact_hash_destroy(static_cast<impl::xml_document_struct*>(_root)->compact_pointers, static_cast<impl::xml_document_struct*>(_root)->_resource);
+	#endif
+
+		// destroy extra buffers (note: no need to destroy linked list nodes, they're allocated using document allocator)
+		for (impl::xml_extra_buffer* extra = static_cast<impl::xml_document_struct*>(_root)->extra_buffers; extra; extra = extra->next)
+		{
+			if (extra->buffer) impl::resource_deallocate(extra->buffer, _resource);
+		}
+
+		// destroy dynamic storage, leave sentinel page (it's in static memory)
+		impl::xml_memory_page* root_page = impl::get_page(_root->header);
+		assert(root_page && !root_page->prev);
+
+		for (impl::xml_memory_page* page = root_page->next; page; )
+		{
+			impl::xml_memory_page* next = page->next;
+
+			static_cast<impl::xml_document_struct*>(_root)->deallocate_page(page);
+
+			page = next;
+		}
 
-#ifdef PUGIXML_HAS_LONG_LONG
-	PUGI__FN xml_text& xml_text::operator=(long long rhs)
-	{
-		set(rhs);
-		return *this;
+		_root = 0;
 	}
 
-	PUGI__FN xml_text& xml_text::operator=(unsigned long long rhs)
+#ifndef PUGIXML_NO_STL
+	PUGI__FN xml_parse_result xml_document::load(std::basic_istream<char, std::char_traits<char> >& stream, unsigned int options, xml_encoding encoding)
 	{
-		set(rhs);
-		return *this;
-	}
-#endif
+		reset();
 
-	PUGI__FN xml_node xml_text::data() const
-	{
-		return xml_node(_data());
+		return impl::load_stream_impl(*this, stream, options, encoding);
 	}
 
-#ifdef __BORLANDC__
-	PUGI__FN bool operator&&(const xml_text& lhs, bool rhs)
+	PUGI__FN xml_parse_result xml_document::load(std::basic_istream<wchar_t, std::char_traits<wchar_t> >& stream, unsigned int options)
 	{
-		return (bool)lhs && rhs;
-	}
+		reset();
 
-	PUGI__FN bool operator||(const xml_text& lhs, bool rhs)
-	{
-		return (bool)lhs || rhs;
+		return impl::load_stream_impl(*this, stream, options, encoding_wchar);
 	}
 #endif
 
-	PUGI__FN xml_node_iterator::xml_node_iterator()
+	PUGI__FN xml_parse_result xml_document::load(const char_t* contents, unsigned int options)
 	{
-	}
+		// Force native encoding (skip autodetection)
+	#ifdef PUGIXML_WCHAR_MODE
+		xml_encoding encoding = encoding_wchar;
+	#else
+		xml_encoding encoding = encoding_utf8;
+	#endif
 
-	PUGI__FN xml_node_iterator::xml_node_iterator(const xml_node& node): _wrap(node), _parent(node.parent())
-	{
+		return load_buffer(contents, impl::strlength(contents) * sizeof(char_t), options, encoding);
 	}
 
-	PUGI__FN xml_node_iterator::xml_node_iterator(xml_node_struct* ref, xml_node_struct* parent): _wrap(ref), _parent(parent)
+	PUGI__FN xml_parse_result xml_document::load_file(const char* path_, unsigned int options, xml_encoding encoding)
 	{
-	}
+		reset();
 
-	PUGI__FN bool xml_node_iterator::operator==(const xml_node_iterator& rhs) const
-	{
-		return _wrap._root == rhs._wrap._root && _parent._root == rhs._parent._root;
-	}
-	
-	PUGI__FN bool xml_node_iterator::operator!=(const xml_node_iterator& rhs) const
-	{
-		return _wrap._root != rhs._wrap._root || _parent._root != rhs._parent._root;
-	}
+		FILE* file = fopen(path_, "rb");
 
-	PUGI__FN xml_node& xml_node_iterator::operator*() const
-	{
-		assert(_wrap._root);
-		return _wrap;
+		return impl::load_file_impl(*this, file, options, encoding);
 	}
 
-	PUGI__FN xml_node* xml_node_iterator::operator->() const
+	PUGI__FN xml_parse_result xml_document::load_file(const wchar_t* path_, unsigned int options, xml_encoding encoding)
 	{
-		assert(_wrap._root);
-		return const_cast<xml_node*>(&_wrap); // BCC32 workaround
-	}
+		reset();
 
-	PUGI__FN const xml_node_iterator& xml_node_iterator::operator++()
-	{
-		assert(_wrap._root);
-		_wrap._root = _wrap._root->next_sibling;
-		return *this;
-	}
+		FILE* file = impl::open_file_wide(path_, L"rb");
 
-	PUGI__FN xml_node_iterator xml_node_iterator::operator++(int)
-	{
-		xml_node_iterator temp = *this;
-		++*this;
-		return temp;
+		return impl::load_file_impl(*this, file, options, encoding);
 	}
 
-	PUGI__FN const xml_node_iterator& xml_node_iterator::operator--()
+	PUGI__FN xml_parse_result xml_document::load_buffer(const void* contents, size_t size, unsigned int options, xml_encoding encoding)
 	{
-		_wrap = _wrap._root ? _wrap.previous_sibling() : _parent.last_child();
-		return *this;
-	}
+		reset();
 
-	PUGI__FN xml_node_iterator xml_node_iterator::operator--(int)
-	{
-		xml_node_iterator temp = *this;
-		--*this;
-		return temp;
+		return impl::load_buffer_impl(static_cast<impl::xml_document_struct*>(_root), _root, const_cast<void*>(contents), size, options, encoding, false, false, &_buffer);
 	}
 
-	PUGI__FN xml_attribute_iterator::xml_attribute_iterator()
+	PUGI__FN xml_parse_result xml_document::load_buffer_inplace(void* contents, size_t size, unsigned int options, xml_encoding encoding)
 	{
-	}
+		reset();
 
-	PUGI__FN xml_attribute_iterator::xml_attribute_iterator(const xml_attribute& attr, const xml_node& parent): _wrap(attr), _parent(parent)
-	{
+		return impl::load_buffer_impl(static_cast<impl::xml_document_struct*>(_root), _root, contents, size, options, encoding, true, false, &_buffer);
 	}
 
-	PUGI__FN xml_attribute_iterator::xml_attribute_iterator(xml_attribute_struct* ref, xml_node_struct* parent): _wrap(ref), _parent(parent)
+	PUGI__FN xml_parse_result xml_document::load_buffer_inplace_own(void* contents, size_t size, unsigned int options, xml_encoding encoding)
 	{
-	}
+		reset();
 
-	PUGI__FN bool xml_attribute_iterator::operator==(const xml_attribute_iterator& rhs) const
-	{
-		return _wrap._attr == rhs._wrap._attr && _parent._root == rhs._parent._root;
+		return impl::load_buffer_impl(static_cast<impl::xml_document_struct*>(_root), _root, contents, size, options, encoding, true, true, &_buffer);
 	}
-	
-	PUGI__FN bool xml_attribute_iterator::operator!=(const xml_attribute_iterator& rhs) const
+
+	PUGI__FN void xml_document::save(xml_writer& writer, const char_t* indent, unsigned int flags, xml_encoding encoding) const
 	{
-		return _wrap._attr != rhs._wrap._attr || _parent._root != rhs._parent._root;
+		impl::xml_buffered_writer buffered_writer(writer, encoding);
+
+		if ((flags & format_write_bom) && encoding != encoding_latin1)
+		{
+			// BOM always represents the codepoint U+FEFF, so just write it in native encoding
+		#ifdef PUGIXML_WCHAR_MODE
+			unsigned int bom = 0xfeff;
+			buffered_writer.write(static_cast<wchar_t>(bom));
+		#else
+			buffered_writer.write('\xef', '\xbb', '\xbf');
+		#endif
+		}
+
+		if (!(flags & format_no_declaration) && !impl::has_declaration(*this))
+		{
+			buffered_writer.write_string(PUGIXML_TEXT("<?xml version=\"1.0\""));
+			if (encoding == encoding_latin1) buffered_writer.write_string(PUGIXML_TEXT(" encoding=\"ISO-8859-1\""));
+			buffered_writer.write('?', '>');
+			if (!(flags & format_raw)) buffered_writer.write('\n');
+		}
+
+		impl::node_output(buffered_writer, *this, indent, flags, 0);
 	}
 
-	PUGI__FN xml_attribute& xml_attribute_iterator::operator*() const
+#ifndef PUGIXML_NO_STL
+	PUGI__FN void xml_document::save(std::basic_ostream<char, std::char_traits<char> >& stream, const char_t* indent, unsigned int flags, xml_encoding encoding) const
 	{
-		assert(_wrap._attr);
-		return _wrap;
+		xml_writer_stream writer(stream);
+
+		save(writer, indent, flags, encoding);
 	}
 
-	PUGI__FN xml_attribute* xml_attribute_iterator::operator->() const
+	PUGI__FN void xml_document::save(std::basic_ostream<wchar_t, std::char_traits<wchar_t> >& stream, const char_t* indent, unsigned int flags) const
 	{
-		assert(_wrap._attr);
-		return const_cast<xml_attribute*>(&_wrap); // BCC32 workaround
+		xml_writer_stream writer(stream);
+
+		save(writer, indent, flags, encoding_wchar);
 	}
+#endif
 
-	PUGI__FN const xml_attribute_iterator& xml_attribute_iterator::operator++()
+	PUGI__FN bool xml_document::save_file(const char* path_, const char_t* indent, unsigned int flags, xml_encoding encoding) const
 	{
-		assert(_wrap._attr);
-		_wrap._attr = _wrap._attr->next_attribute;
-		return *this;
+		FILE* file = fopen(path_, (flags & format_save_file_text) ? "w" : "wb");
+		return impl::save_file_impl(*this, file, indent, flags, encoding);
 	}
 
-	PUGI__FN xml_attribute_iterator xml_attribute_iterator::operator++(int)
+	PUGI__FN bool xml_document::save_file(const wchar_t* path_, const char_t* indent, unsigned int flags, xml_encoding encoding) const
 	{
-		xml_attribute_iterator temp = *this;
-		++*this;
-		return temp;
+		FILE* file = impl::open_file_wide(path_, (flags & format_save_file_text) ? L"w" : L"wb");
+		return impl::save_file_impl(*this, file, indent, flags, encoding);
 	}
 
-	PUGI__FN const xml_attribute_iterator& xml_attribute_iterator::operator--()
+	PUGI__FN xml_node xml_document::document_element() const
 	{
-		_wrap = _wrap._attr ? _wrap.previous_attribute() : _parent.last_attribute();
-		return *this;
+		assert(_root);
+
+		for (xml_node_struct* i = _root->first_child; i; i = i->next_sibling)
+			if (PUGI__NODETYPE(i) == node_element)
+				return xml_node(i);
+
+		return xml_node();
 	}
 
-	PUGI__FN xml_attribute_iterator xml_attribute_iterator::operator--(int)
+	PUGI__FN void xml_document::set_parse_filter(xml_parse_filter* filter)
 	{
-		xml_attribute_iterator temp = *this;
-		--*this;
-		return temp;
+		_filter = filter;
+
+		static_cast<impl::xml_document_struct*>(_root)->filter = filter;
 	}
 
-	PUGI__FN xml_named_node_iterator::xml_named_node_iterator(): _name(0)
+	PUGI__FN xml_parse_filter* xml_document::parse_filter() const
 	{
+		return _filter;
 	}
 
-	PUGI__FN xml_named_node_iterator::xml_named_node_iterator(const xml_node& node, const char_t* name): _wrap(node), _parent(node.parent()), _name(name)
+	PUGI__FN void xml_document::set_value_cache(bool enable)
 	{
+		_value_cache = enable;
+
+		impl::xml_document_struct* doc = static_cast<impl::xml_document_struct*>(_root);
+
+		if (enable && !doc->values)
+			doc->values = impl::create_value_cache(_resource);
+		else if (!enable && doc->values)
+		{
+			impl::destroy_value_cache(doc->values);
+			doc->values = 0;
+		}
 	}
 
-	PUGI__FN xml_named_node_iterator::xml_named_node_iterator(xml_node_struct* ref, xml_node_struct* parent, const char_t* name): _wrap(ref), _parent(parent), _name(name)
+	PUGI__FN bool xml_document::value_cache() const
 	{
+		return _value_cache;
 	}
 
-	PUGI__FN bool xml_named_node_iterator::operator==(const xml_named_node_iterator& rhs) const
+	PUGI__FN void xml_document::set_memory_page_size(size_t initial_size, size_t maximum_size)
 	{
-		return _wrap._root == rhs._wrap._root && _parent._root == rhs._parent._root;
+		// 0 selects the default page size; the sizes are clamped to the range that the allocator supports
+		_initial_page_size = impl::clamp_page_size(initial_size ? initial_size : impl::xml_memory_page_size);
+		_maximum_page_size = impl::clamp_page_size(maximum_size ? maximum_size : impl::xml_memory_page_size);
+
+		if (_maximum_page_size < _initial_page_size) _maximum_page_size = _initial_page_size;
+
+		static_cast<impl::xml_document_struct*>(_root)->set_page_size(_initial_page_size, _maximum_page_size);
 	}
 
-	PUGI__FN bool xml_named_node_iterator::operator!=(const xml_named_node_iterator& rhs) const
+	PUGI__FN size_t xml_document::initial_memory_page_size() const
 	{
-		return _wrap._root != rhs._wrap._root || _parent._root != rhs._parent._root;
+		return _initial_page_size;
 	}
 
-	PUGI__FN xml_node& xml_named_node_iterator::operator*() const
+	PUGI__FN size_t xml_document::maximum_memory_page_size() const
 	{
-		assert(_wrap._root);
-		return _wrap;
+		return _maximum_page_size;
 	}
 
-	PUGI__FN xml_node* xml_named_node_iterator::operator->() const
+	PUGI__FN xml_memory_resource* xml_document::memory_resource() const
 	{
-		assert(_wrap._root);
-		return const_cast<xml_node*>(&_wrap); // BCC32 workaround
+		return _resource;
 	}
 
-	PUGI__FN const xml_named_node_iterator& xml_named_node_iterator::operator++()
+	PUGI__FN xml_document_batch::xml_document_batch(): _items(0), _size(0), _capacity(0)
 	{
-		assert(_wrap._root);
-		_wrap = _wrap.next_sibling(_name);
-		return *this;
 	}
 
-	PUGI__FN xml_named_node_iterator xml_named_node_iterator::operator++(int)
+	PUGI__FN xml_document_batch::~xml_document_batch()
 	{
-		xml_named_node_iterator temp = *this;
-		++*this;
-		return temp;
+		if (_items) impl::xml_memory::deallocate(_items);
 	}
 
-	PUGI__FN const xml_named_node_iterator& xml_named_node_iterator::operator--()
+	PUGI__FN void* xml_document_batch::add(xml_document& document, unsigned int options, xml_encoding encoding)
 	{
-		if (_wrap._root)
-			_wrap = _wrap.previous_sibling(_name);
-		else
+		if (_size == _capacity)
 		{
-			_wrap = _parent.last_child();
+			size_t capacity = _capacity ? _capacity * 2 : 16;
 
-			if (!impl::strequal(_wrap.name(), _name))
-				_wrap = _wrap.previous_sibling(_name);
+			void* items = impl::xml_memory::allocate(capacity * sizeof(impl::xml_batch_item));
+			if (!items) return 0;
+
+			if (_items)
+			{
+				memcpy(items, _items, _size * sizeof(impl::xml_batch_item));
+				impl::xml_memory::deallocate(_items);
+			}
+
+			_items = items;
+			_capacity = capacity;
 		}
 
-		return *this;
-	}
+		impl::xml_batch_item* item = static_cast<impl::xml_batch_item*>(_items) + _size++;
 
-	PUGI__FN xml_named_node_iterator xml_named_node_iterator::operator--(int)
-	{
-		xml_named_node_iterator temp = *this;
-		--*this;
-		return temp;
+		item->document = &document;
+		item->path = 0;
+		item->wide_path = 0;
+		item->contents = 0;
+		item->size = 0;
+		item->options = options;
+		item->encoding = encoding;
+		item->result = xml_parse_result();
+
+		return item;
 	}
 
-	PUGI__FN xml_parse_result::xml_parse_result(): status(status_internal_error), offset(0), encoding(encoding_auto)
+	PUGI__FN bool xml_document_batch::add_file(xml_document& document, const char* path_, unsigned int options, xml_encoding encoding)
 	{
+		impl::xml_batch_item* item = static_cast<impl::xml_batch_item*>(add(document, options, encoding));
+		if (!item) return false;
+
+		item->path = path_;
+
+		return true;
 	}
 
-	PUGI__FN xml_parse_result::operator bool() const
+	PUGI__FN bool xml_document_batch::add_file(xml_document& document, const wchar_t* path_, unsigned int options, xml_encoding encoding)
 	{
-		return status == status_ok;
+		impl::xml_batch_item* item = static_cast<impl::xml_batch_item*>(add(document, options, encoding));
+		if (!item) return false;
+
+		item->wide_path = path_;
+
+		return true;
 	}
 
-	PUGI__FN const char* xml_parse_result::description() const
+	PUGI__FN bool xml_document_batch::add_buffer(xml_document& document, const void* contents, size_t size, unsigned int options, xml_encoding encoding)
 	{
-		switch (status)
-		{
-		case status_ok: return "No error";
+		assert(contents || size == 0);
 
-		case status_file_not_found: return "File was not found";
-		case status_io_error: return "Error reading from file/stream";
-		case status_out_of_memory: return "Could not allocate memory";
-		case status_internal_error: return "Internal error occurred";
+		impl::xml_batch_item* item = static_cast<impl::xml_batch_item*>(add(document, options, encoding));
+		if (!item) return false;
 
-		case status_unrecognized_tag: return "Could not determine tag type";
+		item->contents = contents;
+		item->size = size;
 
-		case status_bad_pi: return "Error parsing document declaration/processing instruction";
-		case status_bad_comment: return "Error parsing comment";
-		case status_bad_cdata: return "Error parsing CDATA section";
-		case status_bad_doctype: return "Error parsing document type declaration";
-		case status_bad_pcdata: return "Error parsing PCDATA section";
-		case status_bad_start_element: return "Error parsing start element tag";
-		case status_bad_attribute: return "Error parsing element attribute";
-		case status_bad_end_element: return "Error parsing end element tag";
-		case status_end_element_mismatch: return "Start-end tags mismatch";
+		return true;
+	}
 
-		case status_append_invalid_root: return "Unable to append nodes: root is not an element or document";
+	PUGI__FN bool xml_document_batch::load(unsigned int thread_count)
+	{
+		impl::xml_batch_item* items = static_cast<impl::xml_batch_item*>(_items);
 
-		case status_no_document_element: return "No document element found";
+	#ifdef PUGIXML_HAS_THREADS
+		if (thread_count == 0) thread_count = impl::get_hardware_concurrency();
+		if (thread_count > _size) thread_count = static_cast<unsigned int>(_size);
 
-		default: return "Unknown error";
+		if (thread_count <= 1 || !impl::load_batch_parallel(items, _size, thread_count))
+	#else
+		(void)thread_count;
+	#endif
+		{
+			for (size_t i = 0; i < _size; ++i) items[i].load();
 		}
+
+		for (size_t i = 0; i < _size; ++i)
+			if (!items[i].result)
+				return false;
+
+		return true;
 	}
 
-	PUGI__FN xml_document::xml_document(): _buffer(0)
+	PUGI__FN void xml_document_batch::reset()
 	{
-		create();
+		_size = 0;
 	}
 
-	PUGI__FN xml_document::~xml_document()
+	PUGI__FN size_t xml_document_batch::size() const
 	{
-		destroy();
+		return _size;
 	}
 
-	PUGI__FN void xml_document::reset()
+	PUGI__FN xml_document& xml_document_batch::document(size_t index) const
 	{
-		destroy();
-		create();
+		assert(index < _size);
+
+		return *static_cast<impl::xml_batch_item*>(_items)[index].document;
 	}
 
-	PUGI__FN void xml_document::reset(const xml_document& proto)
+	PUGI__FN xml_parse_result xml_document_batch::result(size_t index) const
 	{
-		reset();
+		assert(index < _size);
 
-		for (xml_node cur = proto.first_child(); cur; cur = cur.next_sibling())
-			append_copy(cur);
+		return static_cast<impl::xml_batch_item*>(_items)[index].result;
 	}
 
-	PUGI__FN void xml_document::create()
+	PUGI__FN xml_incremental_parser::xml_incremental_parser(xml_document& document, unsigned int options, xml_encoding encoding): _document(&document), _cursor(0), _skip(0), _buffer(0), _size(0), _capacity(0), _start(0), _offset(0), _options(options), _encoding(encoding_auto), _tail_size(0)
 	{
-		assert(!_root);
+		document.reset();
 
-		// initialize sentinel page
-		PUGI__STATIC_ASSERT(sizeof(impl::xml_memory_page) + sizeof(impl::xml_document_struct) + impl::xml_memory_page_alignment - sizeof(void*) <= sizeof(_memory));
+		_cursor = document.internal_object();
 
-		// align upwards to page boundary
-		void* page_memory = reinterpret_cast<void*>((reinterpret_cast<uintptr_t>(_memory) + (impl::xml_memory_page_alignment - 1)) & ~(impl::xml_memory_page_alignment - 1));
+		// disable document_buffer_order optimization since in a document with multiple buffers comparing buffer pointers does not make sense
+		_cursor->header |= impl::xml_memory_page_contents_shared_mask;
 
-		// prepare page structure
-		impl::xml_memory_page* page = impl::xml_memory_page::construct(page_memory);
-		assert(page);
+		// autodetection has to wait for the first bytes of the document
+		if (encoding != encoding_auto) _encoding = impl::get_buffer_encoding(encoding, 0, 0);
 
-		page->busy_size = impl::xml_memory_page_size;
+		_options = impl::get_lazy_parse_options(*static_cast<impl::xml_document_struct*>(_cursor), options);
 
-		// allocate new root
-		_root = new (reinterpret_cast<char*>(page) + sizeof(impl::xml_memory_page)) impl::xml_document_struct(page);
-		_root->prev_sibling_c = _root;
+		_result.status = status_ok;
+	}
 
-		// setup sentinel page
-		page->allocator = static_cast<impl::xml_document_struct*>(_root);
+	PUGI__FN bool xml_incremental_parser::reserve(size_t length)
+	{
+		if (_buffer && _size + length <= _capacity) return true;
+
+		impl::xml_document_struct* doc = static_cast<impl::xml_document_struct*>(_document->internal_object());
+
+		// parsed data has to stay in place since the nodes point to it, so only the unparsed data is moved to the new buffer
+		size_t pending = _size - _start;
+		size_t capacity = (_start == 0) ? _capacity * 2 : _capacity;
+
+		if (capacity < impl::xml_incremental_buffer_size) capacity = impl::xml_incremental_buffer_size;
+		if (capacity < pending + length) capacity = pending + length;
+
+		char_t* buffer = static_cast<char_t*>(impl::resource_allocate((capacity + 1) * sizeof(char_t), doc->_resource));
+		if (!buffer) return false;
+
+		if (_buffer) memcpy(buffer, _buffer + _start, pending * sizeof(char_t));
+
+		if (_buffer && _start == 0)
+		{
+			// nothing was parsed from the old buffer so we can replace it
+			assert(doc->extra_buffers && doc->extra_buffers->buffer == _buffer);
+
+			impl::resource_deallocate(_buffer, doc->_resource);
+			doc->extra_buffers->buffer = buffer;
+		}
+		else
+		{
+			// get extra buffer element (we'll store the buffer there so that we can deallocate it later)
+			impl::xml_extra_buffer* extra = impl::allocate_extra_buffer(*doc);
 
-		// verify the document allocation
-		assert(reinterpret_cast<char*>(_root) + sizeof(impl::xml_document_struct) <= _memory + sizeof(_memory));
+			if (!extra)
+			{
+				impl::resource_deallocate(buffer, doc->_resource);
+				return false;
+			}
+
+			extra->buffer = buffer;
+			extra->next = doc->extra_buffers;
+			doc->extra_buffers = extra;
+		}
+
+		_buffer = buffer;
+		_offset += _start;
+		_size = pending;
+		_start = 0;
+		_capacity = capacity;
+
+		return true;
 	}
 
-	PUGI__FN void xml_document::destroy()
+	PUGI__FN bool xml_incremental_parser::append(const void* contents, size_t size, bool last)
 	{
-		assert(_root);
+		const uint8_t* data = static_cast<const uint8_t*>(contents);
 
-		// destroy static storage
-		if (_buffer)
+		// encoding autodetection needs the first 4 bytes
+		if (_encoding == encoding_auto)
 		{
-			impl::xml_memory::deallocate(_buffer);
-			_buffer = 0;
+			if (size < 4 && !last)
+			{
+				memcpy(_tail, data, size);
+				_tail_size = size;
+
+				return true;
+			}
+
+			_encoding = impl::get_buffer_encoding(encoding_auto, data, size);
 		}
 
-		// destroy extra buffers (note: no need to destroy linked list nodes, they're allocated using document allocator)
-		for (impl::xml_extra_buffer* extra = static_cast<impl::xml_document_struct*>(_root)->extra_buffers; extra; extra = extra->next)
+		size_t length = last ? size : impl::get_incremental_valid_length(_encoding, data, size);
+
+		char_t* buffer = 0;
+		size_t count = 0;
+
+		if (!impl::convert_buffer_chunk(buffer, count, _encoding, data, length, _document->memory_resource())) return false;
+
+		bool result = reserve(count);
+
+		if (result)
 		{
-			if (extra->buffer) impl::xml_memory::deallocate(extra->buffer);
+			memcpy(_buffer + _size, buffer, count * sizeof(char_t));
+			_size += count;
 		}
 
-		// destroy dynamic storage, leave sentinel page (it's in static memory)
-		impl::xml_memory_page* root_page = reinterpret_cast<impl::xml_memory_page*>(_root->header & impl::xml_memory_page_pointer_mask);
-		assert(root_page && !root_page->prev);
+		// delete converted buffer if we performed a conversion
+		if (buffer != static_cast<const void*>(data)) impl::resource_deallocate(buffer, _document->memory_resource());
 
-		for (impl::xml_memory_page* page = root_page->next; page; )
-		{
-			impl::xml_memory_page* next = page->next;
+		if (!result) return false;
 
-			impl::xml_allocator::deallocate_page(page);
+		_buffer[_size] = 0;
 
-			page = next;
-		}
+		// keep the incomplete character until more data arrives
+		if (!last) memcpy(_tail, data + length, size - length);
+		_tail_size = last ? 0 : size - length;
 
-		_root = 0;
+		return true;
 	}
 
-#ifndef PUGIXML_NO_STL
-	PUGI__FN xml_parse_result xml_document::load(std::basic_istream<char, std::char_traits<char> >& stream, unsigned int options, xml_encoding encoding)
+	PUGI__FN xml_parse_result xml_incremental_parser::parse(bool last)
 	{
-		reset();
+		// encoding autodetection is still waiting for data
+		if (!_buffer) return _result;
 
-		return impl::load_stream_impl(*this, stream, options, encoding);
-	}
+		// allocator object is a part of document object
+		impl::xml_allocator& alloc = *static_cast<impl::xml_document_struct*>(_document->internal_object());
 
-	PUGI__FN xml_parse_result xml_document::load(std::basic_istream<wchar_t, std::char_traits<wchar_t> >& stream, unsigned int options)
-	{
-		reset();
+		char_t* s = _buffer + _start;
+		char_t* end = last ? _buffer + _size : impl::find_incremental_split_point(s, alloc);
 
-		return impl::load_stream_impl(*this, stream, options, encoding_wchar);
-	}
-#endif
+		if (end == s && !last) return _result;
 
-	PUGI__FN xml_parse_result xml_document::load(const char_t* contents, unsigned int options)
-	{
-		// Force native encoding (skip autodetection)
-	#ifdef PUGIXML_WCHAR_MODE
-		xml_encoding encoding = encoding_wchar;
-	#else
-		xml_encoding encoding = encoding_utf8;
-	#endif
+		// skip BOM to make sure it does not end up as part of parse output
+		if (_offset + _start == 0) s = impl::xml_parser::parse_skip_bom(s);
 
-		return load_buffer(contents, impl::strlength(contents) * sizeof(char_t), options, encoding);
+		// make the complete part of the buffer zero-terminated
+		char_t endch = *end;
+		*end = 0;
+
+		impl::xml_document_struct* doc = static_cast<impl::xml_document_struct*>(_document->internal_object());
+		if (!impl::init_name_table(*doc, doc, _options)) return _result = impl::make_parse_result(status_out_of_memory);
+
+		// new values can reuse the memory of the values that were converted before
+		if (doc->values) impl::clear_value_cache(*doc->values);
+
+		impl::xml_parser parser(alloc, doc->names);
+		parser.filter = doc->filter;
+		parser.skip = _skip;
+
+		char_t* result = parser.parse_tree(s, _cursor, _options, 0, false);
+
+		// update allocator state
+		alloc = parser.alloc;
+		_skip = parser.skip;
+
+		*end = endch;
+		_start = static_cast<size_t>(end - _buffer);
+
+		if (!result)
+			_result = impl::make_parse_result(parser.error_status, static_cast<ptrdiff_t>(_offset) + (parser.error_offset - _buffer));
+		else if (last && _cursor != _document->internal_object())
+			_result = impl::make_parse_result(status_end_element_mismatch, static_cast<ptrdiff_t>(_offset) + (result - _buffer));
+
+		return _result;
 	}
 
-	PUGI__FN xml_parse_result xml_document::load_file(const char* path_, unsigned int options, xml_encoding encoding)
+	PUGI__FN xml_parse_result xml_incremental_parser::feed(const void* contents, size_t size)
 	{
-		reset();
+		assert(contents || size == 0);
 
-		FILE* file = fopen(path_, "rb");
+		if (!_document || !_result) return _result;
 
-		return impl::load_file_impl(*this, file, options, encoding);
+		bool result;
+
+		if (_tail_size)
+		{
+			// prepend incomplete data from the previous chunk
+			uint8_t* data = static_cast<uint8_t*>(impl::resource_allocate(_tail_size + size, _document->memory_resource()));
+			if (!data) return _result = impl::make_parse_result(status_out_of_memory);
+
+			memcpy(data, _tail, _tail_size);
+			memcpy(data + _tail_size, contents, size);
+
+			result = append(data, _tail_size + size, false);
+
+			impl::resource_deallocate(data, _document->memory_resource());
+		}
+		else
+			result = append(contents, size, false);
+
+		if (!result) return _result = impl::make_parse_result(status_out_of_memory);
+
+		return parse(false);
 	}
 
-	PUGI__FN xml_parse_result xml_document::load_file(const wchar_t* path_, unsigned int options, xml_encoding encoding)
+	PUGI__FN xml_parse_result xml_incremental_parser::finish()
 	{
-		reset();
+		if (!_document) return _result;
 
-		FILE* file = impl::open_file_wide(path_, L"rb");
+		if (_result)
+		{
+			if (!append(_tail, _tail_size, true))
+				_result = impl::make_parse_result(status_out_of_memory);
+			else if (parse(true))
+			{
+				// check if there are any element nodes parsed
+				if (!(_options & parse_fragment) && !impl::xml_parser::has_element_node_siblings(_document->internal_object()->first_child))
+					_result = impl::make_parse_result(status_no_document_element, static_cast<ptrdiff_t>(_offset + _size));
+			}
+			else
+			{
+				// roll back offset if it occurs on a null terminator in the source buffer
+				if (_result.offset > 0 && static_cast<size_t>(_result.offset) == _offset + _size)
+					_result.offset--;
+			}
+		}
 
-		return impl::load_file_impl(*this, file, options, encoding);
+		// remember encoding
+		_result.encoding = _encoding;
+
+		// finished parser doesn't accept any more data
+		_document = 0;
+
+		return _result;
 	}
 
-	PUGI__FN xml_parse_result xml_document::load_buffer(const void* contents, size_t size, unsigned int options, xml_encoding encoding)
+	PUGI__FN xml_reader::xml_reader(): _impl(0)
 	{
-		reset();
+	}
 
-		return impl::load_buffer_impl(static_cast<impl::xml_document_struct*>(_root), _root, const_cast<void*>(contents), size, options, encoding, false, false, &_buffer);
+	PUGI__FN xml_reader::~xml_reader()
+	{
+		impl::xml_reader_impl::destroy(_impl);
 	}
 
-	PUGI__FN xml_parse_result xml_document::load_buffer_inplace(void* contents, size_t size, unsigned int options, xml_encoding encoding)
+	PUGI__FN xml_parse_result xml_reader::open_buffer(const void* contents, size_t size, unsigned int options, xml_encoding encoding)
 	{
-		reset();
+		assert(contents || size == 0);
 
-		return impl::load_buffer_impl(static_cast<impl::xml_document_struct*>(_root), _root, contents, size, options, encoding, true, false, &_buffer);
+		if (!_impl) _impl = impl::xml_reader_impl::create();
+		if (!_impl) return impl::make_parse_result(status_out_of_memory);
+
+		impl::xml_reader_impl* reader = static_cast<impl::xml_reader_impl*>(_impl);
+
+		reader->reset(0, options, impl::get_buffer_encoding(encoding, contents, size));
+
+		if (!reader->reserve(size) || !reader->append(contents, size)) reader->oom();
+		else reader->done = false;
+
+		return result();
 	}
 
-	PUGI__FN xml_parse_result xml_document::load_buffer_inplace_own(void* contents, size_t size, unsigned int options, xml_encoding encoding)
+	PUGI__FN xml_parse_result xml_reader::open(xml_reader_source& source, unsigned int options, xml_encoding encoding)
 	{
-		reset();
+		if (!_impl) _impl = impl::xml_reader_impl::create();
+		if (!_impl) return impl::make_parse_result(status_out_of_memory);
 
-		return impl::load_buffer_impl(static_cast<impl::xml_document_struct*>(_root), _root, contents, size, options, encoding, true, true, &_buffer);
+		impl::xml_reader_impl* reader = static_cast<impl::xml_reader_impl*>(_impl);
+
+		// autodetection has to wait for the first bytes of the document
+		reader->reset(&source, options, (encoding == encoding_auto) ? encoding_auto : impl::get_buffer_encoding(encoding, 0, 0));
+
+		if (!reader->reserve(0)) reader->oom();
+		else reader->done = false;
+
+		return result();
 	}
 
-	PUGI__FN void xml_document::save(xml_writer& writer, const char_t* indent, unsigned int flags, xml_encoding encoding) const
+	PUGI__FN bool xml_reader::next()
 	{
-		impl::xml_buffered_writer buffered_writer(writer, encoding);
+		return _impl && static_cast<impl::xml_reader_impl*>(_impl)->next();
+	}
 
-		if ((flags & format_write_bom) && encoding != encoding_latin1)
-		{
-			// BOM always represents the codepoint U+FEFF, so just write it in native encoding
-		#ifdef PUGIXML_WCHAR_MODE
-			unsigned int bom = 0xfeff;
-			buffered_writer.write(static_cast<wchar_t>(bom));
-		#else
-			buffered_writer.write('\xef', '\xbb', '\xbf');
-		#endif
-		}
+	PUGI__FN xml_node_type xml_reader::type() const
+	{
+		xml_node_struct* node = _impl ? static_cast<impl::xml_reader_impl*>(_impl)->current.node : 0;
 
-		if (!(flags & format_no_declaration) && !impl::has_declaration(*this))
-		{
-			buffered_writer.write_string(PUGIXML_TEXT("<?xml version=\"1.0\""));
-			if (encoding == encoding_latin1) buffered_writer.write_string(PUGIXML_TEXT(" encoding=\"ISO-8859-1\""));
-			buffered_writer.write('?', '>');
-			if (!(flags & format_raw)) buffered_writer.write('\n');
-		}
+		return node ? PUGI__NODETYPE(node) : node_null;
+	}
 
-		impl::node_output(buffered_writer, *this, indent, flags, 0);
+	PUGI__FN bool xml_reader::end_element() const
+	{
+		return _impl && static_cast<impl::xml_reader_impl*>(_impl)->current.node && static_cast<impl::xml_reader_impl*>(_impl)->current.end;
 	}
 
-#ifndef PUGIXML_NO_STL
-	PUGI__FN void xml_document::save(std::basic_ostream<char, std::char_traits<char> >& stream, const char_t* indent, unsigned int flags, xml_encoding encoding) const
+	PUGI__FN unsigned int xml_reader::depth() const
 	{
-		xml_writer_stream writer(stream);
+		return _impl ? static_cast<impl::xml_reader_impl*>(_impl)->current.depth : 0;
+	}
 
-		save(writer, indent, flags, encoding);
+	PUGI__FN const char_t* xml_reader::name() const
+	{
+		xml_node_struct* node = _impl ? static_cast<impl::xml_reader_impl*>(_impl)->current.node : 0;
+
+		return (node && node->name) ? node->name : PUGIXML_TEXT("");
 	}
 
-	PUGI__FN void xml_document::save(std::basic_ostream<wchar_t, std::char_traits<wchar_t> >& stream, const char_t* indent, unsigned int flags) const
+	PUGI__FN const char_t* xml_reader::value() const
 	{
-		xml_writer_stream writer(stream);
+		xml_node_struct* node = _impl ? static_cast<impl::xml_reader_impl*>(_impl)->current.node : 0;
 
-		save(writer, indent, flags, encoding_wchar);
+		return (node && node->value) ? node->value : PUGIXML_TEXT("");
 	}
-#endif
 
-	PUGI__FN bool xml_document::save_file(const char* path_, const char_t* indent, unsigned int flags, xml_encoding encoding) const
+	PUGI__FN xml_attribute xml_reader::first_attribute() const
 	{
-		FILE* file = fopen(path_, (flags & format_save_file_text) ? "w" : "wb");
-		return impl::save_file_impl(*this, file, indent, flags, encoding);
+		impl::xml_reader_impl* reader = static_cast<impl::xml_reader_impl*>(_impl);
+
+		// end of element does not have attributes
+		return (reader && reader->current.node && !reader->current.end) ? xml_attribute(reader->current.node->first_attribute) : xml_attribute();
 	}
 
-	PUGI__FN bool xml_document::save_file(const wchar_t* path_, const char_t* indent, unsigned int flags, xml_encoding encoding) const
+	PUGI__FN xml_attribute xml_reader::attribute(const char_t* name_) const
 	{
-		FILE* file = impl::open_file_wide(path_, (flags & format_save_file_text) ? L"w" : L"wb");
-		return impl::save_file_impl(*this, file, indent, flags, encoding);
+		for (xml_attribute a = first_attribute(); a; a = a.next_attribute())
+			if (impl::strequal(name_, a.name()))
+				return a;
+
+		return xml_attribute();
 	}
 
-	PUGI__FN xml_node xml_document::document_element() const
+	PUGI__FN xml_parse_result xml_reader::result() const
 	{
-		assert(_root);
+		if (!_impl) return xml_parse_result();
 
-		for (xml_node_struct* i = _root->first_child; i; i = i->next_sibling)
-			if (PUGI__NODETYPE(i) == node_element)
-				return xml_node(i);
+		impl::xml_reader_impl* reader = static_cast<impl::xml_reader_impl*>(_impl);
 
-		return xml_node();
+		xml_parse_result result = reader->result;
+		result.encoding = reader->encoding;
+
+		return result;
 	}
 
 #ifndef PUGIXML_NO_STL
@@ -6141,6 +10445,11 @@ namespace pugi
 	}
 #endif
 
+	PUGI__FN unsigned int PUGIXML_FUNCTION parse_lazy_depth(unsigned int depth)
+	{
+		return parse_lazy_subtrees | ((depth < 255 ? depth : 255) << 24);
+	}
+
 	PUGI__FN void PUGIXML_FUNCTION set_memory_management_functions(allocation_function allocate, deallocation_function deallocate)
 	{
 		impl::xml_memory::allocate = allocate;
@@ -6448,13 +10757,14 @@ PUGI__NS_BEGIN
 	{
 		xpath_memory_block* _root;
 		size_t _root_size;
+		xml_memory_resource* _resource;
 
 	public:
 	#ifdef PUGIXML_NO_EXCEPTIONS
 		jmp_buf* error_handler;
 	#endif
 
-		xpath_allocator(xpath_memory_block* root, size_t root_size = 0): _root(root), _root_size(root_size)
+		xpath_allocator(xpath_memory_block* root, xml_memory_resource* resource): _root(root), _root_size(0), _resource(resource)
 		{
 		#ifdef PUGIXML_NO_EXCEPTIONS
 			error_handler = 0;
@@ -6481,7 +10791,7 @@ PUGI__NS_BEGIN
 
 				size_t block_size = block_capacity + offsetof(xpath_memory_block, data);
 
-				xpath_memory_block* block = static_cast<xpath_memory_block*>(xml_memory::allocate(block_size));
+				xpath_memory_block* block = static_cast<xpath_memory_block*>(resource_allocate(block_size, _resource));
 				if (!block) return 0;
 				
 				block->next = _root;
@@ -6547,7 +10857,7 @@ PUGI__NS_BEGIN
 					if (next)
 					{
 						// deallocate the whole page, unless it was the first one
-						xml_memory::deallocate(_root->next);
+						resource_deallocate(_root->next, _resource);
 						_root->next = next;
 					}
 				}
@@ -6565,7 +10875,7 @@ PUGI__NS_BEGIN
 			{
 				xpath_memory_block* next = cur->next;
 
-				xml_memory::deallocate(cur);
+				resource_deallocate(cur, _resource);
 
 				cur = next;
 			}
@@ -6584,7 +10894,7 @@ PUGI__NS_BEGIN
 			{
 				xpath_memory_block* next = cur->next;
 
-				xml_memory::deallocate(cur);
+				resource_deallocate(cur, _resource);
 
 				cur = next;
 			}
@@ -6623,7 +10933,7 @@ PUGI__NS_BEGIN
 		jmp_buf error_handler;
 	#endif
 
-		xpath_stack_data(): result(blocks + 0), temp(blocks + 1)
+		xpath_stack_data(xml_memory_resource* resource): result(blocks + 0, resource), temp(blocks + 1, resource)
 		{
 			blocks[0].next = blocks[1].next = 0;
 			blocks[0].capacity = blocks[1].capacity = sizeof(blocks[0].data);
@@ -6833,12 +11143,18 @@ PUGI__NS_BEGIN
 			{
 				xpath_string result;
 
+				// text embedded with parse_embed_pcdata precedes the children of the element
+				const char_t* text = get_embedded_pcdata(n.internal_object());
+				if (text) result.append(xpath_string::from_const(text), alloc);
+
 				xml_node cur = n.first_child();
 				
 				while (cur && cur != n)
 				{
 					if (cur.type() == node_pcdata || cur.type() == node_cdata)
 						result.append(xpath_string::from_const(cur.value()), alloc);
+					else if ((text = get_embedded_pcdata(cur.internal_object())) != 0)
+						result.append(xpath_string::from_const(text), alloc);
 
 					if (cur.first_child())
 						cur = cur.first_child();
@@ -6942,9 +11258,12 @@ PUGI__NS_BEGIN
 
 		if (node)
 		{
-			if ((get_document(node).header & xml_memory_page_contents_shared_mask) == 0)
+			xml_document_struct& doc = get_document(node);
+
+			if ((doc.header & xml_memory_page_contents_shared_mask) == 0)
 			{
-				if (node->name && (node->header & impl::xml_memory_page_name_allocated_or_shared_mask) == 0) return node->name;
+				// interned names point to the first occurrence of the name
+				if (node->name && !doc.names && (node->header & impl::xml_memory_page_name_allocated_or_shared_mask) == 0) return node->name;
 				if (node->value && (node->header & impl::xml_memory_page_value_allocated_or_shared_mask) == 0) return node->value;
 			}
 
@@ -6955,9 +11274,11 @@ PUGI__NS_BEGIN
 
 		if (attr)
 		{
-			if ((get_document(attr).header & xml_memory_page_contents_shared_mask) == 0)
+			xml_document_struct& doc = get_document(attr);
+
+			if ((doc.header & xml_memory_page_contents_shared_mask) == 0)
 			{
-				if ((attr->header & impl::xml_memory_page_name_allocated_or_shared_mask) == 0) return attr->name;
+				if (!doc.names && (attr->header & impl::xml_memory_page_name_allocated_or_shared_mask) == 0) return attr->name;
 				if ((attr->header & impl::xml_memory_page_value_allocated_or_shared_mask) == 0) return attr->value;
 			}
 
@@ -7101,51 +11422,18 @@ PUGI__NS_BEGIN
 	}
 
 	// gets mantissa digits in the form of 0.xxxxx with 0. implied and the exponent
-#if defined(PUGI__MSVC_CRT_VERSION) && PUGI__MSVC_CRT_VERSION >= 1400 && !defined(_WIN32_WCE)
-	PUGI__FN void convert_number_to_mantissa_exponent(double value, char* buffer, size_t buffer_size, char** out_mantissa, int* out_exponent)
-	{
-		// get base values
-		int sign, exponent;
-		_ecvt_s(buffer, buffer_size, value, DBL_DIG + 1, &exponent, &sign);
-
-		// truncate redundant zeros
-		truncate_zeros(buffer, buffer + strlen(buffer));
-
-		// fill results
-		*out_mantissa = buffer;
-		*out_exponent = exponent;
-	}
-#else
 	PUGI__FN void convert_number_to_mantissa_exponent(double value, char* buffer, size_t buffer_size, char** out_mantissa, int* out_exponent)
 	{
-		// get a scientific notation value with IEEE DBL_DIG decimals
-		sprintf(buffer, "%.*e", DBL_DIG, value);
-		assert(strlen(buffer) < buffer_size);
+		// get the shortest digits that convert back to the same value
+		int length = double_to_digits(value < 0 ? -value : value, buffer, *out_exponent);
+		assert(static_cast<size_t>(length) < buffer_size);
 		(void)!buffer_size;
 
-		// get the exponent (possibly negative)
-		char* exponent_string = strchr(buffer, 'e');
-		assert(exponent_string);
-
-		int exponent = atoi(exponent_string + 1);
-
-		// extract mantissa string: skip sign
-		char* mantissa = buffer[0] == '-' ? buffer + 1 : buffer;
-		assert(mantissa[0] != '0' && mantissa[1] == '.');
-
-		// divide mantissa by 10 to eliminate integer part
-		mantissa[1] = mantissa[0];
-		mantissa++;
-		exponent++;
+		// remove trailing zeros and zero-terminate mantissa
+		truncate_zeros(buffer, buffer + length);
 
-		// remove extra mantissa digits and zero-terminate mantissa
-		truncate_zeros(mantissa, exponent_string);
-
-		// fill results
-		*out_mantissa = mantissa;
-		*out_exponent = exponent;
+		*out_mantissa = buffer;
 	}
-#endif
 
 	PUGI__FN xpath_string convert_number_to_string(double value, xpath_allocator* alloc)
 	{
@@ -7250,11 +11538,10 @@ PUGI__NS_BEGIN
 		if (!check_string_to_number_format(string)) return gen_nan();
 
 		// parse string
-	#ifdef PUGIXML_WCHAR_MODE
-		return wcstod(string, 0);
-	#else
-		return atof(string);
-	#endif
+		double result;
+		string_to_double(string, result);
+
+		return result;
 	}
 
 	PUGI__FN bool convert_string_to_number_scratch(char_t (&buffer)[32], const char_t* begin, const char_t* end, double* out_result)
@@ -8532,7 +12819,7 @@ PUGI__NS_BEGIN
 			}
 		}
 
-		bool step_push(xpath_node_set_raw& ns, xml_attribute_struct* a, xml_node_struct* parent, xpath_allocator* alloc)
+		bool step_push(xpath_node_set_raw& ns, xml_attribute_struct* a, xml_node_struct* parent, const xml_name_key& key, xpath_allocator* alloc)
 		{
             assert(a);
 
@@ -8541,7 +12828,7 @@ PUGI__NS_BEGIN
 			switch (_test)
 			{
 			case nodetest_name:
-				if (strequal(name, _data.nodetest) && is_xpath_attribute(name))
+				if (key.match(name) && is_xpath_attribute(name))
 				{
 					ns.push_back(xpath_node(xml_attribute(a), xml_node(parent)), alloc);
 					return true;
@@ -8572,7 +12859,7 @@ PUGI__NS_BEGIN
 			return false;
 		}
 		
-		bool step_push(xpath_node_set_raw& ns, xml_node_struct* n, xpath_allocator* alloc)
+		bool step_push(xpath_node_set_raw& ns, xml_node_struct* n, const xml_name_key& key, xpath_allocator* alloc)
 		{
             assert(n);
 
@@ -8581,7 +12868,7 @@ PUGI__NS_BEGIN
 			switch (_test)
 			{
 			case nodetest_name:
-				if (type == node_element && n->name && strequal(n->name, _data.nodetest))
+				if (type == node_element && key.match(n->name))
 				{
 					ns.push_back(xml_node(n), alloc);
 					return true;
@@ -8647,7 +12934,7 @@ PUGI__NS_BEGIN
 			return false;
 		}
 
-		template <class T> void step_fill(xpath_node_set_raw& ns, xml_node_struct* n, xpath_allocator* alloc, bool once, T)
+		template <class T> void step_fill(xpath_node_set_raw& ns, xml_node_struct* n, const xml_name_key& key, xpath_allocator* alloc, bool once, T)
 		{
 			const axis_t axis = T::axis;
 
@@ -8656,7 +12943,7 @@ PUGI__NS_BEGIN
 			case axis_attribute:
 			{
 				for (xml_attribute_struct* a = n->first_attribute; a; a = a->next_attribute)
-					if (step_push(ns, a, n, alloc) & once)
+					if (step_push(ns, a, n, key, alloc) & once)
 						return;
 				
 				break;
@@ -8664,8 +12951,8 @@ PUGI__NS_BEGIN
 			
 			case axis_child:
 			{
-				for (xml_node_struct* c = n->first_child; c; c = c->next_sibling)
-					if (step_push(ns, c, alloc) & once)
+				for (xml_node_struct* c = get_first_child(n); c; c = c->next_sibling)
+					if (step_push(ns, c, key, alloc) & once)
 						return;
 					
 				break;
@@ -8675,17 +12962,17 @@ PUGI__NS_BEGIN
 			case axis_descendant_or_self:
 			{
 				if (axis == axis_descendant_or_self)
-					if (step_push(ns, n, alloc) & once)
+					if (step_push(ns, n, key, alloc) & once)
 						return;
 					
-				xml_node_struct* cur = n->first_child;
+				xml_node_struct* cur = get_first_child(n);
 				
 				while (cur)
 				{
-					if (step_push(ns, cur, alloc) & once)
+					if (step_push(ns, cur, key, alloc) & once)
 						return;
 					
-					if (cur->first_child)
+					if (get_first_child(cur))
 						cur = cur->first_child;
 					else
 					{
@@ -8706,7 +12993,7 @@ PUGI__NS_BEGIN
 			case axis_following_sibling:
 			{
 				for (xml_node_struct* c = n->next_sibling; c; c = c->next_sibling)
-					if (step_push(ns, c, alloc) & once)
+					if (step_push(ns, c, key, alloc) & once)
 						return;
 				
 				break;
@@ -8715,7 +13002,7 @@ PUGI__NS_BEGIN
 			case axis_preceding_sibling:
 			{
 				for (xml_node_struct* c = n->prev_sibling_c; c->next_sibling; c = c->prev_sibling_c)
-					if (step_push(ns, c, alloc) & once)
+					if (step_push(ns, c, key, alloc) & once)
 						return;
 				
 				break;
@@ -8737,10 +13024,10 @@ PUGI__NS_BEGIN
 
 				while (cur)
 				{
-					if (step_push(ns, cur, alloc) & once)
+					if (step_push(ns, cur, key, alloc) & once)
 						return;
 
-					if (cur->first_child)
+					if (get_first_child(cur))
 						cur = cur->first_child;
 					else
 					{
@@ -8774,12 +13061,12 @@ PUGI__NS_BEGIN
 
 				while (cur)
 				{
-					if (cur->first_child)
+					if (get_first_child(cur))
 						cur = cur->first_child->prev_sibling_c;
 					else
 					{
 						// leaf node, can't be ancestor
-						if (step_push(ns, cur, alloc) & once)
+						if (step_push(ns, cur, key, alloc) & once)
 							return;
 
 						while (!cur->prev_sibling_c->next_sibling)
@@ -8789,7 +13076,7 @@ PUGI__NS_BEGIN
 							if (!cur) return;
 
 							if (!node_is_ancestor(cur, n))
-								if (step_push(ns, cur, alloc) & once)
+								if (step_push(ns, cur, key, alloc) & once)
 									return;
 						}
 
@@ -8804,14 +13091,14 @@ PUGI__NS_BEGIN
 			case axis_ancestor_or_self:
 			{
 				if (axis == axis_ancestor_or_self)
-					if (step_push(ns, n, alloc) & once)
+					if (step_push(ns, n, key, alloc) & once)
 						return;
 
 				xml_node_struct* cur = n->parent;
 				
 				while (cur)
 				{
-					if (step_push(ns, cur, alloc) & once)
+					if (step_push(ns, cur, key, alloc) & once)
 						return;
 					
 					cur = cur->parent;
@@ -8822,7 +13109,7 @@ PUGI__NS_BEGIN
 
 			case axis_self:
 			{
-				step_push(ns, n, alloc);
+				step_push(ns, n, key, alloc);
 
 				break;
 			}
@@ -8830,7 +13117,7 @@ PUGI__NS_BEGIN
 			case axis_parent:
 			{
 				if (n->parent)
-					step_push(ns, n->parent, alloc);
+					step_push(ns, n->parent, key, alloc);
 
 				break;
 			}
@@ -8840,7 +13127,7 @@ PUGI__NS_BEGIN
 			}
 		}
 		
-		template <class T> void step_fill(xpath_node_set_raw& ns, xml_attribute_struct* a, xml_node_struct* p, xpath_allocator* alloc, bool once, T v)
+		template <class T> void step_fill(xpath_node_set_raw& ns, xml_attribute_struct* a, xml_node_struct* p, const xml_name_key& key, xpath_allocator* alloc, bool once, T v)
 		{
 			const axis_t axis = T::axis;
 
@@ -8850,14 +13137,14 @@ PUGI__NS_BEGIN
 			case axis_ancestor_or_self:
 			{
 				if (axis == axis_ancestor_or_self && _test == nodetest_type_node) // reject attributes based on principal node type test
-					if (step_push(ns, a, p, alloc) & once)
+					if (step_push(ns, a, p, key, alloc) & once)
 						return;
 
 				xml_node_struct* cur = p;
 				
 				while (cur)
 				{
-					if (step_push(ns, cur, alloc) & once)
+					if (step_push(ns, cur, key, alloc) & once)
 						return;
 					
 					cur = cur->parent;
@@ -8870,7 +13157,7 @@ PUGI__NS_BEGIN
 			case axis_self:
 			{
 				if (_test == nodetest_type_node) // reject attributes based on principal node type test
-					step_push(ns, a, p, alloc);
+					step_push(ns, a, p, key, alloc);
 
 				break;
 			}
@@ -8881,7 +13168,7 @@ PUGI__NS_BEGIN
 				
 				while (cur)
 				{
-					if (cur->first_child)
+					if (get_first_child(cur))
 						cur = cur->first_child;
 					else
 					{
@@ -8895,7 +13182,7 @@ PUGI__NS_BEGIN
 						cur = cur->next_sibling;
 					}
 
-					if (step_push(ns, cur, alloc) & once)
+					if (step_push(ns, cur, key, alloc) & once)
 						return;
 				}
 
@@ -8904,7 +13191,7 @@ PUGI__NS_BEGIN
 
 			case axis_parent:
 			{
-				step_push(ns, p, alloc);
+				step_push(ns, p, key, alloc);
 
 				break;
 			}
@@ -8912,7 +13199,7 @@ PUGI__NS_BEGIN
 			case axis_preceding:
 			{
 				// preceding:: axis does not include attribute nodes and attribute ancestors (they are the same as parent's ancestors), so we can reuse node preceding
-				step_fill(ns, p, alloc, once, v);
+				step_fill(ns, p, key, alloc, once, v);
 				break;
 			}
 			
@@ -8921,15 +13208,24 @@ PUGI__NS_BEGIN
 			}
 		}
 
+		// name tests use the name table of the context node document
+		xml_name_key step_name_key(xml_node_struct* n)
+		{
+			if (_test == nodetest_name) return get_name_key(n, _data.nodetest);
+
+			xml_name_key result = {_data.nodetest, false};
+			return result;
+		}
+
 		template <class T> void step_fill(xpath_node_set_raw& ns, const xpath_node& xn, xpath_allocator* alloc, bool once, T v)
 		{
 			const axis_t axis = T::axis;
 			bool axis_has_attributes = (axis == axis_ancestor || axis == axis_ancestor_or_self || axis == axis_descendant_or_self || axis == axis_following || axis == axis_parent || axis == axis_preceding || axis == axis_self);
 
 			if (xn.node())
-				step_fill(ns, xn.node().internal_object(), alloc, once, v);
+				step_fill(ns, xn.node().internal_object(), step_name_key(xn.node().internal_object()), alloc, once, v);
 			else if (axis_has_attributes && xn.attribute() && xn.parent())
-				step_fill(ns, xn.attribute().internal_object(), xn.parent().internal_object(), alloc, once, v);
+				step_fill(ns, xn.attribute().internal_object(), xn.parent().internal_object(), step_name_key(xn.parent().internal_object()), alloc, once, v);
 		}
 
 		template <class T> xpath_node_set_raw step_do(const xpath_context& c, const xpath_stack& stack, nodeset_eval_t eval, T v)
@@ -10635,14 +14931,14 @@ PUGI__NS_BEGIN
 
 	struct xpath_query_impl
 	{
-		static xpath_query_impl* create()
+		static xpath_query_impl* create(xml_memory_resource* resource)
 		{
-			void* memory = xml_memory::allocate(sizeof(xpath_query_impl));
+			void* memory = resource_allocate(sizeof(xpath_query_impl), resource);
 
-			return new (memory) xpath_query_impl();
+			return new (memory) xpath_query_impl(resource);
 		}
 
-		static void destroy(void* ptr)
+		static void destroy(void* ptr, xml_memory_resource* resource)
 		{
 			if (!ptr) return;
 			
@@ -10650,10 +14946,10 @@ PUGI__NS_BEGIN
 			static_cast<xpath_query_impl*>(ptr)->alloc.release();
 
 			// free allocator memory (with the first page)
-			xml_memory::deallocate(ptr);
+			resource_deallocate(ptr, resource);
 		}
 
-		xpath_query_impl(): root(0), alloc(&block)
+		xpath_query_impl(xml_memory_resource* resource): root(0), alloc(&block, resource)
 		{
 			block.next = 0;
 			block.capacity = sizeof(block.data);
@@ -10788,7 +15084,7 @@ namespace pugi
 		if (size_ <= 1)
 		{
 			// deallocate old buffer
-			if (_begin != &_storage) impl::xml_memory::deallocate(_begin);
+			if (_begin != &_storage) impl::resource_deallocate(_begin, _resource);
 
 			// use internal buffer
 			if (begin_ != end_) _storage = *begin_;
@@ -10799,7 +15095,7 @@ namespace pugi
 		else
 		{
 			// make heap copy
-			xpath_node* storage = static_cast<xpath_node*>(impl::xml_memory::allocate(size_ * sizeof(xpath_node)));
+			xpath_node* storage = static_cast<xpath_node*>(impl::resource_allocate(size_ * sizeof(xpath_node), _resource));
 
 			if (!storage)
 			{
@@ -10813,7 +15109,7 @@ namespace pugi
 			memcpy(storage, begin_, size_ * sizeof(xpath_node));
 			
 			// deallocate old buffer
-			if (_begin != &_storage) impl::xml_memory::deallocate(_begin);
+			if (_begin != &_storage) impl::resource_deallocate(_begin, _resource);
 
 			// finalize
 			_begin = storage;
@@ -10821,21 +15117,25 @@ namespace pugi
 		}
 	}
 
-	PUGI__FN xpath_node_set::xpath_node_set(): _type(type_unsorted), _begin(&_storage), _end(&_storage)
+	PUGI__FN xpath_node_set::xpath_node_set(): _type(type_unsorted), _resource(0), _begin(&_storage), _end(&_storage)
+	{
+	}
+
+	PUGI__FN xpath_node_set::xpath_node_set(xml_memory_resource* resource): _type(type_unsorted), _resource(resource), _begin(&_storage), _end(&_storage)
 	{
 	}
 
-	PUGI__FN xpath_node_set::xpath_node_set(const_iterator begin_, const_iterator end_, type_t type_): _type(type_), _begin(&_storage), _end(&_storage)
+	PUGI__FN xpath_node_set::xpath_node_set(const_iterator begin_, const_iterator end_, type_t type_, xml_memory_resource* resource): _type(type_), _resource(resource), _begin(&_storage), _end(&_storage)
 	{
 		_assign(begin_, end_);
 	}
 
 	PUGI__FN xpath_node_set::~xpath_node_set()
 	{
-		if (_begin != &_storage) impl::xml_memory::deallocate(_begin);
+		if (_begin != &_storage) impl::resource_deallocate(_begin, _resource);
 	}
 		
-	PUGI__FN xpath_node_set::xpath_node_set(const xpath_node_set& ns): _type(ns._type), _begin(&_storage), _end(&_storage)
+	PUGI__FN xpath_node_set::xpath_node_set(const xpath_node_set& ns): _type(ns._type), _resource(ns._resource), _begin(&_storage), _end(&_storage)
 	{
 		_assign(ns._begin, ns._end);
 	}
@@ -10864,6 +15164,11 @@ namespace pugi
 	{
 		return _begin == _end;
 	}
+
+	PUGI__FN xml_memory_resource* xpath_node_set::memory_resource() const
+	{
+		return _resource;
+	}
 		
 	PUGI__FN const xpath_node& xpath_node_set::operator[](size_t index) const
 	{
@@ -11095,9 +15400,9 @@ namespace pugi
 		return find(name);
 	}
 
-	PUGI__FN xpath_query::xpath_query(const char_t* query, xpath_variable_set* variables): _impl(0)
+	PUGI__FN xpath_query::xpath_query(const char_t* query, xpath_variable_set* variables, xml_memory_resource* resource): _impl(0), _resource(resource)
 	{
-		impl::xpath_query_impl* qimpl = impl::xpath_query_impl::create();
+		impl::xpath_query_impl* qimpl = impl::xpath_query_impl::create(resource);
 
 		if (!qimpl)
 		{
@@ -11109,7 +15414,7 @@ namespace pugi
 		}
 		else
 		{
-			impl::buffer_holder impl_holder(qimpl, impl::xpath_query_impl::destroy);
+			impl::buffer_holder impl_holder(qimpl, impl::xpath_query_impl::destroy, resource);
 
 			qimpl->root = impl::xpath_parser::parse(query, variables, &qimpl->alloc, &_result);
 
@@ -11125,7 +15430,7 @@ namespace pugi
 
 	PUGI__FN xpath_query::~xpath_query()
 	{
-		impl::xpath_query_impl::destroy(_impl);
+		impl::xpath_query_impl::destroy(_impl, _resource);
 	}
 
 	PUGI__FN xpath_value_type xpath_query::return_type() const
@@ -11140,7 +15445,7 @@ namespace pugi
 		if (!_impl) return false;
 		
 		impl::xpath_context c(n, 1, 1);
-		impl::xpath_stack_data sd;
+		impl::xpath_stack_data sd(_resource);
 
 	#ifdef PUGIXML_NO_EXCEPTIONS
 		if (setjmp(sd.error_handler)) return false;
@@ -11154,7 +15459,7 @@ namespace pugi
 		if (!_impl) return impl::gen_nan();
 		
 		impl::xpath_context c(n, 1, 1);
-		impl::xpath_stack_data sd;
+		impl::xpath_stack_data sd(_resource);
 
 	#ifdef PUGIXML_NO_EXCEPTIONS
 		if (setjmp(sd.error_handler)) return impl::gen_nan();
@@ -11166,7 +15471,7 @@ namespace pugi
 #ifndef PUGIXML_NO_STL
 	PUGI__FN string_t xpath_query::evaluate_string(const xpath_node& n) const
 	{
-		impl::xpath_stack_data sd;
+		impl::xpath_stack_data sd(_resource);
 
 		impl::xpath_string r = impl::evaluate_string_impl(static_cast<impl::xpath_query_impl*>(_impl), n, sd);
 
@@ -11176,7 +15481,7 @@ namespace pugi
 
 	PUGI__FN size_t xpath_query::evaluate_string(char_t* buffer, size_t capacity, const xpath_node& n) const
 	{
-		impl::xpath_stack_data sd;
+		impl::xpath_stack_data sd(_resource);
 
 		impl::xpath_string r = impl::evaluate_string_impl(static_cast<impl::xpath_query_impl*>(_impl), n, sd);
 
@@ -11197,18 +15502,18 @@ namespace pugi
 	PUGI__FN xpath_node_set xpath_query::evaluate_node_set(const xpath_node& n) const
 	{
 		impl::xpath_ast_node* root = impl::evaluate_node_set_prepare(static_cast<impl::xpath_query_impl*>(_impl));
-		if (!root) return xpath_node_set();
+		if (!root) return xpath_node_set(_resource);
 
 		impl::xpath_context c(n, 1, 1);
-		impl::xpath_stack_data sd;
+		impl::xpath_stack_data sd(_resource);
 
 	#ifdef PUGIXML_NO_EXCEPTIONS
-		if (setjmp(sd.error_handler)) return xpath_node_set();
+		if (setjmp(sd.error_handler)) return xpath_node_set(_resource);
 	#endif
 
 		impl::xpath_node_set_raw r = root->eval_node_set(c, sd.stack, impl::nodeset_eval_all);
 
-		return xpath_node_set(r.begin(), r.end(), r.type());
+		return xpath_node_set(r.begin(), r.end(), r.type(), _resource);
 	}
 
 	PUGI__FN xpath_node xpath_query::evaluate_node(const xpath_node& n) const
@@ -11217,7 +15522,7 @@ namespace pugi
 		if (!root) return xpath_node();
 
 		impl::xpath_context c(n, 1, 1);
-		impl::xpath_stack_data sd;
+		impl::xpath_stack_data sd(_resource);
 
 	#ifdef PUGIXML_NO_EXCEPTIONS
 		if (setjmp(sd.error_handler)) return xpath_node();
@@ -11237,6 +15542,11 @@ namespace pugi
 	{
 	}
 
+	PUGI__FN xml_memory_resource* xpath_query::memory_resource() const
+	{
+		return _resource;
+	}
+
 	PUGI__FN xpath_query::operator xpath_query::unspecified_bool_type() const
 	{
 		return _impl ? unspecified_bool_xpath_query : 0;
@@ -11296,6 +15606,8 @@ namespace pugi
 // Undefine all local macros (makes sure we're not leaking macros in header-only mode)
 #undef PUGI__NO_INLINE
 #undef PUGI__UNLIKELY
+#undef PUGI__SIMD_SSE2
+#undef PUGI__NO_SANITIZE
 #undef PUGI__STATIC_ASSERT
 #undef PUGI__DMC_VOLATILE
 #undef PUGI__MSVC_CRT_VERSION
@@ -11315,6 +15627,7 @@ namespace pugi
 #undef PUGI__SCANFOR
 #undef PUGI__SCANWHILE
 #undef PUGI__SCANWHILE_UNROLL
+#undef PUGI__SCANCHARTYPE
 #undef PUGI__ENDSEG
 #undef PUGI__THROW_ERROR
 #undef PUGI__CHECK_ERROR
@@ -158,6 +158,38 @@ namespace pugi
 	// is a valid document. This flag is off by default.
 	const unsigned int parse_fragment = 0x1000;
 
+	// This flag determines if large documents are parsed using multiple threads. The document is split between the children of the
+	// document element, and the resulting tree is identical to the one produced by the single-threaded parser. This flag is off by default;
+	// it has no effect unless the library is compiled with PUGIXML_HAS_THREADS. Memory allocation functions are called from several threads.
+	const unsigned int parse_parallel = 0x2000;
+
+	// This flag determines if character/reference entities, End-of-Line characters and attribute whitespace are converted when the value
+	// is first accessed instead of during parsing (the other flags still determine which conversions are performed). This flag is off by default;
+	// turning it on speeds up parsing of documents where most values are not read, but reading a value is no longer thread-safe until it is converted.
+	const unsigned int parse_lazy_decode = 0x4000;
+
+	// This flag determines if the contents of elements at the depth set with parse_lazy_depth are parsed when they are first accessed
+	// (i.e. via first_child(), children(), XPath or print) instead of during loading. The parser only finds the end tag of these elements,
+	// so errors in their contents are not reported. This flag is off by default; reading the contents is not thread-safe until they are parsed.
+	const unsigned int parse_lazy_subtrees = 0x8000;
+
+	// Get parse_lazy_subtrees flag for the given depth of elements with lazily parsed contents (document element has depth 0, maximum depth is 255)
+	unsigned int PUGIXML_FUNCTION parse_lazy_depth(unsigned int depth);
+
+	// This flag determines if node and attribute names are stored once per document, so that lookups by name (i.e. child(), attribute(),
+	// XPath name tests) compare pointers instead of strings. It has effect only when loading a document or appending to an empty one, and
+	// then applies to all names of the document, including the ones set later. This flag is off by default.
+	const unsigned int parse_intern_names = 0x10000;
+
+	// This flag determines if load_file and load(std::istream&) read the input on a separate thread while the data that was already read
+	// is parsed. This flag is off by default; it has no effect unless the library is compiled with PUGIXML_HAS_THREADS.
+	const unsigned int parse_pipelined = 0x20000;
+
+	// This flag determines if plain character data that is the first child of an element is stored in the value of the element instead of
+	// a separate node_pcdata node. xml_text, child_value(), XPath and printing treat this value as the text of the element. This flag is off by
+	// default; turning it on results in less memory consumption for documents with many short text elements.
+	const unsigned int parse_embed_pcdata = 0x40000;
+
 	// The default parsing mode.
 	// Elements, PCDATA and CDATA sections are added to the DOM tree, character/reference entities are expanded,
 	// End-of-Line characters are normalized, attribute values are normalized using CDATA normalization rules.
@@ -331,14 +363,15 @@ namespace pugi
 		const char_t* as_string(const char_t* def = PUGIXML_TEXT("")) const;
 
 		// Get attribute value as a number, or the default value if conversion did not succeed or attribute is empty
-		int as_int(int def = 0) const;
-		unsigned int as_uint(unsigned int def = 0) const;
-		double as_double(double def = 0) const;
-		float as_float(float def = 0) const;
+		// If ok is not null, it receives the conversion status, and the default value is returned for malformed or out of range numbers
+		int as_int(int def = 0, bool* ok = 0) const;
+		unsigned int as_uint(unsigned int def = 0, bool* ok = 0) const;
+		double as_double(double def = 0, bool* ok = 0) const;
+		float as_float(float def = 0, bool* ok = 0) const;
 
 	#ifdef PUGIXML_HAS_LONG_LONG
-		long long as_llong(long long def = 0) const;
-		unsigned long long as_ullong(unsigned long long def = 0) const;
+		long long as_llong(long long def = 0, bool* ok = 0) const;
+		unsigned long long as_ullong(unsigned long long def = 0, bool* ok = 0) const;
 	#endif
 
 		// Get attribute value as bool (returns true if first character is in '1tTyY' set), or the default value if attribute is empty
@@ -351,6 +384,7 @@ namespace pugi
 		// Set attribute value with type conversion (numbers are converted to strings, boolean is converted to "true"/"false")
 		bool set_value(int rhs);
 		bool set_value(unsigned int rhs);
+		bool set_value(float rhs);
 		bool set_value(double rhs);
 		bool set_value(bool rhs);
 
@@ -363,6 +397,7 @@ namespace pugi
 		xml_attribute& operator=(const char_t* rhs);
 		xml_attribute& operator=(int rhs);
 		xml_attribute& operator=(unsigned int rhs);
+		xml_attribute& operator=(float rhs);
 		xml_attribute& operator=(double rhs);
 		xml_attribute& operator=(bool rhs);
 
@@ -674,14 +709,15 @@ namespace pugi
 		const char_t* as_string(const char_t* def = PUGIXML_TEXT("")) const;
 
 		// Get text as a number, or the default value if conversion did not succeed or object is empty
-		int as_int(int def = 0) const;
-		unsigned int as_uint(unsigned int def = 0) const;
-		double as_double(double def = 0) const;
-		float as_float(float def = 0) const;
+		// If ok is not null, it receives the conversion status, and the default value is returned for malformed or out of range numbers
+		int as_int(int def = 0, bool* ok = 0) const;
+		unsigned int as_uint(unsigned int def = 0, bool* ok = 0) const;
+		double as_double(double def = 0, bool* ok = 0) const;
+		float as_float(float def = 0, bool* ok = 0) const;
 
 	#ifdef PUGIXML_HAS_LONG_LONG
-		long long as_llong(long long def = 0) const;
-		unsigned long long as_ullong(unsigned long long def = 0) const;
+		long long as_llong(long long def = 0, bool* ok = 0) const;
+		unsigned long long as_ullong(unsigned long long def = 0, bool* ok = 0) const;
 	#endif
 
 		// Get text as bool (returns true if first character is in '1tTyY' set), or the default value if object is empty
@@ -693,6 +729,7 @@ namespace pugi
 		// Set text with type conversion (numbers are converted to strings, boolean is converted to "true"/"false")
 		bool set(int rhs);
 		bool set(unsigned int rhs);
+		bool set(float rhs);
 		bool set(double rhs);
 		bool set(bool rhs);
 
@@ -705,6 +742,7 @@ namespace pugi
 		xml_text& operator=(const char_t* rhs);
 		xml_text& operator=(int rhs);
 		xml_text& operator=(unsigned int rhs);
+		xml_text& operator=(float rhs);
 		xml_text& operator=(double rhs);
 		xml_text& operator=(bool rhs);
 
@@ -925,13 +963,57 @@ namespace pugi
 		const char* description() const;
 	};
 
+	// Parse filter actions
+	enum xml_filter_action
+	{
+		filter_keep,			// Keep the element and its contents
+		filter_skip,			// Remove the element and its contents
+		filter_skip_children	// Keep the element without its contents
+	};
+
+	// Memory resource interface; a document or an XPath object that is constructed with a resource gets all its memory from it instead of
+	// the global memory management functions. The resource has to outlive the objects that use it.
+	class PUGIXML_CLASS xml_memory_resource
+	{
+	public:
+		virtual ~xml_memory_resource();
+
+		// Allocate memory with alignment suitable for any object; returns NULL on failure
+		virtual void* allocate(size_t size) = 0;
+
+		// Deallocate memory that was returned by allocate
+		virtual void deallocate(void* ptr) = 0;
+	};
+
+	// Parse filter interface; decides which elements are added to the document during parsing (see xml_document::set_parse_filter)
+	class PUGIXML_CLASS xml_parse_filter
+	{
+	public:
+		virtual ~xml_parse_filter();
+
+		// Callback that is called when the start tag of an element is parsed; the element has its name, attributes and parents, but no children yet.
+		// The callback should not modify the document. Skipped contents are still checked for errors, but no nodes are created for them.
+		virtual xml_filter_action filter(xml_node& node) = 0;
+	};
+
 	// Document class (DOM tree root)
 	class PUGIXML_CLASS xml_document: public xml_node
 	{
 	private:
 		char_t* _buffer;
+		xml_parse_filter* _filter;
+		xml_memory_resource* _resource;
+
+	#ifdef PUGIXML_SEGREGATED_PAGES
+		char _memory[832];
+	#else
+		char _memory[528];
+	#endif
 
-		char _memory[192];
+		bool _value_cache;
+
+		size_t _initial_page_size;
+		size_t _maximum_page_size;
 		
 		// Non-copyable semantics
 		xml_document(const xml_document&);
@@ -944,6 +1026,13 @@ namespace pugi
 		// Default constructor, makes empty document
 		xml_document();
 
+		// Construct empty document that allocates memory from the resource (NULL uses the global memory management functions)
+		explicit xml_document(xml_memory_resource* resource);
+
+		// Construct empty document that allocates all memory from the specified block and never uses the heap; operations that need
+		// more memory than the block has fail with status_out_of_memory. The block is reused when the document is reset or loaded again.
+		xml_document(void* memory, size_t size);
+
 		// Destructor, invalidates all node/attribute handles to this document
 		~xml_document();
 
@@ -992,6 +1081,169 @@ namespace pugi
 
 		// Get document element
 		xml_node document_element() const;
+
+		// Set the filter that is called for elements parsed into this document by load functions, xml_node::append_buffer and xml_incremental_parser
+		// (0 disables filtering). The filter is kept when the document is reset; parse_parallel and parse_lazy_subtrees have no effect if it's set.
+		void set_parse_filter(xml_parse_filter* filter);
+		xml_parse_filter* parse_filter() const;
+
+		// Enable caching of as_int/as_uint/as_double/as_float/as_llong/as_ullong results for attributes and text of this document,
+		// so that repeated conversions of the same value don't parse it again. The cache is kept when the document is reset;
+		// note that with the cache enabled, conversion functions modify the document and are not safe to call from multiple threads.
+		void set_value_cache(bool enable);
+		bool value_cache() const;
+
+		// Set the sizes of the memory pages that hold the document tree; the first page has the initial size, and every next page is twice
+		// as large up to the maximum size. Loading functions start with larger pages for large inputs. 0 selects PUGIXML_MEMORY_PAGE_SIZE,
+		// which is also the default for both sizes. The settings apply to the pages allocated afterwards and are kept when the document is reset.
+		void set_memory_page_size(size_t initial_size, size_t maximum_size);
+		size_t initial_memory_page_size() const;
+		size_t maximum_memory_page_size() const;
+
+		// Get the memory resource of the document (NULL if the global memory management functions are used)
+		xml_memory_resource* memory_resource() const;
+	};
+
+	// Loads several documents at once, using a pool of threads if the library is compiled with PUGIXML_HAS_THREADS
+	class PUGIXML_CLASS xml_document_batch
+	{
+	private:
+		void* _items;
+		size_t _size;
+		size_t _capacity;
+
+		// Non-copyable semantics
+		xml_document_batch(const xml_document_batch&);
+		const xml_document_batch& operator=(const xml_document_batch&);
+
+		void* add(xml_document& document, unsigned int options, xml_encoding encoding);
+
+	public:
+		// Default constructor, makes empty batch
+		xml_document_batch();
+
+		// Destructor; does not affect the documents
+		~xml_document_batch();
+
+		// Add a document to be loaded from file/buffer; returns false if out of memory. Nothing is loaded until load() is called.
+		// The document, the path and the buffer have to stay valid until load() returns; every document can be added to the batch once.
+		bool add_file(xml_document& document, const char* path, unsigned int options = parse_default, xml_encoding encoding = encoding_auto);
+		bool add_file(xml_document& document, const wchar_t* path, unsigned int options = parse_default, xml_encoding encoding = encoding_auto);
+		bool add_buffer(xml_document& document, const void* contents, size_t size, unsigned int options = parse_default, xml_encoding encoding = encoding_auto);
+
+		// Load all documents using up to thread_count threads (0 means the number of processors); returns true if all documents were loaded successfully.
+		// Memory allocation functions are called from several threads.
+		bool load(unsigned int thread_count = 0);
+
+		// Remove all documents from the batch
+		void reset();
+
+		// Get the number of documents in the batch
+		size_t size() const;
+
+		// Get the document/load result by index (in the order the documents were added); the result is set by load()
+		xml_document& document(size_t index) const;
+		xml_parse_result result(size_t index) const;
+	};
+
+	// Incremental parser; builds the document from chunks of data as they become available
+	class PUGIXML_CLASS xml_incremental_parser
+	{
+	private:
+		xml_document* _document;
+		xml_node_struct* _cursor;
+		xml_node_struct* _skip;
+
+		char_t* _buffer;
+		size_t _size;
+		size_t _capacity;
+		size_t _start;
+		size_t _offset;
+
+		unsigned int _options;
+		xml_encoding _encoding;
+
+		unsigned char _tail[4];
+		size_t _tail_size;
+
+		xml_parse_result _result;
+
+		// Non-copyable semantics
+		xml_incremental_parser(const xml_incremental_parser&);
+		const xml_incremental_parser& operator=(const xml_incremental_parser&);
+
+		bool reserve(size_t length);
+		bool append(const void* contents, size_t size, bool last);
+		xml_parse_result parse(bool last);
+
+	public:
+		// Resets the document and prepares it for loading. The document has to outlive the parser and should not be modified until finish() is called.
+		xml_incremental_parser(xml_document& document, unsigned int options = parse_default, xml_encoding encoding = encoding_auto);
+
+		// Parse the next chunk of data. Copies/converts the data, so it may be deleted or changed after the function returns.
+		// Complete nodes are added to the document; data after the last complete markup is kept until more data arrives.
+		xml_parse_result feed(const void* contents, size_t size);
+
+		// Parse the remaining data and check that the document is complete.
+		xml_parse_result finish();
+	};
+
+	// Data source interface for xml_reader
+	class PUGIXML_CLASS xml_reader_source
+	{
+	public:
+		virtual ~xml_reader_source() {}
+
+		// Read up to size bytes of the document into data; returns the number of bytes read, 0 means the end of the document
+		virtual size_t read(void* data, size_t size) = 0;
+	};
+
+	// Pull parser; reports document nodes one by one without building the document tree
+	class PUGIXML_CLASS xml_reader
+	{
+	private:
+		void* _impl;
+
+		// Non-copyable semantics
+		xml_reader(const xml_reader&);
+		const xml_reader& operator=(const xml_reader&);
+
+	public:
+		// Default constructor; the reader has no nodes until the document is opened
+		xml_reader();
+
+		// Destructor
+		~xml_reader();
+
+		// Start reading the document from a memory buffer. Copies/converts the buffer, so it may be deleted or changed after the function returns.
+		xml_parse_result open_buffer(const void* contents, size_t size, unsigned int options = parse_default, xml_encoding encoding = encoding_auto);
+
+		// Start reading the document from the source in chunks; memory usage depends on the size of the largest markup construct, not on the document size.
+		// The source has to outlive the reader (or the next open call).
+		xml_parse_result open(xml_reader_source& source, unsigned int options = parse_default, xml_encoding encoding = encoding_auto);
+
+		// Advance to the next node; returns false at the end of the document or if an error occurs (see result())
+		bool next();
+
+		// Get current node type (node_null if there is no current node)
+		xml_node_type type() const;
+
+		// Check if the current node is the end of an element (reported for every element after its contents, including empty ones)
+		bool end_element() const;
+
+		// Get the number of elements enclosing the current node
+		unsigned int depth() const;
+
+		// Get current node name/value, or "" if node is empty or it has no name/value. The strings are valid until the next call to next().
+		const char_t* name() const;
+		const char_t* value() const;
+
+		// Get attributes of the current node (start of an element or declaration). The attributes are valid until the next call to next().
+		xml_attribute first_attribute() const;
+		xml_attribute attribute(const char_t* name) const;
+
+		// Get parsing result; the result is final once next() returns false
+		xml_parse_result result() const;
 	};
 
 #ifndef PUGIXML_NO_XPATH
@@ -1096,6 +1348,7 @@ namespace pugi
 	private:
 		void* _impl;
 		xpath_parse_result _result;
+		xml_memory_resource* _resource;
 
 		typedef void (*unspecified_bool_type)(xpath_query***);
 
@@ -1104,9 +1357,9 @@ namespace pugi
 		xpath_query& operator=(const xpath_query&);
 
 	public:
-		// Construct a compiled object from XPath expression.
+		// Construct a compiled object from XPath expression; the query and the evaluation results allocate memory from the resource if it's not NULL.
 		// If PUGIXML_NO_EXCEPTIONS is not defined, throws xpath_exception on compilation errors.
-		explicit xpath_query(const char_t* query, xpath_variable_set* variables = 0);
+		explicit xpath_query(const char_t* query, xpath_variable_set* variables = 0, xml_memory_resource* resource = 0);
 
 		// Destructor
 		~xpath_query();
@@ -1148,6 +1401,9 @@ namespace pugi
 		// Get parsing result (used to get compilation errors in PUGIXML_NO_EXCEPTIONS mode)
 		const xpath_parse_result& result() const;
 
+		// Get the memory resource of the query
+		xml_memory_resource* memory_resource() const;
+
 		// Safe bool conversion operator
 		operator unspecified_bool_type() const;
 
@@ -1236,13 +1492,16 @@ namespace pugi
 		// Default constructor. Constructs empty set.
 		xpath_node_set();
 
+		// Constructs empty set that allocates memory from the resource
+		explicit xpath_node_set(xml_memory_resource* resource);
+
 		// Constructs a set from iterator range; data is not checked for duplicates and is not sorted according to provided type, so be careful
-		xpath_node_set(const_iterator begin, const_iterator end, type_t type = type_unsorted);
+		xpath_node_set(const_iterator begin, const_iterator end, type_t type = type_unsorted, xml_memory_resource* resource = 0);
 
 		// Destructor
 		~xpath_node_set();
 		
-		// Copy constructor/assignment operator
+		// Copy constructor/assignment operator; the copy uses the resource of the source set, and the assignment keeps the resource of the target
 		xpath_node_set(const xpath_node_set& ns);
 		xpath_node_set& operator=(const xpath_node_set& ns);
 
@@ -1267,9 +1526,13 @@ namespace pugi
 		
 		// Check if collection is empty
 		bool empty() const;
+
+		// Get the memory resource of the collection
+		xml_memory_resource* memory_resource() const;
 	
 	private:
 		type_t _type;
+		xml_memory_resource* _resource;
 		
 		xpath_node _storage;
 		
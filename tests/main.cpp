@@ -28,8 +28,40 @@ const char* test_runner::_temp_path;
 static size_t g_memory_total_size = 0;
 static size_t g_memory_total_count = 0;
 
+// parse_parallel calls allocation functions from worker threads
+#ifdef PUGIXML_HAS_THREADS
+#	ifdef _WIN32
+#		include <windows.h>
+
+static SRWLOCK g_memory_lock = SRWLOCK_INIT;
+
+struct memory_lock
+{
+	memory_lock() { AcquireSRWLockExclusive(&g_memory_lock); }
+	~memory_lock() { ReleaseSRWLockExclusive(&g_memory_lock); }
+};
+#	else
+#		include <pthread.h>
+
+static pthread_mutex_t g_memory_lock = PTHREAD_MUTEX_INITIALIZER;
+
+struct memory_lock
+{
+	memory_lock() { pthread_mutex_lock(&g_memory_lock); }
+	~memory_lock() { pthread_mutex_unlock(&g_memory_lock); }
+};
+#	endif
+#else
+struct memory_lock
+{
+	memory_lock() {}
+};
+#endif
+
 static void* custom_allocate(size_t size)
 {
+	memory_lock lock;
+
 	if (test_runner::_memory_fail_threshold > 0 && test_runner::_memory_fail_threshold < g_memory_total_size + size)
 	{
 		test_runner::_memory_fail_triggered = true;
@@ -50,6 +82,8 @@ static void* custom_allocate(size_t size)
 
 static void custom_deallocate(void* ptr)
 {
+	memory_lock lock;
+
 	assert(ptr);
 
 	g_memory_total_size -= memory_size(ptr);
@@ -155,6 +155,31 @@ TEST(document_load_stream_exceptions)
 }
 #endif
 
+TEST(document_load_stream_pipelined)
+{
+	std::basic_string<pugi::char_t> str;
+	str += STR("<node>");
+	for (int i = 0; i < 50000; ++i) str += STR("<node attr=\"value\" />");
+	str += STR("</node>");
+
+	std::basic_istringstream<pugi::char_t> iss(str);
+
+	xml_document doc;
+	CHECK(doc.load(iss, parse_default | parse_pipelined));
+	CHECK_NODE(doc, str.c_str());
+
+	std::basic_istringstream<pugi::char_t> error(str.substr(0, str.size() - 2));
+	xml_parse_result result = doc.load(error, parse_default | parse_pipelined);
+
+	xml_document reference;
+	xml_parse_result reference_result = reference.load(str.substr(0, str.size() - 2).c_str());
+	CHECK(!result && result.status == reference_result.status && result.offset == reference_result.offset);
+
+	std::istringstream narrow("<node attr='value'/>");
+	CHECK(doc.load(narrow, parse_default | parse_pipelined));
+	CHECK_NODE(doc, STR("<node attr=\"value\" />"));
+}
+
 TEST(document_load_stream_error_previous)
 {
 	pugi::xml_document doc;
@@ -228,6 +253,33 @@ TEST(document_load_stream_nonseekable_large)
     CHECK_NODE(doc, str.c_str());
 }
 
+TEST(document_load_stream_nonseekable_chunks)
+{
+	// multibyte characters and an error that cross the boundaries of the stream read chunks
+	std::string data = "<node>";
+	for (int i = 0; i < 20000; ++i) data += "\xe2\x82\xac";
+	data += "<child attr='value'/></node><";
+
+	size_t sizes[] = {data.size(), data.size() - 1};
+
+	for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); ++i)
+	{
+		size_t size = sizes[i];
+
+		xml_document reference;
+		xml_parse_result reference_result = reference.load_buffer(data.c_str(), size);
+
+		char_array_buffer<char> buffer(&data[0], &data[0] + size);
+		std::istream in(&buffer);
+
+		xml_document doc;
+		xml_parse_result result = doc.load(in);
+
+		CHECK(result.status == reference_result.status && result.offset == reference_result.offset && result.encoding == reference_result.encoding);
+		CHECK(save_narrow(doc, format_raw, encoding_utf8) == save_narrow(reference, format_raw, encoding_utf8));
+	}
+}
+
 TEST(document_load_stream_nonseekable_out_of_memory)
 {
     char contents[] = "<node />";
@@ -489,6 +541,136 @@ TEST_XML(document_save_file_wide, "<node/>")
 	CHECK_NODE(doc, STR("<?xml version=\"1.0\"?><node />"));
 }
 
+TEST(document_load_file_page_size)
+{
+	temp_file f;
+
+	// file size is a multiple of the page size, so the contents can not be terminated in place
+	std::string data = "<node>";
+	data += std::string(8192 - 13, 'x');
+	data += "</node>";
+
+	FILE* file = fopen(f.path, "wb");
+	CHECK(file && fwrite(data.c_str(), 1, data.size(), file) == data.size());
+	if (file) fclose(file);
+
+	pugi::xml_document doc;
+
+	CHECK(doc.load_file(f.path));
+	CHECK_STRING(doc.child(STR("node")).child_value() + 8192 - 14, STR("x"));
+
+	CHECK(doc.child(STR("node")).first_child().set_value(STR("text")));
+	CHECK(doc.load_file(f.path, pugi::parse_minimal) && doc.child(STR("node")).child_value()[0] == 'x');
+}
+
+static bool test_load_file_pipelined(const char* path)
+{
+	xml_document reference;
+	xml_parse_result reference_result = reference.load_file(path, parse_full);
+
+	xml_document doc;
+	xml_parse_result result = doc.load_file(path, parse_full | parse_pipelined);
+
+	return result.status == reference_result.status && result.offset == reference_result.offset && result.encoding == reference_result.encoding &&
+		save_narrow(doc, format_raw, encoding_utf8) == save_narrow(reference, format_raw, encoding_utf8);
+}
+
+TEST(document_load_file_pipelined)
+{
+	CHECK(test_load_file_pipelined("tests/data/large.xml"));
+	CHECK(test_load_file_pipelined("tests/data/utftest_utf16_le_bom.xml"));
+	CHECK(test_load_file_pipelined("tests/data/utftest_utf32_be.xml"));
+	CHECK(test_load_file_pipelined("tests/data/empty.xml"));
+
+	xml_document doc;
+	CHECK(doc.load_file("filedoesnotexist", parse_default | parse_pipelined).status == status_file_not_found);
+
+	// errors at the start and at the end of a file that is larger than the read blocks
+	std::string data;
+	for (int i = 0; i < 50000; ++i) data += "<a/>";
+
+	std::string files[] = {"<node>" + data + "</node>", "<node></x>" + data, "<node>" + data + "</nod>"};
+
+	for (size_t i = 0; i < sizeof(files) / sizeof(files[0]); ++i)
+	{
+		temp_file f;
+
+		FILE* file = fopen(f.path, "wb");
+		CHECK(file && fwrite(files[i].c_str(), 1, files[i].size(), file) == files[i].size());
+		if (file) fclose(file);
+
+		CHECK(test_load_file_pipelined(f.path));
+	}
+}
+
+TEST(document_batch)
+{
+	const char* paths[] = {"tests/data/small.xml", "tests/data/large.xml", "tests/data/utftest_utf16_be_bom.xml", "tests/data/empty.xml", "filedoesnotexist"};
+	const char* buffers[] = {"<node attr='1'/>", "<node>", "text"};
+
+	const size_t path_count = sizeof(paths) / sizeof(paths[0]);
+	const size_t count = path_count + sizeof(buffers) / sizeof(buffers[0]) + 1;
+
+	unsigned int thread_counts[] = {0, 1, 3, 100};
+
+	for (size_t t = 0; t < sizeof(thread_counts) / sizeof(thread_counts[0]); ++t)
+	{
+		xml_document docs[count];
+		xml_document_batch batch;
+
+		for (size_t i = 0; i < path_count; ++i) CHECK(batch.add_file(docs[i], paths[i]));
+		for (size_t i = path_count; i < count - 1; ++i) CHECK(batch.add_buffer(docs[i], buffers[i - path_count], strlen(buffers[i - path_count]), parse_default | parse_fragment));
+
+		CHECK(batch.add_file(docs[count - 1], L"tests/data/small.xml"));
+		CHECK(batch.size() == count);
+
+		CHECK(!batch.load(thread_counts[t]));
+
+		for (size_t i = 0; i < count; ++i)
+		{
+			xml_document reference;
+			xml_parse_result reference_result = i < path_count ? reference.load_file(paths[i]) : i < count - 1 ? reference.load_buffer(buffers[i - path_count], strlen(buffers[i - path_count]), parse_default | parse_fragment) : reference.load_file("tests/data/small.xml");
+
+			CHECK(&batch.document(i) == &docs[i]);
+			CHECK(batch.result(i).status == reference_result.status && batch.result(i).offset == reference_result.offset && batch.result(i).encoding == reference_result.encoding);
+			CHECK(save_narrow(docs[i], format_raw, encoding_utf8) == save_narrow(reference, format_raw, encoding_utf8));
+		}
+
+		// loading the same batch again replaces the documents
+		batch.reset();
+		CHECK(batch.size() == 0 && batch.load(thread_counts[t]));
+
+		CHECK(batch.add_file(docs[0], paths[1]) && batch.add_buffer(docs[1], buffers[0], strlen(buffers[0])));
+		CHECK(batch.load(thread_counts[t]));
+		CHECK(docs[0].child(STR("node")).first_child() && docs[1].child(STR("node")).attribute(STR("attr")).as_int() == 1);
+	}
+}
+
+TEST(document_batch_many)
+{
+	xml_document docs[100];
+	xml_document_batch batch;
+
+	for (size_t i = 0; i < sizeof(docs) / sizeof(docs[0]); ++i)
+		CHECK(batch.add_file(docs[i], i % 2 ? "tests/data/small.xml" : "tests/data/large.xml", parse_default | parse_intern_names));
+
+	CHECK(batch.load(4));
+
+	for (size_t i = 0; i < sizeof(docs) / sizeof(docs[0]); ++i)
+		CHECK(batch.result(i) && docs[i].child(STR("node")));
+}
+
+TEST(document_batch_out_of_memory)
+{
+	xml_document doc;
+	xml_document_batch batch;
+
+	test_runner::_memory_fail_threshold = 1;
+
+	CHECK(!batch.add_file(doc, "tests/data/small.xml"));
+	CHECK(batch.size() == 0 && batch.load());
+}
+
 TEST_XML(document_save_file_error, "<node/>")
 {
 	CHECK(!doc.save_file("tests/data/unknown/output.xml"));
@@ -1220,6 +1402,127 @@ TEST(document_load_buffer_utf_truncated)
 	}
 }
 
+static size_t encode_utf(char* result, const unsigned int* data, size_t size, xml_encoding encoding)
+{
+	unsigned char* out = reinterpret_cast<unsigned char*>(result);
+
+	for (size_t i = 0; i < size; ++i)
+	{
+		unsigned int ch = data[i];
+
+		if (encoding == encoding_latin1)
+		{
+			*out++ = static_cast<unsigned char>(ch);
+		}
+		else if (encoding == encoding_utf8)
+		{
+			if (ch < 0x80) *out++ = static_cast<unsigned char>(ch);
+			else if (ch < 0x800) *out++ = static_cast<unsigned char>(0xc0 | (ch >> 6)), *out++ = static_cast<unsigned char>(0x80 | (ch & 0x3f));
+			else if (ch < 0x10000) *out++ = static_cast<unsigned char>(0xe0 | (ch >> 12)), *out++ = static_cast<unsigned char>(0x80 | ((ch >> 6) & 0x3f)), *out++ = static_cast<unsigned char>(0x80 | (ch & 0x3f));
+			else *out++ = static_cast<unsigned char>(0xf0 | (ch >> 18)), *out++ = static_cast<unsigned char>(0x80 | ((ch >> 12) & 0x3f)), *out++ = static_cast<unsigned char>(0x80 | ((ch >> 6) & 0x3f)), *out++ = static_cast<unsigned char>(0x80 | (ch & 0x3f));
+		}
+		else if (encoding == encoding_utf16_le || encoding == encoding_utf16_be)
+		{
+			unsigned int units[2] = {ch, 0};
+			size_t count = 1;
+
+			if (ch >= 0x10000)
+			{
+				units[0] = 0xd800 + ((ch - 0x10000) >> 10);
+				units[1] = 0xdc00 + ((ch - 0x10000) & 0x3ff);
+				count = 2;
+			}
+
+			for (size_t j = 0; j < count; ++j)
+			{
+				unsigned char lo = static_cast<unsigned char>(units[j] & 0xff), hi = static_cast<unsigned char>(units[j] >> 8);
+
+				*out++ = (encoding == encoding_utf16_le) ? lo : hi;
+				*out++ = (encoding == encoding_utf16_le) ? hi : lo;
+			}
+		}
+		else
+		{
+			for (int j = 0; j < 4; ++j)
+				*out++ = static_cast<unsigned char>(ch >> (encoding == encoding_utf32_le ? j * 8 : 24 - j * 8));
+		}
+	}
+
+	return static_cast<size_t>(out - reinterpret_cast<unsigned char*>(result));
+}
+
+TEST(document_convert_ascii_blocks)
+{
+	xml_encoding encodings[] = {encoding_utf8, encoding_utf16_le, encoding_utf16_be, encoding_utf32_le, encoding_utf32_be};
+
+	for (size_t offset = 0; offset < 40; ++offset)
+	{
+		// long ascii runs interrupted by non-ascii characters and surrogate pairs at varying positions
+		unsigned int data[128];
+		size_t size = 0;
+
+		data[size++] = '<'; data[size++] = 'n'; data[size++] = '>';
+		for (size_t i = 0; i < offset; ++i) data[size++] = 'a';
+		data[size++] = 0xe9;
+		for (size_t j = 0; j < 20; ++j) data[size++] = 'b';
+		data[size++] = 0x10437;
+		for (size_t k = 0; k < 17; ++k) data[size++] = 'c';
+		data[size++] = 0x20ac;
+		data[size++] = '<'; data[size++] = '/'; data[size++] = 'n'; data[size++] = '>';
+
+		char buffers[5][512];
+		size_t sizes[5];
+
+		for (size_t e = 0; e < 5; ++e) sizes[e] = encode_utf(buffers[e], data, size, encodings[e]);
+
+		xml_document reference;
+		CHECK(reference.load_buffer(buffers[0], sizes[0], parse_default, encoding_utf8));
+
+		for (size_t src = 0; src < 5; ++src)
+		{
+			xml_document doc;
+			CHECK(doc.load_buffer(buffers[src], sizes[src], parse_default, encodings[src]));
+			CHECK_STRING(doc.child_value(STR("n")), reference.child_value(STR("n")));
+
+			for (size_t dst = 0; dst < 5; ++dst)
+				CHECK(test_save_narrow(doc, format_raw | format_no_declaration, encodings[dst], buffers[dst], sizes[dst]));
+		}
+	}
+}
+
+TEST(document_convert_latin1_blocks)
+{
+	xml_encoding encodings[] = {encoding_utf8, encoding_latin1};
+
+	for (size_t offset = 0; offset < 40; ++offset)
+	{
+		unsigned int data[128];
+		size_t size = 0;
+
+		data[size++] = '<'; data[size++] = 'n'; data[size++] = '>';
+		for (size_t i = 0; i < offset; ++i) data[size++] = 'a';
+		data[size++] = 0xe9;
+		for (size_t j = 0; j < 20; ++j) data[size++] = 'b';
+		for (size_t k = 0; k < 17; ++k) data[size++] = 0xc0 + static_cast<unsigned int>(k);
+		data[size++] = 0xff;
+		data[size++] = '<'; data[size++] = '/'; data[size++] = 'n'; data[size++] = '>';
+
+		char buffers[2][512];
+		size_t sizes[2];
+
+		for (size_t e = 0; e < 2; ++e) sizes[e] = encode_utf(buffers[e], data, size, encodings[e]);
+
+		for (size_t src = 0; src < 2; ++src)
+		{
+			xml_document doc;
+			CHECK(doc.load_buffer(buffers[src], sizes[src], parse_default, encodings[src]));
+
+			for (size_t dst = 0; dst < 2; ++dst)
+				CHECK(test_save_narrow(doc, format_raw | format_no_declaration, encodings[dst], buffers[dst], sizes[dst]));
+		}
+	}
+}
+
 #ifndef PUGIXML_NO_STL
 TEST(document_load_stream_truncated)
 {
@@ -1308,3 +1611,308 @@ TEST(document_convert_out_of_memory)
 		delete[] files[j].data;
 	}
 }
+
+static xml_parse_result load_incremental(xml_document& doc, const char* data, size_t size, size_t chunk, unsigned int options = parse_default, xml_encoding encoding = encoding_auto)
+{
+	xml_incremental_parser parser(doc, options, encoding);
+
+	for (size_t i = 0; i < size; i += chunk)
+		if (!parser.feed(data + i, (size - i < chunk) ? size - i : chunk)) break;
+
+	return parser.finish();
+}
+
+TEST(document_load_incremental)
+{
+	const char* files[] =
+	{
+		"<?xml version='1.0' encoding=\"utf-8\"?><!DOCTYPE root [<!ELEMENT root ANY><!-- <!-- > --><!ENTITY e '>'><![ IGNORE [ <! ]]>]><root>\r\n\t<a b='>' c=\"'\">text &amp; &#x20AC;</a><![CDATA[x]]>y]]><!-- c-o-m-m-e-n-t --><?pi value?>\n</root><!-- tail -->  ",
+		"\xef\xbb\xbf<node attr='1'/>",
+		"<a><b/>   <c>  </c><d>text<e/>more\rtext</d></a>",
+		"<?XML version='1.0?>' ?><a/>",
+		"<a>\0<b/></a>"
+	};
+
+	size_t sizes[] = {0, 0, 0, 0, 10};
+
+	unsigned int flags[] = {parse_default, parse_full, parse_minimal, parse_fragment, parse_default | parse_ws_pcdata, parse_default | parse_ws_pcdata_single, parse_full | parse_trim_pcdata, parse_full | parse_intern_names};
+
+	size_t chunks[] = {1, 2, 3, 7, 16, 4096};
+
+	for (size_t i = 0; i < sizeof(files) / sizeof(files[0]); ++i)
+	{
+		size_t size = sizes[i] ? sizes[i] : strlen(files[i]);
+
+		for (size_t f = 0; f < sizeof(flags) / sizeof(flags[0]); ++f)
+		{
+			xml_document reference;
+			xml_parse_result reference_result = reference.load_buffer(files[i], size, flags[f]);
+
+			for (size_t c = 0; c < sizeof(chunks) / sizeof(chunks[0]); ++c)
+			{
+				xml_document doc;
+				xml_parse_result result = load_incremental(doc, files[i], size, chunks[c], flags[f]);
+
+				CHECK(result.status == reference_result.status && result.offset == reference_result.offset && result.encoding == reference_result.encoding);
+				CHECK(save_narrow(doc, format_raw, encoding_utf8) == save_narrow(reference, format_raw, encoding_utf8));
+			}
+		}
+	}
+}
+
+TEST(document_load_incremental_convert)
+{
+	const char* files[] =
+	{
+		"tests/data/utftest_utf16_be_bom.xml",
+		"tests/data/utftest_utf16_le_nodecl.xml",
+		"tests/data/utftest_utf32_be_nodecl.xml",
+		"tests/data/utftest_utf32_le_bom.xml",
+		"tests/data/utftest_utf8.xml",
+		"tests/data/utftest_utf8_bom.xml"
+	};
+
+	xml_encoding encodings[] =
+	{
+		encoding_utf16_be, encoding_utf16_le, encoding_utf32_be, encoding_utf32_le, encoding_utf8, encoding_utf8
+	};
+
+	size_t chunks[] = {1, 3, 5, 4096};
+
+	for (unsigned int i = 0; i < sizeof(files) / sizeof(files[0]); ++i)
+	{
+		char* data = 0;
+		size_t size = 0;
+		CHECK(load_file_in_memory(files[i], data, size));
+
+		for (size_t c = 0; c < sizeof(chunks) / sizeof(chunks[0]); ++c)
+		{
+			xml_document doc;
+			xml_parse_result res = load_incremental(doc, data, size, chunks[c]);
+
+			CHECK(res);
+			CHECK(res.encoding == encodings[i]);
+			check_utftest_document(doc);
+
+			xml_document explicit_doc;
+			CHECK(load_incremental(explicit_doc, data, size, chunks[c], parse_default, encodings[i]));
+			check_utftest_document(explicit_doc);
+		}
+
+		delete[] data;
+	}
+}
+
+TEST(document_load_incremental_latin1)
+{
+	char* data = 0;
+	size_t size = 0;
+	CHECK(load_file_in_memory("tests/data/latintest_latin1.xml", data, size));
+
+	xml_document reference;
+	CHECK(reference.load_buffer(data, size));
+
+	xml_document doc;
+	CHECK(load_incremental(doc, data, size, 3));
+	CHECK(save_narrow(doc, format_raw, encoding_utf8) == save_narrow(reference, format_raw, encoding_utf8));
+
+	delete[] data;
+}
+
+TEST(document_load_incremental_error)
+{
+	const char* files[] =
+	{
+		"", "abc", "<", "<a", "<a>", "<a></b>", "<a b='1></a>", "<a><!-- </a>", "<a><![CDATA[ </a>", "<a><?pi </a>", "<!DOCTYPE a [ <a/>",
+		"<a/><b", "<a/>&amp;<", "<a><!x></a>", "<a></a  x>", "<a>< b/></a>", "<?xml version='1?>'?>", "<a/>\r"
+	};
+
+	unsigned int flags[] = {parse_default, parse_full, parse_fragment};
+
+	size_t chunks[] = {1, 2, 5, 4096};
+
+	for (size_t i = 0; i < sizeof(files) / sizeof(files[0]); ++i)
+		for (size_t f = 0; f < sizeof(flags) / sizeof(flags[0]); ++f)
+		{
+			xml_document reference;
+			xml_parse_result reference_result = reference.load_buffer(files[i], strlen(files[i]), flags[f]);
+
+			for (size_t c = 0; c < sizeof(chunks) / sizeof(chunks[0]); ++c)
+			{
+				xml_document doc;
+				xml_parse_result result = load_incremental(doc, files[i], strlen(files[i]), chunks[c], flags[f]);
+
+				CHECK(result.status == reference_result.status && result.offset == reference_result.offset);
+			}
+		}
+}
+
+TEST(document_load_incremental_state)
+{
+	xml_document doc;
+	xml_incremental_parser parser(doc);
+
+	// complete nodes are available before the end of the document
+	CHECK(parser.feed("<root><a>text</a><b at", 22));
+	CHECK_STRING(doc.child(STR("root")).child_value(STR("a")), STR("text"));
+	CHECK(!doc.child(STR("root")).child(STR("b")));
+
+	CHECK(parser.feed("tr='v'/></root>", 15));
+	CHECK_STRING(doc.child(STR("root")).child(STR("b")).attribute(STR("attr")).value(), STR("v"));
+
+	// errors are sticky
+	CHECK(parser.feed("<x></y>", 7).status == status_end_element_mismatch);
+	CHECK(parser.feed("<z/>", 4).status == status_end_element_mismatch);
+	CHECK(parser.finish().status == status_end_element_mismatch);
+	CHECK(parser.finish().status == status_end_element_mismatch);
+}
+
+TEST(document_load_incremental_out_of_memory)
+{
+	test_runner::_memory_fail_threshold = 1;
+
+	xml_document doc;
+	xml_incremental_parser parser(doc);
+
+	CHECK(parser.feed("<node/>", 7).status == status_out_of_memory);
+	CHECK(parser.finish().status == status_out_of_memory);
+}
+
+TEST(document_value_cache)
+{
+	xml_document doc;
+	CHECK(!doc.value_cache());
+
+	doc.set_value_cache(true);
+	CHECK(doc.value_cache());
+
+	CHECK(doc.load(STR("<node a='12' b='1.5' c='x'>34</node>")));
+
+	xml_node node = doc.child(STR("node"));
+	xml_attribute a = node.attribute(STR("a"));
+
+	bool ok = false;
+
+	for (int i = 0; i < 3; ++i)
+	{
+		CHECK(a.as_int() == 12);
+		CHECK(a.as_double() == 12);
+		CHECK(node.attribute(STR("b")).as_float() == 1.5f);
+		CHECK(node.attribute(STR("c")).as_int(7, &ok) == 7 && !ok);
+		CHECK(node.text().as_uint(7, &ok) == 34 && ok);
+	}
+
+	// values of the same length are overwritten in place
+	CHECK(a.set_value(STR("56")));
+	CHECK(a.as_int() == 56);
+	CHECK(a.as_double() == 56);
+
+	CHECK(a.set_value(-78));
+	CHECK(a.as_int() == -78);
+
+	CHECK(node.text().set(STR("9")));
+	CHECK(node.text().as_uint() == 9);
+
+	CHECK(node.text().set(2.5));
+	CHECK(node.text().as_double() == 2.5);
+	CHECK(node.text().as_uint(7, &ok) == 7 && !ok);
+
+	CHECK(node.remove_attribute(a));
+	CHECK(node.append_attribute(STR("d")).set_value(STR("123456")));
+	CHECK(node.attribute(STR("d")).as_int() == 123456);
+
+	// the setting is kept when the document is reset
+	doc.reset();
+	CHECK(doc.value_cache());
+
+	CHECK(doc.load(STR("<node a='90'/>")));
+	CHECK(doc.child(STR("node")).attribute(STR("a")).as_int() == 90);
+
+	doc.set_value_cache(false);
+	CHECK(!doc.value_cache());
+	CHECK(doc.child(STR("node")).attribute(STR("a")).as_int() == 90);
+}
+
+TEST(document_value_cache_many)
+{
+	xml_document doc;
+	doc.set_value_cache(true);
+
+	xml_node node = doc.append_child(STR("node"));
+
+	for (int i = 0; i < 1000; ++i)
+		node.append_child(STR("value")).text().set(i);
+
+	for (int pass = 0; pass < 2; ++pass)
+	{
+		int i = 0;
+
+		for (xml_node child = node.first_child(); child; child = child.next_sibling(), ++i)
+			CHECK(child.text().as_int() == i && child.text().as_double() == i);
+	}
+
+	CHECK(node.append_buffer("<value>1000</value>", 19));
+	CHECK(node.last_child().text().as_int() == 1000);
+}
+
+TEST(document_value_cache_out_of_memory)
+{
+	xml_document doc;
+	CHECK(doc.load(STR("<node a='12'/>")));
+
+	test_runner::_memory_fail_threshold = 1;
+
+	doc.set_value_cache(true);
+
+	// conversions work without the cache
+	CHECK(doc.child(STR("node")).attribute(STR("a")).as_int() == 12);
+	CHECK(doc.child(STR("node")).attribute(STR("a")).as_int() == 12);
+}
+
+TEST(document_memory_page_size)
+{
+	xml_document doc;
+	CHECK(doc.initial_memory_page_size() == doc.maximum_memory_page_size());
+
+	size_t default_size = doc.initial_memory_page_size();
+
+	doc.set_memory_page_size(1024, 65536);
+	CHECK(doc.initial_memory_page_size() == 1024 && doc.maximum_memory_page_size() == 65536);
+
+	// the maximum size is at least the initial size; 0 selects the default size
+	doc.set_memory_page_size(4096, 2048);
+	CHECK(doc.initial_memory_page_size() == 4096 && doc.maximum_memory_page_size() == 4096);
+
+	doc.set_memory_page_size(0, 0);
+	CHECK(doc.initial_memory_page_size() == default_size && doc.maximum_memory_page_size() == default_size);
+
+	// small pages hold large strings and many nodes
+	doc.set_memory_page_size(1, 8192);
+
+	std::basic_string<pugi::char_t> text(1000, STR('x'));
+
+	xml_node root = doc.append_child(STR("root"));
+
+	for (int i = 0; i < 1000; ++i)
+	{
+		xml_node node = root.append_child(STR("node"));
+		CHECK(node.append_attribute(STR("id")).set_value(i));
+		CHECK(node.text().set(text.substr(0, i).c_str()));
+	}
+
+	int count = 0;
+
+	for (xml_node node = root.first_child(); node; node = node.next_sibling(), ++count)
+		CHECK(node.attribute(STR("id")).as_int() == count && node.text().get() == text.substr(0, count));
+
+	CHECK(count == 1000);
+
+	while (root.first_child()) CHECK(root.remove_child(root.first_child()));
+
+	// the settings are kept when the document is reset
+	doc.reset();
+	CHECK(doc.maximum_memory_page_size() == 8192);
+
+	CHECK(doc.load(STR("<node a='1'>text</node>")));
+	CHECK_NODE(doc, STR("<node a=\"1\">text</node>"));
+}
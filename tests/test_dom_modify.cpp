@@ -746,6 +746,35 @@ TEST_XML_FLAGS(dom_node_copy_types, "<?xml version='1.0'?><!DOCTYPE id><root><?p
 	CHECK_NODE(doc, STR("<?xml version=\"1.0\"?><!DOCTYPE id><?xml version=\"1.0\"?><!DOCTYPE id><root><?pi value?><!--comment--><node id=\"1\">pcdata<![CDATA[cdata]]></node></root><root><?pi value?><!--comment--><node id=\"1\">pcdata<![CDATA[cdata]]></node></root>"));
 }
 
+TEST(dom_node_leaf_types)
+{
+	xml_document doc;
+	xml_node node = doc.append_child(STR("node"));
+
+	// leaf nodes are smaller than elements, so they end up next to each other in memory
+	xml_node_type types[] = {node_pcdata, node_cdata, node_comment, node_pi, node_declaration, node_element};
+
+	for (size_t i = 0; i < sizeof(types) / sizeof(types[0]); ++i)
+	{
+		xml_node leaf = (types[i] == node_declaration) ? doc.prepend_child(types[i]) : node.append_child(types[i]);
+		CHECK(leaf.type() == types[i]);
+
+		CHECK(!leaf.first_child() && !leaf.last_child() && !leaf.first_attribute());
+		CHECK((types[i] == node_element) == !!leaf.append_child(node_pcdata));
+		CHECK((types[i] == node_element || types[i] == node_declaration) == !!leaf.append_attribute(STR("a")));
+
+		if (types[i] == node_pi || types[i] == node_element) leaf.set_name(STR("n"));
+		leaf.set_value(STR("v"));
+	}
+
+	CHECK_NODE(doc, STR("<?xml a=\"\"?><node>v<![CDATA[v]]><!--v--><?n v?><n a=\"\"></n></node>"));
+
+	node.remove_child(node.first_child().next_sibling());
+	node.insert_copy_after(node.first_child(), node.first_child().next_sibling());
+
+	CHECK_NODE(doc, STR("<?xml a=\"\"?><node>v<!--v-->v<?n v?><n a=\"\"></n></node>"));
+}
+
 TEST_XML(dom_attr_assign_large_number, "<node attr1='' attr2='' />")
 {
 	xml_node node = doc.child(STR("node"));
@@ -753,8 +782,25 @@ TEST_XML(dom_attr_assign_large_number, "<node attr1='' attr2='' />")
 	node.attribute(STR("attr1")) = std::numeric_limits<float>::max();
 	node.attribute(STR("attr2")) = std::numeric_limits<double>::max();
 
-	CHECK(test_node(node, STR("<node attr1=\"3.40282e+038\" attr2=\"1.79769e+308\" />"), STR(""), pugi::format_raw) ||
-		  test_node(node, STR("<node attr1=\"3.40282e+38\" attr2=\"1.79769e+308\" />"), STR(""), pugi::format_raw));
+	CHECK_NODE(node, STR("<node attr1=\"3.4028235e+38\" attr2=\"1.7976931348623157e+308\" />"));
+}
+
+TEST_XML(dom_attr_set_value_precision, "<node />")
+{
+	xml_node node = doc.child(STR("node"));
+
+	CHECK(node.append_attribute(STR("attr1")).set_value(0.1));
+	CHECK(node.append_attribute(STR("attr2")).set_value(1.0 / 3));
+	CHECK(node.append_attribute(STR("attr3")).set_value(0.1f));
+	CHECK(node.append_attribute(STR("attr4")).set_value(1e-5));
+	CHECK(node.append_attribute(STR("attr5")).set_value(123456789.0));
+	CHECK(node.append_attribute(STR("attr6")).set_value(-1e100));
+	CHECK(node.append_attribute(STR("attr7")).set_value(-0.0));
+	CHECK(node.append_attribute(STR("attr8")).set_value(16777217.0f));
+
+	CHECK_NODE(node, STR("<node attr1=\"0.1\" attr2=\"0.3333333333333333\" attr3=\"0.1\" attr4=\"1e-05\" attr5=\"123456789\" attr6=\"-1e+100\" attr7=\"-0\" attr8=\"16777216\" />"));
+
+	CHECK(node.attribute(STR("attr2")).as_double() == 1.0 / 3);
 }
 
 TEST(dom_node_declaration_name)
@@ -862,6 +908,11 @@ TEST(dom_node_out_of_memory)
 {
 	test_runner::_memory_fail_threshold = 65536;
 
+#ifdef PUGIXML_SEGREGATED_PAGES
+	// nodes, attributes and names are allocated from separate pages
+	test_runner::_memory_fail_threshold += 32768 * 2;
+#endif
+
 	// exhaust memory limit
 	xml_document doc;
 
@@ -1065,7 +1116,13 @@ TEST(dom_node_append_buffer_out_of_memory_extra)
 
 TEST(dom_node_append_buffer_out_of_memory_buffer)
 {
-	test_runner::_memory_fail_threshold = 32768 + 128;
+	// the page for the extra buffer fits, the copy of the data does not
+	test_runner::_memory_fail_threshold = 32768 + 256;
+
+#ifdef PUGIXML_COMPACT
+	// ... and the smallest table for the pointers that don't fit into 32-bit offsets
+	test_runner::_memory_fail_threshold += 32 * 2 * sizeof(void*);
+#endif
 
 	char data[128] = {0};
 
@@ -1295,7 +1352,17 @@ TEST(dom_node_copy_copyless)
 	std::basic_string<char_t> datacopy = data;
 
 	// the document is parsed in-place so there should only be 1 page worth of allocations
-	test_runner::_memory_fail_threshold = 32768 + 128;
+	test_runner::_memory_fail_threshold = 32768 + 256;
+
+#ifdef PUGIXML_COMPACT
+	// ... and the smallest table for the pointers that don't fit into 32-bit offsets
+	test_runner::_memory_fail_threshold += 32 * 2 * sizeof(void*);
+#endif
+
+#ifdef PUGIXML_SEGREGATED_PAGES
+	// ... and one more page for the attributes
+	test_runner::_memory_fail_threshold += 32768 + 256;
+#endif
 
 	xml_document doc;
 	CHECK(doc.load_buffer_inplace(&datacopy[0], datacopy.size() * sizeof(char_t), parse_full));
@@ -115,6 +115,37 @@ TEST_XML(dom_text_as_integer_space, "<node><text1> \t\n1234</text1><text2>\n\t 0
     CHECK(node.child(STR("text4")).text().as_int() == 0);
 }
 
+TEST_XML(dom_text_as_integer_ok, "<node><text1> 42 </text1><text2>-0x10</text2><text3>12abc</text3><text4></text4><text5>-</text5><text6>2147483648</text6><text7>-2147483649</text7><text8>0x100000000</text8></node>")
+{
+	xml_node node = doc.child(STR("node"));
+
+	bool ok = false;
+
+	CHECK(xml_text().as_int(5, &ok) == 5 && !ok);
+	CHECK(node.child(STR("text1")).text().as_int(5, &ok) == 42 && ok);
+	CHECK(node.child(STR("text2")).text().as_int(5, &ok) == -16 && ok);
+	CHECK(node.child(STR("text3")).text().as_int(5, &ok) == 5 && !ok);
+	CHECK(node.child(STR("text4")).text().as_int(5, &ok) == 5 && !ok);
+	CHECK(node.child(STR("text5")).text().as_int(5, &ok) == 5 && !ok);
+	CHECK(node.child(STR("text6")).text().as_int(5, &ok) == 5 && !ok);
+	CHECK(node.child(STR("text7")).text().as_int(5, &ok) == 5 && !ok);
+	CHECK(node.child(STR("text8")).text().as_uint(5, &ok) == 5 && !ok);
+	CHECK(node.child(STR("text2")).text().as_uint(5, &ok) == 5 && !ok);
+	CHECK(node.child(STR("text1")).text().as_uint(5, &ok) == 42 && ok);
+}
+
+TEST_XML(dom_text_as_integer_overflow, "<node><text1>2147483648</text1><text2>-2147483649</text2><text3>99999999999999999999</text3><text4>-1</text4><text5>0x123456789</text5></node>")
+{
+	xml_node node = doc.child(STR("node"));
+
+	CHECK(node.child(STR("text1")).text().as_int() == 2147483647);
+	CHECK(node.child(STR("text2")).text().as_int() == -2147483647 - 1);
+	CHECK(node.child(STR("text3")).text().as_int() == 2147483647);
+	CHECK(node.child(STR("text3")).text().as_uint() == 4294967295u);
+	CHECK(node.child(STR("text4")).text().as_uint() == 0);
+	CHECK(node.child(STR("text5")).text().as_uint() == 4294967295u);
+}
+
 TEST_XML(dom_text_as_float, "<node><text1>0</text1><text2>1</text2><text3>0.12</text3><text4>-5.1</text4><text5>3e-4</text5><text6>3.14159265358979323846</text6></node>")
 {
 	xml_node node = doc.child(STR("node"));
@@ -141,6 +172,42 @@ TEST_XML(dom_text_as_double, "<node><text1>0</text1><text2>1</text2><text3>0.12<
 	CHECK_DOUBLE(node.child(STR("text6")).text().as_double(), 3.14159265358979323846);
 }
 
+TEST_XML(dom_text_as_double_ok, "<node><text1> -1.5e3 </text1><text2>.5</text2><text3>1.5x</text3><text4>.</text4><text5>1e400</text5><text6>1e-400</text6><text7>inf</text7><text8>1e39</text8></node>")
+{
+	xml_node node = doc.child(STR("node"));
+
+	bool ok = false;
+
+	CHECK(xml_text().as_double(5, &ok) == 5 && !ok);
+	CHECK(node.child(STR("text1")).text().as_double(5, &ok) == -1500 && ok);
+	CHECK(node.child(STR("text2")).text().as_double(5, &ok) == 0.5 && ok);
+	CHECK(node.child(STR("text3")).text().as_double(5, &ok) == 5 && !ok);
+	CHECK(node.child(STR("text3")).text().as_double() == 1.5);
+	CHECK(node.child(STR("text4")).text().as_double(5, &ok) == 5 && !ok);
+	CHECK(node.child(STR("text5")).text().as_double(5, &ok) == 5 && !ok);
+	CHECK(node.child(STR("text6")).text().as_double(5, &ok) == 0 && ok);
+	CHECK(node.child(STR("text8")).text().as_double(5, &ok) == 1e39 && ok);
+	CHECK(node.child(STR("text8")).text().as_float(5, &ok) == 5 && !ok);
+	CHECK(node.child(STR("text1")).text().as_float(5, &ok) == -1500 && ok);
+
+	double inf = node.child(STR("text7")).text().as_double(5, &ok);
+	CHECK(ok && inf > 0 && inf * 0.5 == inf);
+}
+
+TEST_XML(dom_text_as_double_exact, "<node><text1>0.1</text1><text2>123456789012345</text2><text3>1234567890123456789</text3><text4>9007199254740993</text4><text5>1e23</text5><text6>2.2250738585072014e-308</text6><text7>-0.000000000000000000000000000001</text7><text8>12345e30</text8></node>")
+{
+	xml_node node = doc.child(STR("node"));
+
+	CHECK(node.child(STR("text1")).text().as_double() == 0.1);
+	CHECK(node.child(STR("text2")).text().as_double() == 123456789012345.0);
+	CHECK(node.child(STR("text3")).text().as_double() == 1234567890123456789.0);
+	CHECK(node.child(STR("text4")).text().as_double() == 9007199254740992.0);
+	CHECK(node.child(STR("text5")).text().as_double() == 1e23);
+	CHECK(node.child(STR("text6")).text().as_double() == 2.2250738585072014e-308);
+	CHECK(node.child(STR("text7")).text().as_double() == -1e-30);
+	CHECK(node.child(STR("text8")).text().as_double() == 12345e30);
+}
+
 TEST_XML(dom_text_as_bool, "<node><text1>0</text1><text2>1</text2><text3>true</text3><text4>True</text4><text5>Yes</text5><text6>yes</text6><text7>false</text7></node>")
 {
 	xml_node node = doc.child(STR("node"));
@@ -357,6 +424,24 @@ TEST_XML_FLAGS(dom_text_data, "<node><a>foo</a><b><![CDATA[bar]]></b><c><?pi val
     CHECK(!xml_text().data());
 }
 
+TEST_XML_FLAGS(dom_text_embed_pcdata, "<node><a>foo</a><b>bar<c/></b><d/></node>", parse_default | parse_embed_pcdata)
+{
+    xml_node node = doc.child(STR("node"));
+
+    // the text stored in the element is used before the child nodes
+    xml_text a = node.child(STR("a")).text();
+    CHECK(a.data() == node.child(STR("a")));
+    CHECK_STRING(a.get(), STR("foo"));
+
+    CHECK(a.set(42));
+    CHECK(a.as_int() == 42);
+
+    CHECK_STRING(node.child(STR("b")).text().get(), STR("bar"));
+    CHECK(node.child(STR("d")).text().set(STR("baz")));
+
+    CHECK_NODE(node, STR("<node><a>42</a><b>bar<c /></b><d>baz</d></node>"));
+}
+
 TEST(dom_text_defaults)
 {
     xml_text text;
@@ -165,6 +165,28 @@ TEST_XML(dom_attr_as_double, "<node attr1='0' attr2='1' attr3='0.12' attr4='-5.1
 	CHECK_DOUBLE(node.attribute(STR("attr6")).as_double(), 3.14159265358979323846);
 }
 
+TEST_XML(dom_attr_as_number_ok, "<node attr1='-12' attr2='0.25' attr3='abc' attr4='9223372036854775808'/>")
+{
+	xml_node node = doc.child(STR("node"));
+
+	bool ok = false;
+
+	CHECK(xml_attribute().as_int(7, &ok) == 7 && !ok);
+	CHECK(node.attribute(STR("attr1")).as_int(7, &ok) == -12 && ok);
+	CHECK(node.attribute(STR("attr1")).as_uint(7, &ok) == 7 && !ok);
+	CHECK(node.attribute(STR("attr2")).as_double(7, &ok) == 0.25 && ok);
+	CHECK(node.attribute(STR("attr2")).as_float(7, &ok) == 0.25f && ok);
+	CHECK(node.attribute(STR("attr2")).as_int(7, &ok) == 7 && !ok);
+	CHECK(node.attribute(STR("attr3")).as_double(7, &ok) == 7 && !ok);
+
+#ifdef PUGIXML_HAS_LONG_LONG
+	CHECK(node.attribute(STR("attr4")).as_llong(7, &ok) == 7 && !ok);
+	CHECK(node.attribute(STR("attr4")).as_llong() == 9223372036854775807ll);
+	CHECK(node.attribute(STR("attr4")).as_ullong(7, &ok) == 9223372036854775808ull && ok);
+	CHECK(node.attribute(STR("attr1")).as_llong(7, &ok) == -12 && ok);
+#endif
+}
+
 TEST_XML(dom_attr_as_bool, "<node attr1='0' attr2='1' attr3='true' attr4='True' attr5='Yes' attr6='yes' attr7='false'/>")
 {
 	xml_node node = doc.child(STR("node"));
@@ -8,10 +8,12 @@ namespace
 {
 	int allocate_count = 0;
 	int deallocate_count = 0;
+	size_t allocate_size = 0;
 
 	void* allocate(size_t size)
 	{
 		++allocate_count;
+		allocate_size += size;
 		return new char[size];
 	}
 
@@ -20,6 +22,42 @@ namespace
 		++deallocate_count;
 		delete[] reinterpret_cast<char*>(ptr);
 	}
+
+	struct counting_resource: xml_memory_resource
+	{
+		int allocate_count;
+		int deallocate_count;
+
+		counting_resource(): allocate_count(0), deallocate_count(0)
+		{
+		}
+
+		virtual void* allocate(size_t size)
+		{
+			++allocate_count;
+			return new char[size];
+		}
+
+		virtual void deallocate(void* ptr)
+		{
+			++deallocate_count;
+			delete[] static_cast<char*>(ptr);
+		}
+	};
+
+	// compact documents also allocate a table for the pointers that don't fit into 32-bit offsets
+#ifdef PUGIXML_COMPACT
+	const int table_count = 1;
+#else
+	const int table_count = 0;
+#endif
+
+	// segregated documents allocate strings from separate pages
+#ifdef PUGIXML_SEGREGATED_PAGES
+	const int string_page_count = 1;
+#else
+	const int string_page_count = 0;
+#endif
 }
 
 TEST(memory_custom_memory_management)
@@ -41,26 +79,26 @@ TEST(memory_custom_memory_management)
 
 		CHECK(doc.load(STR("<node />")));
 	
-		CHECK(allocate_count == 2 && deallocate_count == 0);
+		CHECK(allocate_count == 2 + table_count && deallocate_count == 0);
 
 		// modify document (no new page)
 		CHECK(doc.first_child().set_name(STR("foobars")));
-		CHECK(allocate_count == 2 && deallocate_count == 0);
+		CHECK(allocate_count == 2 + table_count + string_page_count && deallocate_count == 0);
 
 		// modify document (new page)
 		std::basic_string<pugi::char_t> s(65536, 'x');
 
 		CHECK(doc.first_child().set_name(s.c_str()));
-		CHECK(allocate_count == 3 && deallocate_count == 0);
+		CHECK(allocate_count == 3 + table_count + string_page_count && deallocate_count == 0);
 
 		// modify document (new page, old one should die)
 		s += s;
 
 		CHECK(doc.first_child().set_name(s.c_str()));
-		CHECK(allocate_count == 4 && deallocate_count == 1);
+		CHECK(allocate_count == 4 + table_count + string_page_count && deallocate_count == 1);
 	}
 
-	CHECK(allocate_count == 4 && deallocate_count == 4);
+	CHECK(allocate_count == 4 + table_count + string_page_count && deallocate_count == 4 + table_count + string_page_count);
 
 	// restore old functions
 	set_memory_management_functions(old_allocate, old_deallocate);
@@ -90,7 +128,8 @@ TEST(memory_large_allocations)
 			CHECK(doc.append_child(node_pcdata).set_value(s.c_str()));
 		}
 
-		CHECK(allocate_count > 0 && deallocate_count == 0);
+		// the table of compact documents may be reallocated as it grows
+		CHECK(allocate_count > 0 && (deallocate_count == 0 || table_count));
 
 		// grow-prune loop
 		while (doc.first_child())
@@ -116,7 +155,7 @@ TEST(memory_large_allocations)
 			}
 		}
 
-		CHECK(allocate_count == deallocate_count + 1); // only one live page left (it waits for new allocations)
+		CHECK(allocate_count == deallocate_count + 1 + table_count + string_page_count); // only one live page left (it waits for new allocations)
 
 		char buffer;
 		CHECK(doc.load_buffer_inplace(&buffer, 0, parse_fragment, get_native_encoding()));
@@ -130,6 +169,252 @@ TEST(memory_large_allocations)
 	set_memory_management_functions(old_allocate, old_deallocate);
 }
 
+TEST(memory_free_list_reuse)
+{
+	allocate_count = deallocate_count = 0;
+
+	// remember old functions
+	allocation_function old_allocate = get_memory_allocation_function();
+	deallocation_function old_deallocate = get_memory_deallocation_function();
+
+	// replace functions
+	set_memory_management_functions(allocate, deallocate);
+
+	{
+		xml_document doc;
+		xml_node root = doc.append_child(STR("root"));
+
+		// the first iteration allocates the memory that the next ones reuse
+		int count = -1;
+
+		for (int i = 0; i < 10000; ++i)
+		{
+			xml_node node = root.append_child(STR("node"));
+
+			CHECK(node.append_attribute(STR("id")).set_value(i));
+			CHECK(node.text().set(STR("text")));
+			CHECK(root.remove_child(node));
+
+			if (count < 0) count = allocate_count;
+		}
+
+		// the nodes are removed while the root keeps the page alive, so the freed blocks have to be reused
+		CHECK(allocate_count == count);
+	}
+
+	CHECK(allocate_count == deallocate_count);
+
+	// restore old functions
+	set_memory_management_functions(old_allocate, old_deallocate);
+}
+
+TEST(memory_page_size_growth)
+{
+	// remember old functions
+	allocation_function old_allocate = get_memory_allocation_function();
+	deallocation_function old_deallocate = get_memory_deallocation_function();
+
+	// replace functions
+	set_memory_management_functions(allocate, deallocate);
+
+	int counts[2];
+
+	for (int pass = 0; pass < 2; ++pass)
+	{
+		allocate_count = deallocate_count = 0;
+		allocate_size = 0;
+
+		{
+			xml_document doc;
+			if (pass == 1) doc.set_memory_page_size(1024, 256 * 1024);
+
+			xml_node root = doc.append_child(STR("root"));
+
+			// tiny documents only take a small page
+			CHECK(pass == 0 || allocate_size < 4096);
+
+			for (int i = 0; i < 50000; ++i) root.append_child(STR("node"));
+
+			counts[pass] = allocate_count;
+		}
+
+		CHECK(allocate_count == deallocate_count);
+	}
+
+	// growing pages need fewer allocations for large documents
+	CHECK(counts[1] * 3 < counts[0]);
+
+	// restore old functions
+	set_memory_management_functions(old_allocate, old_deallocate);
+}
+
+TEST(memory_page_size_load_hint)
+{
+	std::basic_string<pugi::char_t> data = STR("<root>");
+	for (int i = 0; i < 1000; ++i) data += STR("<node>") + std::basic_string<pugi::char_t>(250, STR('x')) + STR("</node>");
+	data += STR("</root>");
+
+	// remember old functions
+	allocation_function old_allocate = get_memory_allocation_function();
+	deallocation_function old_deallocate = get_memory_deallocation_function();
+
+	// replace functions
+	set_memory_management_functions(allocate, deallocate);
+
+	allocate_count = deallocate_count = 0;
+
+	{
+		xml_document doc;
+		doc.set_memory_page_size(1024, 256 * 1024);
+
+		// the first page is sized from the input length, so the tree fits into one page next to the copy of the buffer
+		CHECK(doc.load_buffer(data.c_str(), data.size() * sizeof(pugi::char_t)));
+		CHECK(allocate_count == 2 + table_count);
+	}
+
+	CHECK(allocate_count == deallocate_count);
+
+	// restore old functions
+	set_memory_management_functions(old_allocate, old_deallocate);
+}
+
+TEST(memory_resource)
+{
+	allocate_count = deallocate_count = 0;
+
+	// remember old functions
+	allocation_function old_allocate = get_memory_allocation_function();
+	deallocation_function old_deallocate = get_memory_deallocation_function();
+
+	// replace functions
+	set_memory_management_functions(allocate, deallocate);
+
+	counting_resource resource;
+
+	{
+		xml_document doc(&resource);
+		CHECK(doc.memory_resource() == &resource);
+
+		doc.set_value_cache(true);
+
+		CHECK(doc.load(STR("<node a='1'><child>text</child></node>"), parse_default | parse_intern_names));
+		CHECK(doc.child(STR("node")).append_buffer("<child a='2'/>", 14));
+
+		for (int i = 0; i < 1000; ++i)
+			CHECK(doc.child(STR("node")).append_child(STR("child")).append_attribute(STR("a")).set_value(i));
+
+		CHECK(doc.child(STR("node")).attribute(STR("a")).as_int() == 1);
+
+	#ifndef PUGIXML_NO_XPATH
+		xpath_query q(STR("node/child[@a > 500]"), 0, &resource);
+		CHECK(q.memory_resource() == &resource);
+
+		xpath_node_set ns = q.evaluate_node_set(doc);
+		CHECK(ns.size() == 499 && ns.memory_resource() == &resource);
+
+		xpath_node_set copy = ns;
+		CHECK(copy.size() == 499 && copy.memory_resource() == &resource);
+	#endif
+
+		// the resource is kept when the document is reset
+		doc.reset();
+		CHECK(doc.memory_resource() == &resource);
+		CHECK(doc.load(STR("<node/>")));
+	}
+
+	// all memory comes from the resource
+	CHECK(resource.allocate_count > 0 && resource.allocate_count == resource.deallocate_count);
+	CHECK(allocate_count == 0 && deallocate_count == 0);
+
+	// restore old functions
+	set_memory_management_functions(old_allocate, old_deallocate);
+}
+
+TEST(memory_resource_out_of_memory)
+{
+	struct failing_resource: xml_memory_resource
+	{
+		virtual void* allocate(size_t)
+		{
+			return 0;
+		}
+
+		virtual void deallocate(void*)
+		{
+		}
+	};
+
+	failing_resource resource;
+
+	xml_document doc(&resource);
+	CHECK(doc.load(STR("<node/>")).status == status_out_of_memory);
+	CHECK(!doc.append_child(STR("node")));
+}
+
+TEST(memory_fixed_buffer)
+{
+	allocate_count = deallocate_count = 0;
+
+	// remember old functions
+	allocation_function old_allocate = get_memory_allocation_function();
+	deallocation_function old_deallocate = get_memory_deallocation_function();
+
+	// replace functions
+	set_memory_management_functions(allocate, deallocate);
+
+	static char memory[65536];
+
+	{
+		xml_document doc(memory, sizeof(memory));
+		CHECK(doc.memory_resource() != 0);
+
+		// the block is reused every time the document is loaded
+		for (int i = 0; i < 10; ++i)
+		{
+			CHECK(doc.load(STR("<node a='1'><child>text</child></node>")));
+			CHECK_NODE(doc, STR("<node a=\"1\"><child>text</child></node>"));
+
+			for (int j = 0; j < 100; ++j)
+				CHECK(doc.child(STR("node")).append_child(STR("child")).append_attribute(STR("a")).set_value(j));
+		}
+
+		// the node set of the query with the document resource also comes from the block
+	#ifndef PUGIXML_NO_XPATH
+		xpath_query q(STR("node/child[@a]"), 0, doc.memory_resource());
+		CHECK(q.evaluate_node_set(doc).size() == 100);
+	#endif
+	}
+
+	CHECK(allocate_count == 0 && deallocate_count == 0);
+
+	// restore old functions
+	set_memory_management_functions(old_allocate, old_deallocate);
+}
+
+TEST(memory_fixed_buffer_out_of_memory)
+{
+	char memory[4096];
+
+	xml_document doc(memory, sizeof(memory));
+
+	// fill the block with nodes until the allocation fails
+	xml_node node = doc.append_child(STR("node"));
+	CHECK(node);
+
+	int count = 0;
+	while (node.append_child(STR("child"))) ++count;
+
+	CHECK(count > 10 && count < 1000);
+
+	// the memory is available again after the document is reloaded
+	CHECK(doc.load(STR("<node><child/></node>")));
+	CHECK_NODE(doc, STR("<node><child /></node>"));
+
+	xml_document empty(0, 0);
+	CHECK(empty.load(STR("<node/>")).status == status_out_of_memory);
+	CHECK(!empty.append_child(STR("node")));
+}
+
 TEST(memory_string_allocate_increasing)
 {
 	xml_document doc;
@@ -918,6 +918,11 @@ TEST(parse_out_of_memory_halfway_attr)
 
 	test_runner::_memory_fail_threshold = 65536;
 
+#ifdef PUGIXML_SEGREGATED_PAGES
+	// attributes are allocated from a separate page
+	test_runner::_memory_fail_threshold += 32768;
+#endif
+
 	xml_document doc;
 	CHECK(doc.load_buffer_inplace(text, count * 5 + 4).status == status_out_of_memory);
 	CHECK_STRING(doc.first_child().name(), STR("n"));
@@ -1090,3 +1095,564 @@ TEST(parse_close_tag_eof)
 	CHECK(doc.load_buffer_inplace(test2, 12 * sizeof(char_t)).status == status_end_element_mismatch);
 	CHECK_STRING(doc.first_child().name(), STR("node"));
 }
+
+TEST(parse_pcdata_long_offsets)
+{
+	for (size_t offset = 0; offset < 70; ++offset)
+	{
+		char_t data[128] = STR("<n>");
+		char_t expected[128] = {};
+
+		size_t pos = 3;
+		for (size_t i = 0; i < offset; ++i) data[pos++] = expected[i] = static_cast<char_t>('a' + i % 26);
+
+		const char_t* tail = STR("&amp;b\r\nc</n>");
+		for (size_t j = 0; tail[j]; ++j) data[pos++] = tail[j];
+
+		const char_t* expected_tail = STR("&b\nc");
+		for (size_t k = 0; expected_tail[k]; ++k) expected[offset + k] = expected_tail[k];
+
+		xml_document doc;
+		CHECK(doc.load_buffer(data, pos * sizeof(char_t), parse_default | parse_eol | parse_escapes, get_native_encoding()));
+		CHECK_STRING(doc.child_value(STR("n")), expected);
+	}
+}
+
+TEST(parse_attribute_long_offsets)
+{
+	const unsigned int options[] = {parse_minimal, parse_eol, parse_escapes, parse_wconv_attribute, parse_wnorm_attribute};
+
+	for (size_t option = 0; option < sizeof(options) / sizeof(options[0]); ++option)
+	{
+		for (size_t offset = 0; offset < 70; ++offset)
+		{
+			char_t data[128] = STR("<n a='");
+			size_t pos = 6;
+			for (size_t i = 0; i < offset; ++i) data[pos++] = static_cast<char_t>('a' + i % 26);
+
+			const char_t* tail = STR("\"b'/>");
+			for (size_t j = 0; tail[j]; ++j) data[pos++] = tail[j];
+
+			xml_document doc;
+			CHECK(doc.load_buffer(data, pos * sizeof(char_t), options[option], get_native_encoding()));
+
+			const char_t* value = doc.child(STR("n")).attribute(STR("a")).value();
+
+			size_t length = 0;
+			while (value[length]) ++length;
+
+			CHECK(length == offset + 2 && value[offset] == '"' && value[offset + 1] == 'b');
+		}
+	}
+}
+
+static std::basic_string<char_t> make_parallel_test_document()
+{
+	std::basic_string<char_t> result = STR("<?xml version='1.0'?><!-- header --><root a='1'>");
+
+	for (int i = 0; i < 4000; ++i)
+	{
+		result += STR("<item id='item' v=\"a&gt;b\">text &amp; more<![CDATA[<x>]]><!-- c --><?pi v?><sub/>\r\n</item>");
+		result += (i % 3 == 0) ? STR("\n  ") : (i % 3 == 1) ? STR("tail text") : STR("");
+	}
+
+	result += STR("</root><!-- footer -->");
+
+	return result;
+}
+
+TEST(parse_parallel_equal)
+{
+	std::basic_string<char_t> data = make_parallel_test_document();
+
+	unsigned int options[] = {parse_minimal, parse_default, parse_full, parse_full | parse_ws_pcdata, parse_default | parse_trim_pcdata, parse_default | parse_lazy_decode};
+
+	for (size_t i = 0; i < sizeof(options) / sizeof(options[0]); ++i)
+	{
+		xml_document serial;
+		CHECK(serial.load(data.c_str(), options[i]));
+
+		xml_document parallel;
+		CHECK(parallel.load(data.c_str(), options[i] | parse_parallel));
+
+		CHECK(save_narrow(serial, format_raw, encoding_utf8) == save_narrow(parallel, format_raw, encoding_utf8));
+
+		xml_node root = parallel.child(STR("root"));
+
+		for (xml_node child = root.first_child(); child; child = child.next_sibling())
+			CHECK(child.parent() == root && (child == root.first_child() || child.previous_sibling().next_sibling() == child));
+	}
+}
+
+TEST(parse_parallel_error)
+{
+	std::basic_string<char_t> data = make_parallel_test_document();
+
+	size_t positions[] = {data.size() / 5, data.size() / 2, data.size() - 200, data.find(STR("</root>"))};
+
+	for (size_t i = 0; i < sizeof(positions) / sizeof(positions[0]); ++i)
+	{
+		// break the name of the closing tag
+		std::basic_string<char_t> copy = data;
+		size_t pos = copy.find(STR("</"), positions[i]);
+		copy[pos + 2] = 'x';
+
+		xml_document serial;
+		xml_parse_result serial_result = serial.load(copy.c_str());
+
+		xml_document parallel;
+		xml_parse_result parallel_result = parallel.load(copy.c_str(), parse_default | parse_parallel);
+
+		CHECK(serial_result.status == status_end_element_mismatch);
+		CHECK(parallel_result.status == serial_result.status && parallel_result.offset == serial_result.offset);
+	}
+}
+
+TEST(parse_parallel_out_of_memory)
+{
+	std::basic_string<char_t> data = make_parallel_test_document();
+
+	test_runner::_memory_fail_threshold = 65536;
+
+	xml_document doc;
+	CHECK(doc.load_buffer_inplace(&data[0], data.size() * sizeof(char_t), parse_default | parse_parallel).status == status_out_of_memory);
+}
+
+TEST(parse_lazy_decode_equal)
+{
+	const char_t* data = STR("<node a='  x &amp;\r\n\ty  ' b=\"&#x20;&lt;\" c='plain'>  text &amp; more\r\ntext &#32; <child>&lt;&gt;</child>\r<![CDATA[&amp;]]>\t&quot;  </node>");
+
+	unsigned int options[] =
+	{
+		parse_minimal, parse_escapes, parse_eol, parse_default, parse_full, parse_default | parse_trim_pcdata, parse_default | parse_ws_pcdata,
+		parse_eol | parse_wnorm_attribute, parse_escapes | parse_wconv_attribute | parse_wnorm_attribute | parse_trim_pcdata
+	};
+
+	for (size_t i = 0; i < sizeof(options) / sizeof(options[0]); ++i)
+	{
+		xml_document doc;
+		CHECK(doc.load(data, options[i]));
+
+		xml_document lazy;
+		CHECK(lazy.load(data, options[i] | parse_lazy_decode));
+
+		CHECK(save_narrow(lazy, format_raw, encoding_utf8) == save_narrow(doc, format_raw, encoding_utf8));
+	}
+}
+
+TEST(parse_lazy_decode_inplace)
+{
+	char_t buffer[] = STR("<node attr='&lt;'/>");
+
+	xml_document doc;
+	CHECK(doc.load_buffer_inplace(buffer, sizeof(buffer), parse_default | parse_lazy_decode));
+
+	// the value is converted on first access
+	CHECK_STRING(buffer + 12, STR("&lt;"));
+	CHECK_STRING(doc.child(STR("node")).attribute(STR("attr")).value(), STR("<"));
+	CHECK_STRING(buffer + 12, STR("<"));
+}
+
+TEST(parse_lazy_decode_access)
+{
+	xml_document doc;
+	CHECK(doc.load(STR("<node attr='&#49;&#50;' other='&amp;' text='&lt;'>&#x31;5<child>&amp;</child></node>"), parse_default | parse_lazy_decode));
+
+	xml_node node = doc.child(STR("node"));
+
+	CHECK(node.attribute(STR("attr")).as_int() == 12);
+	CHECK(node.text().as_int() == 15);
+	CHECK_STRING(node.child_value(STR("child")), STR("&"));
+	CHECK(doc.find_child_by_attribute(STR("node"), STR("text"), STR("<")) == node);
+
+	// assigned values are not converted
+	CHECK(node.attribute(STR("other")).set_value(STR("&amp;")));
+	CHECK_STRING(node.attribute(STR("other")).value(), STR("&amp;"));
+
+	CHECK(node.child(STR("child")).first_child().set_value(STR("&lt;")));
+	CHECK_STRING(node.child_value(STR("child")), STR("&lt;"));
+
+	// copies are converted
+	xml_document copy;
+	CHECK(copy.load(STR("<copy a='&amp;'/>"), parse_minimal | parse_lazy_decode));
+	copy.append_copy(node);
+
+	CHECK_NODE(copy, STR("<copy a=\"&amp;amp;\" /><node attr=\"12\" other=\"&amp;amp;\" text=\"&lt;\">15<child>&amp;lt;</child></node>"));
+}
+
+TEST(parse_lazy_decode_mixed_options)
+{
+	xml_document doc;
+	CHECK(doc.load(STR("<node attr='&amp;'>&lt;</node>"), parse_default | parse_lazy_decode));
+
+	// the document already has values that are converted with other options, so this buffer is converted right away
+	CHECK(doc.child(STR("node")).append_buffer("<child attr='&amp;'>&lt;</child>", 32, parse_minimal | parse_lazy_decode));
+
+	CHECK_NODE(doc, STR("<node attr=\"&amp;\">&lt;<child attr=\"&amp;amp;\">&amp;lt;</child></node>"));
+}
+
+TEST(parse_lazy_subtrees_equal)
+{
+	std::basic_string<char_t> data = make_parallel_test_document();
+	data += STR("<node a='/>' b=\"</node>\"><!-- <node> --><![CDATA[</node>]]><?pi <node>?><child/><child>text<x y='>'/></child></node>");
+
+	unsigned int options[] = {parse_minimal, parse_default, parse_full | parse_fragment, parse_full | parse_ws_pcdata, parse_default | parse_lazy_decode};
+
+	for (size_t i = 0; i < sizeof(options) / sizeof(options[0]); ++i)
+	{
+		xml_document doc;
+		CHECK(doc.load(data.c_str(), options[i] | parse_fragment));
+
+		for (unsigned int depth = 0; depth < 4; ++depth)
+		{
+			xml_document lazy;
+			CHECK(lazy.load(data.c_str(), options[i] | parse_fragment | parse_lazy_depth(depth)));
+
+			CHECK(save_narrow(lazy, format_raw, encoding_utf8) == save_narrow(doc, format_raw, encoding_utf8));
+		}
+	}
+}
+
+TEST(parse_lazy_subtrees_inplace)
+{
+	char_t buffer[] = STR("<root><node attr='1'><child>&lt;</child></node></root>");
+
+	xml_document doc;
+	CHECK(doc.load_buffer_inplace(buffer, sizeof(buffer), parse_default | parse_lazy_depth(1)));
+
+	xml_node node = doc.child(STR("root")).child(STR("node"));
+	CHECK(node.attribute(STR("attr")).as_int() == 1);
+
+	// the contents are parsed on first access
+	CHECK_STRING(buffer + 28, STR("&lt;</child>"));
+	CHECK_STRING(node.child_value(STR("child")), STR("<"));
+	CHECK_STRING(buffer + 28, STR("<"));
+}
+
+TEST(parse_lazy_subtrees_access)
+{
+	const char_t* data = STR("<root><a x='1'><b>1</b><b>2</b></a><a x='2'><c/>text</a><a x='3'/></root>");
+	unsigned int options = parse_default | parse_lazy_depth(1);
+
+	xml_document doc;
+	CHECK(doc.load(data, options));
+
+	xml_node a = doc.child(STR("root")).child(STR("a"));
+	CHECK_STRING(a.value(), STR(""));
+	CHECK(a.child(STR("b")).text().as_int() == 1);
+	CHECK(a.next_sibling().last_child().type() == node_pcdata);
+	CHECK(!a.next_sibling().next_sibling().first_child());
+
+#ifndef PUGIXML_NO_XPATH
+	CHECK(doc.load(data, options));
+	CHECK(doc.select_nodes(STR("//b")).size() == 2);
+	CHECK(doc.select_single_node(STR("root/a[2]/c")).node());
+#endif
+
+	// copies and modifications parse the contents first
+	CHECK(doc.load(data, options));
+
+	xml_document copy;
+	copy.append_copy(doc.child(STR("root")).child(STR("a")));
+	CHECK_NODE(copy, STR("<a x=\"1\"><b>1</b><b>2</b></a>"));
+
+	CHECK(doc.load(data, options));
+	CHECK(doc.child(STR("root")).child(STR("a")).append_child(STR("d")));
+	CHECK(doc.child(STR("root")).child(STR("a")).next_sibling().prepend_child(node_comment).set_value(STR("c")));
+	CHECK_NODE(doc, STR("<root><a x=\"1\"><b>1</b><b>2</b><d /></a><a x=\"2\"><!--c--><c />text</a><a x=\"3\" /></root>"));
+}
+
+TEST(parse_lazy_subtrees_lazy_decode)
+{
+	xml_document doc;
+	CHECK(doc.load(STR("<root><a x='&amp;'><b y='&lt;'>&gt;</b></a></root>"), parse_default | parse_lazy_decode | parse_lazy_subtrees));
+
+	CHECK_NODE(doc, STR("<root><a x=\"&amp;\"><b y=\"&lt;\">&gt;</b></a></root>"));
+}
+
+TEST(parse_lazy_subtrees_error)
+{
+	xml_document doc;
+
+	// the end tag has to be found
+	CHECK(doc.load(STR("<root><a><b></a></root>"), parse_default | parse_lazy_depth(1)).status == status_end_element_mismatch);
+	CHECK(doc.load(STR("<root><a><b/>"), parse_default | parse_lazy_depth(1)).status == status_end_element_mismatch);
+
+	// errors in the contents are not reported
+	CHECK(doc.load(STR("<root><a><b x=></b></a></root>"), parse_default | parse_lazy_depth(1)));
+	CHECK_STRING(doc.child(STR("root")).child(STR("a")).first_child().name(), STR("b"));
+}
+
+TEST(parse_embed_pcdata_equal)
+{
+	std::basic_string<char_t> data = make_parallel_test_document();
+	data += STR("<node>text<child/>tail<![CDATA[data]]></node><node><![CDATA[data]]>text</node><node> <child> text </child></node>");
+
+	unsigned int options[] = {parse_default, parse_full | parse_ws_pcdata, parse_full | parse_trim_pcdata, parse_full | parse_parallel, parse_default | parse_lazy_decode | parse_lazy_depth(1)};
+
+	for (size_t i = 0; i < sizeof(options) / sizeof(options[0]); ++i)
+	{
+		xml_document doc;
+		CHECK(doc.load(data.c_str(), options[i] | parse_fragment));
+
+		xml_document embedded;
+		CHECK(embedded.load(data.c_str(), options[i] | parse_fragment | parse_embed_pcdata));
+
+		CHECK(save_narrow(embedded, format_raw, encoding_utf8) == save_narrow(doc, format_raw, encoding_utf8));
+	}
+}
+
+TEST(parse_embed_pcdata)
+{
+	xml_document doc;
+	CHECK(doc.load(STR("<root><a>&lt;text&gt;</a><b>text<c/>tail</b><d><![CDATA[data]]></d><e/></root>"), parse_default | parse_embed_pcdata));
+
+	xml_node root = doc.child(STR("root"));
+
+	// the first text of an element is stored in the element
+	xml_node a = root.child(STR("a"));
+	CHECK(!a.first_child());
+	CHECK_STRING(a.value(), STR(""));
+	CHECK_STRING(a.child_value(), STR("<text>"));
+	CHECK_STRING(a.text().get(), STR("<text>"));
+
+	// the text after other children is kept in separate nodes
+	xml_node b = root.child(STR("b"));
+	CHECK_STRING(b.child_value(), STR("text"));
+	CHECK_STRING(b.first_child().name(), STR("c"));
+	CHECK(b.last_child().type() == node_pcdata);
+	CHECK_STRING(b.last_child().value(), STR("tail"));
+
+	CHECK(root.child(STR("d")).first_child().type() == node_cdata);
+	CHECK(!root.child(STR("e")).text());
+
+	CHECK_NODE(doc, STR("<root><a>&lt;text&gt;</a><b>text<c />tail</b><d><![CDATA[data]]></d><e /></root>"));
+}
+
+TEST(parse_intern_names_equal)
+{
+	std::basic_string<char_t> data = make_parallel_test_document();
+
+	unsigned int options[] = {parse_minimal, parse_default, parse_full, parse_full | parse_parallel, parse_default | parse_lazy_decode | parse_lazy_depth(1)};
+
+	for (size_t i = 0; i < sizeof(options) / sizeof(options[0]); ++i)
+	{
+		xml_document doc;
+		CHECK(doc.load(data.c_str(), options[i]));
+
+		xml_document interned;
+		CHECK(interned.load(data.c_str(), options[i] | parse_intern_names));
+
+		CHECK(save_narrow(interned, format_raw, encoding_utf8) == save_narrow(doc, format_raw, encoding_utf8));
+	}
+}
+
+TEST(parse_intern_names)
+{
+	xml_document doc;
+	CHECK(doc.load(STR("<?xml version='1.0'?><root a='1'><node a='2'/><?node?><node b='3'/><other a='4'/></root>"), parse_default | parse_declaration | parse_pi | parse_intern_names));
+
+	xml_node root = doc.child(STR("root"));
+	xml_node node = root.child(STR("node"));
+
+	// names are stored once
+	CHECK(node.name() == node.next_sibling(STR("node")).name());
+	CHECK(node.name() == root.child(STR("node")).next_sibling().name());
+	CHECK(root.first_attribute().name() == root.last_child().first_attribute().name());
+
+	// lookups
+	CHECK(root.child(STR("other")).attribute(STR("a")).as_int() == 4);
+	CHECK(root.find_child_by_attribute(STR("node"), STR("b"), STR("3")) == node.next_sibling().next_sibling());
+	CHECK(root.last_child().previous_sibling(STR("node")) == node.next_sibling().next_sibling());
+	CHECK(!root.child(STR("missing")) && !root.attribute(STR("b")));
+
+	int count = 0;
+	for (xml_named_node_iterator it = root.children(STR("node")).begin(); it != root.children(STR("node")).end(); ++it) count++;
+	CHECK(count == 3);
+
+	// names that are set later are also stored once
+	CHECK(root.child(STR("other")).set_name(STR("node")));
+	CHECK(root.last_child().name() == node.name());
+	CHECK(root.append_child(STR("new")).append_attribute(STR("a")));
+	CHECK(root.child(STR("new")).first_attribute().name() == root.first_attribute().name());
+
+	xml_document other;
+	CHECK(other.load(STR("<copy new='5'/>")));
+	root.append_copy(other.first_child()).append_copy(other.first_child().first_attribute());
+	CHECK(root.last_child().first_attribute().name() == root.last_child().last_attribute().name());
+	CHECK(root.last_child().attribute(STR("new")).as_int() == 5);
+
+	CHECK_NODE(doc, STR("<?xml version=\"1.0\"?><root a=\"1\"><node a=\"2\" /><?node?><node b=\"3\" /><node a=\"4\" /><new a=\"\" /><copy new=\"5\" new=\"5\" /></root>"));
+
+#ifndef PUGIXML_NO_XPATH
+	xpath_node_set ns = doc.select_nodes(STR("//node[@a] | //@a | //new"));
+	ns.sort();
+
+	CHECK(ns.size() == 7 && ns[0].attribute() == root.first_attribute() && ns[1].node() == node && ns[5].node() == root.child(STR("new")));
+	CHECK(doc.select_nodes(STR("//missing")).empty());
+#endif
+}
+
+TEST(parse_intern_names_append)
+{
+	// names are interned if the document was empty
+	xml_document doc;
+	CHECK(doc.append_buffer("<node><node/></node>", 20, parse_default | parse_intern_names));
+	CHECK(doc.first_child().name() == doc.first_child().first_child().name());
+
+	CHECK(doc.first_child().append_buffer("<node/>", 7, parse_default));
+	CHECK(doc.first_child().last_child().name() == doc.first_child().name());
+
+	CHECK(doc.load(STR("<node/>")));
+	CHECK(doc.first_child().append_buffer("<node/>", 7, parse_default | parse_intern_names));
+	CHECK(doc.first_child().first_child().name() != doc.first_child().name());
+}
+
+TEST(parse_intern_names_out_of_memory)
+{
+	test_runner::_memory_fail_threshold = 1;
+
+	xml_document doc;
+	CHECK(doc.load(STR("<node/>"), parse_default | parse_intern_names).status == status_out_of_memory);
+}
+
+struct attribute_filter: xml_parse_filter
+{
+	unsigned int count;
+
+	attribute_filter(): count(0)
+	{
+	}
+
+	virtual xml_filter_action filter(xml_node& node)
+	{
+		count++;
+
+		if (node.attribute(STR("skip"))) return filter_skip;
+		if (node.attribute(STR("empty"))) return filter_skip_children;
+
+		return filter_keep;
+	}
+};
+
+TEST(parse_filter)
+{
+	const char_t* data = STR("<root><a/><b skip='1'><c/>text<!--c--></b><d empty='1'><e/><f skip='1'/>text</d><g skip='1'/><h empty='1'/><i><j skip='1'><k empty='1'/></j>text</i></root>");
+
+	attribute_filter filter;
+
+	xml_document doc;
+	doc.set_parse_filter(&filter);
+	CHECK(doc.parse_filter() == &filter);
+
+	CHECK(doc.load(data, parse_full));
+	CHECK_NODE(doc, STR("<root><a /><d empty=\"1\" /><h empty=\"1\" /><i>text</i></root>"));
+
+	// the filter is not called for the contents of skipped elements
+	CHECK(filter.count == 8);
+
+	// the filter applies to all loading functions until it's removed
+	doc.reset();
+	CHECK(doc.load(data, parse_default | parse_lazy_depth(1) | parse_intern_names));
+	CHECK_NODE(doc, STR("<root><a /><d empty=\"1\" /><h empty=\"1\" /><i>text</i></root>"));
+
+	CHECK(doc.child(STR("root")).append_buffer("<x><y skip='1'/></x>", 20));
+	CHECK_NODE(doc, STR("<root><a /><d empty=\"1\" /><h empty=\"1\" /><i>text</i><x /></root>"));
+
+	doc.set_parse_filter(0);
+	CHECK(doc.load(STR("<root skip='1'/>")));
+	CHECK_NODE(doc, STR("<root skip=\"1\" />"));
+}
+
+TEST(parse_filter_error)
+{
+	const char_t* data[] =
+	{
+		STR("<root><b skip='1'><c></b></root>"),
+		STR("<root><b skip='1'><c x=></c></b></root>"),
+		STR("<root><b skip='1'><!-- x</b></root>"),
+		STR("<root><b skip='1'><![CDATA[</b></root>"),
+		STR("<root><b skip='1'><?pi </b></root>"),
+		STR("<root><d empty='1'><c/></root>"),
+		STR("<root><d empty='1'><c>text</c></d></root"),
+		STR("<root><b skip='1'/><c x=></root>")
+	};
+
+	attribute_filter filter;
+
+	for (size_t i = 0; i < sizeof(data) / sizeof(data[0]); ++i)
+	{
+		xml_document reference;
+		xml_parse_result reference_result = reference.load(data[i], parse_minimal);
+
+		xml_document doc;
+		doc.set_parse_filter(&filter);
+
+		xml_parse_result result = doc.load(data[i], parse_minimal);
+		CHECK(!result && result.status == reference_result.status && result.offset == reference_result.offset);
+
+		CHECK(doc.load(data[i], parse_full).status == reference.load(data[i], parse_full).status);
+	}
+
+	xml_document doc;
+	doc.set_parse_filter(&filter);
+
+	CHECK(doc.load(STR("<root><b skip='1'><?xml version='1.0'?></b></root>"), parse_full).status == status_bad_pi);
+}
+
+TEST(parse_filter_memory)
+{
+	std::basic_string<char_t> data = STR("<root><b skip='1'>");
+	for (int i = 0; i < 10000; ++i) data += STR("<node attr='value'><child a='1' b='2'/>text</node>");
+	data += STR("</b><a empty='1'>");
+	for (int i = 0; i < 10000; ++i) data += STR("<node/>");
+	data += STR("</a></root>");
+
+	attribute_filter filter;
+
+	xml_document doc;
+	doc.set_parse_filter(&filter);
+
+	// the skipped nodes are freed as soon as they are closed, so the memory is reused
+	test_runner::_memory_fail_threshold = 65536;
+
+#ifdef PUGIXML_SEGREGATED_PAGES
+	// attributes are allocated from a separate page
+	test_runner::_memory_fail_threshold += 32768;
+#endif
+
+	std::basic_string<char_t> buffer = data;
+	CHECK(doc.load_buffer_inplace(&buffer[0], buffer.size() * sizeof(char_t)));
+	CHECK_NODE(doc, STR("<root><a empty=\"1\" /></root>"));
+
+	doc.set_parse_filter(0);
+
+	buffer = data;
+	CHECK(doc.load_buffer_inplace(&buffer[0], buffer.size() * sizeof(char_t)).status == status_out_of_memory);
+}
+
+TEST(parse_filter_incremental)
+{
+	const char_t* data = STR("<root><a/><b skip='1'><c/>text</b><d empty='1'><e/>text</d><i><j skip='1'><k empty='1'/></j>text</i></root>");
+	size_t size = std::char_traits<char_t>::length(data) * sizeof(char_t);
+
+	attribute_filter filter;
+
+	xml_document reference;
+	reference.set_parse_filter(&filter);
+	CHECK(reference.load(data));
+
+	for (size_t chunk = 1; chunk < 8; ++chunk)
+	{
+		xml_document doc;
+		doc.set_parse_filter(&filter);
+
+		xml_incremental_parser parser(doc);
+
+		for (size_t offset = 0; offset < size; offset += chunk)
+			CHECK(parser.feed(reinterpret_cast<const char*>(data) + offset, offset + chunk < size ? chunk : size - offset));
+
+		CHECK(parser.finish());
+		CHECK(save_narrow(doc, format_raw, encoding_utf8) == save_narrow(reference, format_raw, encoding_utf8));
+	}
+}
@@ -307,6 +307,15 @@ TEST_XML_FLAGS(parse_doctype_value, "<!DOCTYPE doc [ <!ELEMENT doc (#PCDATA)> <!
     CHECK_STRING(n.value(), STR("doc [ <!ELEMENT doc (#PCDATA)> <!ENTITY e \"<![CDATA[Tim & Michael]]>\"> ]"));
 }
 
+TEST_XML_FLAGS(parse_doctype_value_comment, "<!DOCTYPE doc [<!--comment--><!ELEMENT doc ANY>]>", parse_fragment | parse_doctype)
+{
+    xml_node n = doc.first_child();
+
+    CHECK(n.type() == node_doctype);
+    CHECK_STRING(n.value(), STR("doc [<!--comment--><!ELEMENT doc ANY>]"));
+    CHECK(!n.next_sibling());
+}
+
 TEST(parse_doctype_error_toplevel)
 {
     xml_document doc;
@@ -0,0 +1,260 @@
+#define _CRT_SECURE_NO_WARNINGS
+
+#include <string.h> // because Borland's STL is braindead, we have to include <string.h> _before_ <string> in order to get memcpy
+
+#include "common.hpp"
+
+#include <stdio.h>
+
+#include <string>
+
+typedef std::basic_string<char_t> string_t;
+
+struct memory_source: xml_reader_source
+{
+	const char* data;
+	size_t size;
+	size_t chunk;
+
+	memory_source(const char* data_, size_t size_, size_t chunk_): data(data_), size(size_), chunk(chunk_)
+	{
+	}
+
+	virtual size_t read(void* buffer, size_t capacity)
+	{
+		size_t result = size < chunk ? size : chunk;
+		if (result > capacity) result = capacity;
+
+		memcpy(buffer, data, result);
+		data += result;
+		size -= result;
+
+		return result;
+	}
+};
+
+static void append_node(string_t& result, unsigned int depth, xml_node_type type, bool end, const char_t* name, const char_t* value, xml_attribute attr)
+{
+	result += static_cast<char_t>('0' + depth);
+	result += static_cast<char_t>(end ? '/' : '0' + type);
+	result += name;
+	result += '=';
+	result += value;
+
+	for (xml_attribute a = attr; a; a = a.next_attribute())
+	{
+		result += ' ';
+		result += a.name();
+		result += '=';
+		result += a.value();
+	}
+
+	result += '\n';
+}
+
+static void append_tree(string_t& result, xml_node node, unsigned int depth)
+{
+	for (xml_node n = node.first_child(); n; n = n.next_sibling())
+	{
+		append_node(result, depth, n.type(), false, n.name(), n.value(), n.first_attribute());
+
+		if (n.type() == node_element)
+		{
+			append_tree(result, n, depth + 1);
+			append_node(result, depth, n.type(), true, n.name(), STR(""), xml_attribute());
+		}
+	}
+}
+
+static string_t read_all(xml_reader& reader)
+{
+	string_t result;
+
+	while (reader.next())
+		append_node(result, reader.depth(), reader.type(), reader.end_element(), reader.name(), reader.value(), reader.first_attribute());
+
+	return result;
+}
+
+TEST(reader_buffer)
+{
+	const char* files[] =
+	{
+		"<?xml version='1.0' encoding=\"utf-8\"?><!DOCTYPE root [<!ELEMENT root ANY><!-- <!-- > --><!ENTITY e '>'>]><root>\r\n\t<a b='>' c=\"'\">text &amp; &#x20AC;</a><![CDATA[x]]>y]]><!-- c-o-m-m-e-n-t --><?pi value?>\n</root><!-- tail -->  ",
+		"\xef\xbb\xbf<node attr='1'/>",
+		"<a><b/>   <c>  </c><d>text<e/>more\rtext</d><f><g/></f>  </a>",
+		"<?XML version='1.0?>' ?><a/>",
+		"<a>\0<b/></a>",
+		"text<a/>text<b>text</b>",
+		"",
+		"<a><b></a>",
+		"<a>",
+		"<a/><",
+		"<a><!- </a>",
+		"<!-- comment -->"
+	};
+
+	size_t sizes[] = {0, 0, 0, 0, 10, 0, 0, 0, 0, 0, 0, 0};
+
+	unsigned int flags[] = {parse_default, parse_full, parse_minimal, parse_fragment, parse_default | parse_ws_pcdata, parse_default | parse_ws_pcdata_single, parse_full | parse_trim_pcdata};
+
+	size_t chunks[] = {1, 3, 7, 4096};
+
+	for (size_t i = 0; i < sizeof(files) / sizeof(files[0]); ++i)
+	{
+		size_t size = sizes[i] ? sizes[i] : strlen(files[i]);
+
+		for (size_t f = 0; f < sizeof(flags) / sizeof(flags[0]); ++f)
+		{
+			xml_document reference;
+			xml_parse_result reference_result = reference.load_buffer(files[i], size, flags[f]);
+
+			string_t expected;
+			append_tree(expected, reference, 0);
+
+			xml_reader reader;
+			CHECK(reader.open_buffer(files[i], size, flags[f]));
+
+			string_t events = read_all(reader);
+			xml_parse_result result = reader.result();
+
+			CHECK(result.status == reference_result.status && result.offset == reference_result.offset && result.encoding == reference_result.encoding);
+			CHECK(!result || events == expected);
+
+			for (size_t c = 0; c < sizeof(chunks) / sizeof(chunks[0]); ++c)
+			{
+				memory_source source(files[i], size, chunks[c]);
+
+				CHECK(reader.open(source, flags[f]));
+				CHECK(read_all(reader) == events);
+
+				result = reader.result();
+				CHECK(result.status == reference_result.status && result.offset == reference_result.offset && result.encoding == reference_result.encoding);
+			}
+		}
+	}
+}
+
+TEST(reader_convert)
+{
+	const char* files[] =
+	{
+		"tests/data/utftest_utf16_be_bom.xml",
+		"tests/data/utftest_utf16_le_nodecl.xml",
+		"tests/data/utftest_utf32_be_nodecl.xml",
+		"tests/data/utftest_utf32_le_bom.xml",
+		"tests/data/utftest_utf8.xml",
+		"tests/data/latintest_latin1.xml"
+	};
+
+	size_t chunks[] = {1, 3, 7, 4096};
+
+	for (size_t i = 0; i < sizeof(files) / sizeof(files[0]); ++i)
+	{
+		FILE* file = fopen(files[i], "rb");
+		CHECK(file);
+
+		char data[65536];
+		size_t size = fread(data, 1, sizeof(data), file);
+		fclose(file);
+
+		xml_document reference;
+		xml_parse_result reference_result = reference.load_buffer(data, size);
+		CHECK(reference_result);
+
+		string_t expected;
+		append_tree(expected, reference, 0);
+
+		for (size_t c = 0; c < sizeof(chunks) / sizeof(chunks[0]); ++c)
+		{
+			memory_source source(data, size, chunks[c]);
+
+			xml_reader reader;
+			CHECK(reader.open(source));
+			CHECK(read_all(reader) == expected);
+			CHECK(reader.result() && reader.result().encoding == reference_result.encoding);
+		}
+	}
+}
+
+TEST(reader_nodes)
+{
+	const char* data = "<?xml version='1.0'?><root a='1' b='2'><child>text</child><empty/></root>";
+
+	xml_reader reader;
+	CHECK(reader.type() == node_null && !reader.end_element() && reader.depth() == 0);
+	CHECK(!reader.next());
+
+	CHECK(reader.open_buffer(data, strlen(data), parse_default | parse_declaration));
+	CHECK(reader.type() == node_null);
+
+	CHECK(reader.next() && reader.type() == node_declaration && reader.depth() == 0);
+	CHECK_STRING(reader.name(), STR("xml"));
+	CHECK_STRING(reader.attribute(STR("version")).value(), STR("1.0"));
+
+	CHECK(reader.next() && reader.type() == node_element && !reader.end_element() && reader.depth() == 0);
+	CHECK_STRING(reader.name(), STR("root"));
+	CHECK_STRING(reader.first_attribute().name(), STR("a"));
+	CHECK(reader.attribute(STR("b")).as_int() == 2);
+	CHECK(!reader.attribute(STR("c")));
+
+	CHECK(reader.next() && reader.type() == node_element && reader.depth() == 1);
+	CHECK_STRING(reader.name(), STR("child"));
+
+	CHECK(reader.next() && reader.type() == node_pcdata && reader.depth() == 2);
+	CHECK_STRING(reader.name(), STR(""));
+	CHECK_STRING(reader.value(), STR("text"));
+
+	CHECK(reader.next() && reader.type() == node_element && reader.end_element() && reader.depth() == 1);
+	CHECK_STRING(reader.name(), STR("child"));
+
+	CHECK(reader.next() && reader.type() == node_element && !reader.end_element());
+	CHECK_STRING(reader.name(), STR("empty"));
+
+	CHECK(reader.next() && reader.end_element() && reader.depth() == 1);
+	CHECK_STRING(reader.name(), STR("empty"));
+
+	CHECK(reader.next() && reader.end_element() && reader.depth() == 0);
+	CHECK_STRING(reader.name(), STR("root"));
+	CHECK(!reader.first_attribute());
+
+	CHECK(!reader.next() && reader.type() == node_null && reader.result());
+	CHECK(!reader.next());
+}
+
+TEST(reader_deep)
+{
+	std::string data;
+
+	for (int i = 0; i < 1000; ++i) data += "<node attr='value'>";
+	for (int i = 0; i < 1000; ++i) data += "</node>";
+
+	memory_source source(data.c_str(), data.size(), 100);
+
+	xml_reader reader;
+	CHECK(reader.open(source));
+
+	unsigned int count = 0;
+
+	while (reader.next())
+	{
+		CHECK(reader.depth() == (reader.end_element() ? 1999 - count : count) % 1000);
+		CHECK_STRING(reader.name(), STR("node"));
+		count++;
+	}
+
+	CHECK(count == 2000 && reader.result());
+}
+
+TEST(reader_out_of_memory)
+{
+	const char* data = "<a><b attr='value'>text</b></a>";
+
+	test_runner::_memory_fail_threshold = 1;
+
+	xml_reader reader;
+	xml_parse_result result = reader.open_buffer(data, strlen(data));
+
+	CHECK(result.status == status_out_of_memory);
+	CHECK(!reader.next());
+}
@@ -25,6 +25,12 @@ TEST_XML(write_pcdata, "<node attr='1'><child><sub/>text</child></node>")
 	CHECK_NODE_EX(doc, STR("<node attr=\"1\">\n\t<child>\n\t\t<sub />\n\t\ttext\n\t</child>\n</node>\n"), STR("\t"), format_indent);
 }
 
+TEST_XML_FLAGS(write_embed_pcdata, "<node attr='1'><child>text<sub>text</sub></child><child>&lt;</child></node>", parse_default | parse_embed_pcdata)
+{
+	CHECK_NODE_EX(doc, STR("<node attr=\"1\">\n\t<child>\n\t\ttext\n\t\t<sub>text</sub>\n\t</child>\n\t<child>&lt;</child>\n</node>\n"), STR("\t"), format_indent);
+	CHECK_NODE_EX(doc, STR("<node attr=\"1\"><child>text<sub>text</sub></child><child>&lt;</child></node>"), STR(""), format_raw);
+}
+
 TEST_XML_FLAGS(write_cdata, "<![CDATA[value]]>", parse_cdata | parse_fragment)
 {
 	CHECK_NODE(doc, STR("<![CDATA[value]]>"));
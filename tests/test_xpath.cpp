@@ -249,7 +249,12 @@ TEST(xpath_denorm_numbers)
 		query += STR("0.001");
 	}
 
-	CHECK_XPATH_STRING(xml_node(), query.c_str(), STR("0.0000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000009999987484955998"));
+	// shortest representation that converts back to the same denormal
+	std::basic_string<pugi::char_t> expected = STR("0.");
+	expected.append(317, '0');
+	expected += STR("1");
+
+	CHECK_XPATH_STRING(xml_node(), query.c_str(), expected.c_str());
 }
 
 TEST_XML(xpath_rexml_1, "<a><b><c id='a'/></b><c id='b'/></a>")
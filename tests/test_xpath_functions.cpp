@@ -293,6 +293,16 @@ TEST_XML(xpath_string_string, "<node>123<child id='1'>789</child><child><subchil
 	CHECK_XPATH_FAIL(STR("string(1, 2)"));
 }
 
+TEST_XML_FLAGS(xpath_string_string_embed_pcdata, "<node>123<child id='1'>789</child><child><subchild><![CDATA[200]]></subchild></child>100</node>", parse_default | parse_embed_pcdata)
+{
+	xml_node n = doc.child(STR("node"));
+
+	CHECK_XPATH_STRING(n.child(STR("child")), STR("string()"), STR("789"));
+	CHECK_XPATH_STRING(n, STR("string(.)"), STR("123789200100"));
+	CHECK_XPATH_NUMBER(n, STR("child[@id = 1] + 1"), 790);
+	CHECK_XPATH_NODESET(n, STR("child[. = '789']")) % 3;
+}
+
 TEST(xpath_string_concat)
 {
 	xml_node c;